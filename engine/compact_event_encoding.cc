@@ -0,0 +1,680 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/compact_event_encoding.h"
+
+#include <cstring>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <google/protobuf/repeated_field.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/macros.h"
+#include "engine/get_event_proto_type.h"
+#include "engine/get_peer_message_type.h"
+#include "engine/proto/event.pb.h"
+#include "engine/proto/peer.pb.h"
+#include "engine/proto/uuid.pb.h"
+#include "engine/proto/value_proto.pb.h"
+#include "engine/value_proto_util.h"
+#include "protocol_server/varint.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::memcpy;
+using std::string;
+
+DEFINE_bool(encode_peer_message_events, true,
+            "If true, the events in the transaction messages sent to remote "
+            "peers that support it are sent in a compact binary encoding "
+            "instead of as EventProto messages.");
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+// The low bits of an event's header byte hold the event type. This bit is set
+// if the event has new object IDs, which follow the event's other fields.
+const uint8 kNewObjectIdsFlag = 0x10;
+const uint8 kEventTypeMask = 0x0f;
+
+uint64 ZigZagEncode(int64 n) {
+  return (static_cast<uint64>(n) << 1) ^ static_cast<uint64>(n >> 63);
+}
+
+int64 ZigZagDecode(uint64 n) {
+  return static_cast<int64>(n >> 1) ^ -static_cast<int64>(n & 1);
+}
+
+void WriteByte(uint8 n, string* data) {
+  data->push_back(static_cast<char>(n));
+}
+
+void WriteVarint(uint64 n, string* data) {
+  char buffer[kMaxVarintLength];
+  const int length = FormatVarint(n, buffer, kMaxVarintLength);
+  data->append(buffer, static_cast<string::size_type>(length));
+}
+
+// Writes the integer in little-endian byte order, regardless of the byte order
+// of the host.
+void WriteFixed(uint64 n, int byte_count, string* data) {
+  for (int i = 0; i < byte_count; ++i) {
+    data->push_back(static_cast<char>((n >> (8 * i)) & 0xff));
+  }
+}
+
+void WriteString(const string& s, string* data) {
+  WriteVarint(static_cast<uint64>(s.length()), data);
+  data->append(s);
+}
+
+// An object ID is written as its code plus one if it was replaced by a code
+// (see engine/peer_message_interner.h), or as zero followed by the two words.
+void WriteObjectId(const Uuid& object_id, string* data) {
+  if (object_id.has_code()) {
+    WriteVarint(static_cast<uint64>(object_id.code()) + 1, data);
+  } else {
+    WriteVarint(0, data);
+    WriteFixed(object_id.high_word(), 8, data);
+    WriteFixed(object_id.low_word(), 8, data);
+  }
+}
+
+void WriteValue(const ValueProto& value, string* data) {
+  const ValueProto::Type type = GetValueProtoType(value);
+
+  WriteVarint(ZigZagEncode(value.local_type()), data);
+  WriteByte(static_cast<uint8>(type), data);
+
+  switch (type) {
+    case ValueProto::EMPTY:
+      break;
+
+    case ValueProto::DOUBLE: {
+      const double d = value.double_value();
+      uint64 bits = 0;
+      memcpy(&bits, &d, sizeof bits);
+      WriteFixed(bits, 8, data);
+      break;
+    }
+
+    case ValueProto::FLOAT: {
+      const float f = value.float_value();
+      uint32 bits = 0;
+      memcpy(&bits, &f, sizeof bits);
+      WriteFixed(bits, 4, data);
+      break;
+    }
+
+    case ValueProto::INT64:
+      WriteVarint(ZigZagEncode(value.int64_value()), data);
+      break;
+
+    case ValueProto::UINT64:
+      WriteVarint(value.uint64_value(), data);
+      break;
+
+    case ValueProto::BOOL:
+      WriteByte(value.bool_value() ? 1 : 0, data);
+      break;
+
+    case ValueProto::STRING:
+      WriteString(value.string_value(), data);
+      break;
+
+    case ValueProto::BYTES:
+      WriteString(value.bytes_value(), data);
+      break;
+
+    case ValueProto::OBJECT_ID:
+      WriteObjectId(value.object_id(), data);
+      break;
+
+    default:
+      LOG(FATAL) << "Invalid value type: " << static_cast<int>(type);
+  }
+}
+
+// A method name is written as a varint whose low bit is set if the name was
+// replaced by a code. The rest of the varint is either the code or the length
+// of the name, which follows it.
+template<class CallEventProto>
+void WriteMethodCall(const CallEventProto& call_event, string* data) {
+  if (call_event.has_method_name_code()) {
+    WriteVarint((static_cast<uint64>(call_event.method_name_code()) << 1) | 1,
+                data);
+  } else {
+    const string& method_name = call_event.method_name();
+    WriteVarint(static_cast<uint64>(method_name.length()) << 1, data);
+    data->append(method_name);
+  }
+
+  WriteVarint(static_cast<uint64>(call_event.parameter_size()), data);
+  for (const ValueProto& parameter : call_event.parameter()) {
+    WriteValue(parameter, data);
+  }
+}
+
+void WriteEvent(const EventProto& event, string* data) {
+  const EventProto::Type type = GetEventProtoType(event);
+
+  uint8 header = static_cast<uint8>(type);
+  CHECK_EQ(header & kEventTypeMask, header);
+  if (event.new_object_id_size() > 0) {
+    header |= kNewObjectIdsFlag;
+  }
+  WriteByte(header, data);
+
+  switch (type) {
+    case EventProto::OBJECT_CREATION: {
+      const ObjectCreationEventProto& object_creation = event.object_creation();
+      WriteString(object_creation.data(), data);
+      WriteVarint(
+          static_cast<uint64>(object_creation.referenced_object_id_size()),
+          data);
+      for (const Uuid& object_id : object_creation.referenced_object_id()) {
+        WriteObjectId(object_id, data);
+      }
+      break;
+    }
+
+    case EventProto::BEGIN_TRANSACTION:
+    case EventProto::END_TRANSACTION:
+      break;
+
+    case EventProto::METHOD_CALL:
+      WriteMethodCall(event.method_call(), data);
+      break;
+
+    case EventProto::METHOD_RETURN:
+      WriteValue(event.method_return().return_value(), data);
+      break;
+
+    case EventProto::SUB_METHOD_CALL:
+      WriteMethodCall(event.sub_method_call(), data);
+      WriteObjectId(event.sub_method_call().callee_object_id(), data);
+      break;
+
+    case EventProto::SUB_METHOD_RETURN:
+      WriteValue(event.sub_method_return().return_value(), data);
+      break;
+
+    case EventProto::SELF_METHOD_CALL:
+      WriteMethodCall(event.self_method_call(), data);
+      break;
+
+    case EventProto::SELF_METHOD_RETURN:
+      WriteValue(event.self_method_return().return_value(), data);
+      break;
+
+    default:
+      LOG(FATAL) << "Invalid event type: " << static_cast<int>(type);
+  }
+
+  if (event.new_object_id_size() > 0) {
+    WriteVarint(static_cast<uint64>(event.new_object_id_size()), data);
+    for (const Uuid& object_id : event.new_object_id()) {
+      WriteObjectId(object_id, data);
+    }
+  }
+}
+
+// Reads the fields written by the functions above. Each method returns false
+// if the data ends too soon.
+class Reader {
+ public:
+  explicit Reader(const string& data)
+      : data_(data.data()), size_(data.length()), offset_(0) {}
+
+  bool at_end() const { return offset_ == size_; }
+
+  bool ReadByte(uint8* n);
+  bool ReadVarint(uint64* n);
+  bool ReadFixed(int byte_count, uint64* n);
+  bool ReadBytes(string::size_type length, string* s);
+
+ private:
+  const char* const data_;
+  const string::size_type size_;
+  string::size_type offset_;
+
+  DISALLOW_COPY_AND_ASSIGN(Reader);
+};
+
+bool Reader::ReadByte(uint8* n) {
+  if (offset_ >= size_) {
+    return false;
+  }
+
+  *n = static_cast<uint8>(data_[offset_]);
+  ++offset_;
+  return true;
+}
+
+bool Reader::ReadVarint(uint64* n) {
+  const int length = ParseVarint(data_ + offset_,
+                                 static_cast<int>(size_ - offset_), n);
+  if (length < 0) {
+    return false;
+  }
+
+  offset_ += static_cast<string::size_type>(length);
+  return true;
+}
+
+bool Reader::ReadFixed(int byte_count, uint64* n) {
+  if (size_ - offset_ < static_cast<string::size_type>(byte_count)) {
+    return false;
+  }
+
+  uint64 value = 0;
+  for (int i = 0; i < byte_count; ++i) {
+    value |= static_cast<uint64>(static_cast<uint8>(data_[offset_ + i]))
+        << (8 * i);
+  }
+
+  *n = value;
+  offset_ += static_cast<string::size_type>(byte_count);
+  return true;
+}
+
+bool Reader::ReadBytes(string::size_type length, string* s) {
+  if (size_ - offset_ < length) {
+    return false;
+  }
+
+  s->assign(data_ + offset_, length);
+  offset_ += length;
+  return true;
+}
+
+bool ReadString(Reader* reader, string* s) {
+  uint64 length = 0;
+  return reader->ReadVarint(&length) &&
+      reader->ReadBytes(static_cast<string::size_type>(length), s);
+}
+
+bool ReadObjectId(Reader* reader, Uuid* object_id) {
+  uint64 code_plus_one = 0;
+  if (!reader->ReadVarint(&code_plus_one)) {
+    return false;
+  }
+
+  if (code_plus_one != 0) {
+    object_id->set_code(static_cast<uint32>(code_plus_one - 1));
+    return true;
+  }
+
+  uint64 high_word = 0;
+  uint64 low_word = 0;
+  if (!reader->ReadFixed(8, &high_word) || !reader->ReadFixed(8, &low_word)) {
+    return false;
+  }
+
+  object_id->set_high_word(high_word);
+  object_id->set_low_word(low_word);
+  return true;
+}
+
+bool ReadValue(Reader* reader, ValueProto* value) {
+  uint64 local_type = 0;
+  uint8 type = 0;
+  if (!reader->ReadVarint(&local_type) || !reader->ReadByte(&type)) {
+    return false;
+  }
+
+  value->set_local_type(ZigZagDecode(local_type));
+
+  uint64 n = 0;
+
+  switch (static_cast<ValueProto::Type>(type)) {
+    case ValueProto::EMPTY:
+      value->mutable_empty_value();
+      return true;
+
+    case ValueProto::DOUBLE: {
+      if (!reader->ReadFixed(8, &n)) {
+        return false;
+      }
+      double d = 0.0;
+      memcpy(&d, &n, sizeof d);
+      value->set_double_value(d);
+      return true;
+    }
+
+    case ValueProto::FLOAT: {
+      if (!reader->ReadFixed(4, &n)) {
+        return false;
+      }
+      const uint32 bits = static_cast<uint32>(n);
+      float f = 0.0f;
+      memcpy(&f, &bits, sizeof f);
+      value->set_float_value(f);
+      return true;
+    }
+
+    case ValueProto::INT64:
+      if (!reader->ReadVarint(&n)) {
+        return false;
+      }
+      value->set_int64_value(ZigZagDecode(n));
+      return true;
+
+    case ValueProto::UINT64:
+      if (!reader->ReadVarint(&n)) {
+        return false;
+      }
+      value->set_uint64_value(n);
+      return true;
+
+    case ValueProto::BOOL: {
+      uint8 b = 0;
+      if (!reader->ReadByte(&b)) {
+        return false;
+      }
+      value->set_bool_value(b != 0);
+      return true;
+    }
+
+    case ValueProto::STRING:
+      return ReadString(reader, value->mutable_string_value());
+
+    case ValueProto::BYTES:
+      return ReadString(reader, value->mutable_bytes_value());
+
+    case ValueProto::OBJECT_ID:
+      return ReadObjectId(reader, value->mutable_object_id());
+
+    default:
+      return false;
+  }
+}
+
+template<class CallEventProto>
+bool ReadMethodCall(Reader* reader, CallEventProto* call_event) {
+  uint64 method_name_header = 0;
+  if (!reader->ReadVarint(&method_name_header)) {
+    return false;
+  }
+
+  if ((method_name_header & 1) != 0) {
+    call_event->set_method_name_code(
+        static_cast<uint32>(method_name_header >> 1));
+  } else if (!reader->ReadBytes(
+                 static_cast<string::size_type>(method_name_header >> 1),
+                 call_event->mutable_method_name())) {
+    return false;
+  }
+
+  uint64 parameter_count = 0;
+  if (!reader->ReadVarint(&parameter_count)) {
+    return false;
+  }
+
+  for (uint64 i = 0; i < parameter_count; ++i) {
+    if (!ReadValue(reader, call_event->add_parameter())) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ReadObjectIds(Reader* reader, RepeatedPtrField<Uuid>* object_ids) {
+  uint64 count = 0;
+  if (!reader->ReadVarint(&count)) {
+    return false;
+  }
+
+  for (uint64 i = 0; i < count; ++i) {
+    if (!ReadObjectId(reader, object_ids->Add())) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ReadEvent(Reader* reader, EventProto* event) {
+  uint8 header = 0;
+  if (!reader->ReadByte(&header)) {
+    return false;
+  }
+
+  bool success = false;
+
+  switch (static_cast<EventProto::Type>(header & kEventTypeMask)) {
+    case EventProto::OBJECT_CREATION: {
+      ObjectCreationEventProto* const object_creation =
+          event->mutable_object_creation();
+      success = ReadString(reader, object_creation->mutable_data()) &&
+          ReadObjectIds(reader,
+                        object_creation->mutable_referenced_object_id());
+      break;
+    }
+
+    case EventProto::BEGIN_TRANSACTION:
+      event->mutable_begin_transaction();
+      success = true;
+      break;
+
+    case EventProto::END_TRANSACTION:
+      event->mutable_end_transaction();
+      success = true;
+      break;
+
+    case EventProto::METHOD_CALL:
+      success = ReadMethodCall(reader, event->mutable_method_call());
+      break;
+
+    case EventProto::METHOD_RETURN:
+      success = ReadValue(
+          reader, event->mutable_method_return()->mutable_return_value());
+      break;
+
+    case EventProto::SUB_METHOD_CALL:
+      success = ReadMethodCall(reader, event->mutable_sub_method_call()) &&
+          ReadObjectId(
+              reader,
+              event->mutable_sub_method_call()->mutable_callee_object_id());
+      break;
+
+    case EventProto::SUB_METHOD_RETURN:
+      success = ReadValue(
+          reader, event->mutable_sub_method_return()->mutable_return_value());
+      break;
+
+    case EventProto::SELF_METHOD_CALL:
+      success = ReadMethodCall(reader, event->mutable_self_method_call());
+      break;
+
+    case EventProto::SELF_METHOD_RETURN:
+      success = ReadValue(
+          reader, event->mutable_self_method_return()->mutable_return_value());
+      break;
+
+    default:
+      return false;
+  }
+
+  if (!success) {
+    return false;
+  }
+
+  if ((header & kNewObjectIdsFlag) != 0) {
+    return ReadObjectIds(reader, event->mutable_new_object_id());
+  }
+
+  return true;
+}
+
+}  // namespace
+
+void EncodeEvents(int version, const RepeatedPtrField<EventProto>& events,
+                  string* data) {
+  CHECK_EQ(version, 1) << "Unsupported compact event encoding version";
+  CHECK(data != nullptr);
+
+  data->clear();
+  WriteVarint(static_cast<uint64>(version), data);
+  WriteVarint(static_cast<uint64>(events.size()), data);
+
+  for (const EventProto& event : events) {
+    WriteEvent(event, data);
+  }
+}
+
+bool DecodeEvents(const string& data, RepeatedPtrField<EventProto>* events) {
+  CHECK(events != nullptr);
+
+  Reader reader(data);
+
+  uint64 version = 0;
+  uint64 event_count = 0;
+  if (!reader.ReadVarint(&version) ||
+      version < 1 ||
+      version > static_cast<uint64>(kCompactEventEncodingVersion) ||
+      !reader.ReadVarint(&event_count)) {
+    return false;
+  }
+
+  for (uint64 i = 0; i < event_count; ++i) {
+    if (!ReadEvent(&reader, events->Add())) {
+      return false;
+    }
+  }
+
+  return reader.at_end();
+}
+
+bool EncodeEventsInMessage(int version, PeerMessage* peer_message) {
+  CHECK(peer_message != nullptr);
+
+  bool changed = false;
+
+  switch (GetPeerMessageType(*peer_message)) {
+    case PeerMessage::APPLY_TRANSACTION: {
+      ApplyTransactionMessage* const apply_transaction_message =
+          peer_message->mutable_apply_transaction_message();
+      for (int i = 0; i < apply_transaction_message->object_transaction_size();
+           ++i) {
+        ObjectTransactionProto* const object_transaction =
+            apply_transaction_message->mutable_object_transaction(i);
+        if (object_transaction->event_size() > 0) {
+          EncodeEvents(version, object_transaction->event(),
+                       object_transaction->mutable_compact_events());
+          object_transaction->clear_event();
+          changed = true;
+        }
+      }
+      break;
+    }
+
+    case PeerMessage::STORE_OBJECT: {
+      StoreObjectMessage* const store_object_message =
+          peer_message->mutable_store_object_message();
+      for (int i = 0; i < store_object_message->transaction_size(); ++i) {
+        TransactionProto* const transaction =
+            store_object_message->mutable_transaction(i);
+        if (transaction->event_size() > 0) {
+          EncodeEvents(version, transaction->event(),
+                       transaction->mutable_compact_events());
+          transaction->clear_event();
+          changed = true;
+        }
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  return changed;
+}
+
+bool MessageHasEncodedEvents(const PeerMessage& peer_message) {
+  switch (GetPeerMessageType(peer_message)) {
+    case PeerMessage::APPLY_TRANSACTION:
+      for (const ObjectTransactionProto& object_transaction :
+               peer_message.apply_transaction_message().object_transaction()) {
+        if (object_transaction.has_compact_events()) {
+          return true;
+        }
+      }
+      return false;
+
+    case PeerMessage::STORE_OBJECT:
+      for (const TransactionProto& transaction :
+               peer_message.store_object_message().transaction()) {
+        if (transaction.has_compact_events()) {
+          return true;
+        }
+      }
+      return false;
+
+    default:
+      return false;
+  }
+}
+
+bool DecodeEventsInMessage(PeerMessage* peer_message) {
+  CHECK(peer_message != nullptr);
+
+  switch (GetPeerMessageType(*peer_message)) {
+    case PeerMessage::APPLY_TRANSACTION: {
+      ApplyTransactionMessage* const apply_transaction_message =
+          peer_message->mutable_apply_transaction_message();
+      for (int i = 0; i < apply_transaction_message->object_transaction_size();
+           ++i) {
+        ObjectTransactionProto* const object_transaction =
+            apply_transaction_message->mutable_object_transaction(i);
+        if (object_transaction->has_compact_events()) {
+          if (!DecodeEvents(object_transaction->compact_events(),
+                            object_transaction->mutable_event())) {
+            return false;
+          }
+          object_transaction->clear_compact_events();
+        }
+      }
+      return true;
+    }
+
+    case PeerMessage::STORE_OBJECT: {
+      StoreObjectMessage* const store_object_message =
+          peer_message->mutable_store_object_message();
+      for (int i = 0; i < store_object_message->transaction_size(); ++i) {
+        TransactionProto* const transaction =
+            store_object_message->mutable_transaction(i);
+        if (transaction->has_compact_events()) {
+          if (!DecodeEvents(transaction->compact_events(),
+                            transaction->mutable_event())) {
+            return false;
+          }
+          transaction->clear_compact_events();
+        }
+      }
+      return true;
+    }
+
+    default:
+      return true;
+  }
+}
+
+}  // namespace engine
+}  // namespace floating_temple
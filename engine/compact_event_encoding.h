@@ -0,0 +1,75 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ENGINE_COMPACT_EVENT_ENCODING_H_
+#define ENGINE_COMPACT_EVENT_ENCODING_H_
+
+#include <string>
+
+#include <gflags/gflags.h>
+#include <google/protobuf/repeated_field.h>
+
+DECLARE_bool(encode_peer_message_events);
+
+namespace floating_temple {
+namespace engine {
+
+class EventProto;
+class PeerMessage;
+
+// A compact binary encoding for sequences of events, used in place of the
+// repeated EventProto fields in the messages sent between peers. Each event
+// takes a header byte followed by its fields, with no field tags or
+// submessage headers; integers are encoded as varints.
+//
+// The encoded data starts with a version number. Peers advertise the newest
+// version that they can decode in their HELLO messages, and each connection
+// uses the older of the two versions, or none at all if either peer doesn't
+// advertise one. (See HelloMessage.compact_event_encoding_version in
+// engine/proto/peer.proto.)
+//
+// So that a transaction message sent to many peers is only serialized once,
+// its events are encoded in the newest version when the message is built. A
+// connection that negotiated an older version (or none) decodes them and
+// re-encodes them in its own version before sending the message.
+
+// The newest version of the encoding that this peer can read and write.
+const int kCompactEventEncodingVersion = 1;
+
+// Encodes the events in the given version of the compact encoding and stores
+// the result in *data.
+void EncodeEvents(int version,
+                  const google::protobuf::RepeatedPtrField<EventProto>& events,
+                  std::string* data);
+// Decodes events that were encoded by EncodeEvents and appends them to
+// *events. Returns false if the data is corrupt or was encoded in a version
+// that this peer doesn't support.
+bool DecodeEvents(const std::string& data,
+                  google::protobuf::RepeatedPtrField<EventProto>* events);
+
+// Moves the events in an APPLY_TRANSACTION or STORE_OBJECT message into the
+// compact encoding. Returns true if the message was changed.
+bool EncodeEventsInMessage(int version, PeerMessage* peer_message);
+// Returns true if the message contains events in the compact encoding.
+bool MessageHasEncodedEvents(const PeerMessage& peer_message);
+// Moves the events in the message that are in the compact encoding back into
+// the repeated EventProto fields. Returns false if the encoded events can't be
+// decoded.
+bool DecodeEventsInMessage(PeerMessage* peer_message);
+
+}  // namespace engine
+}  // namespace floating_temple
+
+#endif  // ENGINE_COMPACT_EVENT_ENCODING_H_
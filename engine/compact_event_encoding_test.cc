@@ -0,0 +1,206 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/compact_event_encoding.h"
+
+#include <string>
+
+#include <gflags/gflags.h>
+#include <google/protobuf/repeated_field.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "engine/proto/event.pb.h"
+#include "engine/proto/peer.pb.h"
+#include "engine/proto/uuid.pb.h"
+#include "engine/proto/value_proto.pb.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using google::protobuf::RepeatedPtrField;
+using std::string;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+void SetUuid(uint64 high_word, uint64 low_word, Uuid* uuid) {
+  uuid->set_high_word(high_word);
+  uuid->set_low_word(low_word);
+}
+
+// Adds one event of each type, with parameters of each value type. Some of
+// the method names and object IDs are replaced by interned codes, so the
+// events are missing required fields.
+void AddEvents(RepeatedPtrField<EventProto>* events) {
+  ObjectCreationEventProto* const object_creation =
+      events->Add()->mutable_object_creation();
+  object_creation->set_data(string("serialized\0object", 17));
+  SetUuid(1, 2, object_creation->add_referenced_object_id());
+  object_creation->add_referenced_object_id()->set_code(7);
+
+  events->Add()->mutable_begin_transaction();
+
+  MethodCallEventProto* const method_call =
+      events->Add()->mutable_method_call();
+  method_call->set_method_name("append");
+  ValueProto* parameter = method_call->add_parameter();
+  parameter->set_local_type(-3);
+  parameter->mutable_empty_value();
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(1);
+  parameter->set_double_value(-2.5);
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(2);
+  parameter->set_float_value(0.125f);
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(3);
+  parameter->set_int64_value(-1234567890123LL);
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(4);
+  parameter->set_uint64_value(18446744073709551615ULL);
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(5);
+  parameter->set_bool_value(true);
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(6);
+  parameter->set_string_value("hello");
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(7);
+  parameter->set_bytes_value(string("\xff\0\x01", 3));
+  parameter = method_call->add_parameter();
+  parameter->set_local_type(8);
+  SetUuid(0xfedcba9876543210ULL, 0x0123456789abcdefULL,
+          parameter->mutable_object_id());
+
+  EventProto* const sub_method_call_event = events->Add();
+  SubMethodCallEventProto* const sub_method_call =
+      sub_method_call_event->mutable_sub_method_call();
+  sub_method_call->set_method_name_code(3);
+  sub_method_call->mutable_callee_object_id()->set_code(0);
+  SetUuid(5, 6, sub_method_call_event->add_new_object_id());
+
+  ValueProto* const sub_return_value =
+      events->Add()->mutable_sub_method_return()->mutable_return_value();
+  sub_return_value->set_local_type(0);
+  sub_return_value->mutable_object_id()->set_code(1);
+
+  SelfMethodCallEventProto* const self_method_call =
+      events->Add()->mutable_self_method_call();
+  self_method_call->set_method_name("");
+
+  ValueProto* const self_return_value =
+      events->Add()->mutable_self_method_return()->mutable_return_value();
+  self_return_value->set_local_type(0);
+  self_return_value->set_int64_value(42);
+
+  ValueProto* const return_value =
+      events->Add()->mutable_method_return()->mutable_return_value();
+  return_value->set_local_type(0);
+  return_value->set_bool_value(false);
+
+  events->Add()->mutable_end_transaction();
+}
+
+TEST(CompactEventEncodingTest, EncodeAndDecodeEvents) {
+  ObjectTransactionProto original;
+  SetUuid(1, 2, original.mutable_object_id());
+  AddEvents(original.mutable_event());
+
+  string data;
+  EncodeEvents(kCompactEventEncodingVersion, original.event(), &data);
+
+  ObjectTransactionProto decoded;
+  SetUuid(1, 2, decoded.mutable_object_id());
+  ASSERT_TRUE(DecodeEvents(data, decoded.mutable_event()));
+
+  EXPECT_EQ(original.SerializePartialAsString(),
+            decoded.SerializePartialAsString());
+  EXPECT_LT(data.length(), original.SerializePartialAsString().length());
+}
+
+TEST(CompactEventEncodingTest, RejectTruncatedOrUnsupportedData) {
+  RepeatedPtrField<EventProto> events;
+  AddEvents(&events);
+
+  string data;
+  EncodeEvents(kCompactEventEncodingVersion, events, &data);
+
+  for (string::size_type length = 0; length < data.length(); ++length) {
+    RepeatedPtrField<EventProto> decoded_events;
+    EXPECT_FALSE(DecodeEvents(data.substr(0, length), &decoded_events))
+        << length;
+  }
+
+  // Trailing data isn't allowed either.
+  RepeatedPtrField<EventProto> decoded_events;
+  EXPECT_FALSE(DecodeEvents(data + '\0', &decoded_events));
+
+  // A newer version can't be decoded.
+  data[0] = static_cast<char>(kCompactEventEncodingVersion + 1);
+  decoded_events.Clear();
+  EXPECT_FALSE(DecodeEvents(data, &decoded_events));
+}
+
+TEST(CompactEventEncodingTest, EncodeAndDecodeEventsInMessage) {
+  PeerMessage original_message;
+  StoreObjectMessage* const store_object_message =
+      original_message.mutable_store_object_message();
+  SetUuid(1, 2, store_object_message->mutable_object_id());
+  for (int i = 0; i < 2; ++i) {
+    TransactionProto* const transaction =
+        store_object_message->add_transaction();
+    transaction->mutable_transaction_id()->set_a(1);
+    transaction->mutable_transaction_id()->set_b(2);
+    transaction->mutable_transaction_id()->set_c(i);
+    AddEvents(transaction->mutable_event());
+    transaction->set_origin_peer_id("ip/10.0.0.1/1025");
+  }
+  // A transaction without events is left alone.
+  TransactionProto* const empty_transaction =
+      store_object_message->add_transaction();
+  empty_transaction->mutable_transaction_id()->set_a(4);
+  empty_transaction->mutable_transaction_id()->set_b(5);
+  empty_transaction->mutable_transaction_id()->set_c(6);
+  empty_transaction->set_origin_peer_id("ip/10.0.0.2/1025");
+
+  EXPECT_FALSE(MessageHasEncodedEvents(original_message));
+
+  PeerMessage message(original_message);
+  EXPECT_TRUE(EncodeEventsInMessage(kCompactEventEncodingVersion, &message));
+  EXPECT_TRUE(MessageHasEncodedEvents(message));
+  EXPECT_EQ(0, message.store_object_message().transaction(0).event_size());
+  EXPECT_FALSE(message.store_object_message().transaction(2)
+               .has_compact_events());
+  EXPECT_LT(message.ByteSize(), original_message.ByteSize());
+
+  ASSERT_TRUE(DecodeEventsInMessage(&message));
+  EXPECT_FALSE(MessageHasEncodedEvents(message));
+  EXPECT_EQ(original_message.SerializePartialAsString(),
+            message.SerializePartialAsString());
+}
+
+}  // namespace
+}  // namespace engine
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
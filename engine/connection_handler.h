@@ -30,6 +30,9 @@ class ConnectionHandler {
 
   virtual void NotifyNewConnection(const CanonicalPeer* remote_peer) = 0;
 
+  // 'peer_message' is usually allocated on an arena that's freed when this
+  // method returns, so the handler must copy anything that it keeps. The arena
+  // only saves the allocations made while parsing the message.
   virtual void HandleMessageFromRemotePeer(const CanonicalPeer* remote_peer,
                                            const PeerMessage& peer_message) = 0;
 };
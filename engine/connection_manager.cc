@@ -15,29 +15,79 @@
 
 #include "engine/connection_manager.h"
 
-#include <unistd.h>
+#include <pthread.h>
 
+#include <ctime>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include <gflags/gflags.h>
+
 #include "base/cond_var.h"
+#include "base/integral_types.h"
 #include "base/intrusive_ptr.h"
 #include "base/logging.h"
 #include "base/mutex.h"
 #include "base/mutex_lock.h"
+#include "base/random.h"
+#include "base/time_util.h"
 #include "engine/canonical_peer.h"
 #include "engine/connection_handler.h"
+#include "engine/get_peer_message_lane.h"
+#include "engine/get_peer_message_type.h"
 #include "engine/peer_connection.h"
 #include "engine/peer_id.h"
 #include "engine/proto/peer.pb.h"
+#include "engine/retransmit_buffer.h"
+#include "protocol_server/format_protocol_message.h"
 #include "protocol_server/protocol_server.h"
 #include "util/state_variable.h"
 
+using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using std::unordered_map;
+using std::unordered_set;
 using std::vector;
 
+DEFINE_int32(retransmit_buffer_size, 10000,
+             "Maximum number of unacknowledged messages that are kept for each "
+             "remote peer, so that they can be resent if the connection to the "
+             "peer is lost.");
+DEFINE_int64(retransmit_buffer_max_bytes, 64 * 1024 * 1024,
+             "Maximum total size of the unacknowledged messages that are kept "
+             "for each remote peer in each lane.");
+DEFINE_int64(total_output_budget_bytes, 256 * 1024 * 1024,
+             "Maximum number of bytes of messages that can be queued on all "
+             "peer connections combined before senders are made to wait. -1 "
+             "means no limit.");
+DEFINE_int32(send_backpressure_timeout_ms, 1000,
+             "Maximum time that a blocking send waits for room in the output "
+             "budget of a peer connection. The wait is bounded so that a "
+             "stalled peer can't block the sending thread indefinitely.");
+DEFINE_int32(laggard_timeout_sec, 30,
+             "If a peer connection's output budget stays used up for this "
+             "many seconds, the connection is closed. Unacknowledged messages "
+             "are resent when the peer reconnects.");
+DEFINE_int32(peer_connect_timeout_ms, 5000,
+             "Maximum time that a single attempt to connect to a remote peer "
+             "may take. -1 means no timeout.");
+DEFINE_int32(peer_hello_timeout_ms, 5000,
+             "Maximum time that a new connection to a remote peer waits for "
+             "the peer's HELLO message before the connection attempt is "
+             "considered to have failed.");
+DEFINE_int32(peer_connect_attempts, 10,
+             "Number of times that the peer tries to connect to each of the "
+             "known peers at start-up before giving up.");
+DEFINE_int32(peer_connect_retry_delay_ms, 100,
+             "Delay before the first retry of a failed connection attempt at "
+             "start-up. The delay doubles with each subsequent retry.");
+DEFINE_int32(peer_connect_max_retry_delay_ms, 5000,
+             "Maximum delay between connection attempts at start-up.");
+
 namespace floating_temple {
 
 class ProtocolConnection;
@@ -45,15 +95,67 @@ class ProtocolConnection;
 namespace engine {
 namespace {
 
-const int kConnectionRetryTimeoutSec = 5;
+// The receiver of a message stream sends an ACK message each time it receives
+// this many messages.
+const uint64 kAckInterval = 64;
+
+// Returns the delay before the given retry of a connection attempt. (The first
+// retry is number 1.) The delay doubles with each retry, up to a maximum. A
+// random fraction of up to half of the delay is subtracted from it so that
+// peers that were started at the same time don't retry in lockstep.
+int64 GetConnectRetryDelayUsec(int retry_number) {
+  CHECK_GE(retry_number, 1);
+
+  const int64 max_delay_usec =
+      static_cast<int64>(FLAGS_peer_connect_max_retry_delay_ms) * 1000;
+  int64 delay_usec =
+      static_cast<int64>(FLAGS_peer_connect_retry_delay_ms) * 1000;
+
+  for (int i = 1; i < retry_number && delay_usec < max_delay_usec; ++i) {
+    delay_usec *= 2;
+  }
+  if (delay_usec > max_delay_usec) {
+    delay_usec = max_delay_usec;
+  }
+
+  const int64 jitter_bound_usec = delay_usec / 2;
+  return delay_usec -
+      static_cast<int64>(GetRandomInt()) % (jitter_bound_usec + 1);
+}
+
+void GetTimespec(int64 time_usec, timespec* ts) {
+  CHECK(ts != nullptr);
+
+  ts->tv_sec = static_cast<time_t>(time_usec / 1000000);
+  ts->tv_nsec = static_cast<long>(time_usec % 1000000 * 1000);
+}
 
 }
 
+ConnectionManager::RemotePeerState::RemotePeerState(int max_message_count,
+                                                    int64 max_byte_count)
+    : incoming_session_id(0),
+      received_message_counts(kPeerMessageLaneCount, 0) {
+  outgoing_messages.reserve(kPeerMessageLaneCount);
+  for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+    outgoing_messages.emplace_back(new RetransmitBuffer(max_message_count,
+                                                        max_byte_count));
+  }
+}
+
+ConnectionManager::ConnectStatus::ConnectStatus()
+    : connected_count(0),
+      finished_count(0) {
+}
+
 ConnectionManager::ConnectionManager()
     : canonical_peer_map_(nullptr),
       local_peer_(nullptr),
       connection_handler_(nullptr),
-      state_(NOT_STARTED) {
+      total_output_budget_(FLAGS_total_output_budget_bytes),
+      state_(NOT_STARTED),
+      session_id_(static_cast<uint64>(GetCurrentTimeUsec())),
+      connect_stopping_(false) {
   state_.AddStateTransition(NOT_STARTED, STARTING);
   state_.AddStateTransition(STARTING, RUNNING);
   state_.AddStateTransition(RUNNING, STOPPING);
@@ -64,36 +166,43 @@ ConnectionManager::~ConnectionManager() {
   state_.CheckState(NOT_STARTED | STOPPED);
 }
 
-void ConnectionManager::ConnectToRemotePeer(const CanonicalPeer* remote_peer) {
-  CHECK(remote_peer != nullptr);
+int ConnectionManager::ConnectToRemotePeers(
+    const vector<const CanonicalPeer*>& remote_peers, int quorum) {
+  CHECK_GE(quorum, 0);
+  CHECK_LE(quorum, static_cast<int>(remote_peers.size()));
 
-  const string& peer_id = remote_peer->peer_id();
+  state_.CheckState(RUNNING);
 
-  string address;
-  int port = 0;
-  CHECK(ParsePeerId(peer_id, &address, &port))
-      << "Invalid peer id: " << peer_id;
+  const int remote_peer_count = static_cast<int>(remote_peers.size());
 
-  const intrusive_ptr<PeerConnection> peer_connection(
-      new PeerConnection(this, canonical_peer_map_, nullptr, address, true));
+  MutexLock lock(&connect_mu_);
 
-  {
-    MutexLock lock(&connections_mu_);
-    CHECK(unnamed_connections_.emplace(peer_connection.get(),
-                                       peer_connection).second);
-  }
+  ConnectStatus* const status = new ConnectStatus();
+  connect_statuses_.emplace_back(status);
 
-  ProtocolConnection* const connection = protocol_server_.OpenConnection(
-      peer_connection.get(), address, port);
+  for (const CanonicalPeer* const remote_peer : remote_peers) {
+    CHECK(remote_peer != nullptr);
 
-  if (connection == nullptr) {
-    LOG(ERROR) << "Couldn't connect to peer " << peer_id;
-    return;
+    ConnectThread* const connect_thread = new ConnectThread();
+    connect_thread->connection_manager = this;
+    connect_thread->remote_peer = remote_peer;
+    connect_thread->status = status;
+    connect_threads_.emplace_back(connect_thread);
+
+    CHECK_PTHREAD_ERR(pthread_create(&connect_thread->thread, nullptr,
+                                     &ConnectionManager::ConnectThreadMain,
+                                     connect_thread));
   }
 
-  LOG(INFO) << "Successfully connected to peer " << peer_id << " (peer "
-            << "connection " << peer_connection.get() << ")";
-  peer_connection->Init(connection);
+  // Stop waiting once the quorum has been reached, or once there aren't enough
+  // connection attempts left in progress to reach it.
+  while (status->connected_count < quorum &&
+         status->connected_count + (remote_peer_count -
+                                    status->finished_count) >= quorum) {
+    connect_cond_.Wait(&connect_mu_);
+  }
+
+  return status->connected_count;
 }
 
 void ConnectionManager::Start(CanonicalPeerMap* canonical_peer_map,
@@ -129,6 +238,7 @@ void ConnectionManager::Start(CanonicalPeerMap* canonical_peer_map,
 void ConnectionManager::Stop() {
   ChangeState(STOPPING);
 
+  JoinConnectThreads();
   DrainAllConnections();
   protocol_server_.Stop();
 
@@ -138,35 +248,173 @@ void ConnectionManager::Stop() {
 void ConnectionManager::SendMessageToRemotePeer(
     const CanonicalPeer* canonical_peer, const PeerMessage& peer_message,
     SendMode send_mode) {
+  SendFormattedMessageToRemotePeer(
+      canonical_peer, FormatSharedProtocolMessage(peer_message),
+      GetPeerMessageLane(GetPeerMessageType(peer_message)), send_mode, true);
+}
+
+void ConnectionManager::SendMessageToRemotePeers(
+    const vector<const CanonicalPeer*>& canonical_peers,
+    const PeerMessage& peer_message, SendMode send_mode) {
+  if (canonical_peers.empty()) {
+    return;
+  }
+
+  const shared_ptr<const string> formatted_message =
+      FormatSharedProtocolMessage(peer_message);
+  const PeerMessageLane lane = GetPeerMessageLane(GetPeerMessageType(
+      peer_message));
+
+  for (const CanonicalPeer* const canonical_peer : canonical_peers) {
+    SendFormattedMessageToRemotePeer(canonical_peer, formatted_message, lane,
+                                     send_mode, true);
+  }
+}
+
+void ConnectionManager::BroadcastMessage(const PeerMessage& peer_message,
+                                         SendMode send_mode) {
+  vector<const CanonicalPeer*> remote_peers;
+  GetKnownRemotePeers(&remote_peers);
+
+  if (remote_peers.empty()) {
+    return;
+  }
+
+  // Serialize the message once, and share the buffer between all of the
+  // remote peers.
+  const shared_ptr<const string> formatted_message =
+      FormatSharedProtocolMessage(peer_message);
+  const PeerMessageLane lane = GetPeerMessageLane(GetPeerMessageType(
+      peer_message));
+
+  // Don't reconnect to peers that aren't currently connected. The message will
+  // be sent to them when they reconnect.
+  for (const CanonicalPeer* const remote_peer : remote_peers) {
+    SendFormattedMessageToRemotePeer(remote_peer, formatted_message, lane,
+                                     send_mode, false);
+  }
+}
+
+void ConnectionManager::ChangeState(unsigned new_state) {
+  state_.ChangeState(new_state);
+}
+
+ConnectionManager::RemotePeerState*
+ConnectionManager::GetRemotePeerState_Locked(const CanonicalPeer* remote_peer) {
+  CHECK(remote_peer != nullptr);
+
+  unique_ptr<RemotePeerState>& remote_peer_state = remote_peers_[remote_peer];
+
+  if (remote_peer_state.get() == nullptr) {
+    remote_peer_state.reset(new RemotePeerState(
+        FLAGS_retransmit_buffer_size, FLAGS_retransmit_buffer_max_bytes));
+  }
+
+  return remote_peer_state.get();
+}
+
+void ConnectionManager::SendFormattedMessageToRemotePeer(
+    const CanonicalPeer* canonical_peer,
+    const shared_ptr<const string>& formatted_message, PeerMessageLane lane,
+    SendMode send_mode, bool connect) {
   CHECK(canonical_peer != nullptr);
 
+  intrusive_ptr<PeerConnection> queued_connection;
+  {
+    MutexLock lock(&remote_peers_mu_);
+
+    RemotePeerState* const remote_peer_state = GetRemotePeerState_Locked(
+        canonical_peer);
+
+    // Keep a copy of the message until the remote peer acknowledges it, in
+    // case the connection is lost first. The message is queued while the lock
+    // is held so that messages are sent in sequence number order.
+    remote_peer_state->outgoing_messages[lane]->AddMessage(formatted_message);
+
+    intrusive_ptr<PeerConnection>& resumed_connection =
+        remote_peer_state->resumed_connection;
+
+    if (resumed_connection.get() != nullptr) {
+      if (resumed_connection->SendFormattedMessage(formatted_message, lane)) {
+        queued_connection = resumed_connection;
+      } else {
+        VLOG(1) << "The connection to peer " << canonical_peer->peer_id()
+                << " is being drained. The message will be resent on the next "
+                << "connection. (peer connection " << resumed_connection.get()
+                << ")";
+
+        resumed_connection.reset(nullptr);
+      }
+    }
+  }
+
+  // Wait for the remote peer to catch up without holding the lock, so that
+  // messages to other peers aren't held up.
+  if (queued_connection.get() != nullptr) {
+    ThrottleSender(canonical_peer, queued_connection.get(), send_mode);
+    return;
+  }
+
+  if (!connect) {
+    return;
+  }
+
+  // The message will be sent when the remote peer asks for the message stream
+  // to be resumed. Make sure that there's a connection for it to ask on.
   while (state_.MatchesStateMask(NOT_STARTED | STARTING | RUNNING)) {
     const intrusive_ptr<PeerConnection> peer_connection = GetConnectionToPeer(
         canonical_peer);
 
-    if (peer_connection->SendMessage(peer_message, send_mode)) {
+    if (peer_connection.get() == nullptr || !peer_connection->IsDraining()) {
       return;
     }
 
-    VLOG(1) << "The attempt to send a message to peer "
-            << canonical_peer->peer_id() << " failed temporarily because the "
-            << "connection was being drained. (peer connection "
-            << peer_connection.get() << ")";
+    VLOG(1) << "Waiting for the connection to peer "
+            << canonical_peer->peer_id() << " to finish draining. (peer "
+            << "connection " << peer_connection.get() << ")";
   }
 }
 
-void ConnectionManager::BroadcastMessage(const PeerMessage& peer_message,
-                                         SendMode send_mode) {
-  vector<intrusive_ptr<PeerConnection>> connections;
-  GetAllOpenConnections(&connections);
+void ConnectionManager::ThrottleSender(const CanonicalPeer* canonical_peer,
+                                       PeerConnection* peer_connection,
+                                       SendMode send_mode) {
+  CHECK(canonical_peer != nullptr);
+  CHECK(peer_connection != nullptr);
+
+  if (peer_connection->IsLagging(
+          static_cast<int64>(FLAGS_laggard_timeout_sec) * 1000000)) {
+    LOG(WARNING) << "Peer " << canonical_peer->peer_id() << " hasn't kept up "
+                 << "with the messages sent to it for "
+                 << FLAGS_laggard_timeout_sec << " seconds. Closing the "
+                 << "connection. Unacknowledged messages will be resent when "
+                 << "the peer reconnects. (peer connection " << peer_connection
+                 << ")";
+
+    {
+      MutexLock lock(&remote_peers_mu_);
+
+      intrusive_ptr<PeerConnection>& resumed_connection =
+          GetRemotePeerState_Locked(canonical_peer)->resumed_connection;
+      if (resumed_connection.get() == peer_connection) {
+        resumed_connection.reset(nullptr);
+      }
+    }
 
-  for (const intrusive_ptr<PeerConnection>& connection : connections) {
-    connection->SendMessage(peer_message, send_mode);
+    peer_connection->Abort();
+    return;
   }
-}
 
-void ConnectionManager::ChangeState(unsigned new_state) {
-  state_.ChangeState(new_state);
+  // Replies to remote peers (NON_BLOCKING_MODE) are sent from the network
+  // threads, so they must never wait.
+  if (send_mode != BLOCKING_MODE) {
+    return;
+  }
+
+  if (!peer_connection->WaitForOutputBudget(
+          FLAGS_send_backpressure_timeout_ms)) {
+    VLOG(1) << "Timed out waiting for peer " << canonical_peer->peer_id()
+            << " to catch up. (peer connection " << peer_connection << ")";
+  }
 }
 
 intrusive_ptr<PeerConnection> ConnectionManager::GetConnectionToPeer(
@@ -189,20 +437,173 @@ intrusive_ptr<PeerConnection> ConnectionManager::GetConnectionToPeer(
   if (connection_is_new) {
     ProtocolConnection* const connection = ConnectToPeer(
         peer_connection.get(), peer_id, address, port);
+
+    if (connection == nullptr) {
+      // The connection manager is being stopped. Forget the connection so that
+      // DrainAllConnections doesn't wait for it.
+      MutexLock lock(&connections_mu_);
+      const auto it = named_connections_.find(canonical_peer);
+      if (it != named_connections_.end() &&
+          it->second.get() == peer_connection.get()) {
+        named_connections_.erase(it);
+      }
+      if (named_connections_.empty() && unnamed_connections_.empty()) {
+        connections_empty_cond_.Broadcast();
+      }
+      return intrusive_ptr<PeerConnection>(nullptr);
+    }
+
     peer_connection->Init(connection);
   }
 
   return peer_connection;
 }
 
+void ConnectionManager::ConnectWithRetries(const CanonicalPeer* remote_peer,
+                                           ConnectStatus* status) {
+  CHECK(remote_peer != nullptr);
+  CHECK(status != nullptr);
+
+  const string& peer_id = remote_peer->peer_id();
+
+  string address;
+  int port = 0;
+  CHECK(ParsePeerId(peer_id, &address, &port))
+      << "Invalid peer id: " << peer_id;
+
+  bool connected = false;
+
+  for (int attempt = 1; ; ++attempt) {
+    const intrusive_ptr<PeerConnection> peer_connection =
+        TryConnectToRemotePeer(remote_peer, address, port);
+
+    if (peer_connection.get() != nullptr) {
+      // The connection only counts once the remote peer has identified
+      // itself. Until then, the peer may not be able to process messages.
+      if (WaitForHelloMessage(remote_peer)) {
+        connected = true;
+        break;
+      }
+
+      LOG(WARNING) << "Peer " << peer_id << " didn't send a HELLO message "
+                   << "within " << FLAGS_peer_hello_timeout_ms << " "
+                   << "milliseconds.";
+      peer_connection->Abort();
+    }
+
+    if (attempt >= FLAGS_peer_connect_attempts) {
+      LOG(ERROR) << "Couldn't connect to peer " << peer_id << " after "
+                 << attempt << " attempts. Giving up.";
+      break;
+    }
+
+    const int64 delay_usec = GetConnectRetryDelayUsec(attempt);
+    LOG(WARNING) << "Couldn't connect to peer " << peer_id << ". Will try "
+                 << "again in " << delay_usec / 1000 << " milliseconds.";
+
+    if (!WaitBeforeRetry(delay_usec)) {
+      break;
+    }
+  }
+
+  MutexLock lock(&connect_mu_);
+  if (connected) {
+    ++status->connected_count;
+  }
+  ++status->finished_count;
+  connect_cond_.Broadcast();
+}
+
+intrusive_ptr<PeerConnection> ConnectionManager::TryConnectToRemotePeer(
+    const CanonicalPeer* remote_peer, const string& address, int port) {
+  CHECK(remote_peer != nullptr);
+
+  const intrusive_ptr<PeerConnection> peer_connection(
+      new PeerConnection(this, canonical_peer_map_, nullptr, address, true,
+                         &total_output_budget_));
+
+  {
+    MutexLock lock(&connections_mu_);
+    CHECK(unnamed_connections_.emplace(peer_connection.get(),
+                                       peer_connection).second);
+  }
+
+  ProtocolConnection* const connection = protocol_server_.OpenConnection(
+      peer_connection.get(), address, port, FLAGS_peer_connect_timeout_ms);
+
+  if (connection == nullptr) {
+    MutexLock lock(&connections_mu_);
+    CHECK_EQ(unnamed_connections_.erase(peer_connection.get()), 1u);
+    if (named_connections_.empty() && unnamed_connections_.empty()) {
+      connections_empty_cond_.Broadcast();
+    }
+    return intrusive_ptr<PeerConnection>(nullptr);
+  }
+
+  LOG(INFO) << "Successfully connected to peer " << remote_peer->peer_id()
+            << " (peer connection " << peer_connection.get() << ")";
+  peer_connection->Init(connection);
+
+  return peer_connection;
+}
+
+bool ConnectionManager::WaitForHelloMessage(const CanonicalPeer* remote_peer) {
+  CHECK(remote_peer != nullptr);
+
+  const int64 deadline_usec = GetCurrentTimeUsec() +
+      static_cast<int64>(FLAGS_peer_hello_timeout_ms) * 1000;
+  timespec deadline;
+  GetTimespec(deadline_usec, &deadline);
+
+  MutexLock lock(&connect_mu_);
+
+  while (hello_received_peers_.count(remote_peer) == 0 && !connect_stopping_ &&
+         GetCurrentTimeUsec() < deadline_usec) {
+    connect_cond_.TimedWait(&connect_mu_, &deadline);
+  }
+
+  return hello_received_peers_.count(remote_peer) > 0;
+}
+
+bool ConnectionManager::WaitBeforeRetry(int64 delay_usec) {
+  const int64 deadline_usec = GetCurrentTimeUsec() + delay_usec;
+  timespec deadline;
+  GetTimespec(deadline_usec, &deadline);
+
+  MutexLock lock(&connect_mu_);
+
+  while (!connect_stopping_ && GetCurrentTimeUsec() < deadline_usec) {
+    connect_cond_.TimedWait(&connect_mu_, &deadline);
+  }
+
+  return !connect_stopping_;
+}
+
+void ConnectionManager::JoinConnectThreads() {
+  vector<unique_ptr<ConnectThread>> connect_threads;
+
+  {
+    MutexLock lock(&connect_mu_);
+    connect_stopping_ = true;
+    connect_threads.swap(connect_threads_);
+  }
+  connect_cond_.Broadcast();
+
+  for (const unique_ptr<ConnectThread>& connect_thread : connect_threads) {
+    void* thread_return_value = nullptr;
+    CHECK_PTHREAD_ERR(pthread_join(connect_thread->thread,
+                                   &thread_return_value));
+  }
+}
+
 ProtocolConnection* ConnectionManager::ConnectToPeer(
     PeerConnection* connection_handler,
     const string& peer_id,
     const string& address,
     int port) {
-  for (;;) {
+  for (int attempt = 1; ; ++attempt) {
     ProtocolConnection* const connection = protocol_server_.OpenConnection(
-        connection_handler, address, port);
+        connection_handler, address, port, FLAGS_peer_connect_timeout_ms);
 
     if (connection != nullptr) {
       LOG(INFO) << "Successfully connected to peer " << peer_id << " (peer "
@@ -210,9 +611,15 @@ ProtocolConnection* ConnectionManager::ConnectToPeer(
       return connection;
     }
 
+    // Unlike the connection attempts at start-up, these are retried
+    // indefinitely, since there are messages waiting to be sent to the peer.
+    const int64 delay_usec = GetConnectRetryDelayUsec(attempt);
     LOG(ERROR) << "Couldn't connect to peer " << peer_id << ". Will try "
-               << "again in " << kConnectionRetryTimeoutSec << " seconds.";
-    sleep(static_cast<unsigned>(kConnectionRetryTimeoutSec));
+               << "again in " << delay_usec / 1000 << " milliseconds.";
+
+    if (!WaitBeforeRetry(delay_usec)) {
+      return nullptr;
+    }
   }
 }
 
@@ -234,6 +641,31 @@ void ConnectionManager::GetAllOpenConnections(
   }
 }
 
+void ConnectionManager::GetKnownRemotePeers(
+    vector<const CanonicalPeer*>* remote_peers) {
+  CHECK(remote_peers != nullptr);
+
+  unordered_set<const CanonicalPeer*> remote_peer_set;
+
+  {
+    MutexLock lock(&connections_mu_);
+
+    for (const auto& connection_pair : named_connections_) {
+      remote_peer_set.insert(connection_pair.first);
+    }
+  }
+
+  {
+    MutexLock lock(&remote_peers_mu_);
+
+    for (const auto& remote_peer_pair : remote_peers_) {
+      remote_peer_set.insert(remote_peer_pair.first);
+    }
+  }
+
+  remote_peers->assign(remote_peer_set.begin(), remote_peer_set.end());
+}
+
 void ConnectionManager::DrainAllConnections() {
   for (;;) {
     vector<intrusive_ptr<PeerConnection>> connections;
@@ -268,8 +700,8 @@ intrusive_ptr<PeerConnection> ConnectionManager::GetOrCreateNamedConnection(
 
   if (peer_connection_ptr.get() == nullptr) {
     peer_connection_ptr.reset(new PeerConnection(this, canonical_peer_map_,
-                                                 canonical_peer, address,
-                                                 true));
+                                                 canonical_peer, address, true,
+                                                 &total_output_budget_));
     *connection_is_new = true;
   } else {
     *connection_is_new = false;
@@ -278,6 +710,16 @@ intrusive_ptr<PeerConnection> ConnectionManager::GetOrCreateNamedConnection(
   return peer_connection_ptr;
 }
 
+// static
+void* ConnectionManager::ConnectThreadMain(void* connect_thread_raw) {
+  CHECK(connect_thread_raw != nullptr);
+  ConnectThread* const connect_thread = static_cast<ConnectThread*>(
+      connect_thread_raw);
+  connect_thread->connection_manager->ConnectWithRetries(
+      connect_thread->remote_peer, connect_thread->status);
+  return nullptr;
+}
+
 const CanonicalPeer* ConnectionManager::GetConnectionInitiator(
     const PeerConnection* peer_connection) const {
   CHECK(peer_connection != nullptr);
@@ -294,7 +736,7 @@ ConnectionManager::NotifyConnectionReceived(ProtocolConnection* connection,
                                             const string& remote_address) {
   const intrusive_ptr<PeerConnection> peer_connection(
       new PeerConnection(this, canonical_peer_map_, nullptr, remote_address,
-                         false));
+                         false, &total_output_budget_));
   peer_connection->Init(connection);
 
   LOG(INFO) << "Received a connection from a remote peer at address "
@@ -361,6 +803,20 @@ void ConnectionManager::NotifyConnectionClosed(
     }
   }
 
+  if (remote_peer != nullptr) {
+    MutexLock lock(&remote_peers_mu_);
+
+    const auto remote_peer_it = remote_peers_.find(remote_peer);
+    if (remote_peer_it != remote_peers_.end()) {
+      intrusive_ptr<PeerConnection>& resumed_connection =
+          remote_peer_it->second->resumed_connection;
+
+      if (resumed_connection.get() == peer_connection) {
+        resumed_connection.reset(nullptr);
+      }
+    }
+  }
+
   peer_connection_ptr->Close();
 }
 
@@ -388,6 +844,13 @@ void ConnectionManager::NotifyRemotePeerKnown(
             << peer_connection->remote_address() << " has identified itself as "
             << remote_peer_id << " (peer connection " << peer_connection << ")";
 
+  // Let ConnectWithRetries know that the connection is usable.
+  {
+    MutexLock lock(&connect_mu_);
+    hello_received_peers_.insert(remote_peer);
+  }
+  connect_cond_.Broadcast();
+
   intrusive_ptr<PeerConnection> peer_connection_to_drain;
   {
     MutexLock lock(&connections_mu_);
@@ -454,6 +917,31 @@ void ConnectionManager::NotifyRemotePeerKnown(
     peer_connection_to_drain->Drain();
   }
 
+  if (peer_connection_to_drain.get() != peer_connection) {
+    // Ask the remote peer to resume sending messages on this connection,
+    // starting with the first message that this peer hasn't received.
+    PeerMessage peer_message;
+    ResumeRequestMessage* const resume_request_message =
+        peer_message.mutable_resume_request_message();
+
+    {
+      MutexLock lock(&remote_peers_mu_);
+
+      const RemotePeerState* const remote_peer_state =
+          GetRemotePeerState_Locked(remote_peer);
+      resume_request_message->set_session_id(
+          remote_peer_state->incoming_session_id);
+      for (const uint64 received_message_count :
+               remote_peer_state->received_message_counts) {
+        resume_request_message->add_received_message_count(
+            received_message_count);
+      }
+    }
+
+    peer_connection->SendFormattedMessage(
+        FormatSharedProtocolMessage(peer_message), PRIORITY_LANE);
+  }
+
   // TODO(dss): Only notify the TransactionStore class if a connection to the
   // remote peer didn't already exist.
   connection_handler_->NotifyNewConnection(remote_peer);
@@ -465,5 +953,180 @@ void ConnectionManager::HandleMessageFromRemotePeer(
   connection_handler_->HandleMessageFromRemotePeer(remote_peer, peer_message);
 }
 
+void ConnectionManager::ResumeOutgoingMessages(
+    PeerConnection* peer_connection,
+    const ResumeRequestMessage& resume_request_message) {
+  CHECK(peer_connection != nullptr);
+
+  const CanonicalPeer* const remote_peer = peer_connection->remote_peer();
+  CHECK(remote_peer != nullptr);
+
+  // If the session IDs don't match, the remote peer hasn't received any
+  // messages from this instance of the local peer.
+  const bool same_session = resume_request_message.session_id() == session_id_;
+
+  PeerMessage peer_message;
+  ResumeMessage* const resume_message = peer_message.mutable_resume_message();
+  resume_message->set_session_id(session_id_);
+
+  MutexLock lock(&remote_peers_mu_);
+
+  RemotePeerState* const remote_peer_state = GetRemotePeerState_Locked(
+      remote_peer);
+
+  vector<vector<shared_ptr<const string>>> formatted_messages(
+      kPeerMessageLaneCount);
+
+  for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+    RetransmitBuffer* const outgoing_messages =
+        remote_peer_state->outgoing_messages[lane].get();
+
+    uint64 requested_sequence_number = 0;
+    if (same_session &&
+        lane < resume_request_message.received_message_count_size()) {
+      requested_sequence_number =
+          resume_request_message.received_message_count(lane);
+      outgoing_messages->Acknowledge(requested_sequence_number);
+    }
+
+    const uint64 start_sequence_number = outgoing_messages->GetMessages(
+        requested_sequence_number, &formatted_messages[lane]);
+
+    if (same_session && start_sequence_number > requested_sequence_number) {
+      LOG(WARNING) << (start_sequence_number - requested_sequence_number)
+                   << " messages to peer " << remote_peer->peer_id()
+                   << " in lane " << lane << " were discarded before the peer "
+                   << "received them.";
+    }
+
+    VLOG(1) << "Resuming messages to peer " << remote_peer->peer_id()
+            << " in lane " << lane << " at sequence number "
+            << start_sequence_number << " (" << formatted_messages[lane].size()
+            << " messages to resend). (peer connection " << peer_connection
+            << ")";
+
+    resume_message->add_start_sequence_number(start_sequence_number);
+  }
+
+  // The RESUME message is in the priority lane, so it's sent before any of the
+  // messages that follow it, whatever their lanes are.
+  if (!peer_connection->SendFormattedMessage(
+          FormatSharedProtocolMessage(peer_message), PRIORITY_LANE)) {
+    return;
+  }
+
+  for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+    for (const shared_ptr<const string>& formatted_message :
+             formatted_messages[lane]) {
+      if (!peer_connection->SendFormattedMessage(
+              formatted_message, static_cast<PeerMessageLane>(lane))) {
+        return;
+      }
+    }
+  }
+
+  intrusive_ptr<PeerConnection>& resumed_connection =
+      remote_peer_state->resumed_connection;
+  if (resumed_connection.get() != peer_connection) {
+    peer_connection->IncrementRefCount();
+    resumed_connection.reset(peer_connection);
+  }
+}
+
+void ConnectionManager::AcknowledgeOutgoingMessages(
+    const CanonicalPeer* remote_peer, const AckMessage& ack_message) {
+  // PeerConnection checks the lane before it calls this method.
+  const int lane = ack_message.lane();
+  CHECK_GE(lane, 0);
+  CHECK_LT(lane, kPeerMessageLaneCount);
+
+  MutexLock lock(&remote_peers_mu_);
+
+  if (ack_message.session_id() == session_id_) {
+    GetRemotePeerState_Locked(remote_peer)->outgoing_messages[lane]->
+        Acknowledge(ack_message.received_message_count());
+  }
+}
+
+void ConnectionManager::ResumeIncomingMessages(
+    const CanonicalPeer* remote_peer, const ResumeMessage& resume_message) {
+  const uint64 session_id = resume_message.session_id();
+  // PeerConnection checks the number of sequence numbers before it calls this
+  // method.
+  CHECK_EQ(resume_message.start_sequence_number_size(),
+           kPeerMessageLaneCount);
+
+  MutexLock lock(&remote_peers_mu_);
+
+  RemotePeerState* const remote_peer_state = GetRemotePeerState_Locked(
+      remote_peer);
+
+  // If the remote peer has started a new session (possibly because it was
+  // restarted), sequence numbers from the previous session are meaningless.
+  const bool new_session = remote_peer_state->incoming_session_id !=
+      session_id;
+  remote_peer_state->incoming_session_id = session_id;
+
+  for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+    const uint64 start_sequence_number =
+        resume_message.start_sequence_number(lane);
+    uint64* const received_message_count =
+        &remote_peer_state->received_message_counts[lane];
+
+    if (new_session) {
+      *received_message_count = start_sequence_number;
+    } else if (start_sequence_number > *received_message_count) {
+      LOG(WARNING) << (start_sequence_number - *received_message_count)
+                   << " messages from peer " << remote_peer->peer_id()
+                   << " in lane " << lane << " were lost.";
+      *received_message_count = start_sequence_number;
+    }
+  }
+}
+
+bool ConnectionManager::AcceptIncomingMessage(PeerConnection* peer_connection,
+                                              PeerMessageLane lane,
+                                              uint64 sequence_number) {
+  CHECK(peer_connection != nullptr);
+
+  const CanonicalPeer* const remote_peer = peer_connection->remote_peer();
+
+  PeerMessage peer_message;
+  {
+    MutexLock lock(&remote_peers_mu_);
+
+    RemotePeerState* const remote_peer_state = GetRemotePeerState_Locked(
+        remote_peer);
+    uint64* const received_message_count =
+        &remote_peer_state->received_message_counts[lane];
+
+    if (sequence_number < *received_message_count) {
+      return false;
+    }
+
+    if (sequence_number > *received_message_count) {
+      LOG(WARNING) << (sequence_number - *received_message_count)
+                   << " messages from peer " << remote_peer->peer_id()
+                   << " in lane " << lane << " were lost.";
+    }
+
+    *received_message_count = sequence_number + 1;
+
+    if (*received_message_count % kAckInterval != 0) {
+      return true;
+    }
+
+    AckMessage* const ack_message = peer_message.mutable_ack_message();
+    ack_message->set_session_id(remote_peer_state->incoming_session_id);
+    ack_message->set_lane(lane);
+    ack_message->set_received_message_count(*received_message_count);
+  }
+
+  peer_connection->SendFormattedMessage(
+      FormatSharedProtocolMessage(peer_message), PRIORITY_LANE);
+
+  return true;
+}
+
 }  // namespace engine
 }  // namespace floating_temple
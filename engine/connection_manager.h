@@ -16,19 +16,27 @@
 #ifndef ENGINE_CONNECTION_MANAGER_H_
 #define ENGINE_CONNECTION_MANAGER_H_
 
+#include <pthread.h>
+
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "base/cond_var.h"
+#include "base/integral_types.h"
 #include "base/intrusive_ptr.h"
 #include "base/macros.h"
 #include "base/mutex.h"
 #include "engine/connection_manager_interface_for_peer_connection.h"
+#include "engine/get_peer_message_lane.h"
 #include "engine/peer_message_sender.h"
 #include "engine/proto/peer.pb.h"
+#include "engine/retransmit_buffer.h"
 #include "protocol_server/protocol_server.h"
 #include "protocol_server/protocol_server_handler.h"
+#include "util/byte_budget.h"
 #include "util/state_variable.h"
 
 namespace floating_temple {
@@ -51,7 +59,17 @@ class ConnectionManager : public PeerMessageSender,
   ConnectionManager();
   ~ConnectionManager() override;
 
-  void ConnectToRemotePeer(const CanonicalPeer* remote_peer);
+  // Connects to the given remote peers in parallel. Each connection attempt is
+  // retried, with a randomized exponential backoff, until it succeeds or the
+  // retries run out. An attempt only succeeds once the remote peer has sent
+  // its HELLO message.
+  //
+  // Returns as soon as 'quorum' of the connections have been established, or
+  // once it's clear that the quorum can't be reached. The connection attempts
+  // that are still in progress continue in the background. Returns the number
+  // of connections that were established.
+  int ConnectToRemotePeers(
+      const std::vector<const CanonicalPeer*>& remote_peers, int quorum);
 
   void Start(CanonicalPeerMap* canonical_peer_map,
              const std::string& interpreter_type,
@@ -63,6 +81,9 @@ class ConnectionManager : public PeerMessageSender,
   void SendMessageToRemotePeer(const CanonicalPeer* canonical_peer,
                                const PeerMessage& peer_message,
                                SendMode send_mode) override;
+  void SendMessageToRemotePeers(
+      const std::vector<const CanonicalPeer*>& canonical_peers,
+      const PeerMessage& peer_message, SendMode send_mode) override;
   void BroadcastMessage(const PeerMessage& peer_message,
                         SendMode send_mode) override;
 
@@ -75,22 +96,93 @@ class ConnectionManager : public PeerMessageSender,
     STOPPED = 0x10
   };
 
+  // The state of the message streams to and from a single remote peer. These
+  // outlive the connections to the peer so that messages that were lost when a
+  // connection closed can be sent again on the next connection.
+  struct RemotePeerState {
+    RemotePeerState(int max_message_count, int64 max_byte_count);
+
+    // Messages sent to the remote peer that it hasn't acknowledged yet,
+    // indexed by lane.
+    std::vector<std::unique_ptr<RetransmitBuffer>> outgoing_messages;
+    // The connection that outgoing messages are currently sent on, or NULL if
+    // the remote peer hasn't asked for the messages to be resumed yet.
+    intrusive_ptr<PeerConnection> resumed_connection;
+
+    // The session ID of the remote peer, and the number of messages received
+    // from it in each lane in that session.
+    uint64 incoming_session_id;
+    std::vector<uint64> received_message_counts;
+  };
+
+  // The progress of a call to ConnectToRemotePeers.
+  struct ConnectStatus {
+    ConnectStatus();
+
+    int connected_count;
+    int finished_count;
+  };
+
+  // A thread started by ConnectToRemotePeers to connect to a single remote
+  // peer.
+  struct ConnectThread {
+    ConnectionManager* connection_manager;
+    const CanonicalPeer* remote_peer;
+    ConnectStatus* status;
+    pthread_t thread;
+  };
+
   void ChangeState(unsigned new_state);
 
+  RemotePeerState* GetRemotePeerState_Locked(const CanonicalPeer* remote_peer);
+
+  void SendFormattedMessageToRemotePeer(
+      const CanonicalPeer* canonical_peer,
+      const std::shared_ptr<const std::string>& formatted_message,
+      PeerMessageLane lane, SendMode send_mode, bool connect);
+  // Called after a message has been queued on a connection. In BLOCKING_MODE,
+  // waits (for a bounded time) until the connection's output budget is
+  // available again. If the remote peer has been lagging for too long, the
+  // connection is closed instead.
+  void ThrottleSender(const CanonicalPeer* canonical_peer,
+                      PeerConnection* peer_connection, SendMode send_mode);
+
   intrusive_ptr<PeerConnection> GetConnectionToPeer(
       const CanonicalPeer* canonical_peer);
+  void ConnectWithRetries(const CanonicalPeer* remote_peer,
+                          ConnectStatus* status);
+  // Opens a connection to the remote peer. Returns NULL if the connection
+  // couldn't be opened.
+  intrusive_ptr<PeerConnection> TryConnectToRemotePeer(
+      const CanonicalPeer* remote_peer, const std::string& address, int port);
+  // Waits until the remote peer has sent a HELLO message on any connection.
+  // Returns false if it doesn't do so in time, or if the connection manager is
+  // stopped in the meantime.
+  bool WaitForHelloMessage(const CanonicalPeer* remote_peer);
+  // Waits for the given delay before the next connection attempt. Returns false
+  // if the connection manager is stopped in the meantime.
+  bool WaitBeforeRetry(int64 delay_usec);
+  void JoinConnectThreads();
+
+  // Connects to the remote peer, retrying until the connection succeeds.
+  // Returns NULL if the connection manager is stopped first.
   ProtocolConnection* ConnectToPeer(PeerConnection* connection_handler,
                                     const std::string& peer_id,
                                     const std::string& address,
                                     int port);
   void GetAllOpenConnections(
       std::vector<intrusive_ptr<PeerConnection>>* peer_connections);
+  // Gets the remote peers that this peer is connected to or has exchanged
+  // messages with.
+  void GetKnownRemotePeers(std::vector<const CanonicalPeer*>* remote_peers);
   void DrainAllConnections();
 
   intrusive_ptr<PeerConnection> GetOrCreateNamedConnection(
       const CanonicalPeer* canonical_peer, const std::string& address,
       bool* connection_is_new);
 
+  static void* ConnectThreadMain(void* connect_thread_raw);
+
   const CanonicalPeer* GetConnectionInitiator(
       const PeerConnection* peer_connection) const;
 
@@ -106,11 +198,25 @@ class ConnectionManager : public PeerMessageSender,
                              const CanonicalPeer* remote_peer) override;
   void HandleMessageFromRemotePeer(const CanonicalPeer* remote_peer,
                                    const PeerMessage& peer_message) override;
+  void ResumeOutgoingMessages(
+      PeerConnection* peer_connection,
+      const ResumeRequestMessage& resume_request_message) override;
+  void AcknowledgeOutgoingMessages(const CanonicalPeer* remote_peer,
+                                   const AckMessage& ack_message) override;
+  void ResumeIncomingMessages(const CanonicalPeer* remote_peer,
+                              const ResumeMessage& resume_message) override;
+  bool AcceptIncomingMessage(PeerConnection* peer_connection,
+                             PeerMessageLane lane,
+                             uint64 sequence_number) override;
 
   CanonicalPeerMap* canonical_peer_map_;
   std::string interpreter_type_;
   const CanonicalPeer* local_peer_;
   ConnectionHandler* connection_handler_;
+  // Limits the total size of the messages queued on all of the peer
+  // connections. Each PeerConnection has its own budget nested inside this
+  // one, so this member must outlive the connections.
+  ByteBudget total_output_budget_;
   ProtocolServer<PeerMessage> protocol_server_;
 
   StateVariable state_;
@@ -122,6 +228,25 @@ class ConnectionManager : public PeerMessageSender,
   mutable CondVar connections_empty_cond_;
   mutable Mutex connections_mu_;
 
+  // Identifies this instance to remote peers, so that they can tell when this
+  // peer has restarted and its sequence numbers have started over.
+  const uint64 session_id_;
+
+  std::unordered_map<const CanonicalPeer*, std::unique_ptr<RemotePeerState>>
+      remote_peers_;
+  mutable Mutex remote_peers_mu_;
+
+  // The threads started by ConnectToRemotePeers, and the progress of each call
+  // to that method. 'connect_stopping_' is set when the connection manager is
+  // stopped, so that the threads give up instead of retrying.
+  std::vector<std::unique_ptr<ConnectThread>> connect_threads_;
+  std::vector<std::unique_ptr<ConnectStatus>> connect_statuses_;
+  bool connect_stopping_;
+  // The remote peers that have sent a HELLO message on some connection.
+  std::unordered_set<const CanonicalPeer*> hello_received_peers_;
+  mutable CondVar connect_cond_;
+  mutable Mutex connect_mu_;
+
   DISALLOW_COPY_AND_ASSIGN(ConnectionManager);
 };
 
@@ -18,12 +18,18 @@
 
 #include <string>
 
+#include "base/integral_types.h"
+#include "engine/get_peer_message_lane.h"
+
 namespace floating_temple {
 namespace engine {
 
+class AckMessage;
 class CanonicalPeer;
 class PeerConnection;
 class PeerMessage;
+class ResumeMessage;
+class ResumeRequestMessage;
 
 class ConnectionManagerInterfaceForPeerConnection {
  public:
@@ -36,8 +42,30 @@ class ConnectionManagerInterfaceForPeerConnection {
   // call peer_connection->remote_peer().
   virtual void NotifyRemotePeerKnown(PeerConnection* peer_connection,
                                      const CanonicalPeer* remote_peer) = 0;
+  // 'peer_message' is only valid until this method returns. (See
+  // ConnectionHandler::HandleMessageFromRemotePeer.)
   virtual void HandleMessageFromRemotePeer(const CanonicalPeer* remote_peer,
                                            const PeerMessage& peer_message) = 0;
+
+  // Called when the remote peer asks this peer to resume sending its messages
+  // on the given connection.
+  virtual void ResumeOutgoingMessages(
+      PeerConnection* peer_connection,
+      const ResumeRequestMessage& resume_request_message) = 0;
+  // Called when the remote peer acknowledges the messages that it has received
+  // from this peer. The caller has checked that the lane exists.
+  virtual void AcknowledgeOutgoingMessages(const CanonicalPeer* remote_peer,
+                                           const AckMessage& ack_message) = 0;
+  // Called when the remote peer starts sending sequenced messages on a
+  // connection. The caller has checked that the message has a start sequence
+  // number for each lane.
+  virtual void ResumeIncomingMessages(const CanonicalPeer* remote_peer,
+                                      const ResumeMessage& resume_message) = 0;
+  // Called for each sequenced message received from the remote peer. Returns
+  // false if the message is a duplicate and should be ignored.
+  virtual bool AcceptIncomingMessage(PeerConnection* peer_connection,
+                                     PeerMessageLane lane,
+                                     uint64 sequence_number) = 0;
 };
 
 }  // namespace engine
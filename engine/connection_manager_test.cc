@@ -18,6 +18,7 @@
 #include <pthread.h>
 
 #include <string>
+#include <vector>
 
 #include <gflags/gflags.h>
 
@@ -37,6 +38,7 @@
 using google::InitGoogleLogging;
 using google::ParseCommandLineFlags;
 using std::string;
+using std::vector;
 using testing::AtLeast;
 using testing::AtMost;
 using testing::InSequence;
@@ -44,6 +46,10 @@ using testing::InitGoogleMock;
 using testing::InvokeWithoutArgs;
 using testing::_;
 
+DECLARE_int32(peer_connect_attempts);
+DECLARE_int32(peer_connect_retry_delay_ms);
+DECLARE_int32(peer_connection_receive_window);
+
 namespace floating_temple {
 namespace engine {
 
@@ -117,6 +123,205 @@ TEST(ConnectionManagerTest, SendMessageToRemotePeer) {
   connection_manager2.Stop();
 }
 
+TEST(ConnectionManagerTest, SmallReceiveWindow) {
+  const int kMessageCount = 500;
+
+  // The receiver grants credit after every message, so the sender can only
+  // keep going if the CREDIT messages arrive.
+  const int saved_receive_window = FLAGS_peer_connection_receive_window;
+  FLAGS_peer_connection_receive_window = 2;
+
+  Notification done;
+
+  MockConnectionHandler connection_handler1;
+  MockConnectionHandler connection_handler2;
+
+  EXPECT_CALL(connection_handler1, NotifyNewConnection(_))
+      .Times(AtMost(1));
+  EXPECT_CALL(connection_handler2, NotifyNewConnection(_));
+
+  {
+    InSequence s;
+
+    for (int i = 1; i < kMessageCount; ++i) {
+      EXPECT_CALL(
+          connection_handler2,
+          HandleMessageFromRemotePeer(
+              _, HasTestMessageText(StringPrintf("test message %d", i))));
+    }
+    EXPECT_CALL(
+        connection_handler2,
+        HandleMessageFromRemotePeer(
+            _, HasTestMessageText(StringPrintf("test message %d",
+                                               kMessageCount))))
+        .WillOnce(InvokeWithoutArgs(&done, &Notification::Notify));
+  }
+
+  CanonicalPeerMap canonical_peer_map;
+
+  const string local_address = GetLocalAddress();
+  const CanonicalPeer* const canonical_peer1 =
+      canonical_peer_map.GetCanonicalPeer(
+      MakePeerId(local_address, GetUnusedPortForTesting()));
+  const CanonicalPeer* const canonical_peer2 =
+      canonical_peer_map.GetCanonicalPeer(
+      MakePeerId(local_address, GetUnusedPortForTesting()));
+
+  ConnectionManager connection_manager1, connection_manager2;
+
+  connection_manager1.Start(&canonical_peer_map, "test-interpreter-type",
+                            canonical_peer1, &connection_handler1, 1);
+  connection_manager2.Start(&canonical_peer_map, "test-interpreter-type",
+                            canonical_peer2, &connection_handler2, 1);
+
+  for (int i = 1; i <= kMessageCount; ++i) {
+    PeerMessage peer_message;
+    peer_message.mutable_test_message()->set_text(
+        StringPrintf("test message %d", i));
+
+    connection_manager1.SendMessageToRemotePeer(
+        canonical_peer2, peer_message, PeerMessageSender::BLOCKING_MODE);
+  }
+
+  ASSERT_TRUE(done.WaitWithTimeout(10000));  // milliseconds
+
+  connection_manager1.Stop();
+  connection_manager2.Stop();
+
+  FLAGS_peer_connection_receive_window = saved_receive_window;
+}
+
+TEST(ConnectionManagerTest, ConnectToRemotePeersWithQuorum) {
+  const int saved_connect_attempts = FLAGS_peer_connect_attempts;
+  const int saved_connect_retry_delay_ms = FLAGS_peer_connect_retry_delay_ms;
+  FLAGS_peer_connect_attempts = 3;
+  FLAGS_peer_connect_retry_delay_ms = 10;
+
+  MockConnectionHandler connection_handler1;
+  MockConnectionHandler connection_handler2;
+
+  EXPECT_CALL(connection_handler1, NotifyNewConnection(_))
+      .Times(AtMost(1));
+  EXPECT_CALL(connection_handler2, NotifyNewConnection(_))
+      .Times(AtMost(1));
+
+  CanonicalPeerMap canonical_peer_map;
+
+  const string local_address = GetLocalAddress();
+  const CanonicalPeer* const canonical_peer1 =
+      canonical_peer_map.GetCanonicalPeer(
+      MakePeerId(local_address, GetUnusedPortForTesting()));
+  const CanonicalPeer* const canonical_peer2 =
+      canonical_peer_map.GetCanonicalPeer(
+      MakePeerId(local_address, GetUnusedPortForTesting()));
+  // Nothing listens on this peer's port, so connections to it are refused.
+  const CanonicalPeer* const unreachable_peer =
+      canonical_peer_map.GetCanonicalPeer(
+      MakePeerId(local_address, GetUnusedPortForTesting()));
+
+  ConnectionManager connection_manager1, connection_manager2;
+
+  connection_manager1.Start(&canonical_peer_map, "test-interpreter-type",
+                            canonical_peer1, &connection_handler1, 1);
+  connection_manager2.Start(&canonical_peer_map, "test-interpreter-type",
+                            canonical_peer2, &connection_handler2, 1);
+
+  vector<const CanonicalPeer*> remote_peers;
+  remote_peers.push_back(unreachable_peer);
+  remote_peers.push_back(canonical_peer2);
+
+  // The quorum can be reached without the unreachable peer.
+  EXPECT_EQ(1, connection_manager1.ConnectToRemotePeers(remote_peers, 1));
+
+  // The quorum can't be reached. The call returns once the attempts to connect
+  // to the unreachable peer have run out.
+  remote_peers.pop_back();
+  EXPECT_EQ(0, connection_manager1.ConnectToRemotePeers(remote_peers, 1));
+
+  connection_manager1.Stop();
+  connection_manager2.Stop();
+
+  FLAGS_peer_connect_attempts = saved_connect_attempts;
+  FLAGS_peer_connect_retry_delay_ms = saved_connect_retry_delay_ms;
+}
+
+MATCHER_P(IsStoreObjectMessageOfSize, interested_peer_count, "") {
+  return GetPeerMessageType(arg) == PeerMessage::STORE_OBJECT &&
+      arg.store_object_message().interested_peer_id_size() ==
+      interested_peer_count;
+}
+
+TEST(ConnectionManagerTest, LargeBulkMessage) {
+  const int kInterestedPeerCount = 20000;
+
+  Notification bulk_message_received;
+  Notification test_message_received;
+
+  MockConnectionHandler connection_handler1;
+  MockConnectionHandler connection_handler2;
+
+  EXPECT_CALL(connection_handler1, NotifyNewConnection(_))
+      .Times(AtMost(1));
+  EXPECT_CALL(connection_handler2, NotifyNewConnection(_));
+
+  // The messages are sent in different lanes, so they may be received in
+  // either order. (Google Mock tries the expectations in reverse order, so the
+  // STORE_OBJECT expectation must come last; HasTestMessageText only accepts
+  // TEST messages.)
+  EXPECT_CALL(connection_handler2,
+              HandleMessageFromRemotePeer(_, HasTestMessageText("after")))
+      .WillOnce(InvokeWithoutArgs(&test_message_received,
+                                  &Notification::Notify));
+  EXPECT_CALL(connection_handler2,
+              HandleMessageFromRemotePeer(
+                  _, IsStoreObjectMessageOfSize(kInterestedPeerCount)))
+      .WillOnce(InvokeWithoutArgs(&bulk_message_received,
+                                  &Notification::Notify));
+
+  CanonicalPeerMap canonical_peer_map;
+
+  const string local_address = GetLocalAddress();
+  const CanonicalPeer* const canonical_peer1 =
+      canonical_peer_map.GetCanonicalPeer(
+      MakePeerId(local_address, GetUnusedPortForTesting()));
+  const CanonicalPeer* const canonical_peer2 =
+      canonical_peer_map.GetCanonicalPeer(
+      MakePeerId(local_address, GetUnusedPortForTesting()));
+
+  ConnectionManager connection_manager1, connection_manager2;
+
+  connection_manager1.Start(&canonical_peer_map, "test-interpreter-type",
+                            canonical_peer1, &connection_handler1, 1);
+  connection_manager2.Start(&canonical_peer_map, "test-interpreter-type",
+                            canonical_peer2, &connection_handler2, 1);
+
+  // The STORE_OBJECT message is much larger than a chunk, so it's split into
+  // chunks.
+  PeerMessage bulk_message;
+  StoreObjectMessage* const store_object_message =
+      bulk_message.mutable_store_object_message();
+  store_object_message->mutable_object_id()->set_high_word(1);
+  store_object_message->mutable_object_id()->set_low_word(2);
+  for (int i = 0; i < kInterestedPeerCount; ++i) {
+    store_object_message->add_interested_peer_id(
+        StringPrintf("ip/10.0.%d.%d/1025", i / 256, i % 256));
+  }
+
+  PeerMessage test_message;
+  test_message.mutable_test_message()->set_text("after");
+
+  connection_manager1.SendMessageToRemotePeer(
+      canonical_peer2, bulk_message, PeerMessageSender::NON_BLOCKING_MODE);
+  connection_manager1.SendMessageToRemotePeer(
+      canonical_peer2, test_message, PeerMessageSender::NON_BLOCKING_MODE);
+
+  ASSERT_TRUE(bulk_message_received.WaitWithTimeout(5000));  // milliseconds
+  ASSERT_TRUE(test_message_received.WaitWithTimeout(5000));  // milliseconds
+
+  connection_manager1.Stop();
+  connection_manager2.Stop();
+}
+
 struct SendTestMessageInfo {
   PeerMessageSender* peer_message_sender;
   const CanonicalPeer* remote_peer;
@@ -0,0 +1,225 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/contention_manager.h"
+
+#include <cerrno>
+#include <ctime>
+#include <map>
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/mutex_lock.h"
+#include "base/random.h"
+#include "base/time_util.h"
+#include "engine/proto/uuid.pb.h"
+#include "engine/uuid_util.h"
+#include "util/dump_context.h"
+#include "util/dump_context_impl.h"
+
+using std::map;
+using std::string;
+
+DEFINE_int32(retry_backoff_base_usec, 1000,
+             "Upper bound, in microseconds, of the randomized delay before the "
+             "first retry of a rewound method call. The bound doubles with "
+             "each consecutive retry.");
+DEFINE_int32(retry_backoff_max_usec, 500000,
+             "Maximum upper bound, in microseconds, of the randomized delay "
+             "before a rewound method call is retried.");
+DEFINE_int32(contention_stats_log_interval_sec, 60,
+             "Minimum interval, in seconds, between the contention statistics "
+             "that are logged while conflicts are occurring. Zero disables the "
+             "periodic logging.");
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+// If the recording thread hasn't been rewound for this long, the next retry is
+// no longer considered to be part of the same burst of contention.
+const int64 kContentionResetUsec = 1000000;
+
+// Limits the exponent so that the shift below can't overflow.
+const int kMaxBackoffExponent = 30;
+
+void SleepUsec(int64 delay_usec) {
+  timespec ts;
+  ts.tv_sec = static_cast<time_t>(delay_usec / 1000000);
+  ts.tv_nsec = static_cast<long>((delay_usec % 1000000) * 1000);
+
+  while (nanosleep(&ts, &ts) != 0) {
+    PLOG_IF(FATAL, errno != EINTR) << "nanosleep";
+  }
+}
+
+}  // namespace
+
+ContentionManager::ContentionManager()
+    : total_conflict_count_(0),
+      retry_count_(0),
+      consecutive_retry_count_(0),
+      last_retry_time_usec_(0),
+      last_log_time_usec_(0) {
+}
+
+ContentionManager::~ContentionManager() {
+}
+
+void ContentionManager::RecordConflicts(const Uuid& object_id,
+                                        int conflict_count) {
+  CHECK_GE(conflict_count, 0);
+
+  if (conflict_count == 0) {
+    return;
+  }
+
+  const string object_id_string = UuidToString(object_id);
+
+  int64 object_conflict_count = 0;
+  {
+    MutexLock lock(&mu_);
+    object_conflict_count = (object_conflict_counts_[object_id_string] +=
+                             conflict_count);
+    total_conflict_count_ += conflict_count;
+  }
+
+  VLOG(1) << "Object " << object_id_string << " has had "
+          << object_conflict_count << " conflicts";
+
+  MaybeLogStatistics();
+}
+
+void ContentionManager::WaitBeforeRetry() {
+  const int64 delay_usec = GetRetryDelayUsec();
+
+  VLOG(1) << "Waiting " << delay_usec << " microseconds before retrying";
+
+  if (delay_usec > 0) {
+    SleepUsec(delay_usec);
+  }
+}
+
+int64 ContentionManager::GetConflictCount(const Uuid& object_id) const {
+  MutexLock lock(&mu_);
+
+  const map<string, int64>::const_iterator it = object_conflict_counts_.find(
+      UuidToString(object_id));
+  if (it == object_conflict_counts_.end()) {
+    return 0;
+  }
+
+  return it->second;
+}
+
+int64 ContentionManager::total_conflict_count() const {
+  MutexLock lock(&mu_);
+  return total_conflict_count_;
+}
+
+int64 ContentionManager::retry_count() const {
+  MutexLock lock(&mu_);
+  return retry_count_;
+}
+
+void ContentionManager::Dump(DumpContext* dc) const {
+  CHECK(dc != nullptr);
+
+  MutexLock lock(&mu_);
+
+  dc->BeginMap();
+
+  dc->AddString("total_conflict_count");
+  dc->AddInt64(total_conflict_count_);
+
+  dc->AddString("retry_count");
+  dc->AddInt64(retry_count_);
+
+  dc->AddString("object_conflict_counts");
+  dc->BeginMap();
+  for (const auto& count_pair : object_conflict_counts_) {
+    dc->AddString(count_pair.first);
+    dc->AddInt64(count_pair.second);
+  }
+  dc->End();
+
+  dc->End();
+}
+
+int64 ContentionManager::GetRetryDelayUsec() {
+  const int64 current_time_usec = GetCurrentTimeUsec();
+
+  int exponent = 0;
+  {
+    MutexLock lock(&mu_);
+
+    if (current_time_usec - last_retry_time_usec_ > kContentionResetUsec) {
+      consecutive_retry_count_ = 0;
+    }
+
+    exponent = consecutive_retry_count_;
+    if (consecutive_retry_count_ < kMaxBackoffExponent) {
+      ++consecutive_retry_count_;
+    }
+
+    ++retry_count_;
+    last_retry_time_usec_ = current_time_usec;
+  }
+
+  const int64 max_delay_usec = static_cast<int64>(FLAGS_retry_backoff_max_usec);
+  int64 delay_bound_usec = static_cast<int64>(FLAGS_retry_backoff_base_usec)
+      << exponent;
+  if (delay_bound_usec > max_delay_usec) {
+    delay_bound_usec = max_delay_usec;
+  }
+
+  if (delay_bound_usec <= 0) {
+    return 0;
+  }
+
+  // Choose a delay uniformly at random from [0, delay_bound_usec], so that
+  // peers that were rewound at the same time don't retry at the same time.
+  return static_cast<int64>(GetRandomInt()) % (delay_bound_usec + 1);
+}
+
+void ContentionManager::MaybeLogStatistics() {
+  if (FLAGS_contention_stats_log_interval_sec <= 0) {
+    return;
+  }
+
+  const int64 current_time_usec = GetCurrentTimeUsec();
+  const int64 interval_usec =
+      static_cast<int64>(FLAGS_contention_stats_log_interval_sec) * 1000000;
+
+  {
+    MutexLock lock(&mu_);
+
+    if (total_conflict_count_ == 0 ||
+        (last_log_time_usec_ != 0 &&
+         current_time_usec - last_log_time_usec_ < interval_usec)) {
+      return;
+    }
+
+    last_log_time_usec_ = current_time_usec;
+  }
+
+  LOG(INFO) << "Contention statistics: " << GetJsonString(*this);
+}
+
+}  // namespace engine
+}  // namespace floating_temple
@@ -0,0 +1,90 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ENGINE_CONTENTION_MANAGER_H_
+#define ENGINE_CONTENTION_MANAGER_H_
+
+#include <map>
+#include <string>
+
+#include "base/integral_types.h"
+#include "base/macros.h"
+#include "base/mutex.h"
+#include "engine/proto/uuid.pb.h"
+#include "engine/uuid_util.h"
+
+namespace floating_temple {
+
+class DumpContext;
+
+namespace engine {
+
+// Keeps statistics about conflicts between transactions, and throttles the
+// recording thread when its transactions are being rejected repeatedly.
+//
+// When two peers modify the same object concurrently, the transaction with the
+// later transaction ID is rejected and its recording thread is rewound. If the
+// rewound thread retries immediately, the peers can keep rejecting each
+// other's transactions. To avoid this, the recording thread waits for a
+// randomized delay before each retry. The upper bound of the delay doubles with
+// each consecutive retry, up to a configurable maximum, and is reset once the
+// thread has gone for a while without being rewound.
+//
+// This class is thread-safe.
+class ContentionManager {
+ public:
+  ContentionManager();
+  ~ContentionManager();
+
+  // Records that 'conflict_count' transactions were rejected because they
+  // conflicted with other transactions on the given object. The statistics are
+  // logged periodically while there are new conflicts, so that they're
+  // available even if the program never returns (e.g., in linger mode).
+  void RecordConflicts(const Uuid& object_id, int conflict_count);
+
+  // Blocks for a randomized delay before the recording thread retries a method
+  // call that was rewound.
+  void WaitBeforeRetry();
+
+  int64 GetConflictCount(const Uuid& object_id) const;
+  int64 total_conflict_count() const;
+  int64 retry_count() const;
+
+  void Dump(DumpContext* dc) const;
+
+ private:
+  // Returns the delay, in microseconds, that should precede the next retry.
+  // Updates the backoff state.
+  int64 GetRetryDelayUsec();
+  // Logs the statistics if there have been conflicts and they haven't been
+  // logged recently.
+  void MaybeLogStatistics();
+
+  // Keyed by the string representation of the object ID.
+  std::map<std::string, int64> object_conflict_counts_;
+  int64 total_conflict_count_;
+  int64 retry_count_;
+  int consecutive_retry_count_;
+  int64 last_retry_time_usec_;
+  int64 last_log_time_usec_;
+  mutable Mutex mu_;
+
+  DISALLOW_COPY_AND_ASSIGN(ContentionManager);
+};
+
+}  // namespace engine
+}  // namespace floating_temple
+
+#endif  // ENGINE_CONTENTION_MANAGER_H_
@@ -0,0 +1,85 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/contention_manager.h"
+
+#include <gflags/gflags.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/time_util.h"
+#include "engine/proto/uuid.pb.h"
+#include "engine/uuid_util.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using testing::InitGoogleTest;
+
+DECLARE_int32(retry_backoff_base_usec);
+DECLARE_int32(retry_backoff_max_usec);
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+TEST(ContentionManagerTest, RecordConflicts) {
+  const Uuid object_a = StringToUuid("11111111111111111111111111111111");
+  const Uuid object_b = StringToUuid("22222222222222222222222222222222");
+  const Uuid object_c = StringToUuid("33333333333333333333333333333333");
+
+  ContentionManager contention_manager;
+
+  contention_manager.RecordConflicts(object_a, 2);
+  contention_manager.RecordConflicts(object_b, 1);
+  contention_manager.RecordConflicts(object_a, 3);
+  contention_manager.RecordConflicts(object_c, 0);
+
+  EXPECT_EQ(5, contention_manager.GetConflictCount(object_a));
+  EXPECT_EQ(1, contention_manager.GetConflictCount(object_b));
+  EXPECT_EQ(0, contention_manager.GetConflictCount(object_c));
+  EXPECT_EQ(6, contention_manager.total_conflict_count());
+  EXPECT_EQ(0, contention_manager.retry_count());
+}
+
+TEST(ContentionManagerTest, WaitBeforeRetryIsBounded) {
+  FLAGS_retry_backoff_base_usec = 100;
+  FLAGS_retry_backoff_max_usec = 1000;
+
+  ContentionManager contention_manager;
+
+  const int kRetryCount = 20;
+  const int64 start_time_usec = GetCurrentTimeUsec();
+  for (int i = 0; i < kRetryCount; ++i) {
+    contention_manager.WaitBeforeRetry();
+  }
+  const int64 elapsed_usec = GetCurrentTimeUsec() - start_time_usec;
+
+  EXPECT_EQ(kRetryCount, contention_manager.retry_count());
+  // Each delay is at most FLAGS_retry_backoff_max_usec. Allow plenty of slack
+  // for scheduling overhead.
+  EXPECT_LT(elapsed_usec, 1000000);
+}
+
+}  // namespace
+}  // namespace engine
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,41 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/get_peer_message_lane.h"
+
+#include "engine/proto/peer.pb.h"
+
+namespace floating_temple {
+namespace engine {
+
+PeerMessageLane GetPeerMessageLane(PeerMessage::Type type) {
+  switch (type) {
+    // STORE_OBJECT messages can be very large, and they're self-contained
+    // snapshots of an object's history, so they can safely be delivered out of
+    // order with respect to the transaction messages.
+    case PeerMessage::STORE_OBJECT:
+      return BULK_LANE;
+
+    // APPLY_TRANSACTION, REJECT_TRANSACTION, and INVALIDATE_TRANSACTIONS
+    // messages must stay in the same lane, because REJECT_TRANSACTION and
+    // INVALIDATE_TRANSACTIONS messages advance the receiver's sequence point
+    // past the sender's earlier transactions.
+    default:
+      return PRIORITY_LANE;
+  }
+}
+
+}  // namespace engine
+}  // namespace floating_temple
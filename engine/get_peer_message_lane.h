@@ -0,0 +1,44 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ENGINE_GET_PEER_MESSAGE_LANE_H_
+#define ENGINE_GET_PEER_MESSAGE_LANE_H_
+
+#include "engine/proto/peer.pb.h"
+
+namespace floating_temple {
+namespace engine {
+
+// Each connection sends its messages in several lanes. Messages in the same
+// lane are delivered in the order they were sent, but a message in the
+// priority lane never waits behind a message in the bulk lane. Large messages
+// in the bulk lane are split into chunks so that priority messages can be
+// interleaved with them.
+enum PeerMessageLane {
+  PRIORITY_LANE = 0,
+  BULK_LANE = 1
+};
+
+const int kPeerMessageLaneCount = 2;
+
+// Returns the lane that messages of the given type are sent in. Both ends of a
+// connection must agree on this, because the receiver numbers the messages in
+// each lane separately.
+PeerMessageLane GetPeerMessageLane(PeerMessage::Type type);
+
+}  // namespace engine
+}  // namespace floating_temple
+
+#endif  // ENGINE_GET_PEER_MESSAGE_LANE_H_
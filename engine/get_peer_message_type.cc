@@ -37,6 +37,12 @@ PeerMessage::Type GetPeerMessageType(const PeerMessage& peer_message) {
   CHECK_FIELD(has_store_object_message, STORE_OBJECT);
   CHECK_FIELD(has_reject_transaction_message, REJECT_TRANSACTION);
   CHECK_FIELD(has_invalidate_transactions_message, INVALIDATE_TRANSACTIONS);
+  CHECK_FIELD(has_resume_request_message, RESUME_REQUEST);
+  CHECK_FIELD(has_resume_message, RESUME);
+  CHECK_FIELD(has_ack_message, ACK);
+  CHECK_FIELD(has_compressed_message, COMPRESSED);
+  CHECK_FIELD(has_chunk_message, CHUNK);
+  CHECK_FIELD(has_credit_message, CREDIT);
   CHECK_FIELD(has_test_message, TEST);
 
   CHECK_NE(type, PeerMessage::UNKNOWN);
@@ -15,16 +15,20 @@
 
 #include "engine/live_object.h"
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "base/logging.h"
-#include "base/mutex.h"
 #include "base/mutex_lock.h"
 #include "engine/live_object_node.h"
+#include "engine/serialized_local_object.h"
 #include "include/c++/local_object.h"
 
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
 using std::shared_ptr;
 using std::string;
 using std::vector;
@@ -37,23 +41,23 @@ LiveObject::LiveObject(LocalObject* local_object)
 }
 
 LiveObject::~LiveObject() {
-  LiveObjectNode* const node = GetNode();
-  if (node->DecrementRefCount()) {
-    delete node;
-  }
+  ReleaseNode(node_.load(memory_order_acquire));
 }
 
 const LocalObject* LiveObject::local_object() const {
-  return GetNode()->local_object();
+  return node_.load(memory_order_acquire)->local_object();
 }
 
 shared_ptr<LiveObject> LiveObject::Clone() const {
-  return shared_ptr<LiveObject>(new LiveObject(GetNode()));
+  return shared_ptr<LiveObject>(new LiveObject(AcquireNode()));
 }
 
-void LiveObject::Serialize(
-    string* data, vector<ObjectReferenceImpl*>* object_references) const {
-  GetNode()->Serialize(data, object_references);
+shared_ptr<const SerializedLocalObject> LiveObject::Serialize() const {
+  LiveObjectNode* const node = AcquireNode();
+  const shared_ptr<const SerializedLocalObject> serialized_form =
+      node->Serialize();
+  ReleaseNode(node);
+  return serialized_form;
 }
 
 void LiveObject::InvokeMethod(MethodContext* method_context,
@@ -61,38 +65,53 @@ void LiveObject::InvokeMethod(MethodContext* method_context,
                               const string& method_name,
                               const vector<Value>& parameters,
                               Value* return_value) {
-  LiveObjectNode* const new_node = GetNode()->InvokeMethod(
+  // Only this thread replaces the node, so there's no need to acquire a
+  // reference to it here. Doing so would also cause LiveObjectNode to make an
+  // unnecessary copy of the local object.
+  LiveObjectNode* const old_node = node_.load(memory_order_relaxed);
+  LiveObjectNode* const new_node = old_node->InvokeMethod(
       method_context, self_object_reference, method_name, parameters,
       return_value);
 
-  LiveObjectNode* old_node = nullptr;
+  if (new_node == old_node) {
+    return;
+  }
+
   {
     MutexLock lock(&node_mu_);
-    if (new_node != node_) {
-      old_node = node_;
-      node_ = new_node;
-    }
+    CHECK_EQ(node_.exchange(new_node, memory_order_release), old_node);
   }
 
-  if (old_node != nullptr) {
-    if (old_node->DecrementRefCount()) {
-      delete old_node;
-    }
-  }
+  // Any thread that loaded the old node has already incremented its reference
+  // count, so the old node is only freed if no other thread is using it.
+  ReleaseNode(old_node);
 }
 
 void LiveObject::Dump(DumpContext* dc) const {
-  GetNode()->Dump(dc);
+  LiveObjectNode* const node = AcquireNode();
+  node->Dump(dc);
+  ReleaseNode(node);
 }
 
 LiveObject::LiveObject(LiveObjectNode* node)
     : node_(CHECK_NOTNULL(node)) {
-  node->IncrementRefCount();
 }
 
-LiveObjectNode* LiveObject::GetNode() const {
+LiveObjectNode* LiveObject::AcquireNode() const {
   MutexLock lock(&node_mu_);
-  return node_;
+  LiveObjectNode* const node = node_.load(memory_order_relaxed);
+  node->IncrementRefCount();
+
+  return node;
+}
+
+// static
+void LiveObject::ReleaseNode(LiveObjectNode* node) {
+  CHECK(node != nullptr);
+
+  if (node->DecrementRefCount()) {
+    delete node;
+  }
 }
 
 }  // namespace engine
@@ -16,6 +16,7 @@
 #ifndef ENGINE_LIVE_OBJECT_H_
 #define ENGINE_LIVE_OBJECT_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -34,17 +35,24 @@ namespace engine {
 
 class LiveObjectNode;
 class ObjectReferenceImpl;
+struct SerializedLocalObject;
 
+// The const methods of this class may be called concurrently from any thread.
+// InvokeMethod must not be called concurrently with itself, since only one
+// thread should modify a given LiveObject at a time.
 class LiveObject {
  public:
   explicit LiveObject(LocalObject* local_object);
   ~LiveObject();
 
+  // The returned pointer is only valid until the next call to InvokeMethod.
   const LocalObject* local_object() const;
 
   std::shared_ptr<LiveObject> Clone() const;
-  void Serialize(std::string* data,
-                 std::vector<ObjectReferenceImpl*>* object_references) const;
+  // Returns the serialized form of the local object. The returned form is
+  // shared with other callers (see LiveObjectNode::Serialize), so it must not
+  // be modified.
+  std::shared_ptr<const SerializedLocalObject> Serialize() const;
   void InvokeMethod(MethodContext* method_context,
                     ObjectReferenceImpl* self_object_reference,
                     const std::string& method_name,
@@ -54,11 +62,24 @@ class LiveObject {
   void Dump(DumpContext* dc) const;
 
  private:
+  // Takes ownership of a reference to 'node' that was already acquired by the
+  // caller.
   explicit LiveObject(LiveObjectNode* node);
 
-  LiveObjectNode* GetNode() const;
-
-  LiveObjectNode* node_;  // Not NULL
+  // Returns the current node, with its reference count incremented on behalf
+  // of the caller. The caller must call ReleaseNode when it's done with the
+  // node.
+  LiveObjectNode* AcquireNode() const;
+  static void ReleaseNode(LiveObjectNode* node);
+
+  // Only changed while node_mu_ is locked, but may be loaded without locking
+  // it if the caller doesn't need a reference to the node.
+  std::atomic<LiveObjectNode*> node_;  // Not NULL
+  // Held while a reference to the current node is acquired, and while the
+  // node is replaced, so that InvokeMethod never releases the old node between
+  // another thread loading it and incrementing its reference count. The lock is
+  // only held for a few instructions, and InvokeMethod only takes it when the
+  // method call replaced the node.
   mutable Mutex node_mu_;
 
   DISALLOW_COPY_AND_ASSIGN(LiveObject);
@@ -15,12 +15,13 @@
 
 #include "engine/live_object_node.h"
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "base/escape.h"
 #include "base/logging.h"
-#include "base/mutex.h"
 #include "base/mutex_lock.h"
 #include "engine/object_reference_impl.h"
 #include "engine/serialize_local_object_to_string.h"
@@ -29,6 +30,7 @@
 #include "util/dump_context.h"
 #include "util/dump_context_impl.h"
 
+using std::shared_ptr;
 using std::string;
 using std::vector;
 
@@ -37,6 +39,8 @@ namespace engine {
 
 LiveObjectNode::LiveObjectNode(LocalObject* local_object)
     : local_object_(CHECK_NOTNULL(local_object)),
+      serialized_size_hint_(0),
+      modification_count_(0),
       ref_count_(1) {
 }
 
@@ -44,9 +48,36 @@ LiveObjectNode::~LiveObjectNode() {
   delete local_object_;
 }
 
-void LiveObjectNode::Serialize(
-    string* data, vector<ObjectReferenceImpl*>* object_references) const {
-  SerializeLocalObjectToString(local_object_, data, object_references);
+shared_ptr<const SerializedLocalObject> LiveObjectNode::Serialize() const {
+  uint64 modification_count = 0;
+  {
+    MutexLock lock(&serialized_form_mu_);
+    if (serialized_form_.get() != nullptr) {
+      return serialized_form_;
+    }
+    modification_count = modification_count_;
+  }
+
+  // Serialize the object without holding the lock. If two threads race to do
+  // this, they produce identical results, and either one may be cached.
+  const shared_ptr<SerializedLocalObject> new_serialized_form(
+      new SerializedLocalObject());
+  SerializeLocalObjectToString(
+      local_object_,
+      serialized_size_hint_.load(std::memory_order_relaxed),
+      &new_serialized_form->data,
+      &new_serialized_form->object_references);
+  serialized_size_hint_.store(new_serialized_form->data.size(),
+                              std::memory_order_relaxed);
+
+  // Don't cache the serialized form if the object was modified in the
+  // meantime; it may reflect the object's state before the modification.
+  MutexLock lock(&serialized_form_mu_);
+  if (modification_count_ == modification_count) {
+    serialized_form_ = new_serialized_form;
+  }
+
+  return new_serialized_form;
 }
 
 LiveObjectNode* LiveObjectNode::InvokeMethod(
@@ -68,13 +99,28 @@ LiveObjectNode* LiveObjectNode::InvokeMethod(
                                    method_name, parameters, return_value);
     VLOG(4) << "After: " << GetJsonString(*new_local_object);
 
-    return new LiveObjectNode(new_local_object);
+    LiveObjectNode* const new_node = new LiveObjectNode(new_local_object);
+    // The new version of the object is likely to serialize to about the same
+    // size as this one.
+    new_node->serialized_size_hint_.store(
+        serialized_size_hint_.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+
+    return new_node;
   } else {
     VLOG(4) << "Before: " << GetJsonString(*local_object_);
     local_object_->InvokeMethod(method_context, self_object_reference,
                                 method_name, parameters, return_value);
     VLOG(4) << "After: " << GetJsonString(*local_object_);
 
+    // The method may have modified the local object, so discard its cached
+    // serialized form.
+    {
+      MutexLock lock(&serialized_form_mu_);
+      serialized_form_.reset();
+      ++modification_count_;
+    }
+
     return this;
   }
 }
@@ -84,21 +130,22 @@ void LiveObjectNode::Dump(DumpContext* dc) const {
 }
 
 void LiveObjectNode::IncrementRefCount() {
-  MutexLock lock(&ref_count_mu_);
-  ++ref_count_;
-  CHECK_GE(ref_count_, 2);
+  // The caller already holds a reference (directly or through a LiveObject),
+  // so the increment doesn't need to be ordered with respect to anything.
+  const int old_ref_count = ref_count_.fetch_add(1, std::memory_order_relaxed);
+  CHECK_GE(old_ref_count, 1);
 }
 
 bool LiveObjectNode::DecrementRefCount() {
-  MutexLock lock(&ref_count_mu_);
-  CHECK_GE(ref_count_, 1);
-  --ref_count_;
-  return ref_count_ == 0;
+  // Use acquire-release ordering so that all accesses to the node by other
+  // threads happen before the node is deleted.
+  const int old_ref_count = ref_count_.fetch_sub(1, std::memory_order_acq_rel);
+  CHECK_GE(old_ref_count, 1);
+  return old_ref_count == 1;
 }
 
 int LiveObjectNode::GetRefCount() const {
-  MutexLock lock(&ref_count_mu_);
-  return ref_count_;
+  return ref_count_.load(std::memory_order_acquire);
 }
 
 }  // namespace engine
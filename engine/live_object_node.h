@@ -16,11 +16,16 @@
 #ifndef ENGINE_LIVE_OBJECT_NODE_H_
 #define ENGINE_LIVE_OBJECT_NODE_H_
 
+#include <atomic>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "base/integral_types.h"
 #include "base/macros.h"
 #include "base/mutex.h"
+#include "engine/serialized_local_object.h"
 #include "include/c++/value.h"
 
 namespace floating_temple {
@@ -40,8 +45,10 @@ class LiveObjectNode {
 
   const LocalObject* local_object() const { return local_object_; }
 
-  void Serialize(std::string* data,
-                 std::vector<ObjectReferenceImpl*>* object_references) const;
+  // Serializes the local object. The serialized form is cached until the
+  // local object is modified, so serializing an unchanged object again just
+  // returns another reference to the cached form.
+  std::shared_ptr<const SerializedLocalObject> Serialize() const;
   LiveObjectNode* InvokeMethod(MethodContext* method_context,
                                ObjectReferenceImpl* self_object_reference,
                                const std::string& method_name,
@@ -57,8 +64,20 @@ class LiveObjectNode {
 
   LocalObject* const local_object_;  // Not NULL
 
-  int ref_count_;
-  mutable Mutex ref_count_mu_;
+  // The size of the most recent serialized form of the local object. Used to
+  // size the output buffer the next time the object is serialized.
+  mutable std::atomic<std::size_t> serialized_size_hint_;
+
+  // The cached serialized form of the local object, or NULL if the object
+  // hasn't been serialized since it was created or last modified.
+  mutable std::shared_ptr<const SerializedLocalObject> serialized_form_;
+  // Incremented each time the local object is modified in place. A serialized
+  // form is only cached if no modification happened while it was being
+  // produced.
+  uint64 modification_count_;
+  mutable Mutex serialized_form_mu_;
+
+  std::atomic<int> ref_count_;
 
   DISALLOW_COPY_AND_ASSIGN(LiveObjectNode);
 };
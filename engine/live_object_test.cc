@@ -0,0 +1,165 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/live_object.h"
+
+#include <pthread.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "engine/serialized_local_object.h"
+#include "fake_interpreter/fake_local_object.h"
+#include "include/c++/value.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+const int kAppendCount = 2000;
+const int kCloneCount = 2000;
+
+void AppendString(LiveObject* live_object, const string& s) {
+  vector<Value> parameters(1);
+  parameters[0].set_string_value(FakeLocalObject::kStringLocalType, s);
+
+  Value return_value;
+  live_object->InvokeMethod(nullptr, nullptr, "append", parameters,
+                            &return_value);
+}
+
+string GetString(const LiveObject& live_object) {
+  return static_cast<const FakeLocalObject*>(live_object.local_object())->s();
+}
+
+struct CloneThreadInfo {
+  const LiveObject* live_object;
+  vector<shared_ptr<LiveObject>> clones;
+};
+
+void* CloneRepeatedly(void* info_raw) {
+  CloneThreadInfo* const info = static_cast<CloneThreadInfo*>(info_raw);
+
+  for (int i = 0; i < kCloneCount; ++i) {
+    info->clones.push_back(info->live_object->Clone());
+  }
+
+  return nullptr;
+}
+
+TEST(LiveObjectTest, CloneIsCopyOnWrite) {
+  LiveObject live_object(new FakeLocalObject("a"));
+  const shared_ptr<LiveObject> clone = live_object.Clone();
+
+  AppendString(&live_object, "b");
+  AppendString(clone.get(), "c");
+
+  EXPECT_EQ("ab", GetString(live_object));
+  EXPECT_EQ("ac", GetString(*clone));
+}
+
+TEST(LiveObjectTest, ModifyInPlaceWhenNotShared) {
+  LiveObject live_object(new FakeLocalObject("a"));
+  const LocalObject* const local_object = live_object.local_object();
+
+  AppendString(&live_object, "b");
+
+  EXPECT_EQ(local_object, live_object.local_object());
+  EXPECT_EQ("ab", GetString(live_object));
+}
+
+TEST(LiveObjectTest, SerializeAfterModification) {
+  LiveObject live_object(new FakeLocalObject("a"));
+
+  const shared_ptr<const SerializedLocalObject> serialized_form =
+      live_object.Serialize();
+  EXPECT_EQ(string(FakeLocalObject::kSerializationPrefix) + "a",
+            serialized_form->data);
+
+  // Serializing the unchanged object again returns the cached form.
+  EXPECT_EQ(serialized_form, live_object.Serialize());
+
+  const shared_ptr<LiveObject> clone = live_object.Clone();
+
+  // Modify the object in place, and then modify the clone.
+  AppendString(&live_object, "b");
+  AppendString(&live_object, "c");
+  AppendString(clone.get(), "d");
+
+  EXPECT_EQ(string(FakeLocalObject::kSerializationPrefix) + "abc",
+            live_object.Serialize()->data);
+  EXPECT_EQ(string(FakeLocalObject::kSerializationPrefix) + "ad",
+            clone->Serialize()->data);
+
+  // The form that was returned earlier isn't affected by the modifications.
+  EXPECT_EQ(string(FakeLocalObject::kSerializationPrefix) + "a",
+            serialized_form->data);
+
+  AppendString(&live_object, "e");
+  EXPECT_EQ(string(FakeLocalObject::kSerializationPrefix) + "abce",
+            live_object.Serialize()->data);
+}
+
+TEST(LiveObjectTest, CloneWhileModifying) {
+  LiveObject live_object(new FakeLocalObject(""));
+
+  CloneThreadInfo info;
+  info.live_object = &live_object;
+
+  pthread_t thread;
+  CHECK_PTHREAD_ERR(pthread_create(&thread, nullptr, &CloneRepeatedly, &info));
+
+  for (int i = 0; i < kAppendCount; ++i) {
+    AppendString(&live_object, "x");
+  }
+
+  void* thread_return_value = nullptr;
+  CHECK_PTHREAD_ERR(pthread_join(thread, &thread_return_value));
+
+  EXPECT_EQ(string(kAppendCount, 'x'), GetString(live_object));
+
+  // Each clone should hold some prefix of the final string, and the clones
+  // should have been taken in order.
+  string::size_type prev_length = 0;
+  for (const shared_ptr<LiveObject>& clone : info.clones) {
+    const string s = GetString(*clone);
+    EXPECT_EQ(string(s.length(), 'x'), s);
+    EXPECT_LE(prev_length, s.length());
+    prev_length = s.length();
+  }
+}
+
+}  // namespace
+}  // namespace engine
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -15,8 +15,6 @@
 
 #include "engine/mock_local_object.h"
 
-#include <cstddef>
-#include <cstring>
 #include <string>
 #include <vector>
 
@@ -24,8 +22,6 @@
 #include "include/c++/value.h"
 #include "util/dump_context.h"
 
-using std::memcpy;
-using std::size_t;
 using std::string;
 using std::vector;
 
@@ -40,19 +36,12 @@ LocalObject* MockLocalObject::Clone() const {
   return new MockLocalObject(core_);
 }
 
-size_t MockLocalObject::Serialize(void* buffer, size_t buffer_size,
-                                  SerializationContext* context) const {
-  CHECK(buffer != nullptr);
+void MockLocalObject::Serialize(string* data,
+                                SerializationContext* context) const {
+  CHECK(data != nullptr);
   CHECK(context != nullptr);
 
-  const string data = core_->Serialize(context);
-  const size_t data_size = static_cast<size_t>(data.length());
-
-  if (data_size <= buffer_size) {
-    memcpy(buffer, data.data(), data_size);
-  }
-
-  return data_size;
+  data->assign(core_->Serialize(context));
 }
 
 void MockLocalObject::InvokeMethod(MethodContext* method_context,
@@ -53,8 +53,8 @@ class MockLocalObject : public LocalObject {
   explicit MockLocalObject(const MockLocalObjectCore* core);
 
   LocalObject* Clone() const override;
-  std::size_t Serialize(void* buffer, std::size_t buffer_size,
-                        SerializationContext* context) const override;
+  void Serialize(std::string* data,
+                 SerializationContext* context) const override;
   void InvokeMethod(MethodContext* method_context,
                     ObjectReference* self_object_reference,
                     const std::string& method_name,
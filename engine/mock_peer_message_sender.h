@@ -16,6 +16,8 @@
 #ifndef ENGINE_MOCK_PEER_MESSAGE_SENDER_H_
 #define ENGINE_MOCK_PEER_MESSAGE_SENDER_H_
 
+#include <vector>
+
 #include "base/macros.h"
 #include "engine/peer_message_sender.h"
 #include "third_party/gmock-1.7.0/include/gmock/gmock.h"
@@ -30,6 +32,9 @@ class MockPeerMessageSender : public PeerMessageSender {
   MOCK_METHOD3(SendMessageToRemotePeer,
                void(const CanonicalPeer* canonical_peer,
                     const PeerMessage& peer_message, SendMode send_mode));
+  MOCK_METHOD3(SendMessageToRemotePeers,
+               void(const std::vector<const CanonicalPeer*>& canonical_peers,
+                    const PeerMessage& peer_message, SendMode send_mode));
   MOCK_METHOD2(BroadcastMessage,
                void(const PeerMessage& peer_message, SendMode send_mode));
 
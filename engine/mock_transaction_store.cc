@@ -122,5 +122,9 @@ void MockTransactionStore::WaitForRewind() {
   core_->WaitForRewind();
 }
 
+void MockTransactionStore::WaitBeforeRetry() {
+  core_->WaitBeforeRetry();
+}
+
 }  // namespace engine
 }  // namespace floating_temple
@@ -66,6 +66,7 @@ class MockTransactionStoreCore {
                TransactionStoreInternalInterface::ExecutionPhase(
                    const TransactionId& base_transaction_id));
   MOCK_METHOD0(WaitForRewind, void ());
+  MOCK_METHOD0(WaitBeforeRetry, void ());
 
  private:
   DISALLOW_COPY_AND_ASSIGN(MockTransactionStoreCore);
@@ -97,6 +98,7 @@ class MockTransactionStore : public TransactionStoreInternalInterface {
   ExecutionPhase GetExecutionPhase(
       const TransactionId& base_transaction_id) override;
   void WaitForRewind() override;
+  void WaitBeforeRetry() override;
 
  private:
   MockTransactionStoreCore* const core_;
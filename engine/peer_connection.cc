@@ -15,24 +15,68 @@
 
 #include "engine/peer_connection.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <google/protobuf/arena.h>
 
 #include "base/cond_var.h"
 #include "base/logging.h"
 #include "base/mutex.h"
 #include "base/mutex_lock.h"
 #include "base/string_printf.h"
+#include "base/time_util.h"
 #include "engine/canonical_peer.h"
 #include "engine/canonical_peer_map.h"
+#include "engine/compact_event_encoding.h"
 #include "engine/connection_manager_interface_for_peer_connection.h"
+#include "engine/get_peer_message_lane.h"
 #include "engine/get_peer_message_type.h"
-#include "engine/peer_message_sender.h"
+#include "engine/peer_message_interner.h"
 #include "engine/proto/peer.pb.h"
+#include "protocol_server/format_protocol_message.h"
+#include "protocol_server/parse_protocol_message.h"
 #include "protocol_server/protocol_connection.h"
-#include "util/quota_queue.h"
-
+#include "util/byte_budget.h"
+#include "util/deflate_stream.h"
+#include "util/inflate_stream.h"
+#include "util/producer_consumer_queue.h"
+
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
+using std::min;
+using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
+
+DEFINE_bool(compress_peer_messages, true,
+            "If true, compress large messages sent to remote peers that "
+            "support compression.");
+DEFINE_int32(compression_threshold_bytes, 256,
+             "Messages to remote peers are only compressed if they're at least "
+             "this many bytes long.");
+DEFINE_int32(bulk_chunk_size_bytes, 16384,
+             "Messages in the bulk lane that are larger than this are split "
+             "into chunks of this size, so that messages in the priority lane "
+             "can be sent between the chunks.");
+DEFINE_int64(peer_connection_output_budget_bytes, 64 * 1024 * 1024,
+             "Maximum number of bytes of messages that can be queued on a "
+             "single peer connection before senders are made to wait. -1 "
+             "means no limit.");
+DEFINE_int32(peer_connection_receive_window, 256,
+             "Maximum number of messages that a remote peer may send on a "
+             "connection before it has to wait for this peer to handle them. "
+             "-1 means no limit.");
+DEFINE_int32(peer_connection_intern_table_size, 0,
+             "Maximum number of recurring method names and peer IDs (and, "
+             "separately, object IDs) that are replaced with short codes in "
+             "the messages sent in each lane of a connection. 0 disables "
+             "interning. The codes are specific to each connection, so each "
+             "interned message is re-encoded for every connection it's sent "
+             "on; this only pays off when bandwidth is scarcer than CPU time.");
 
 namespace floating_temple {
 namespace engine {
@@ -40,7 +84,7 @@ namespace {
 
 void CreateHelloMessage(
     ConnectionManagerInterfaceForPeerConnection* connection_manager,
-    PeerMessage* peer_message) {
+    int receive_window, int intern_table_size, PeerMessage* peer_message) {
   CHECK(connection_manager != nullptr);
   CHECK(peer_message != nullptr);
 
@@ -49,6 +93,17 @@ void CreateHelloMessage(
   HelloMessage* const hello_message = peer_message->mutable_hello_message();
   hello_message->set_peer_id(connection_manager->local_peer()->peer_id());
   hello_message->set_interpreter_type(connection_manager->interpreter_type());
+  hello_message->set_compression_supported(FLAGS_compress_peer_messages);
+  if (receive_window != -1) {
+    hello_message->set_receive_window(receive_window);
+  }
+  if (intern_table_size > 0) {
+    hello_message->set_intern_table_size(intern_table_size);
+  }
+  if (FLAGS_encode_peer_message_events) {
+    hello_message->set_compact_event_encoding_version(
+        kCompactEventEncodingVersion);
+  }
 }
 
 void CreateGoodbyeMessage(PeerMessage* peer_message) {
@@ -58,6 +113,58 @@ void CreateGoodbyeMessage(PeerMessage* peer_message) {
   peer_message->mutable_goodbye_message();
 }
 
+void CreateCreditMessage(int message_count, PeerMessage* peer_message) {
+  CHECK_GT(message_count, 0);
+  CHECK(peer_message != nullptr);
+
+  peer_message->Clear();
+  peer_message->mutable_credit_message()->set_message_count(message_count);
+}
+
+// Returns true if the sender of a message of the given type needs credit to
+// send it. Only messages that are queued count; the others are generated by
+// PeerConnection itself.
+bool MessageConsumesCredit(PeerMessage::Type type) {
+  return type != PeerMessage::HELLO && type != PeerMessage::GOODBYE &&
+      type != PeerMessage::CREDIT;
+}
+
+// Returns the number of handled messages after which the remote peer is
+// granted more credit. Granting credit in batches keeps the number of CREDIT
+// messages small, while granting it before the window is used up keeps the
+// remote peer from stalling.
+int GetCreditGrantThreshold(int receive_window) {
+  CHECK_GT(receive_window, 0);
+  return receive_window > 1 ? receive_window / 2 : 1;
+}
+
+// Returns the length of the length prefix of a formatted message. The
+// serialized message follows it.
+string::size_type GetSerializedMessageOffset(const string& formatted_message) {
+  int message_length = 0;
+  const int varint_length = ParseMessageLength(
+      formatted_message.data(), static_cast<int>(formatted_message.length()),
+      &message_length);
+  CHECK_GE(varint_length, 0);
+  CHECK_EQ(static_cast<string::size_type>(varint_length + message_length),
+           formatted_message.length());
+
+  return static_cast<string::size_type>(varint_length);
+}
+
+// Sets the block size of an arena that a large received message will be
+// parsed into. The parsed message takes up more memory than the serialized
+// message, but usually not more than twice as much, so it's usually parsed
+// into a single block.
+void GetArenaOptionsForMessage(const string& serialized_message,
+                               ArenaOptions* arena_options) {
+  CHECK(arena_options != nullptr);
+
+  const string::size_type block_size = 2 * serialized_message.length() + 4096;
+  arena_options->start_block_size = static_cast<size_t>(block_size);
+  arena_options->max_block_size = static_cast<size_t>(block_size);
+}
+
 }  // namespace
 
 PeerConnection::PeerConnection(
@@ -65,41 +172,46 @@ PeerConnection::PeerConnection(
     CanonicalPeerMap* canonical_peer_map,
     const CanonicalPeer* remote_peer,
     const string& remote_address,
-    bool locally_initiated)
+    bool locally_initiated,
+    ByteBudget* total_output_budget)
     : connection_manager_(CHECK_NOTNULL(connection_manager)),
       canonical_peer_map_(CHECK_NOTNULL(canonical_peer_map)),
       remote_address_(remote_address),
       locally_initiated_(locally_initiated),
+      receive_window_(FLAGS_peer_connection_receive_window),
+      intern_table_size_(FLAGS_peer_connection_intern_table_size),
       remote_peer_(remote_peer),
       connection_state_(CONNECTION_OPEN),
       receive_state_(NO_MESSAGE_RECEIVED),
       send_state_(NO_MESSAGE_SENT),
       drain_state_(NO_DRAIN_REQUESTED),
-      output_messages_(-1),
+      protocol_error_(false),
+      incoming_messages_sequenced_(false),
+      next_incoming_sequence_numbers_(kPeerMessageLaneCount, 0),
+      compress_output_(false),
+      send_credit_(0),
+      pending_credit_(0),
+      bulk_message_offset_(0),
+      event_encoding_version_(0),
+      output_budget_(total_output_budget,
+                     FLAGS_peer_connection_output_budget_bytes),
       ref_count_(1) {
   CHECK(!remote_address.empty());
+  CHECK(receive_window_ == -1 || receive_window_ > 0);
+  CHECK_GE(intern_table_size_, 0);
 
-  // Add the service IDs in descending order so that the vector inside
-  // QuotaQueue won't have to reallocate memory. (This is probably an
-  // unnecessary optimization, but it's easy to do.)
-
-  // The BLOCKING_MODE sub-queue is limited to a single message, so that calls
-  // to PeerConnection::SendMessage(..., BLOCKING_MODE) will block if there's
-  // already a message in that sub-queue.
-  output_messages_.AddService(PeerMessageSender::BLOCKING_MODE, 1);
+  output_messages_.reserve(kPeerMessageLaneCount);
 
-  // The NON_BLOCKING_MODE sub-queue is unlimited, so that calls to
-  // PeerConnection::SendMessage(..., NON_BLOCKING_MODE) will never block.
-  output_messages_.AddService(PeerMessageSender::NON_BLOCKING_MODE, -1);
+  // The queues themselves are unlimited. The output budget limits the number
+  // of bytes queued, and the remote peer's credit limits the number of
+  // messages in flight.
+  for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+    output_messages_.emplace_back(
+        new ProducerConsumerQueue<shared_ptr<const string>>(-1));
+  }
 }
 
 PeerConnection::~PeerConnection() {
-  PeerMessage* peer_message = nullptr;
-  int service_id = 0;
-
-  while (output_messages_.Pop(&peer_message, &service_id, false)) {
-    delete peer_message;
-  }
 }
 
 void PeerConnection::Init(ProtocolConnection* connection) {
@@ -114,14 +226,19 @@ void PeerConnection::Init(ProtocolConnection* connection) {
   connection->NotifyMessageReadyToSend();
 }
 
-bool PeerConnection::SendMessage(const PeerMessage& peer_message,
-                                 PeerMessageSender::SendMode send_mode) {
-  PeerMessage* peer_message_copy = new PeerMessage();
-  peer_message_copy->CopyFrom(peer_message);
+bool PeerConnection::SendFormattedMessage(
+    const shared_ptr<const string>& formatted_message, PeerMessageLane lane) {
+  CHECK(formatted_message.get() != nullptr);
+  CHECK_GE(lane, 0);
+  CHECK_LT(lane, kPeerMessageLaneCount);
 
-  if (!output_messages_.Push(peer_message_copy, static_cast<int>(send_mode),
-                             false)) {
-    delete peer_message_copy;
+  // Charge the budget before queuing the message, so that the charge can't be
+  // released before it's made.
+  const int64 byte_count = static_cast<int64>(formatted_message->length());
+  output_budget_.Charge(byte_count);
+
+  if (!output_messages_[lane]->Push(formatted_message, false)) {
+    output_budget_.Release(byte_count);
     return false;
   }
 
@@ -130,13 +247,23 @@ bool PeerConnection::SendMessage(const PeerMessage& peer_message,
   return true;
 }
 
+bool PeerConnection::WaitForOutputBudget(int timeout_ms) const {
+  return output_budget_.WaitUntilAvailable(timeout_ms);
+}
+
+bool PeerConnection::IsLagging(int64 timeout_usec) const {
+  const int64 exhausted_since_usec = output_budget_.exhausted_since_usec();
+  return exhausted_since_usec != -1 &&
+      GetCurrentTimeUsec() - exhausted_since_usec >= timeout_usec;
+}
+
 void PeerConnection::Drain() {
   {
     MutexLock lock(&state_mu_);
     drain_state_ = DRAIN_REQUESTED;
   }
 
-  output_messages_.Drain();
+  DrainOutputMessages();
 
   ProtocolConnection* const protocol_connection =
       PrivateGetProtocolConnection();
@@ -147,8 +274,36 @@ void PeerConnection::Drain() {
 }
 
 void PeerConnection::Close() {
+  {
+    MutexLock lock(&state_mu_);
+    connection_state_ = CONNECTION_CLOSED;
+  }
+
+  // Messages that are still queued will never be sent on this connection.
+  // Don't let them count against the total output budget while this object
+  // waits to be destroyed.
+  DrainOutputMessages();
+  output_budget_.ReleaseAll();
+}
+
+void PeerConnection::Abort() {
+  LOG(WARNING) << "Aborting the connection to peer "
+               << GetRemotePeerIdForLogging() << " (peer connection " << this
+               << ")";
+
+  DrainOutputMessages();
+
+  // The protocol server closes the socket the next time it checks the
+  // connection.
+  ProtocolConnection* const protocol_connection =
+      PrivateGetProtocolConnection();
+  protocol_connection->Close();
+  protocol_connection->NotifyMessageReadyToSend();
+}
+
+bool PeerConnection::IsDraining() const {
   MutexLock lock(&state_mu_);
-  connection_state_ = CONNECTION_CLOSED;
+  return drain_state_ == DRAIN_REQUESTED;
 }
 
 void PeerConnection::IncrementRefCount() {
@@ -164,42 +319,37 @@ bool PeerConnection::DecrementRefCount() {
   return ref_count_ == 0;
 }
 
-bool PeerConnection::GetNextOutputMessage(PeerMessage* message) {
-  CHECK(message != nullptr);
+bool PeerConnection::GetNextOutputMessage(
+    shared_ptr<const string>* formatted_message) {
+  CHECK(formatted_message != nullptr);
 
-  if (!GetNextOutputMessageHelper(message)) {
+  if (!GetNextOutputMessageHelper(formatted_message)) {
     return false;
   }
 
-  VLOG(1) << "Sending a "
-          << PeerMessage::Type_Name(GetPeerMessageType(*message)) << " message "
+  VLOG(1) << "Sending a " << (*formatted_message)->length() << "-byte message "
           << "to peer " << GetRemotePeerIdForLogging() << " (peer connection "
           << this << ")";
 
   return true;
 }
 
-void PeerConnection::NotifyMessageReceived(const PeerMessage& message) {
-  // TODO(dss): Fail gracefully if the remote peer violates the protocol.
-  message.CheckInitialized();
-
-  const PeerMessage::Type type = GetPeerMessageType(message);
-  VLOG(1) << "Received a " << PeerMessage::Type_Name(type) << " message from "
-          << "peer " << GetRemotePeerIdForLogging() << " (peer connection "
-          << this << ")";
-  VLOG(4) << "Incoming message:\n" << message.DebugString();
+void PeerConnection::NotifyMessageReceived(PeerMessage* message) {
+  CHECK(message != nullptr);
 
-  switch (type) {
-    case PeerMessage::HELLO:
-      HandleHelloMessage(message.hello_message());
-      break;
+  {
+    MutexLock lock(&state_mu_);
+    if (protocol_error_) {
+      return;
+    }
+  }
 
-    case PeerMessage::GOODBYE:
-      HandleGoodbyeMessage(message.goodbye_message());
-      break;
+  const PeerMessage::Type type = GetPeerMessageType(*message);
+  HandleMessage(message);
 
-    default:
-      HandleRegularMessage(message);
+  // The message has been handled, so the remote peer may send another one.
+  if (MessageConsumesCredit(type)) {
+    ReplenishCredit();
   }
 }
 
@@ -218,15 +368,20 @@ const CanonicalPeer* PeerConnection::PrivateGetRemotePeer() const {
   return remote_peer_;
 }
 
-bool PeerConnection::GetNextOutputMessageHelper(PeerMessage* message) {
-  CHECK(message != nullptr);
+bool PeerConnection::GetNextOutputMessageHelper(
+    shared_ptr<const string>* formatted_message) {
+  CHECK(formatted_message != nullptr);
+
+  PeerMessage message;
 
   {
     MutexLock lock(&state_mu_);
 
     switch (send_state_) {
       case NO_MESSAGE_SENT:
-        CreateHelloMessage(connection_manager_, message);
+        CreateHelloMessage(connection_manager_, receive_window_,
+                           intern_table_size_, &message);
+        *formatted_message = FormatSharedProtocolMessage(message);
         send_state_ = HELLO_SENT;
         return true;
 
@@ -236,17 +391,36 @@ bool PeerConnection::GetNextOutputMessageHelper(PeerMessage* message) {
       default:
         return false;
     }
-  }
 
-  PeerMessage* regular_message = nullptr;
-  int service_id = 0;
+    // CREDIT messages don't need credit themselves, so they're never held up
+    // by messages waiting in the queues.
+    if (receive_window_ != -1 &&
+        pending_credit_ >= GetCreditGrantThreshold(receive_window_)) {
+      CreateCreditMessage(pending_credit_, &message);
+      *formatted_message = FormatSharedProtocolMessage(message);
+      pending_credit_ = 0;
+      return true;
+    }
+
+    // Queued messages wait until the remote peer has granted credit for them.
+    // This also holds up the GOODBYE message, so that it isn't sent before the
+    // queued messages.
+    if (send_credit_ == 0) {
+      return false;
+    }
+  }
 
-  if (output_messages_.Pop(&regular_message, &service_id, false)) {
-    CHECK(regular_message != nullptr);
+  if (GetNextQueuedMessage(formatted_message)) {
+    CHECK(formatted_message->get() != nullptr);
 
-    message->Swap(regular_message);
-    delete regular_message;
+    {
+      MutexLock lock(&state_mu_);
+      if (send_credit_ > 0) {
+        --send_credit_;
+      }
+    }
 
+    MaybeCompressMessage(formatted_message);
     return true;
   }
 
@@ -258,7 +432,8 @@ bool PeerConnection::GetNextOutputMessageHelper(PeerMessage* message) {
       return false;
     }
 
-    CreateGoodbyeMessage(message);
+    CreateGoodbyeMessage(&message);
+    *formatted_message = FormatSharedProtocolMessage(message);
     send_state_ = GOODBYE_SENT;
 
     if (receive_state_ == GOODBYE_RECEIVED) {
@@ -273,6 +448,248 @@ bool PeerConnection::GetNextOutputMessageHelper(PeerMessage* message) {
   return true;
 }
 
+bool PeerConnection::GetNextQueuedMessage(
+    shared_ptr<const string>* formatted_message) {
+  CHECK(formatted_message != nullptr);
+
+  // Messages in the priority lane never wait for messages in the bulk lane.
+  if (output_messages_[PRIORITY_LANE]->Pop(formatted_message, false)) {
+    output_budget_.Release(static_cast<int64>((*formatted_message)->length()));
+
+    MutexLock lock(&output_mu_);
+    MaybeRewriteMessage_Locked(PRIORITY_LANE, formatted_message);
+    return true;
+  }
+
+  MutexLock lock(&output_mu_);
+
+  if (bulk_message_.get() == nullptr) {
+    if (!output_messages_[BULK_LANE]->Pop(&bulk_message_, false)) {
+      return false;
+    }
+
+    // The output budget covers the message that's being sent in chunks, so
+    // it's adjusted if rewriting the message changes its length.
+    const int64 queued_length = static_cast<int64>(bulk_message_->length());
+    if (MaybeRewriteMessage_Locked(BULK_LANE, &bulk_message_)) {
+      output_budget_.Release(queued_length);
+      output_budget_.Charge(static_cast<int64>(bulk_message_->length()));
+    }
+
+    bulk_message_offset_ = GetSerializedMessageOffset(*bulk_message_);
+
+    // Small messages are sent as is.
+    if (bulk_message_->length() - bulk_message_offset_ <=
+        static_cast<string::size_type>(FLAGS_bulk_chunk_size_bytes)) {
+      output_budget_.Release(static_cast<int64>(bulk_message_->length()));
+      formatted_message->swap(bulk_message_);
+      bulk_message_.reset();
+      return true;
+    }
+  }
+
+  const string::size_type chunk_size = min(
+      bulk_message_->length() - bulk_message_offset_,
+      static_cast<string::size_type>(FLAGS_bulk_chunk_size_bytes));
+
+  PeerMessage peer_message;
+  ChunkMessage* const chunk_message = peer_message.mutable_chunk_message();
+  chunk_message->set_data(bulk_message_->data() + bulk_message_offset_,
+                          chunk_size);
+
+  bulk_message_offset_ += chunk_size;
+
+  if (bulk_message_offset_ == bulk_message_->length()) {
+    chunk_message->set_last_chunk(true);
+    output_budget_.Release(static_cast<int64>(bulk_message_->length()));
+    bulk_message_.reset();
+  } else {
+    chunk_message->set_last_chunk(false);
+  }
+
+  *formatted_message = FormatSharedProtocolMessage(peer_message);
+
+  return true;
+}
+
+bool PeerConnection::MaybeRewriteMessage_Locked(
+    PeerMessageLane lane, shared_ptr<const string>* formatted_message) {
+  CHECK(formatted_message != nullptr);
+
+  // Transaction messages are queued with their events encoded in the newest
+  // version (if encoding is enabled). They only need to be rewritten if the
+  // remote peer can't read that version, or if they're interned.
+  const bool reencode_events = FLAGS_encode_peer_message_events &&
+      event_encoding_version_ < kCompactEventEncodingVersion;
+
+  if (output_interners_.empty() && !reencode_events) {
+    return false;
+  }
+
+  const string& input = **formatted_message;
+  const string::size_type message_offset = GetSerializedMessageOffset(input);
+
+  PeerMessage message;
+  CHECK(message.ParseFromArray(input.data() + message_offset,
+                               static_cast<int>(input.length() -
+                                                message_offset)));
+
+  if (!PeerMessageInterner::MessageTypeIsInterned(GetPeerMessageType(
+          message))) {
+    return false;
+  }
+
+  // The events are decoded so that the method names and object IDs in them
+  // can be interned along with the rest of the message, and then encoded again
+  // in the version that the remote peer can read. This peer encoded them, so
+  // they can always be decoded.
+  const bool events_decoded = MessageHasEncodedEvents(message);
+  if (events_decoded) {
+    CHECK(DecodeEventsInMessage(&message));
+  }
+
+  bool changed = events_decoded &&
+      event_encoding_version_ != kCompactEventEncodingVersion;
+  if (!output_interners_.empty() &&
+      output_interners_[lane]->InternMessage(&message)) {
+    changed = true;
+  }
+
+  if (!changed) {
+    return false;
+  }
+
+  if (events_decoded && event_encoding_version_ != 0) {
+    EncodeEventsInMessage(event_encoding_version_, &message);
+  }
+
+  // The parts of the message that were replaced by codes are missing.
+  *formatted_message = FormatSharedPartialProtocolMessage(message);
+  return true;
+}
+
+void PeerConnection::MaybeCompressMessage(
+    shared_ptr<const string>* formatted_message) {
+  CHECK(formatted_message != nullptr);
+
+  const string& input = **formatted_message;
+
+  if (input.length() <
+      static_cast<string::size_type>(FLAGS_compression_threshold_bytes)) {
+    return;
+  }
+
+  {
+    MutexLock lock(&state_mu_);
+    if (!compress_output_) {
+      return;
+    }
+  }
+
+  // Only the message itself is compressed. The COMPRESSED message gets its own
+  // length prefix.
+  const string::size_type message_offset = GetSerializedMessageOffset(input);
+  const string::size_type message_length = input.length() - message_offset;
+
+  PeerMessage compressed_message;
+  string* const data =
+      compressed_message.mutable_compressed_message()->mutable_data();
+
+  {
+    MutexLock lock(&output_mu_);
+
+    if (deflate_stream_.get() == nullptr) {
+      deflate_stream_.reset(new DeflateStream());
+    }
+
+    deflate_stream_->Compress(input.data() + message_offset, message_length,
+                              data);
+  }
+
+  VLOG(2) << "Compressed a " << message_length << "-byte message to "
+          << data->length() << " bytes (peer connection " << this << ")";
+
+  *formatted_message = FormatSharedProtocolMessage(compressed_message);
+}
+
+void PeerConnection::HandleMessage(PeerMessage* message) {
+  CHECK(message != nullptr);
+
+  const PeerMessage::Type type = GetPeerMessageType(*message);
+
+  // The messages that can be interned may be missing the fields that were
+  // replaced by codes, so they're checked after they're expanded. (See
+  // HandleRegularMessage.)
+  if (!PeerMessageInterner::MessageTypeIsInterned(type) &&
+      !message->IsInitialized()) {
+    AbortAfterProtocolError(StringPrintf(
+        "The %s message is missing required fields: %s",
+        PeerMessage::Type_Name(type).c_str(),
+        message->InitializationErrorString().c_str()));
+    return;
+  }
+
+  VLOG(1) << "Received a " << PeerMessage::Type_Name(type) << " message from "
+          << "peer " << GetRemotePeerIdForLogging() << " (peer connection "
+          << this << ")";
+  VLOG(4) << "Incoming message:\n" << message->DebugString();
+
+  switch (type) {
+    case PeerMessage::HELLO:
+      HandleHelloMessage(message->hello_message());
+      break;
+
+    case PeerMessage::GOODBYE:
+      HandleGoodbyeMessage(message->goodbye_message());
+      break;
+
+    case PeerMessage::RESUME_REQUEST:
+      HandleResumeRequestMessage(message->resume_request_message());
+      break;
+
+    case PeerMessage::RESUME:
+      HandleResumeMessage(message->resume_message());
+      break;
+
+    case PeerMessage::ACK:
+      HandleAckMessage(message->ack_message());
+      break;
+
+    case PeerMessage::COMPRESSED:
+      HandleCompressedMessage(message->compressed_message());
+      break;
+
+    case PeerMessage::CHUNK:
+      HandleChunkMessage(message->chunk_message());
+      break;
+
+    case PeerMessage::CREDIT:
+      HandleCreditMessage(message->credit_message());
+      break;
+
+    default:
+      HandleRegularMessage(message);
+  }
+}
+
+void PeerConnection::ReplenishCredit() {
+  if (receive_window_ == -1) {
+    return;
+  }
+
+  {
+    MutexLock lock(&state_mu_);
+
+    ++pending_credit_;
+    if (pending_credit_ < GetCreditGrantThreshold(receive_window_)) {
+      return;
+    }
+  }
+
+  // GetNextOutputMessageHelper will send the CREDIT message.
+  PrivateGetProtocolConnection()->NotifyMessageReadyToSend();
+}
+
 void PeerConnection::SetRemotePeer(const CanonicalPeer* new_remote_peer) {
   CHECK(new_remote_peer != nullptr);
 
@@ -291,11 +708,69 @@ void PeerConnection::SetRemotePeer(const CanonicalPeer* new_remote_peer) {
   connection_manager_->NotifyRemotePeerKnown(this, new_remote_peer);
 }
 
+void PeerConnection::DrainOutputMessages() {
+  for (const unique_ptr<ProducerConsumerQueue<shared_ptr<const string>>>&
+           output_messages : output_messages_) {
+    output_messages->Drain();
+  }
+}
+
 void PeerConnection::HandleHelloMessage(const HelloMessage& hello_message) {
   const string& new_remote_peer_id = hello_message.peer_id();
   CHECK_EQ(hello_message.interpreter_type(),
            connection_manager_->interpreter_type());
 
+  if (hello_message.has_intern_table_size() &&
+      hello_message.intern_table_size() <= 0) {
+    AbortAfterProtocolError(StringPrintf(
+        "The HELLO message has an intern table size of %d",
+        hello_message.intern_table_size()));
+    return;
+  }
+  if (hello_message.has_receive_window() &&
+      hello_message.receive_window() <= 0) {
+    AbortAfterProtocolError(StringPrintf(
+        "The HELLO message has a receive window of %d",
+        hello_message.receive_window()));
+    return;
+  }
+
+  // Both peers use the smaller of the two table sizes, so that the tables on
+  // each side of the connection stay in sync. This must be done before the
+  // send credit is set below; no regular messages are sent or received until
+  // then.
+  if (intern_table_size_ > 0 && hello_message.has_intern_table_size()) {
+    const int intern_table_size = min(intern_table_size_,
+                                      hello_message.intern_table_size());
+
+    {
+      MutexLock lock(&output_mu_);
+      for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+        output_interners_.emplace_back(
+            new PeerMessageInterner(intern_table_size));
+      }
+    }
+
+    {
+      MutexLock lock(&input_mu_);
+      for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+        input_interners_.emplace_back(
+            new PeerMessageInterner(intern_table_size));
+      }
+    }
+  }
+
+  // The events in received messages are decoded whenever they're encoded, so
+  // only the sending side depends on the version. A remote peer that doesn't
+  // advertise a usable version is sent plain EventProto messages.
+  if (FLAGS_encode_peer_message_events &&
+      hello_message.compact_event_encoding_version() > 0) {
+    MutexLock lock(&output_mu_);
+    event_encoding_version_ = min(
+        kCompactEventEncodingVersion,
+        hello_message.compact_event_encoding_version());
+  }
+
   {
     MutexLock lock(&state_mu_);
 
@@ -303,8 +778,21 @@ void PeerConnection::HandleHelloMessage(const HelloMessage& hello_message) {
     // messages, or sends a HELLO message after sending a GOODBYE message.
     CHECK_EQ(receive_state_, NO_MESSAGE_RECEIVED);
     receive_state_ = HELLO_RECEIVED;
+
+    compress_output_ = FLAGS_compress_peer_messages &&
+        hello_message.compression_supported();
+
+    if (hello_message.has_receive_window()) {
+      send_credit_ = static_cast<int64>(hello_message.receive_window());
+    } else {
+      send_credit_ = -1;
+    }
   }
 
+  // Messages may have been queued while waiting for the remote peer's receive
+  // window.
+  PrivateGetProtocolConnection()->NotifyMessageReadyToSend();
+
   const CanonicalPeer* const new_remote_peer =
       canonical_peer_map_->GetCanonicalPeer(new_remote_peer_id);
 
@@ -330,24 +818,270 @@ void PeerConnection::HandleGoodbyeMessage(
     }
   }
 
-  output_messages_.Drain();
+  DrainOutputMessages();
 
   if (close_connection) {
     PrivateGetProtocolConnection()->Close();
   }
 }
 
-void PeerConnection::HandleRegularMessage(const PeerMessage& peer_message) {
+void PeerConnection::HandleResumeRequestMessage(
+    const ResumeRequestMessage& resume_request_message) {
+  if (!CheckHelloReceived(PeerMessage::RESUME_REQUEST)) {
+    return;
+  }
+
+  connection_manager_->ResumeOutgoingMessages(this, resume_request_message);
+}
+
+void PeerConnection::HandleResumeMessage(const ResumeMessage& resume_message) {
+  if (resume_message.start_sequence_number_size() != kPeerMessageLaneCount) {
+    AbortAfterProtocolError(StringPrintf(
+        "The RESUME message has %d sequence numbers instead of %d",
+        resume_message.start_sequence_number_size(), kPeerMessageLaneCount));
+    return;
+  }
+
+  if (!CheckHelloReceived(PeerMessage::RESUME)) {
+    return;
+  }
+
+  bool already_sequenced = false;
+  {
+    MutexLock lock(&state_mu_);
+
+    if (incoming_messages_sequenced_) {
+      already_sequenced = true;
+    } else {
+      incoming_messages_sequenced_ = true;
+      for (int lane = 0; lane < kPeerMessageLaneCount; ++lane) {
+        next_incoming_sequence_numbers_[lane] =
+            resume_message.start_sequence_number(lane);
+      }
+    }
+  }
+
+  if (already_sequenced) {
+    AbortAfterProtocolError("More than one RESUME message was sent on the "
+                            "connection");
+    return;
+  }
+
+  connection_manager_->ResumeIncomingMessages(PrivateGetRemotePeer(),
+                                              resume_message);
+}
+
+void PeerConnection::HandleAckMessage(const AckMessage& ack_message) {
+  if (ack_message.lane() < 0 || ack_message.lane() >= kPeerMessageLaneCount) {
+    AbortAfterProtocolError(StringPrintf(
+        "The ACK message is for the nonexistent lane %d", ack_message.lane()));
+    return;
+  }
+
+  if (!CheckHelloReceived(PeerMessage::ACK)) {
+    return;
+  }
+
+  connection_manager_->AcknowledgeOutgoingMessages(PrivateGetRemotePeer(),
+                                                   ack_message);
+}
+
+void PeerConnection::HandleCompressedMessage(
+    const CompressedMessage& compressed_message) {
+  const string& data = compressed_message.data();
+  string serialized_message;
+
+  {
+    MutexLock lock(&input_mu_);
+
+    if (inflate_stream_.get() == nullptr) {
+      inflate_stream_.reset(new InflateStream());
+    }
+
+    // TODO(dss): Fail gracefully if the remote peer sends corrupt data.
+    CHECK(inflate_stream_->Decompress(data.data(), data.length(),
+                                      &serialized_message));
+  }
+
+  ArenaOptions arena_options;
+  GetArenaOptionsForMessage(serialized_message, &arena_options);
+  Arena arena(arena_options);
+
+  PeerMessage* const message = Arena::CreateMessage<PeerMessage>(&arena);
+  // The message may be interned, so its required fields are checked later.
+  // (See HandleMessage.)
+  if (!message->ParsePartialFromString(serialized_message)) {
+    AbortAfterProtocolError("The COMPRESSED message contains an improperly "
+                            "encoded message");
+    return;
+  }
+  CHECK_NE(GetPeerMessageType(*message), PeerMessage::COMPRESSED);
+
+  HandleMessage(message);
+}
+
+void PeerConnection::HandleChunkMessage(const ChunkMessage& chunk_message) {
+  string serialized_message;
+
+  {
+    MutexLock lock(&input_mu_);
+
+    incoming_chunks_ += chunk_message.data();
+
+    if (!chunk_message.last_chunk()) {
+      return;
+    }
+
+    serialized_message.swap(incoming_chunks_);
+  }
+
+  ArenaOptions arena_options;
+  GetArenaOptionsForMessage(serialized_message, &arena_options);
+  Arena arena(arena_options);
+
+  PeerMessage* const message = Arena::CreateMessage<PeerMessage>(&arena);
+  // The message may be interned, so its required fields are checked later.
+  // (See HandleMessage.)
+  if (!message->ParsePartialFromString(serialized_message)) {
+    AbortAfterProtocolError("The CHUNK messages contain an improperly encoded "
+                            "message");
+    return;
+  }
+  CHECK_EQ(GetPeerMessageLane(GetPeerMessageType(*message)), BULK_LANE);
+
+  HandleMessage(message);
+}
+
+void PeerConnection::HandleCreditMessage(const CreditMessage& credit_message) {
+  if (credit_message.message_count() <= 0) {
+    AbortAfterProtocolError(StringPrintf(
+        "The CREDIT message grants %d messages",
+        credit_message.message_count()));
+    return;
+  }
+  if (!CheckHelloReceived(PeerMessage::CREDIT)) {
+    return;
+  }
+
+  {
+    MutexLock lock(&state_mu_);
+
+    if (send_credit_ != -1) {
+      send_credit_ += static_cast<int64>(credit_message.message_count());
+    }
+  }
+
+  PrivateGetProtocolConnection()->NotifyMessageReadyToSend();
+}
+
+void PeerConnection::HandleRegularMessage(PeerMessage* peer_message) {
+  CHECK(peer_message != nullptr);
+
+  const PeerMessageLane lane = GetPeerMessageLane(GetPeerMessageType(
+      *peer_message));
+
+  // The message must be expanded even if it turns out to be a duplicate, so
+  // that the tables stay in sync with the remote peer's tables.
+  if (!ExpandReceivedMessage(lane, peer_message)) {
+    AbortAfterProtocolError(StringPrintf(
+        "The %s message contains a code that wasn't defined or events that "
+        "can't be decoded",
+        PeerMessage::Type_Name(GetPeerMessageType(*peer_message)).c_str()));
+    return;
+  }
+  // A missing ID is rejected here, rather than being read as an empty string
+  // or zero.
+  if (!peer_message->IsInitialized()) {
+    AbortAfterProtocolError(StringPrintf(
+        "The %s message is missing required fields: %s",
+        PeerMessage::Type_Name(GetPeerMessageType(*peer_message)).c_str(),
+        peer_message->InitializationErrorString().c_str()));
+    return;
+  }
+
+  bool sequenced = false;
+  uint64 sequence_number = 0;
   {
     MutexLock lock(&state_mu_);
 
     // TODO(dss): Fail gracefully if the remote peer sends a regular message
     // before sending a HELLO message or after sending a GOODBYE message.
     CHECK_EQ(receive_state_, HELLO_RECEIVED);
+
+    if (incoming_messages_sequenced_) {
+      sequenced = true;
+      sequence_number = next_incoming_sequence_numbers_[lane];
+      ++next_incoming_sequence_numbers_[lane];
+    }
+  }
+
+  if (sequenced &&
+      !connection_manager_->AcceptIncomingMessage(this, lane,
+                                                  sequence_number)) {
+    VLOG(1) << "Ignoring message " << sequence_number << " in lane " << lane
+            << " from peer " << GetRemotePeerIdForLogging() << " because it "
+            << "was already received. (peer connection " << this << ")";
+    return;
   }
 
   connection_manager_->HandleMessageFromRemotePeer(PrivateGetRemotePeer(),
-                                                   peer_message);
+                                                   *peer_message);
+}
+
+bool PeerConnection::ExpandReceivedMessage(PeerMessageLane lane,
+                                           PeerMessage* peer_message) {
+  CHECK(peer_message != nullptr);
+
+  if (!PeerMessageInterner::MessageTypeIsInterned(GetPeerMessageType(
+          *peer_message))) {
+    return true;
+  }
+
+  const bool events_encoded = MessageHasEncodedEvents(*peer_message);
+
+  MutexLock lock(&input_mu_);
+
+  // The remote peer interned the events before it encoded them, so they're
+  // decoded before the message is expanded. The message is expanded in place,
+  // so the restored fields are allocated from the same arena as the rest of the
+  // message.
+  if (events_encoded && !DecodeEventsInMessage(peer_message)) {
+    return false;
+  }
+  if (!input_interners_.empty() &&
+      !input_interners_[lane]->ExpandMessage(peer_message)) {
+    return false;
+  }
+
+  return true;
+}
+
+bool PeerConnection::CheckHelloReceived(PeerMessage::Type type) {
+  {
+    MutexLock lock(&state_mu_);
+    if (receive_state_ == HELLO_RECEIVED) {
+      return true;
+    }
+  }
+
+  AbortAfterProtocolError(StringPrintf(
+      "The %s message was sent before the HELLO message or after the GOODBYE "
+      "message", PeerMessage::Type_Name(type).c_str()));
+  return false;
+}
+
+void PeerConnection::AbortAfterProtocolError(
+    const string& error_description) {
+  LOG(ERROR) << "Peer " << GetRemotePeerIdForLogging() << " violated the "
+             << "protocol: " << error_description << " (peer connection "
+             << this << ")";
+
+  {
+    MutexLock lock(&state_mu_);
+    protocol_error_ = true;
+  }
+
+  Abort();
 }
 
 string PeerConnection::GetRemotePeerIdForLogging() const {
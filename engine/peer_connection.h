@@ -20,27 +20,40 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/cond_var.h"
+#include "base/integral_types.h"
 #include "base/macros.h"
 #include "base/mutex.h"
-#include "engine/peer_message_sender.h"
+#include "engine/get_peer_message_lane.h"
+#include "engine/proto/peer.pb.h"
 #include "protocol_server/protocol_connection_handler.h"
-#include "util/quota_queue.h"
+#include "util/byte_budget.h"
+#include "util/producer_consumer_queue.h"
 
 namespace floating_temple {
 
+class DeflateStream;
+class InflateStream;
 class ProtocolConnection;
 class StateVariableInternalInterface;
 
 namespace engine {
 
+class AckMessage;
 class CanonicalPeer;
 class CanonicalPeerMap;
+class ChunkMessage;
+class CompressedMessage;
 class ConnectionManagerInterfaceForPeerConnection;
+class CreditMessage;
 class GoodbyeMessage;
 class HelloMessage;
 class PeerMessage;
+class PeerMessageInterner;
+class ResumeMessage;
+class ResumeRequestMessage;
 
 class PeerConnection : public ProtocolConnectionHandler<PeerMessage> {
  public:
@@ -49,7 +62,8 @@ class PeerConnection : public ProtocolConnectionHandler<PeerMessage> {
       CanonicalPeerMap* canonical_peer_map,
       const CanonicalPeer* remote_peer,
       const std::string& remote_address,
-      bool locally_initiated);
+      bool locally_initiated,
+      ByteBudget* total_output_budget);
   ~PeerConnection() override;
 
   void Init(ProtocolConnection* connection);
@@ -58,17 +72,38 @@ class PeerConnection : public ProtocolConnectionHandler<PeerMessage> {
   const std::string& remote_address() const { return remote_address_; }
   bool locally_initiated() const { return locally_initiated_; }
 
-  bool SendMessage(const PeerMessage& peer_message,
-                   PeerMessageSender::SendMode send_mode);
+  // Queues a message that has already been formatted by FormatProtocolMessage.
+  // The same buffer may be queued on several connections. 'lane' must be the
+  // lane for the message's type. This method never blocks; callers that need
+  // to wait for the remote peer to catch up call WaitForOutputBudget.
+  bool SendFormattedMessage(
+      const std::shared_ptr<const std::string>& formatted_message,
+      PeerMessageLane lane);
+
+  // Waits until there's room in the output budget for this connection (and in
+  // the total output budget that it's part of), or until the timeout expires.
+  // Returns true if there's room.
+  bool WaitForOutputBudget(int timeout_ms) const;
+  // Returns true if the output budget for this connection has been used up for
+  // at least the given amount of time; i.e., the remote peer isn't reading the
+  // messages as quickly as they're being queued.
+  bool IsLagging(int64 timeout_usec) const;
 
   void Drain();
   void Close();
+  // Closes the connection immediately, discarding any queued messages.
+  void Abort();
+
+  // Returns true if Drain() has been called or the remote peer has said
+  // goodbye. Messages can no longer be sent on the connection.
+  bool IsDraining() const;
 
   void IncrementRefCount();
   bool DecrementRefCount();
 
-  bool GetNextOutputMessage(PeerMessage* message) override;
-  void NotifyMessageReceived(const PeerMessage& message) override;
+  bool GetNextOutputMessage(
+      std::shared_ptr<const std::string>* formatted_message) override;
+  void NotifyMessageReceived(PeerMessage* message) override;
 
  private:
   enum ConnectionState {
@@ -96,13 +131,58 @@ class PeerConnection : public ProtocolConnectionHandler<PeerMessage> {
   ProtocolConnection* PrivateGetProtocolConnection() const;
   const CanonicalPeer* PrivateGetRemotePeer() const;
 
-  bool GetNextOutputMessageHelper(PeerMessage* message);
+  bool GetNextOutputMessageHelper(
+      std::shared_ptr<const std::string>* formatted_message);
+  // Gets the next queued message, or the next chunk of the current message in
+  // the bulk lane. Returns false if there's nothing to send.
+  bool GetNextQueuedMessage(
+      std::shared_ptr<const std::string>* formatted_message);
+  // Replaces the recurring method names, peer IDs, and object IDs in a queued
+  // message with codes, if interning is enabled on the connection, and
+  // re-encodes its events if the remote peer can't read the version they were
+  // encoded in. Returns true if the message was changed. The caller must hold
+  // output_mu_.
+  bool MaybeRewriteMessage_Locked(
+      PeerMessageLane lane,
+      std::shared_ptr<const std::string>* formatted_message);
+  // Replaces the formatted message with a COMPRESSED message if the remote
+  // peer supports compression and the message is large enough to benefit.
+  void MaybeCompressMessage(
+      std::shared_ptr<const std::string>* formatted_message);
+
+  // Handles a message received from the remote peer, or a message that was
+  // unwrapped from a COMPRESSED message or reassembled from CHUNK messages.
+  void HandleMessage(PeerMessage* message);
+  // Records that a message from the remote peer has been handled, so that the
+  // remote peer can be granted credit to send another one.
+  void ReplenishCredit();
 
   void SetRemotePeer(const CanonicalPeer* new_remote_peer);
+  void DrainOutputMessages();
 
   void HandleHelloMessage(const HelloMessage& hello_message);
   void HandleGoodbyeMessage(const GoodbyeMessage& goodbye_message);
-  void HandleRegularMessage(const PeerMessage& peer_message);
+  void HandleResumeRequestMessage(
+      const ResumeRequestMessage& resume_request_message);
+  void HandleResumeMessage(const ResumeMessage& resume_message);
+  void HandleAckMessage(const AckMessage& ack_message);
+  void HandleCompressedMessage(const CompressedMessage& compressed_message);
+  void HandleChunkMessage(const ChunkMessage& chunk_message);
+  void HandleCreditMessage(const CreditMessage& credit_message);
+  void HandleRegularMessage(PeerMessage* peer_message);
+  // Restores the parts of the message that the remote peer replaced with codes,
+  // and decodes its events if they're encoded. The message is modified in
+  // place. Returns false if the message contains a code that the remote peer
+  // hasn't defined or events that can't be decoded.
+  bool ExpandReceivedMessage(PeerMessageLane lane, PeerMessage* peer_message);
+  // Returns true if the remote peer has sent its HELLO message and hasn't sent
+  // a GOODBYE message. Otherwise, aborts the connection because the remote
+  // peer shouldn't have sent a message of the given type.
+  bool CheckHelloReceived(PeerMessage::Type type);
+  // Called when the remote peer violates the protocol. Logs the error and
+  // aborts the connection. Any messages that are received on the connection
+  // after this are ignored.
+  void AbortAfterProtocolError(const std::string& error_description);
 
   std::string GetRemotePeerIdForLogging() const;
 
@@ -112,6 +192,13 @@ class PeerConnection : public ProtocolConnectionHandler<PeerMessage> {
   CanonicalPeerMap* const canonical_peer_map_;
   const std::string remote_address_;
   const bool locally_initiated_;
+  // The number of messages that the remote peer may send before it has to
+  // wait for a CREDIT message, or -1 if there's no limit.
+  const int receive_window_;
+  // The maximum size of the tables that this peer offers to use for interning
+  // the messages sent in each direction, or zero if it doesn't support
+  // interning.
+  const int intern_table_size_;
 
   std::unique_ptr<ProtocolConnection> protocol_connection_;
   mutable CondVar protocol_connection_set_cond_;
@@ -124,12 +211,63 @@ class PeerConnection : public ProtocolConnectionHandler<PeerMessage> {
   ReceiveState receive_state_;
   SendState send_state_;
   DrainState drain_state_;
+  // True if the remote peer violated the protocol.
+  bool protocol_error_;
+  // Regular messages received after a RESUME message are numbered
+  // consecutively in each lane, starting at the sequence numbers in the RESUME
+  // message. Indexed by lane.
+  bool incoming_messages_sequenced_;
+  std::vector<uint64> next_incoming_sequence_numbers_;
+  // True if the remote peer's HELLO message said that it can decompress
+  // COMPRESSED messages.
+  bool compress_output_;
+  // Credit-based flow control. 'send_credit_' is the number of queued messages
+  // that may be sent before the remote peer grants more credit, or -1 if the
+  // remote peer didn't ask for a limit. 'pending_credit_' is the number of
+  // messages from the remote peer that have been handled since the last CREDIT
+  // message was sent.
+  int64 send_credit_;
+  int pending_credit_;
   mutable Mutex state_mu_;
 
-  // TODO(dss): The message queue should be separate from the connection object,
-  // so that no messages will be dropped if the connection is closed and needs
-  // to be reestablished.
-  QuotaQueue<PeerMessage*> output_messages_;
+  // The compression context for the messages sent on this connection (created
+  // when it's first needed), and the message in the bulk lane that's currently
+  // being sent in chunks.
+  std::unique_ptr<DeflateStream> deflate_stream_;
+  std::shared_ptr<const std::string> bulk_message_;
+  std::string::size_type bulk_message_offset_;
+  // The tables for interning the messages sent on this connection, indexed by
+  // lane. Empty if interning isn't used. The tables are kept separately for
+  // each lane because the messages in the priority lane may overtake a
+  // message in the bulk lane that's being sent in chunks.
+  std::vector<std::unique_ptr<PeerMessageInterner>> output_interners_;
+  // The version of the compact event encoding that's used for the messages
+  // sent on this connection, or zero if events are sent as EventProto
+  // messages. Negotiated when the remote peer's HELLO message is received.
+  int event_encoding_version_;
+  mutable Mutex output_mu_;
+
+  // The decompression context for the messages received on this connection,
+  // and the chunks received so far of the current message in the bulk lane.
+  std::unique_ptr<InflateStream> inflate_stream_;
+  std::string incoming_chunks_;
+  // The tables for expanding the messages received on this connection, indexed
+  // by lane. Empty if interning isn't used.
+  std::vector<std::unique_ptr<PeerMessageInterner>> input_interners_;
+  mutable Mutex input_mu_;
+
+  // The queued messages in each lane, indexed by lane. Messages leave the
+  // queues only as fast as the remote peer grants credit for them.
+  //
+  // Messages that were lost when the connection closed are resent on the next
+  // connection by ConnectionManager, which keeps a copy of each message until
+  // the remote peer acknowledges it.
+  std::vector<std::unique_ptr<
+      ProducerConsumerQueue<std::shared_ptr<const std::string>>>>
+      output_messages_;
+  // The number of bytes in the queued messages (including the message in the
+  // bulk lane that's currently being sent in chunks).
+  ByteBudget output_budget_;
 
   int ref_count_;
   mutable Mutex ref_count_mu_;
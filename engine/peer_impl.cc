@@ -19,6 +19,8 @@
 #include <string>
 #include <vector>
 
+#include <gflags/gflags.h>
+
 #include "base/logging.h"
 #include "engine/canonical_peer_map.h"
 #include "engine/connection_manager.h"
@@ -29,6 +31,12 @@
 using std::string;
 using std::vector;
 
+DEFINE_int32(peer_startup_quorum, -1,
+             "Number of known peers that the peer must be connected to before "
+             "it reports that it's running. The connections to the rest of "
+             "the known peers are established in the background. -1 means all "
+             "of the known peers.");
+
 namespace floating_temple {
 
 class ObjectReference;
@@ -74,12 +82,24 @@ void PeerImpl::Start(Interpreter* interpreter,
                             send_receive_thread_count);
 
   // Connect to remote peers.
+  vector<const CanonicalPeer*> known_peers;
+  known_peers.reserve(known_peer_ids.size());
   for (const string& peer_id : known_peer_ids) {
-    const CanonicalPeer* const known_peer =
-        canonical_peer_map_.GetCanonicalPeer(peer_id);
-    connection_manager_.ConnectToRemotePeer(known_peer);
+    known_peers.push_back(canonical_peer_map_.GetCanonicalPeer(peer_id));
   }
 
+  int quorum = static_cast<int>(known_peers.size());
+  if (FLAGS_peer_startup_quorum >= 0 && FLAGS_peer_startup_quorum < quorum) {
+    quorum = FLAGS_peer_startup_quorum;
+  }
+
+  const int connected_count = connection_manager_.ConnectToRemotePeers(
+      known_peers, quorum);
+  LOG_IF(ERROR, connected_count < quorum)
+      << "Connected to only " << connected_count << " of the "
+      << known_peers.size() << " known peers at start-up (quorum: " << quorum
+      << ")";
+
   state_.ChangeState(RUNNING);
 }
 
@@ -0,0 +1,541 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/peer_message_interner.h"
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "engine/get_event_proto_type.h"
+#include "engine/get_peer_message_type.h"
+#include "engine/proto/event.pb.h"
+#include "engine/proto/peer.pb.h"
+#include "engine/proto/uuid.pb.h"
+#include "engine/proto/value_proto.pb.h"
+
+using std::make_pair;
+using std::pair;
+using std::size_t;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace floating_temple {
+namespace engine {
+
+PeerMessageInterner::PeerMessageInterner(int max_entry_count)
+    : max_entry_count_(static_cast<vector<string>::size_type>(
+          max_entry_count)),
+      replacement_count_(0) {
+  CHECK_GT(max_entry_count, 0);
+}
+
+PeerMessageInterner::~PeerMessageInterner() {
+}
+
+// static
+bool PeerMessageInterner::MessageTypeIsInterned(PeerMessage::Type type) {
+  switch (type) {
+    case PeerMessage::APPLY_TRANSACTION:
+    case PeerMessage::GET_OBJECT:
+    case PeerMessage::STORE_OBJECT:
+    case PeerMessage::REJECT_TRANSACTION:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+bool PeerMessageInterner::InternMessage(PeerMessage* peer_message) {
+  CHECK(peer_message != nullptr);
+
+  replacement_count_ = 0;
+
+  switch (GetPeerMessageType(*peer_message)) {
+    case PeerMessage::APPLY_TRANSACTION:
+      InternApplyTransactionMessage(
+          peer_message->mutable_apply_transaction_message());
+      break;
+
+    case PeerMessage::GET_OBJECT:
+      InternObjectId(
+          peer_message->mutable_get_object_message()->mutable_object_id());
+      break;
+
+    case PeerMessage::STORE_OBJECT:
+      InternStoreObjectMessage(peer_message->mutable_store_object_message());
+      break;
+
+    case PeerMessage::REJECT_TRANSACTION:
+      InternRejectTransactionMessage(
+          peer_message->mutable_reject_transaction_message());
+      break;
+
+    default:
+      break;
+  }
+
+  return replacement_count_ > 0;
+}
+
+bool PeerMessageInterner::ExpandMessage(PeerMessage* peer_message) {
+  CHECK(peer_message != nullptr);
+
+  switch (GetPeerMessageType(*peer_message)) {
+    case PeerMessage::APPLY_TRANSACTION:
+      return ExpandApplyTransactionMessage(
+          peer_message->mutable_apply_transaction_message());
+
+    case PeerMessage::GET_OBJECT:
+      return ExpandObjectId(
+          peer_message->mutable_get_object_message()->mutable_object_id());
+
+    case PeerMessage::STORE_OBJECT:
+      return ExpandStoreObjectMessage(
+          peer_message->mutable_store_object_message());
+
+    case PeerMessage::REJECT_TRANSACTION:
+      return ExpandRejectTransactionMessage(
+          peer_message->mutable_reject_transaction_message());
+
+    default:
+      return true;
+  }
+}
+
+size_t PeerMessageInterner::ObjectIdHash::operator()(
+    const pair<uint64, uint64>& object_id) const {
+  // Object IDs are random, so any of their bits make a good hash.
+  return static_cast<size_t>(object_id.first ^ object_id.second);
+}
+
+void PeerMessageInterner::InternApplyTransactionMessage(
+    ApplyTransactionMessage* apply_transaction_message) {
+  for (int i = 0; i < apply_transaction_message->object_transaction_size();
+       ++i) {
+    ObjectTransactionProto* const object_transaction =
+        apply_transaction_message->mutable_object_transaction(i);
+
+    InternObjectId(object_transaction->mutable_object_id());
+    for (int j = 0; j < object_transaction->event_size(); ++j) {
+      InternEvent(object_transaction->mutable_event(j));
+    }
+  }
+}
+
+void PeerMessageInterner::InternStoreObjectMessage(
+    StoreObjectMessage* store_object_message) {
+  InternObjectId(store_object_message->mutable_object_id());
+
+  for (int i = 0; i < store_object_message->transaction_size(); ++i) {
+    InternTransaction(store_object_message->mutable_transaction(i));
+  }
+
+  for (int i = 0; i < store_object_message->peer_version_size(); ++i) {
+    PeerVersion* const peer_version =
+        store_object_message->mutable_peer_version(i);
+    uint32 code = 0;
+    if (InternString(peer_version->peer_id(), &code)) {
+      peer_version->clear_peer_id();
+      peer_version->set_peer_code(code);
+    }
+  }
+
+  // The interested peers are a set, so the peers that are sent in full and the
+  // peers that are replaced by codes can be listed separately.
+  vector<string> interested_peer_ids;
+  for (int i = 0; i < store_object_message->interested_peer_id_size(); ++i) {
+    const string& interested_peer_id =
+        store_object_message->interested_peer_id(i);
+    uint32 code = 0;
+    if (InternString(interested_peer_id, &code)) {
+      store_object_message->add_interested_peer_code(code);
+    } else {
+      interested_peer_ids.push_back(interested_peer_id);
+    }
+  }
+
+  store_object_message->clear_interested_peer_id();
+  for (const string& interested_peer_id : interested_peer_ids) {
+    store_object_message->add_interested_peer_id(interested_peer_id);
+  }
+}
+
+void PeerMessageInterner::InternRejectTransactionMessage(
+    RejectTransactionMessage* reject_transaction_message) {
+  for (int i = 0; i < reject_transaction_message->rejected_peer_size(); ++i) {
+    RejectedPeerProto* const rejected_peer =
+        reject_transaction_message->mutable_rejected_peer(i);
+    uint32 code = 0;
+    if (InternString(rejected_peer->rejected_peer_id(), &code)) {
+      rejected_peer->clear_rejected_peer_id();
+      rejected_peer->set_rejected_peer_code(code);
+    }
+  }
+}
+
+void PeerMessageInterner::InternTransaction(TransactionProto* transaction) {
+  for (int i = 0; i < transaction->event_size(); ++i) {
+    InternEvent(transaction->mutable_event(i));
+  }
+
+  uint32 code = 0;
+  if (InternString(transaction->origin_peer_id(), &code)) {
+    transaction->clear_origin_peer_id();
+    transaction->set_origin_peer_code(code);
+  }
+}
+
+void PeerMessageInterner::InternEvent(EventProto* event) {
+  switch (GetEventProtoType(*event)) {
+    case EventProto::OBJECT_CREATION: {
+      ObjectCreationEventProto* const object_creation =
+          event->mutable_object_creation();
+      for (int i = 0; i < object_creation->referenced_object_id_size(); ++i) {
+        InternObjectId(object_creation->mutable_referenced_object_id(i));
+      }
+      break;
+    }
+
+    case EventProto::METHOD_CALL:
+      InternMethodCall(event->mutable_method_call());
+      break;
+
+    case EventProto::METHOD_RETURN:
+      InternValue(event->mutable_method_return()->mutable_return_value());
+      break;
+
+    case EventProto::SUB_METHOD_CALL:
+      InternMethodCall(event->mutable_sub_method_call());
+      InternObjectId(
+          event->mutable_sub_method_call()->mutable_callee_object_id());
+      break;
+
+    case EventProto::SUB_METHOD_RETURN:
+      InternValue(event->mutable_sub_method_return()->mutable_return_value());
+      break;
+
+    case EventProto::SELF_METHOD_CALL:
+      InternMethodCall(event->mutable_self_method_call());
+      break;
+
+    case EventProto::SELF_METHOD_RETURN:
+      InternValue(event->mutable_self_method_return()->mutable_return_value());
+      break;
+
+    default:
+      break;
+  }
+
+  for (int i = 0; i < event->new_object_id_size(); ++i) {
+    InternObjectId(event->mutable_new_object_id(i));
+  }
+}
+
+template<class CallEventProto>
+void PeerMessageInterner::InternMethodCall(CallEventProto* call_event) {
+  uint32 code = 0;
+  if (InternString(call_event->method_name(), &code)) {
+    call_event->clear_method_name();
+    call_event->set_method_name_code(code);
+  }
+
+  for (int i = 0; i < call_event->parameter_size(); ++i) {
+    InternValue(call_event->mutable_parameter(i));
+  }
+}
+
+void PeerMessageInterner::InternValue(ValueProto* value) {
+  if (value->has_object_id()) {
+    InternObjectId(value->mutable_object_id());
+  }
+}
+
+void PeerMessageInterner::InternObjectId(Uuid* object_id) {
+  const pair<uint64, uint64> key(object_id->high_word(),
+                                 object_id->low_word());
+
+  const unordered_map<pair<uint64, uint64>, uint32, ObjectIdHash>::
+      const_iterator it = object_id_codes_.find(key);
+
+  if (it != object_id_codes_.end()) {
+    object_id->Clear();
+    object_id->set_code(it->second);
+    ++replacement_count_;
+  } else if (object_id_codes_.size() < max_entry_count_) {
+    const uint32 code = static_cast<uint32>(object_id_codes_.size());
+    object_id_codes_.emplace(key, code);
+  }
+}
+
+bool PeerMessageInterner::InternString(const string& s, uint32* code) {
+  CHECK(code != nullptr);
+
+  const unordered_map<string, uint32>::const_iterator it =
+      string_codes_.find(s);
+
+  if (it != string_codes_.end()) {
+    *code = it->second;
+    ++replacement_count_;
+    return true;
+  }
+
+  if (string_codes_.size() < max_entry_count_) {
+    const uint32 new_code = static_cast<uint32>(string_codes_.size());
+    string_codes_.emplace(s, new_code);
+  }
+
+  return false;
+}
+
+bool PeerMessageInterner::ExpandApplyTransactionMessage(
+    ApplyTransactionMessage* apply_transaction_message) {
+  for (int i = 0; i < apply_transaction_message->object_transaction_size();
+       ++i) {
+    ObjectTransactionProto* const object_transaction =
+        apply_transaction_message->mutable_object_transaction(i);
+
+    if (!ExpandObjectId(object_transaction->mutable_object_id())) {
+      return false;
+    }
+    for (int j = 0; j < object_transaction->event_size(); ++j) {
+      if (!ExpandEvent(object_transaction->mutable_event(j))) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool PeerMessageInterner::ExpandStoreObjectMessage(
+    StoreObjectMessage* store_object_message) {
+  if (!ExpandObjectId(store_object_message->mutable_object_id())) {
+    return false;
+  }
+
+  for (int i = 0; i < store_object_message->transaction_size(); ++i) {
+    if (!ExpandTransaction(store_object_message->mutable_transaction(i))) {
+      return false;
+    }
+  }
+
+  for (int i = 0; i < store_object_message->peer_version_size(); ++i) {
+    PeerVersion* const peer_version =
+        store_object_message->mutable_peer_version(i);
+    if (peer_version->has_peer_code()) {
+      if (!ExpandString(peer_version->peer_code(),
+                        peer_version->mutable_peer_id())) {
+        return false;
+      }
+      peer_version->clear_peer_code();
+    } else {
+      AddString(peer_version->peer_id());
+    }
+  }
+
+  for (int i = 0; i < store_object_message->interested_peer_id_size(); ++i) {
+    AddString(store_object_message->interested_peer_id(i));
+  }
+  for (int i = 0; i < store_object_message->interested_peer_code_size(); ++i) {
+    if (!ExpandString(store_object_message->interested_peer_code(i),
+                      store_object_message->add_interested_peer_id())) {
+      return false;
+    }
+  }
+  store_object_message->clear_interested_peer_code();
+
+  return true;
+}
+
+bool PeerMessageInterner::ExpandRejectTransactionMessage(
+    RejectTransactionMessage* reject_transaction_message) {
+  for (int i = 0; i < reject_transaction_message->rejected_peer_size(); ++i) {
+    RejectedPeerProto* const rejected_peer =
+        reject_transaction_message->mutable_rejected_peer(i);
+    if (rejected_peer->has_rejected_peer_code()) {
+      if (!ExpandString(rejected_peer->rejected_peer_code(),
+                        rejected_peer->mutable_rejected_peer_id())) {
+        return false;
+      }
+      rejected_peer->clear_rejected_peer_code();
+    } else {
+      AddString(rejected_peer->rejected_peer_id());
+    }
+  }
+
+  return true;
+}
+
+bool PeerMessageInterner::ExpandTransaction(TransactionProto* transaction) {
+  for (int i = 0; i < transaction->event_size(); ++i) {
+    if (!ExpandEvent(transaction->mutable_event(i))) {
+      return false;
+    }
+  }
+
+  if (transaction->has_origin_peer_code()) {
+    if (!ExpandString(transaction->origin_peer_code(),
+                      transaction->mutable_origin_peer_id())) {
+      return false;
+    }
+    transaction->clear_origin_peer_code();
+  } else {
+    AddString(transaction->origin_peer_id());
+  }
+
+  return true;
+}
+
+bool PeerMessageInterner::ExpandEvent(EventProto* event) {
+  switch (GetEventProtoType(*event)) {
+    case EventProto::OBJECT_CREATION: {
+      ObjectCreationEventProto* const object_creation =
+          event->mutable_object_creation();
+      for (int i = 0; i < object_creation->referenced_object_id_size(); ++i) {
+        if (!ExpandObjectId(object_creation->mutable_referenced_object_id(i))) {
+          return false;
+        }
+      }
+      break;
+    }
+
+    case EventProto::METHOD_CALL:
+      if (!ExpandMethodCall(event->mutable_method_call())) {
+        return false;
+      }
+      break;
+
+    case EventProto::METHOD_RETURN:
+      if (!ExpandValue(
+              event->mutable_method_return()->mutable_return_value())) {
+        return false;
+      }
+      break;
+
+    case EventProto::SUB_METHOD_CALL:
+      if (!ExpandMethodCall(event->mutable_sub_method_call()) ||
+          !ExpandObjectId(
+              event->mutable_sub_method_call()->mutable_callee_object_id())) {
+        return false;
+      }
+      break;
+
+    case EventProto::SUB_METHOD_RETURN:
+      if (!ExpandValue(
+              event->mutable_sub_method_return()->mutable_return_value())) {
+        return false;
+      }
+      break;
+
+    case EventProto::SELF_METHOD_CALL:
+      if (!ExpandMethodCall(event->mutable_self_method_call())) {
+        return false;
+      }
+      break;
+
+    case EventProto::SELF_METHOD_RETURN:
+      if (!ExpandValue(
+              event->mutable_self_method_return()->mutable_return_value())) {
+        return false;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  for (int i = 0; i < event->new_object_id_size(); ++i) {
+    if (!ExpandObjectId(event->mutable_new_object_id(i))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<class CallEventProto>
+bool PeerMessageInterner::ExpandMethodCall(CallEventProto* call_event) {
+  if (call_event->has_method_name_code()) {
+    if (!ExpandString(call_event->method_name_code(),
+                      call_event->mutable_method_name())) {
+      return false;
+    }
+    call_event->clear_method_name_code();
+  } else {
+    AddString(call_event->method_name());
+  }
+
+  for (int i = 0; i < call_event->parameter_size(); ++i) {
+    if (!ExpandValue(call_event->mutable_parameter(i))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool PeerMessageInterner::ExpandValue(ValueProto* value) {
+  if (value->has_object_id()) {
+    return ExpandObjectId(value->mutable_object_id());
+  }
+
+  return true;
+}
+
+bool PeerMessageInterner::ExpandObjectId(Uuid* object_id) {
+  if (object_id->has_code()) {
+    const uint32 code = object_id->code();
+    if (code >= object_ids_.size()) {
+      return false;
+    }
+
+    const pair<uint64, uint64>& entry = object_ids_[code];
+    object_id->clear_code();
+    object_id->set_high_word(entry.first);
+    object_id->set_low_word(entry.second);
+  } else if (object_ids_.size() < max_entry_count_) {
+    object_ids_.push_back(make_pair(object_id->high_word(),
+                                    object_id->low_word()));
+  }
+
+  return true;
+}
+
+bool PeerMessageInterner::ExpandString(uint32 code, string* s) const {
+  CHECK(s != nullptr);
+
+  if (code >= strings_.size()) {
+    return false;
+  }
+
+  *s = strings_[code];
+  return true;
+}
+
+void PeerMessageInterner::AddString(const string& s) {
+  if (strings_.size() < max_entry_count_) {
+    strings_.push_back(s);
+  }
+}
+
+}  // namespace engine
+}  // namespace floating_temple
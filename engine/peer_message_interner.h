@@ -0,0 +1,131 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ENGINE_PEER_MESSAGE_INTERNER_H_
+#define ENGINE_PEER_MESSAGE_INTERNER_H_
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/macros.h"
+#include "engine/proto/peer.pb.h"
+
+namespace floating_temple {
+namespace engine {
+
+class ApplyTransactionMessage;
+class EventProto;
+class RejectTransactionMessage;
+class StoreObjectMessage;
+class TransactionProto;
+class Uuid;
+class ValueProto;
+
+// Replaces the method names, peer IDs, and object IDs that recur in the
+// messages sent on a peer connection with small integer codes, and restores
+// them in the received messages.
+//
+// The sender and the receiver of a message stream each keep a table of the
+// strings and a table of the object IDs that have been sent. Both sides add
+// each string or object ID to the table the first time it's sent in full,
+// until the table is full. Later occurrences are replaced by the index of the
+// table entry. Since the tables are built up the same way on both sides, no
+// extra messages are needed to keep them in sync, but the receiver must expand
+// the messages in the same order that the sender interned them.
+//
+// The fields that are replaced by codes are required, so an interned message
+// must be serialized and parsed with the "Partial" protobuf methods, and
+// checked with IsInitialized() after it's expanded.
+//
+// An instance of this class is used either to intern messages or to expand
+// them, but not both. This class is not thread-safe.
+class PeerMessageInterner {
+ public:
+  // 'max_entry_count' is the maximum size of each table.
+  explicit PeerMessageInterner(int max_entry_count);
+  ~PeerMessageInterner();
+
+  // Returns true if messages of the given type can contain codes.
+  static bool MessageTypeIsInterned(PeerMessage::Type type);
+
+  // Replaces the strings and object IDs in the message that have been sent
+  // before with their codes, and adds the others to the tables. Returns true if
+  // anything was replaced.
+  bool InternMessage(PeerMessage* peer_message);
+  // Restores the strings and object IDs in a message that was interned by the
+  // remote peer. Returns false if the message contains a code that isn't in the
+  // tables.
+  bool ExpandMessage(PeerMessage* peer_message);
+
+ private:
+  struct ObjectIdHash {
+    std::size_t operator()(const std::pair<uint64, uint64>& object_id) const;
+  };
+
+  void InternApplyTransactionMessage(
+      ApplyTransactionMessage* apply_transaction_message);
+  void InternStoreObjectMessage(StoreObjectMessage* store_object_message);
+  void InternRejectTransactionMessage(
+      RejectTransactionMessage* reject_transaction_message);
+  void InternTransaction(TransactionProto* transaction);
+  void InternEvent(EventProto* event);
+  template<class CallEventProto> void InternMethodCall(
+      CallEventProto* call_event);
+  void InternValue(ValueProto* value);
+  void InternObjectId(Uuid* object_id);
+  // If the string is already in the table, returns true and sets *code to the
+  // index of its entry. Otherwise, adds it to the table if there's room.
+  bool InternString(const std::string& s, uint32* code);
+
+  bool ExpandApplyTransactionMessage(
+      ApplyTransactionMessage* apply_transaction_message);
+  bool ExpandStoreObjectMessage(StoreObjectMessage* store_object_message);
+  bool ExpandRejectTransactionMessage(
+      RejectTransactionMessage* reject_transaction_message);
+  bool ExpandTransaction(TransactionProto* transaction);
+  bool ExpandEvent(EventProto* event);
+  template<class CallEventProto> bool ExpandMethodCall(
+      CallEventProto* call_event);
+  bool ExpandValue(ValueProto* value);
+  bool ExpandObjectId(Uuid* object_id);
+  // Looks up the string with the given code and stores it in *s.
+  bool ExpandString(uint32 code, std::string* s) const;
+  // Adds a string that was sent in full to the table if there's room.
+  void AddString(const std::string& s);
+
+  const std::vector<std::string>::size_type max_entry_count_;
+
+  // Used when interning messages. 'replacement_count_' is the number of
+  // strings and object IDs that have been replaced in the current message.
+  int replacement_count_;
+  std::unordered_map<std::string, uint32> string_codes_;
+  std::unordered_map<std::pair<uint64, uint64>, uint32, ObjectIdHash>
+      object_id_codes_;
+
+  // Used when expanding messages. Indexed by code.
+  std::vector<std::string> strings_;
+  std::vector<std::pair<uint64, uint64>> object_ids_;
+
+  DISALLOW_COPY_AND_ASSIGN(PeerMessageInterner);
+};
+
+}  // namespace engine
+}  // namespace floating_temple
+
+#endif  // ENGINE_PEER_MESSAGE_INTERNER_H_
@@ -0,0 +1,202 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/peer_message_interner.h"
+
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "engine/compact_event_encoding.h"
+#include "engine/proto/event.pb.h"
+#include "engine/proto/peer.pb.h"
+#include "engine/proto/uuid.pb.h"
+#include "engine/proto/value_proto.pb.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::string;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+void SetUuid(uint64 high_word, uint64 low_word, Uuid* uuid) {
+  uuid->set_high_word(high_word);
+  uuid->set_low_word(low_word);
+}
+
+void AddTransaction(const string& method_name, const string& origin_peer_id,
+                    StoreObjectMessage* store_object_message) {
+  TransactionProto* const transaction =
+      store_object_message->add_transaction();
+  transaction->mutable_transaction_id()->set_a(1);
+  transaction->mutable_transaction_id()->set_b(2);
+  transaction->mutable_transaction_id()->set_c(3);
+
+  SubMethodCallEventProto* const sub_method_call =
+      transaction->add_event()->mutable_sub_method_call();
+  sub_method_call->set_method_name(method_name);
+  SetUuid(10, 20, sub_method_call->mutable_callee_object_id());
+
+  ValueProto* const parameter = sub_method_call->add_parameter();
+  parameter->set_local_type(0);
+  SetUuid(30, 40, parameter->mutable_object_id());
+
+  transaction->set_origin_peer_id(origin_peer_id);
+}
+
+void CreateStoreObjectMessage(PeerMessage* peer_message) {
+  StoreObjectMessage* const store_object_message =
+      peer_message->mutable_store_object_message();
+  SetUuid(10, 20, store_object_message->mutable_object_id());
+
+  AddTransaction("append", "ip/10.0.0.1/1025", store_object_message);
+  AddTransaction("append", "ip/10.0.0.2/1025", store_object_message);
+  AddTransaction("get", "ip/10.0.0.1/1025", store_object_message);
+
+  // The expanded message lists the interested peers that were sent in full
+  // before the ones that were replaced by codes. The new peer comes first here
+  // so that the order is preserved.
+  store_object_message->add_interested_peer_id("ip/10.0.0.3/1025");
+  store_object_message->add_interested_peer_id("ip/10.0.0.1/1025");
+}
+
+TEST(PeerMessageInternerTest, InternAndExpand) {
+  PeerMessageInterner sender(100);
+  PeerMessageInterner receiver(100);
+
+  PeerMessage original_message;
+  CreateStoreObjectMessage(&original_message);
+
+  // The first message defines the table entries, but also refers to them.
+  PeerMessage message1(original_message);
+  EXPECT_TRUE(sender.InternMessage(&message1));
+  EXPECT_FALSE(message1.store_object_message().object_id().has_code());
+  EXPECT_TRUE(message1.store_object_message().transaction(0).event(0)
+              .sub_method_call().callee_object_id().has_code());
+  EXPECT_FALSE(message1.store_object_message().transaction(0).event(0)
+               .sub_method_call().has_method_name_code());
+  EXPECT_TRUE(message1.store_object_message().transaction(1).event(0)
+              .sub_method_call().has_method_name_code());
+  EXPECT_LT(message1.ByteSize(), original_message.ByteSize());
+
+  // The second message only refers to them.
+  PeerMessage message2(original_message);
+  EXPECT_TRUE(sender.InternMessage(&message2));
+  EXPECT_LT(message2.ByteSize(), message1.ByteSize());
+  EXPECT_EQ(0, message2.store_object_message().interested_peer_id_size());
+  EXPECT_EQ(2, message2.store_object_message().interested_peer_code_size());
+
+  // The IDs that were replaced by codes are missing until the message is
+  // expanded, so the message can only be parsed partially.
+  EXPECT_FALSE(message2.IsInitialized());
+  PeerMessage parsed_message;
+  EXPECT_FALSE(parsed_message.ParseFromString(
+      message2.SerializePartialAsString()));
+  EXPECT_TRUE(parsed_message.ParsePartialFromString(
+      message2.SerializePartialAsString()));
+
+  ASSERT_TRUE(receiver.ExpandMessage(&message1));
+  EXPECT_EQ(original_message.SerializeAsString(),
+            message1.SerializeAsString());
+
+  ASSERT_TRUE(receiver.ExpandMessage(&message2));
+  EXPECT_TRUE(message2.IsInitialized());
+  EXPECT_EQ(original_message.SerializeAsString(),
+            message2.SerializeAsString());
+}
+
+TEST(PeerMessageInternerTest, InternEncodedEvents) {
+  PeerMessageInterner sender(100);
+  PeerMessageInterner receiver(100);
+
+  PeerMessage original_message;
+  CreateStoreObjectMessage(&original_message);
+
+  // The sender interns the events before it encodes them, and the receiver
+  // decodes them before it expands them.
+  PeerMessage message(original_message);
+  EXPECT_TRUE(sender.InternMessage(&message));
+  EXPECT_TRUE(EncodeEventsInMessage(kCompactEventEncodingVersion, &message));
+
+  PeerMessage uninterned_message(original_message);
+  EXPECT_TRUE(EncodeEventsInMessage(kCompactEventEncodingVersion,
+                                    &uninterned_message));
+  EXPECT_LT(message.ByteSize(), uninterned_message.ByteSize());
+
+  ASSERT_TRUE(DecodeEventsInMessage(&message));
+  EXPECT_TRUE(message.store_object_message().transaction(1).event(0)
+              .sub_method_call().has_method_name_code());
+  ASSERT_TRUE(receiver.ExpandMessage(&message));
+  EXPECT_EQ(original_message.SerializeAsString(), message.SerializeAsString());
+}
+
+TEST(PeerMessageInternerTest, TablesAreBounded) {
+  PeerMessageInterner sender(1);
+  PeerMessageInterner receiver(1);
+
+  PeerMessage original_message;
+  RejectTransactionMessage* const reject_transaction_message =
+      original_message.mutable_reject_transaction_message();
+  reject_transaction_message->mutable_new_transaction_id()->set_a(1);
+  reject_transaction_message->mutable_new_transaction_id()->set_b(2);
+  reject_transaction_message->mutable_new_transaction_id()->set_c(3);
+  for (int i = 0; i < 3; ++i) {
+    RejectedPeerProto* const rejected_peer =
+        reject_transaction_message->add_rejected_peer();
+    rejected_peer->set_rejected_peer_id(i == 1 ? "ip/10.0.0.2/1025" :
+                                        "ip/10.0.0.1/1025");
+    rejected_peer->mutable_rejected_transaction_id()->set_a(4);
+    rejected_peer->mutable_rejected_transaction_id()->set_b(5);
+    rejected_peer->mutable_rejected_transaction_id()->set_c(6);
+  }
+
+  // Only the first peer ID fits in the table.
+  PeerMessage message(original_message);
+  EXPECT_TRUE(sender.InternMessage(&message));
+  EXPECT_FALSE(message.reject_transaction_message().rejected_peer(0)
+               .has_rejected_peer_code());
+  EXPECT_FALSE(message.reject_transaction_message().rejected_peer(1)
+               .has_rejected_peer_code());
+  EXPECT_EQ(0u, message.reject_transaction_message().rejected_peer(2)
+            .rejected_peer_code());
+
+  ASSERT_TRUE(receiver.ExpandMessage(&message));
+  EXPECT_EQ(original_message.SerializeAsString(), message.SerializeAsString());
+}
+
+TEST(PeerMessageInternerTest, MessageWithUndefinedCode) {
+  PeerMessageInterner receiver(100);
+
+  PeerMessage message;
+  message.mutable_get_object_message()->mutable_object_id()->set_code(0);
+
+  EXPECT_FALSE(receiver.ExpandMessage(&message));
+}
+
+}  // namespace
+}  // namespace engine
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -16,6 +16,8 @@
 #ifndef ENGINE_PEER_MESSAGE_SENDER_H_
 #define ENGINE_PEER_MESSAGE_SENDER_H_
 
+#include <vector>
+
 namespace floating_temple {
 namespace engine {
 
@@ -28,7 +30,8 @@ class PeerMessageSender {
     NON_BLOCKING_MODE,
 
     // Blocking mode doesn't actually wait for the message to be sent; it just
-    // waits for the message to be queued. This is useful for throttling
+    // waits (for a bounded time) until the messages already queued for the
+    // remote peer fit within its output budget. This is useful for throttling
     // messages that originate from the local interpreter, to prevent them from
     // exhausting the available memory.
     BLOCKING_MODE
@@ -39,6 +42,11 @@ class PeerMessageSender {
   virtual void SendMessageToRemotePeer(const CanonicalPeer* canonical_peer,
                                        const PeerMessage& peer_message,
                                        SendMode send_mode) = 0;
+  // Sends the same message to each of the given peers. The message is only
+  // serialized once.
+  virtual void SendMessageToRemotePeers(
+      const std::vector<const CanonicalPeer*>& canonical_peers,
+      const PeerMessage& peer_message, SendMode send_mode) = 0;
   virtual void BroadcastMessage(const PeerMessage& peer_message,
                                 SendMode send_mode) = 0;
 };
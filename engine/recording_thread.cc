@@ -105,6 +105,8 @@ void RecordingThread::RunProgram(LocalObject* local_object,
       // transaction from this peer.
       transaction_store_->WaitForRewind();
     }
+
+    transaction_store_->WaitBeforeRetry();
   }
 }
 
@@ -336,7 +338,11 @@ bool RecordingThread::CallMethodHelper(
       case TransactionStoreInternalInterface::RESUME:
         // A rewind action was requested, but the rewind does not include the
         // current method call. Discard the old pending transaction and call
-        // the child method again.
+        // the child method again. First back off for a while, so that this
+        // peer doesn't immediately conflict again with the peer that rejected
+        // its transaction.
+        transaction_store_->WaitBeforeRetry();
+
         pending_transaction_.reset(
             new PendingTransaction(
                 transaction_store_, method_base_transaction_id,
@@ -15,7 +15,6 @@
 
 #include "engine/recording_thread.h"
 
-#include <cstddef>
 #include <memory>
 #include <string>
 #include <vector>
@@ -43,7 +42,6 @@
 using google::InitGoogleLogging;
 using google::ParseCommandLineFlags;
 using std::shared_ptr;
-using std::size_t;
 using std::string;
 using std::vector;
 using testing::AnyNumber;
@@ -150,8 +148,8 @@ void CallAppendMethod(MethodContext* method_context,
 
 class TestLocalObject : public LocalObject {
  public:
-  size_t Serialize(void* buffer, size_t buffer_size,
-                   SerializationContext* context) const override {
+  void Serialize(string* data,
+                 SerializationContext* context) const override {
     LOG(FATAL) << "Not implemented.";
   }
 
@@ -732,6 +730,10 @@ TEST(RecordingThreadTest, DISABLED_RewindInPendingTransaction) {
           _, _, _))
       .InSequence(s2);
 
+  // The recording thread should back off once before it resumes execution.
+  EXPECT_CALL(transaction_store_core, WaitBeforeRetry())
+      .Times(1);
+
   RecordingThread recording_thread(&transaction_store);
   LocalObject* const program_object =
       new RewindInPendingTransaction_ProgramObject();
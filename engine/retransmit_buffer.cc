@@ -0,0 +1,112 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/retransmit_buffer.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+
+using std::deque;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace floating_temple {
+namespace engine {
+
+RetransmitBuffer::RetransmitBuffer(int max_message_count,
+                                   int64 max_byte_count)
+    : max_message_count_(
+          static_cast<deque<shared_ptr<const string>>::size_type>(
+              max_message_count)),
+      max_byte_count_(max_byte_count),
+      byte_count_(0),
+      next_sequence_number_(0) {
+  CHECK_GT(max_message_count, 0);
+  CHECK_GT(max_byte_count, 0);
+}
+
+RetransmitBuffer::~RetransmitBuffer() {
+}
+
+uint64 RetransmitBuffer::first_sequence_number() const {
+  return next_sequence_number_ - static_cast<uint64>(messages_.size());
+}
+
+uint64 RetransmitBuffer::AddMessage(
+    const shared_ptr<const string>& formatted_message) {
+  CHECK(formatted_message.get() != nullptr);
+
+  messages_.push_back(formatted_message);
+  byte_count_ += static_cast<int64>(formatted_message->length());
+
+  while (messages_.size() > max_message_count_ ||
+         (byte_count_ > max_byte_count_ && messages_.size() > 1)) {
+    PopFrontMessage();
+  }
+
+  return next_sequence_number_++;
+}
+
+void RetransmitBuffer::Acknowledge(uint64 received_message_count) {
+  if (received_message_count > next_sequence_number_) {
+    LOG(WARNING) << "The remote peer acknowledged " << received_message_count
+                 << " messages, but only " << next_sequence_number_
+                 << " messages have been sent.";
+    received_message_count = next_sequence_number_;
+  }
+
+  while (!messages_.empty() &&
+         first_sequence_number() < received_message_count) {
+    PopFrontMessage();
+  }
+}
+
+uint64 RetransmitBuffer::GetMessages(
+    uint64 start_sequence_number,
+    vector<shared_ptr<const string>>* formatted_messages) const {
+  CHECK(formatted_messages != nullptr);
+
+  const uint64 first = first_sequence_number();
+  if (start_sequence_number < first) {
+    start_sequence_number = first;
+  } else if (start_sequence_number > next_sequence_number_) {
+    start_sequence_number = next_sequence_number_;
+  }
+
+  for (uint64 sequence_number = start_sequence_number;
+       sequence_number < next_sequence_number_; ++sequence_number) {
+    formatted_messages->push_back(
+        messages_[static_cast<deque<shared_ptr<const string>>::size_type>(
+            sequence_number - first)]);
+  }
+
+  return start_sequence_number;
+}
+
+void RetransmitBuffer::PopFrontMessage() {
+  CHECK(!messages_.empty());
+
+  byte_count_ -= static_cast<int64>(messages_.front()->length());
+  messages_.pop_front();
+}
+
+}  // namespace engine
+}  // namespace floating_temple
@@ -0,0 +1,89 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ENGINE_RETRANSMIT_BUFFER_H_
+#define ENGINE_RETRANSMIT_BUFFER_H_
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/macros.h"
+
+namespace floating_temple {
+namespace engine {
+
+// Holds the formatted messages that have been sent to a single remote peer but
+// not yet acknowledged by it, so that they can be sent again if the connection
+// to the remote peer is lost and reestablished.
+//
+// Each message is assigned a sequence number. Sequence numbers start at zero
+// and increase by one for each message. The buffer holds at most
+// 'max_message_count' messages, totaling at most 'max_byte_count' bytes; if
+// it's full, the oldest messages are discarded to make room for the new one.
+// The newest message is always kept, however large it is.
+//
+// This class is not thread-safe.
+class RetransmitBuffer {
+ public:
+  RetransmitBuffer(int max_message_count, int64 max_byte_count);
+  ~RetransmitBuffer();
+
+  // Returns the sequence number that will be assigned to the next message.
+  uint64 next_sequence_number() const { return next_sequence_number_; }
+  // Returns the sequence number of the oldest message in the buffer, or
+  // next_sequence_number() if the buffer is empty.
+  uint64 first_sequence_number() const;
+  // Returns the total size of the messages in the buffer.
+  int64 byte_count() const { return byte_count_; }
+
+  // Adds a message to the buffer and returns its sequence number.
+  uint64 AddMessage(
+      const std::shared_ptr<const std::string>& formatted_message);
+
+  // Discards the messages whose sequence numbers are less than
+  // 'received_message_count'.
+  void Acknowledge(uint64 received_message_count);
+
+  // Appends the messages whose sequence numbers are greater than or equal to
+  // 'start_sequence_number' to *formatted_messages. Returns the sequence
+  // number of the first message that was appended (or that would have been
+  // appended). This is greater than 'start_sequence_number' if some of the
+  // requested messages have already been discarded.
+  uint64 GetMessages(
+      uint64 start_sequence_number,
+      std::vector<std::shared_ptr<const std::string>>* formatted_messages)
+      const;
+
+ private:
+  void PopFrontMessage();
+
+  const std::deque<std::shared_ptr<const std::string>>::size_type
+      max_message_count_;
+  const int64 max_byte_count_;
+
+  std::deque<std::shared_ptr<const std::string>> messages_;
+  int64 byte_count_;
+  uint64 next_sequence_number_;
+
+  DISALLOW_COPY_AND_ASSIGN(RetransmitBuffer);
+};
+
+}  // namespace engine
+}  // namespace floating_temple
+
+#endif  // ENGINE_RETRANSMIT_BUFFER_H_
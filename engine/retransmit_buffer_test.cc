@@ -0,0 +1,122 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/retransmit_buffer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+shared_ptr<const string> MakeMessage(const string& content) {
+  return make_shared<const string>(content);
+}
+
+TEST(RetransmitBufferTest, ResendUnacknowledgedMessages) {
+  RetransmitBuffer retransmit_buffer(10, 1000);
+
+  EXPECT_EQ(0u, retransmit_buffer.AddMessage(MakeMessage("a")));
+  EXPECT_EQ(1u, retransmit_buffer.AddMessage(MakeMessage("b")));
+  EXPECT_EQ(2u, retransmit_buffer.AddMessage(MakeMessage("c")));
+
+  retransmit_buffer.Acknowledge(1);
+  EXPECT_EQ(1u, retransmit_buffer.first_sequence_number());
+
+  vector<shared_ptr<const string>> formatted_messages;
+  EXPECT_EQ(2u, retransmit_buffer.GetMessages(2, &formatted_messages));
+  ASSERT_EQ(1u, formatted_messages.size());
+  EXPECT_EQ("c", *formatted_messages[0]);
+
+  // Messages that have already been acknowledged can't be resent.
+  formatted_messages.clear();
+  EXPECT_EQ(1u, retransmit_buffer.GetMessages(0, &formatted_messages));
+  ASSERT_EQ(2u, formatted_messages.size());
+  EXPECT_EQ("b", *formatted_messages[0]);
+  EXPECT_EQ("c", *formatted_messages[1]);
+}
+
+TEST(RetransmitBufferTest, DiscardOldestMessageWhenFull) {
+  RetransmitBuffer retransmit_buffer(2, 1000);
+
+  retransmit_buffer.AddMessage(MakeMessage("a"));
+  retransmit_buffer.AddMessage(MakeMessage("b"));
+  retransmit_buffer.AddMessage(MakeMessage("c"));
+
+  EXPECT_EQ(1u, retransmit_buffer.first_sequence_number());
+  EXPECT_EQ(3u, retransmit_buffer.next_sequence_number());
+
+  vector<shared_ptr<const string>> formatted_messages;
+  EXPECT_EQ(1u, retransmit_buffer.GetMessages(0, &formatted_messages));
+  ASSERT_EQ(2u, formatted_messages.size());
+  EXPECT_EQ("b", *formatted_messages[0]);
+  EXPECT_EQ("c", *formatted_messages[1]);
+
+  // An acknowledgement for messages that haven't been sent empties the buffer.
+  retransmit_buffer.Acknowledge(100);
+  EXPECT_EQ(3u, retransmit_buffer.first_sequence_number());
+
+  formatted_messages.clear();
+  EXPECT_EQ(3u, retransmit_buffer.GetMessages(5, &formatted_messages));
+  EXPECT_TRUE(formatted_messages.empty());
+}
+
+TEST(RetransmitBufferTest, DiscardOldestMessagesWhenOverByteLimit) {
+  RetransmitBuffer retransmit_buffer(10, 10);
+
+  retransmit_buffer.AddMessage(MakeMessage("aaaa"));
+  retransmit_buffer.AddMessage(MakeMessage("bbbb"));
+  EXPECT_EQ(0u, retransmit_buffer.first_sequence_number());
+  EXPECT_EQ(8, retransmit_buffer.byte_count());
+
+  retransmit_buffer.AddMessage(MakeMessage("cccc"));
+  EXPECT_EQ(1u, retransmit_buffer.first_sequence_number());
+  EXPECT_EQ(8, retransmit_buffer.byte_count());
+
+  // A message that's larger than the limit by itself is still kept.
+  retransmit_buffer.AddMessage(MakeMessage("dddddddddddd"));
+  EXPECT_EQ(3u, retransmit_buffer.first_sequence_number());
+  EXPECT_EQ(12, retransmit_buffer.byte_count());
+
+  retransmit_buffer.Acknowledge(4);
+  EXPECT_EQ(0, retransmit_buffer.byte_count());
+}
+
+}  // namespace
+}  // namespace engine
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
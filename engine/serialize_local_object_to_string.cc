@@ -31,44 +31,20 @@ using std::vector;
 
 namespace floating_temple {
 namespace engine {
-namespace {
 
-size_t TryToSerialize(const LocalObject* local_object,
-                      void* buffer,
-                      size_t buffer_size,
-                      vector<ObjectReferenceImpl*>* object_references) {
+void SerializeLocalObjectToString(
+    const LocalObject* local_object, size_t size_hint, string* data,
+    vector<ObjectReferenceImpl*>* object_references) {
   CHECK(local_object != nullptr);
+  CHECK(data != nullptr);
   CHECK(object_references != nullptr);
 
   object_references->clear();
+  data->clear();
+  data->reserve(size_hint);
 
   SerializationContextImpl context(object_references);
-  return local_object->Serialize(buffer, buffer_size, &context);
-}
-
-}  // namespace
-
-void SerializeLocalObjectToString(
-    const LocalObject* local_object, string* data,
-    vector<ObjectReferenceImpl*>* object_references) {
-  CHECK(data != nullptr);
-
-  char static_buffer[1000];
-  const size_t data_size = TryToSerialize(local_object, static_buffer,
-                                          sizeof static_buffer,
-                                          object_references);
-
-  if (data_size <= sizeof static_buffer) {
-    data->assign(static_buffer, data_size);
-    return;
-  }
-
-  char* const dynamic_buffer = new char[data_size];
-  CHECK_EQ(TryToSerialize(local_object, dynamic_buffer, data_size,
-                          object_references), data_size);
-
-  data->assign(dynamic_buffer, data_size);
-  delete[] dynamic_buffer;
+  local_object->Serialize(data, &context);
 }
 
 LocalObject* DeserializeLocalObjectFromString(
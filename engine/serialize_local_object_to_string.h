@@ -16,6 +16,7 @@
 #ifndef ENGINE_SERIALIZE_LOCAL_OBJECT_TO_STRING_H_
 #define ENGINE_SERIALIZE_LOCAL_OBJECT_TO_STRING_H_
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -28,8 +29,12 @@ namespace engine {
 
 class ObjectReferenceImpl;
 
+// Serializes the local object to *data in a single pass. 'size_hint' is the
+// expected size of the serialized form (e.g., the size of an earlier version of
+// the object), or zero if it's unknown; it's used to reserve space in *data up
+// front.
 void SerializeLocalObjectToString(
-    const LocalObject* local_object, std::string* data,
+    const LocalObject* local_object, std::size_t size_hint, std::string* data,
     std::vector<ObjectReferenceImpl*>* object_references);
 
 LocalObject* DeserializeLocalObjectFromString(
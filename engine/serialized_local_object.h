@@ -0,0 +1,41 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ENGINE_SERIALIZED_LOCAL_OBJECT_H_
+#define ENGINE_SERIALIZED_LOCAL_OBJECT_H_
+
+#include <string>
+#include <vector>
+
+namespace floating_temple {
+namespace engine {
+
+class ObjectReferenceImpl;
+
+// The serialized form of a local object, as produced by
+// SerializeLocalObjectToString. Instances are shared through
+// std::shared_ptr<const SerializedLocalObject> and never modified after they're
+// produced, so they can be read from any thread without copying.
+struct SerializedLocalObject {
+  std::string data;
+  // The objects that the local object refers to, indexed by the numbers that
+  // appear in 'data'.
+  std::vector<ObjectReferenceImpl*> object_references;
+};
+
+}  // namespace engine
+}  // namespace floating_temple
+
+#endif  // ENGINE_SERIALIZED_LOCAL_OBJECT_H_
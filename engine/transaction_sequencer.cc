@@ -15,9 +15,11 @@
 
 #include "engine/transaction_sequencer.h"
 
-#include <map>
+#include <algorithm>
+#include <deque>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "base/logging.h"
@@ -31,7 +33,8 @@
 #include "engine/transaction_id_generator.h"
 #include "engine/transaction_id_util.h"
 
-using std::map;
+using std::deque;
+using std::lower_bound;
 using std::unique_ptr;
 using std::vector;
 
@@ -39,6 +42,10 @@ namespace floating_temple {
 namespace engine {
 
 struct TransactionSequencer::Transaction {
+  TransactionId transaction_id;
+  // Messages that are waiting for the earlier transactions to be released.
+  // This list is always empty for the first transaction in transactions_,
+  // because its messages are sent as soon as they're queued.
   vector<unique_ptr<OutgoingMessage>> outgoing_messages;
   bool done;
 };
@@ -65,114 +72,188 @@ void TransactionSequencer::ReserveTransaction(TransactionId* transaction_id) {
   transaction_id_generator_->Generate(transaction_id);
 
   if (!transactions_.empty()) {
-    CHECK_LT(transactions_.rbegin()->first, *transaction_id);
+    CHECK_LT(transactions_.back()->transaction_id, *transaction_id);
   }
 
   Transaction* const transaction = new Transaction();
+  transaction->transaction_id = *transaction_id;
   transaction->done = false;
-  // TODO(dss): Provide a hint to map<...>::emplace that the new map entry is
-  // being inserted at the end.
-  CHECK(transactions_.emplace(*transaction_id,
-                              unique_ptr<Transaction>(transaction)).second);
+  transactions_.emplace_back(transaction);
 }
 
 void TransactionSequencer::ReleaseTransaction(
     const TransactionId& transaction_id) {
-  MutexLock lock(&mu_);
+  {
+    MutexLock lock(&mu_);
 
-  const map<TransactionId, unique_ptr<Transaction>>::iterator it =
-      transactions_.find(transaction_id);
-  CHECK(it != transactions_.end());
+    Transaction* const transaction = FindTransaction_Locked(transaction_id);
+    CHECK(!transaction->done);
+    transaction->done = true;
+
+    if (!IsFirstTransaction_Locked(transaction)) {
+      // The transaction will be removed when the earlier transactions are
+      // released.
+      return;
+    }
+  }
+
+  MutexLock send_lock(&send_mu_);
 
-  Transaction* const transaction = it->second.get();
-  CHECK(!transaction->done);
-  transaction->done = true;
+  vector<unique_ptr<OutgoingMessage>> messages;
+  {
+    MutexLock lock(&mu_);
+    TakeReadyMessages_Locked(&messages);
+  }
 
-  FlushMessages_Locked();
+  for (const unique_ptr<OutgoingMessage>& message : messages) {
+    SendOutgoingMessage(message->type, message->remote_peers,
+                        message->peer_message, message->send_mode);
+  }
 }
 
 void TransactionSequencer::SendMessageToRemotePeer(
     const CanonicalPeer* canonical_peer, const PeerMessage& peer_message,
     PeerMessageSender::SendMode send_mode) {
-  QueueOutgoingMessage(OutgoingMessage::UNICAST, canonical_peer, peer_message,
-                       send_mode);
+  CHECK(canonical_peer != nullptr);
+
+  QueueOutgoingMessage(OutgoingMessage::UNICAST,
+                       vector<const CanonicalPeer*>(1, canonical_peer),
+                       peer_message, send_mode);
+}
+
+void TransactionSequencer::SendMessageToRemotePeers(
+    const vector<const CanonicalPeer*>& canonical_peers,
+    const PeerMessage& peer_message, PeerMessageSender::SendMode send_mode) {
+  if (canonical_peers.empty()) {
+    return;
+  }
+
+  QueueOutgoingMessage(OutgoingMessage::MULTICAST, canonical_peers,
+                       peer_message, send_mode);
 }
 
 void TransactionSequencer::BroadcastMessage(
     const PeerMessage& peer_message, PeerMessageSender::SendMode send_mode) {
-  QueueOutgoingMessage(OutgoingMessage::BROADCAST, nullptr, peer_message,
+  QueueOutgoingMessage(OutgoingMessage::BROADCAST,
+                       vector<const CanonicalPeer*>(), peer_message,
                        send_mode);
 }
 
 void TransactionSequencer::QueueOutgoingMessage(
     OutgoingMessage::Type type,
-    const CanonicalPeer* remote_peer,
+    const vector<const CanonicalPeer*>& remote_peers,
     const PeerMessage& peer_message,
     PeerMessageSender::SendMode send_mode) {
-  OutgoingMessage* const outgoing_message = new OutgoingMessage();
-  outgoing_message->type = type;
-  outgoing_message->remote_peer = remote_peer;
-  // TODO(dss): As an optimization, don't make a copy of the peer message if it
-  // can be sent immediately.
-  outgoing_message->peer_message.CopyFrom(peer_message);
-  outgoing_message->send_mode = send_mode;
-
   const TransactionId* const transaction_id =
       ExtractTransactionIdFromPeerMessage(peer_message);
 
   if (transaction_id == nullptr) {
-    SendOutgoingMessage(*outgoing_message);
-    delete outgoing_message;
-  } else {
+    SendOutgoingMessage(type, remote_peers, peer_message, send_mode);
+    return;
+  }
+
+  {
     MutexLock lock(&mu_);
 
-    const map<TransactionId, unique_ptr<Transaction>>::iterator it =
-        transactions_.find(*transaction_id);
-    CHECK(it != transactions_.end());
-    it->second->outgoing_messages.emplace_back(outgoing_message);
+    Transaction* const transaction = FindTransaction_Locked(*transaction_id);
 
-    FlushMessages_Locked();
-  }
-}
+    if (!IsFirstTransaction_Locked(transaction)) {
+      // The message must wait for the earlier transactions to be released, so
+      // it has to be copied.
+      OutgoingMessage* const outgoing_message = new OutgoingMessage();
+      outgoing_message->type = type;
+      outgoing_message->remote_peers = remote_peers;
+      outgoing_message->peer_message.CopyFrom(peer_message);
+      outgoing_message->send_mode = send_mode;
 
-void TransactionSequencer::FlushMessages_Locked() {
-  for (;;) {
-    const map<TransactionId, unique_ptr<Transaction>>::iterator transaction_it =
-        transactions_.begin();
-    if (transaction_it == transactions_.end()) {
+      transaction->outgoing_messages.emplace_back(outgoing_message);
       return;
     }
+  }
 
-    const Transaction& transaction = *transaction_it->second;
+  // The transaction is the first pending transaction, and it will remain so
+  // until it's released. The message can be sent right away without being
+  // copied. Locking send_mu_ ensures that any messages for earlier
+  // transactions that another thread is still sending are sent first.
+  MutexLock send_lock(&send_mu_);
+  {
+    MutexLock lock(&mu_);
+
+    const Transaction* const transaction = FindTransaction_Locked(
+        *transaction_id);
+    CHECK(IsFirstTransaction_Locked(transaction));
+    CHECK(transaction->outgoing_messages.empty());
+  }
+
+  SendOutgoingMessage(type, remote_peers, peer_message, send_mode);
+}
+
+TransactionSequencer::Transaction*
+TransactionSequencer::FindTransaction_Locked(
+    const TransactionId& transaction_id) {
+  const deque<unique_ptr<Transaction>>::iterator it = lower_bound(
+      transactions_.begin(), transactions_.end(), transaction_id,
+      TransactionIdLessThan);
+  CHECK(it != transactions_.end());
+
+  Transaction* const transaction = it->get();
+  CHECK_EQ(transaction->transaction_id, transaction_id);
+
+  return transaction;
+}
+
+bool TransactionSequencer::IsFirstTransaction_Locked(
+    const Transaction* transaction) const {
+  return !transactions_.empty() && transactions_.front().get() == transaction;
+}
+
+void TransactionSequencer::TakeReadyMessages_Locked(
+    vector<unique_ptr<OutgoingMessage>>* messages) {
+  CHECK(messages != nullptr);
+
+  while (!transactions_.empty()) {
+    Transaction* const transaction = transactions_.front().get();
 
-    for (const auto& message : transaction.outgoing_messages) {
-      SendOutgoingMessage(*message);
+    for (unique_ptr<OutgoingMessage>& message :
+             transaction->outgoing_messages) {
+      messages->push_back(std::move(message));
     }
+    transaction->outgoing_messages.clear();
 
-    if (!transaction.done) {
+    if (!transaction->done) {
       return;
     }
 
-    transactions_.erase(transaction_it);
+    transactions_.pop_front();
   }
 }
 
-void TransactionSequencer::SendOutgoingMessage(
-    const OutgoingMessage& outgoing_message) {
-  const OutgoingMessage::Type type = outgoing_message.type;
-  const CanonicalPeer* remote_peer = outgoing_message.remote_peer;
-  const PeerMessage& peer_message = outgoing_message.peer_message;
-  const PeerMessageSender::SendMode send_mode = outgoing_message.send_mode;
+// static
+bool TransactionSequencer::TransactionIdLessThan(
+    const unique_ptr<Transaction>& transaction,
+    const TransactionId& transaction_id) {
+  return transaction->transaction_id < transaction_id;
+}
 
+void TransactionSequencer::SendOutgoingMessage(
+    OutgoingMessage::Type type,
+    const vector<const CanonicalPeer*>& remote_peers,
+    const PeerMessage& peer_message,
+    PeerMessageSender::SendMode send_mode) {
   switch (type) {
     case OutgoingMessage::UNICAST:
-      CHECK(remote_peer != nullptr);
-      peer_message_sender_->SendMessageToRemotePeer(remote_peer, peer_message,
-                                                    send_mode);
+      CHECK_EQ(remote_peers.size(), 1u);
+      peer_message_sender_->SendMessageToRemotePeer(remote_peers[0],
+                                                    peer_message, send_mode);
+      break;
+
+    case OutgoingMessage::MULTICAST:
+      peer_message_sender_->SendMessageToRemotePeers(remote_peers,
+                                                     peer_message, send_mode);
       break;
 
     case OutgoingMessage::BROADCAST:
-      CHECK(remote_peer == nullptr);
+      CHECK(remote_peers.empty());
       peer_message_sender_->BroadcastMessage(peer_message, send_mode);
       break;
 
@@ -16,8 +16,9 @@
 #ifndef ENGINE_TRANSACTION_SEQUENCER_H_
 #define ENGINE_TRANSACTION_SEQUENCER_H_
 
-#include <map>
+#include <deque>
 #include <memory>
+#include <vector>
 
 #include "base/macros.h"
 #include "base/mutex.h"
@@ -34,6 +35,13 @@ class PeerMessage;
 class PeerMessageSender;
 class TransactionIdGenerator;
 
+// Delivers the messages associated with local transactions to remote peers in
+// transaction ID order. Messages for a transaction are held back until every
+// earlier reserved transaction has been released, and each message is sent
+// exactly once. Messages that aren't associated with a transaction are sent
+// immediately.
+//
+// This class is thread-safe.
 class TransactionSequencer {
  public:
   TransactionSequencer(CanonicalPeerMap* canonical_peer_map,
@@ -48,6 +56,9 @@ class TransactionSequencer {
   void SendMessageToRemotePeer(const CanonicalPeer* canonical_peer,
                                const PeerMessage& peer_message,
                                PeerMessageSender::SendMode send_mode);
+  void SendMessageToRemotePeers(
+      const std::vector<const CanonicalPeer*>& canonical_peers,
+      const PeerMessage& peer_message, PeerMessageSender::SendMode send_mode);
   void BroadcastMessage(const PeerMessage& peer_message,
                         PeerMessageSender::SendMode send_mode);
 
@@ -55,20 +66,41 @@ class TransactionSequencer {
   struct Transaction;
 
   struct OutgoingMessage {
-    enum Type { UNICAST, BROADCAST };
+    enum Type { UNICAST, MULTICAST, BROADCAST };
 
     Type type;
-    const CanonicalPeer* remote_peer;
+    // Contains exactly one peer for UNICAST, and is empty for BROADCAST.
+    std::vector<const CanonicalPeer*> remote_peers;
     PeerMessage peer_message;
     PeerMessageSender::SendMode send_mode;
   };
 
   void QueueOutgoingMessage(OutgoingMessage::Type type,
-                            const CanonicalPeer* remote_peer,
+                            const std::vector<const CanonicalPeer*>&
+                                remote_peers,
                             const PeerMessage& peer_message,
                             PeerMessageSender::SendMode send_mode);
-  void FlushMessages_Locked();
-  void SendOutgoingMessage(const OutgoingMessage& outgoing_message);
+
+  // Returns the pending transaction with the given ID. Crashes if there is no
+  // such transaction.
+  Transaction* FindTransaction_Locked(const TransactionId& transaction_id);
+  // Returns true if the given transaction is the earliest pending transaction.
+  bool IsFirstTransaction_Locked(const Transaction* transaction) const;
+  // Removes the queued messages that are ready to be sent from their
+  // transactions, and appends them to *messages in the order in which they
+  // must be sent. Removes the transactions that are done.
+  void TakeReadyMessages_Locked(
+      std::vector<std::unique_ptr<OutgoingMessage>>* messages);
+
+  static bool TransactionIdLessThan(
+      const std::unique_ptr<Transaction>& transaction,
+      const TransactionId& transaction_id);
+
+  void SendOutgoingMessage(OutgoingMessage::Type type,
+                           const std::vector<const CanonicalPeer*>&
+                               remote_peers,
+                           const PeerMessage& peer_message,
+                           PeerMessageSender::SendMode send_mode);
 
   const TransactionId* ExtractTransactionIdFromPeerMessage(
       const PeerMessage& peer_message) const;
@@ -79,7 +111,15 @@ class TransactionSequencer {
   TransactionIdGenerator* const transaction_id_generator_;
   const CanonicalPeer* const local_peer_;
 
-  std::map<TransactionId, std::unique_ptr<Transaction>> transactions_;
+  // Serializes the calls to *peer_message_sender_ for messages that are
+  // associated with transactions, so that they are sent in transaction ID
+  // order. If both mutexes are needed, send_mu_ must be locked first.
+  Mutex send_mu_;
+
+  // Pending transactions, sorted by transaction ID. Transaction IDs are
+  // generated in increasing order, so new transactions are always appended to
+  // the end, and transactions are only ever removed from the front.
+  std::deque<std::unique_ptr<Transaction>> transactions_;
   mutable Mutex mu_;
 
   DISALLOW_COPY_AND_ASSIGN(TransactionSequencer);
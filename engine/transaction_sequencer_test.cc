@@ -0,0 +1,248 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "engine/transaction_sequencer.h"
+
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "engine/canonical_peer_map.h"
+#include "engine/get_peer_message_type.h"
+#include "engine/mock_peer_message_sender.h"
+#include "engine/peer_message_sender.h"
+#include "engine/proto/peer.pb.h"
+#include "engine/proto/transaction_id.pb.h"
+#include "engine/transaction_id_generator.h"
+#include "engine/transaction_id_util.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+#include "third_party/gmock-1.7.0/include/gmock/gmock.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::vector;
+using testing::InSequence;
+using testing::InitGoogleMock;
+using testing::Mock;
+using testing::StrictMock;
+using testing::_;
+
+namespace floating_temple {
+namespace engine {
+namespace {
+
+// Matches an APPLY_TRANSACTION message with the given transaction ID and number
+// of object transactions. (The tests use the number of object transactions to
+// tell messages apart.)
+MATCHER_P2(IsApplyTransactionMessage, transaction_id, tag, "") {
+  if (GetPeerMessageType(arg) != PeerMessage::APPLY_TRANSACTION) {
+    return false;
+  }
+
+  const ApplyTransactionMessage& apply_transaction_message =
+      arg.apply_transaction_message();
+  return apply_transaction_message.transaction_id() == transaction_id &&
+      apply_transaction_message.object_transaction_size() == tag;
+}
+
+MATCHER_P(HasTestMessageText, text, "") {
+  return GetPeerMessageType(arg) == PeerMessage::TEST &&
+      arg.test_message().text() == text;
+}
+
+PeerMessage MakeApplyTransactionMessage(const TransactionId& transaction_id,
+                                        int tag) {
+  PeerMessage peer_message;
+  ApplyTransactionMessage* const apply_transaction_message =
+      peer_message.mutable_apply_transaction_message();
+  *apply_transaction_message->mutable_transaction_id() = transaction_id;
+  for (int i = 0; i < tag; ++i) {
+    apply_transaction_message->add_object_transaction();
+  }
+  return peer_message;
+}
+
+PeerMessage MakeTestMessage(const char* text) {
+  PeerMessage peer_message;
+  peer_message.mutable_test_message()->set_text(text);
+  return peer_message;
+}
+
+TEST(TransactionSequencerTest, MessagesAreSentInOrderExactlyOnce) {
+  CanonicalPeerMap canonical_peer_map;
+  StrictMock<MockPeerMessageSender> peer_message_sender;
+  TransactionIdGenerator transaction_id_generator;
+  const CanonicalPeer* const local_peer = canonical_peer_map.GetCanonicalPeer(
+      "test-local-peer-id");
+  const CanonicalPeer* const remote_peer = canonical_peer_map.GetCanonicalPeer(
+      "test-remote-peer-id");
+
+  TransactionSequencer transaction_sequencer(&canonical_peer_map,
+                                             &peer_message_sender,
+                                             &transaction_id_generator,
+                                             local_peer);
+
+  TransactionId transaction_id1;
+  TransactionId transaction_id2;
+  transaction_sequencer.ReserveTransaction(&transaction_id1);
+  transaction_sequencer.ReserveTransaction(&transaction_id2);
+
+  // The message for the second transaction must wait for the first
+  // transaction.
+  transaction_sequencer.BroadcastMessage(
+      MakeApplyTransactionMessage(transaction_id2, 1),
+      PeerMessageSender::NON_BLOCKING_MODE);
+  Mock::VerifyAndClearExpectations(&peer_message_sender);
+
+  {
+    InSequence s;
+
+    EXPECT_CALL(peer_message_sender,
+                BroadcastMessage(
+                    IsApplyTransactionMessage(transaction_id1, 2), _))
+        .Times(1);
+    EXPECT_CALL(peer_message_sender,
+                SendMessageToRemotePeer(
+                    remote_peer, IsApplyTransactionMessage(transaction_id1, 3),
+                    _))
+        .Times(1);
+  }
+
+  transaction_sequencer.BroadcastMessage(
+      MakeApplyTransactionMessage(transaction_id1, 2),
+      PeerMessageSender::NON_BLOCKING_MODE);
+  transaction_sequencer.SendMessageToRemotePeer(
+      remote_peer, MakeApplyTransactionMessage(transaction_id1, 3),
+      PeerMessageSender::NON_BLOCKING_MODE);
+  Mock::VerifyAndClearExpectations(&peer_message_sender);
+
+  // Releasing the first transaction sends the queued message for the second
+  // transaction. The messages for the first transaction aren't sent again.
+  EXPECT_CALL(peer_message_sender,
+              BroadcastMessage(IsApplyTransactionMessage(transaction_id2, 1),
+                               _))
+      .Times(1);
+  transaction_sequencer.ReleaseTransaction(transaction_id1);
+  Mock::VerifyAndClearExpectations(&peer_message_sender);
+
+  EXPECT_CALL(peer_message_sender,
+              BroadcastMessage(IsApplyTransactionMessage(transaction_id2, 4),
+                               _))
+      .Times(1);
+  transaction_sequencer.BroadcastMessage(
+      MakeApplyTransactionMessage(transaction_id2, 4),
+      PeerMessageSender::NON_BLOCKING_MODE);
+  transaction_sequencer.ReleaseTransaction(transaction_id2);
+}
+
+TEST(TransactionSequencerTest, TransactionsReleasedOutOfOrder) {
+  CanonicalPeerMap canonical_peer_map;
+  StrictMock<MockPeerMessageSender> peer_message_sender;
+  TransactionIdGenerator transaction_id_generator;
+  const CanonicalPeer* const local_peer = canonical_peer_map.GetCanonicalPeer(
+      "test-local-peer-id");
+
+  TransactionSequencer transaction_sequencer(&canonical_peer_map,
+                                             &peer_message_sender,
+                                             &transaction_id_generator,
+                                             local_peer);
+
+  TransactionId transaction_id1;
+  TransactionId transaction_id2;
+  TransactionId transaction_id3;
+  transaction_sequencer.ReserveTransaction(&transaction_id1);
+  transaction_sequencer.ReserveTransaction(&transaction_id2);
+  transaction_sequencer.ReserveTransaction(&transaction_id3);
+
+  transaction_sequencer.BroadcastMessage(
+      MakeApplyTransactionMessage(transaction_id3, 3),
+      PeerMessageSender::NON_BLOCKING_MODE);
+  transaction_sequencer.BroadcastMessage(
+      MakeApplyTransactionMessage(transaction_id2, 2),
+      PeerMessageSender::NON_BLOCKING_MODE);
+  transaction_sequencer.ReleaseTransaction(transaction_id3);
+  transaction_sequencer.ReleaseTransaction(transaction_id2);
+
+  // Messages that aren't associated with a transaction aren't delayed.
+  EXPECT_CALL(peer_message_sender,
+              BroadcastMessage(HasTestMessageText("hello"), _))
+      .Times(1);
+  transaction_sequencer.BroadcastMessage(MakeTestMessage("hello"),
+                                         PeerMessageSender::NON_BLOCKING_MODE);
+  Mock::VerifyAndClearExpectations(&peer_message_sender);
+
+  {
+    InSequence s;
+
+    EXPECT_CALL(peer_message_sender,
+                BroadcastMessage(
+                    IsApplyTransactionMessage(transaction_id2, 2), _))
+        .Times(1);
+    EXPECT_CALL(peer_message_sender,
+                BroadcastMessage(
+                    IsApplyTransactionMessage(transaction_id3, 3), _))
+        .Times(1);
+  }
+
+  transaction_sequencer.ReleaseTransaction(transaction_id1);
+}
+
+TEST(TransactionSequencerTest, MulticastMessageIsSentOnce) {
+  CanonicalPeerMap canonical_peer_map;
+  StrictMock<MockPeerMessageSender> peer_message_sender;
+  TransactionIdGenerator transaction_id_generator;
+  const CanonicalPeer* const local_peer = canonical_peer_map.GetCanonicalPeer(
+      "test-local-peer-id");
+
+  vector<const CanonicalPeer*> remote_peers;
+  remote_peers.push_back(canonical_peer_map.GetCanonicalPeer("peer-a"));
+  remote_peers.push_back(canonical_peer_map.GetCanonicalPeer("peer-b"));
+
+  TransactionSequencer transaction_sequencer(&canonical_peer_map,
+                                             &peer_message_sender,
+                                             &transaction_id_generator,
+                                             local_peer);
+
+  TransactionId transaction_id1;
+  TransactionId transaction_id2;
+  transaction_sequencer.ReserveTransaction(&transaction_id1);
+  transaction_sequencer.ReserveTransaction(&transaction_id2);
+
+  transaction_sequencer.SendMessageToRemotePeers(
+      remote_peers, MakeApplyTransactionMessage(transaction_id2, 1),
+      PeerMessageSender::BLOCKING_MODE);
+  Mock::VerifyAndClearExpectations(&peer_message_sender);
+
+  EXPECT_CALL(peer_message_sender,
+              SendMessageToRemotePeers(
+                  remote_peers, IsApplyTransactionMessage(transaction_id2, 1),
+                  PeerMessageSender::BLOCKING_MODE))
+      .Times(1);
+
+  transaction_sequencer.ReleaseTransaction(transaction_id1);
+  transaction_sequencer.ReleaseTransaction(transaction_id2);
+}
+
+}  // namespace
+}  // namespace engine
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
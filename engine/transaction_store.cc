@@ -32,6 +32,8 @@
 #include "engine/canonical_peer.h"
 #include "engine/canonical_peer_map.h"
 #include "engine/committed_event.h"
+#include "engine/compact_event_encoding.h"
+#include "engine/contention_manager.h"
 #include "engine/convert_value.h"
 #include "engine/get_event_proto_type.h"
 #include "engine/get_peer_message_type.h"
@@ -48,6 +50,7 @@
 #include "engine/recording_thread.h"
 #include "engine/sequence_point_impl.h"
 #include "engine/serialize_local_object_to_string.h"
+#include "engine/serialized_local_object.h"
 #include "engine/shared_object.h"
 #include "engine/shared_object_transaction.h"
 #include "engine/transaction_id_generator.h"
@@ -116,6 +119,11 @@ void TransactionStore::RunProgram(LocalObject* local_object,
     CHECK(recording_thread_ == &thread);
     recording_thread_ = nullptr;
   }
+
+  if (contention_manager_.total_conflict_count() > 0) {
+    LOG(INFO) << "Contention statistics: "
+              << GetJsonString(contention_manager_);
+  }
 }
 
 void TransactionStore::NotifyNewConnection(const CanonicalPeer* remote_peer) {
@@ -390,6 +398,10 @@ void TransactionStore::WaitForRewind() {
   rejected_transaction_id_ = MIN_TRANSACTION_ID;
 }
 
+void TransactionStore::WaitBeforeRetry() {
+  contention_manager_.WaitBeforeRetry();
+}
+
 void TransactionStore::HandleApplyTransactionMessage(
     const CanonicalPeer* remote_peer,
     const ApplyTransactionMessage& apply_transaction_message) {
@@ -497,6 +509,12 @@ void TransactionStore::HandleGetObjectMessage(
         transaction->origin_peer()->peer_id());
   }
 
+  // The events are encoded in the newest version. The connections to peers
+  // that can only read an older version re-encode them.
+  if (FLAGS_encode_peer_message_events) {
+    EncodeEventsInMessage(kCompactEventEncodingVersion, &reply);
+  }
+
   for (const auto& version_pair : effective_version.peer_transaction_ids()) {
     PeerVersion* const peer_version = store_object_message->add_peer_version();
     peer_version->set_peer_id(version_pair.first->peer_id());
@@ -567,6 +585,8 @@ void TransactionStore::HandleStoreObjectMessage(
   shared_object->StoreTransactions(remote_peer, transactions, version_map,
                                    &new_object_references,
                                    &all_transactions_to_reject);
+  contention_manager_.RecordConflicts(
+      object_id, static_cast<int>(all_transactions_to_reject.size()));
 
   for (int i = 0; i < store_object_message.interested_peer_id_size(); ++i) {
     const string& interested_peer_id =
@@ -702,6 +722,10 @@ TransactionStore::GetLiveObjectAtSequencePoint_Helper(
           << GetJsonString(current_version_map);
   VLOG(4) << "Sequence point: " << GetJsonString(sequence_point_impl);
 
+  // The conflicts found here aren't recorded in contention_manager_. The same
+  // transactions are found again on every read of the object until the
+  // rejection propagates, so they're only counted where the rejection is first
+  // issued (in ApplyTransaction and HandleStoreObjectMessage).
   vector<pair<const CanonicalPeer*, TransactionId>> transactions_to_reject;
   const shared_ptr<const LiveObject> live_object =
       shared_object->GetWorkingVersion(current_version_map, sequence_point_impl,
@@ -746,6 +770,11 @@ void TransactionStore::ApplyTransactionAndSendMessage(
     CHECK(affected_objects.insert(shared_object).second);
   }
 
+  // See the comment in HandleGetObjectMessage.
+  if (FLAGS_encode_peer_message_events) {
+    EncodeEventsInMessage(kCompactEventEncodingVersion, &peer_message);
+  }
+
   ApplyTransaction(transaction_id, local_peer_, shared_object_transactions);
 
   SendMessageToAffectedPeers(peer_message, affected_objects);
@@ -777,6 +806,9 @@ void TransactionStore::ApplyTransaction(
                                      origin_peer == local_peer_,
                                      &new_object_references,
                                      &transactions_to_reject);
+    contention_manager_.RecordConflicts(
+        shared_object->object_id(),
+        static_cast<int>(transactions_to_reject.size()));
 
     all_transactions_to_reject.insert(all_transactions_to_reject.end(),
                                       transactions_to_reject.begin(),
@@ -903,10 +935,12 @@ void TransactionStore::SendMessageToAffectedPeers(
 
   all_interested_peers.erase(local_peer_);
 
-  for (const CanonicalPeer* const interested_peer : all_interested_peers) {
-    transaction_sequencer_.SendMessageToRemotePeer(
-        interested_peer, peer_message, PeerMessageSender::BLOCKING_MODE);
-  }
+  // Send the message to all of the interested peers at once, so that it's only
+  // serialized once.
+  const vector<const CanonicalPeer*> interested_peers(
+      all_interested_peers.begin(), all_interested_peers.end());
+  transaction_sequencer_.SendMessageToRemotePeers(
+      interested_peers, peer_message, PeerMessageSender::BLOCKING_MODE);
 }
 
 void TransactionStore::UpdateCurrentSequencePoint(
@@ -1088,11 +1122,14 @@ void TransactionStore::ConvertCommittedEventToEventProto(
       ObjectCreationEventProto* const object_creation_event_proto =
           out->mutable_object_creation();
 
-      vector<ObjectReferenceImpl*> object_references;
-      live_object->Serialize(object_creation_event_proto->mutable_data(),
-                             &object_references);
+      // The serialized form is shared with the live object's cache. It's
+      // copied once, into the event.
+      const shared_ptr<const SerializedLocalObject> serialized_form =
+          live_object->Serialize();
+      object_creation_event_proto->set_data(serialized_form->data);
 
-      for (ObjectReferenceImpl* const object_reference : object_references) {
+      for (ObjectReferenceImpl* const object_reference :
+               serialized_form->object_references) {
         SharedObject* const shared_object = GetSharedObjectForObjectReference(
             object_reference);
         object_creation_event_proto->add_referenced_object_id()->CopyFrom(
@@ -29,6 +29,7 @@
 #include "base/macros.h"
 #include "base/mutex.h"
 #include "engine/connection_handler.h"
+#include "engine/contention_manager.h"
 #include "engine/proto/transaction_id.pb.h"
 #include "engine/proto/uuid.pb.h"
 #include "engine/sequence_point_impl.h"
@@ -115,6 +116,7 @@ class TransactionStore : public ConnectionHandler,
   ExecutionPhase GetExecutionPhase(
       const TransactionId& base_transaction_id) override;
   void WaitForRewind() override;
+  void WaitBeforeRetry() override;
 
   void HandleApplyTransactionMessage(
       const CanonicalPeer* remote_peer,
@@ -202,6 +204,7 @@ class TransactionStore : public ConnectionHandler,
 
   TransactionIdGenerator transaction_id_generator_;
   TransactionSequencer transaction_sequencer_;
+  ContentionManager contention_manager_;
 
   RecordingThread* recording_thread_;
   mutable Mutex recording_thread_mu_;
@@ -66,6 +66,10 @@ class TransactionStoreInternalInterface {
   virtual ExecutionPhase GetExecutionPhase(
       const TransactionId& base_transaction_id) = 0;
   virtual void WaitForRewind() = 0;
+
+  // Called by the recording thread before it retries a method call that was
+  // rewound. May block for a while to reduce contention with other peers.
+  virtual void WaitBeforeRetry() = 0;
 };
 
 }  // namespace engine
@@ -15,8 +15,6 @@
 
 #include "engine/transaction_store.h"
 
-#include <cstddef>
-#include <cstring>
 #include <string>
 #include <vector>
 
@@ -39,8 +37,6 @@
 
 using google::InitGoogleLogging;
 using google::ParseCommandLineFlags;
-using std::memcpy;
-using std::size_t;
 using std::string;
 using std::vector;
 using testing::AnyNumber;
@@ -63,8 +59,8 @@ class TestProgramObject : public LocalObject {
   TestProgramObject() {}
 
   LocalObject* Clone() const override;
-  size_t Serialize(void* buffer, size_t buffer_size,
-                   SerializationContext* context) const override;
+  void Serialize(string* data,
+                 SerializationContext* context) const override;
   void InvokeMethod(MethodContext* method_context,
                     ObjectReference* self_object_reference,
                     const string& method_name,
@@ -80,16 +76,10 @@ LocalObject* TestProgramObject::Clone() const {
   return new TestProgramObject();
 }
 
-size_t TestProgramObject::Serialize(void* buffer, size_t buffer_size,
-                                    SerializationContext* context) const {
-  const string kSerializedForm = "TestProgramObject:";
-  const size_t length = kSerializedForm.length();
-
-  if (length <= buffer_size) {
-    memcpy(buffer, kSerializedForm.data(), length);
-  }
-
-  return length;
+void TestProgramObject::Serialize(string* data,
+                                  SerializationContext* context) const {
+  CHECK(data != nullptr);
+  data->assign("TestProgramObject:");
 }
 
 void TestProgramObject::InvokeMethod(MethodContext* method_context,
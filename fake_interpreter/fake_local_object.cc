@@ -15,8 +15,6 @@
 
 #include "fake_interpreter/fake_local_object.h"
 
-#include <cstddef>
-#include <cstring>
 #include <string>
 #include <vector>
 
@@ -25,8 +23,6 @@
 #include "include/c++/value.h"
 #include "util/dump_context.h"
 
-using std::memcpy;
-using std::size_t;
 using std::string;
 using std::vector;
 
@@ -42,18 +38,13 @@ LocalObject* FakeLocalObject::Clone() const {
   return new FakeLocalObject(s_);
 }
 
-size_t FakeLocalObject::Serialize(void* buffer, size_t buffer_size,
-                                  SerializationContext* context) const {
-  string serialized_form = kSerializationPrefix;
-  serialized_form += s_;
+void FakeLocalObject::Serialize(string* data,
+                                SerializationContext* context) const {
+  CHECK(data != nullptr);
 
-  const string::size_type length = serialized_form.length();
-
-  if (static_cast<string::size_type>(buffer_size) >= length) {
-    memcpy(buffer, serialized_form.data(), length);
-  }
-
-  return static_cast<size_t>(length);
+  data->clear();
+  *data += kSerializationPrefix;
+  *data += s_;
 }
 
 void FakeLocalObject::InvokeMethod(MethodContext* method_context,
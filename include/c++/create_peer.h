@@ -58,10 +58,14 @@ class Peer;
 // 'known_peer_ids' is a list of peer IDs of remote peers that the local peer
 // should connect to at start-up. Once the local peer is up and running, it may
 // discover additional remote peers and connect to them automatically. The
-// engine will crash if it can't connect to one of the peers in
-// 'known_peer_ids', or if 'known_peer_ids' contains the peer ID for the local
-// peer. [TODO(dss): These should not be fatal errors. Instead, the engine
-// should log an error and continue without the bad peer ID.]
+// connections to the known peers are established in parallel, and each one is
+// retried a few times if it fails. This function returns once the local peer
+// is connected to enough of the known peers (all of them, unless the
+// --peer_startup_quorum flag says otherwise), or once it's given up on
+// reaching that many. The engine will crash if 'known_peer_ids' contains the
+// peer ID for the local peer. [TODO(dss): This should not be a fatal error.
+// Instead, the engine should log an error and continue without the bad peer
+// ID.]
 //
 // The format for peer IDs is as follows:
 //
@@ -16,7 +16,6 @@
 #ifndef INCLUDE_CPP_LOCAL_OBJECT_H_
 #define INCLUDE_CPP_LOCAL_OBJECT_H_
 
-#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -46,14 +45,13 @@ class LocalObject {
   // caller must take ownership of the returned LocalObject object.
   virtual LocalObject* Clone() const = 0;
 
-  // buffer points to a writable buffer, and buffer_size is the maximum number
-  // of bytes that can be written to the buffer.
-  //
-  // If the buffer is large enough, this method serializes *this to the buffer
-  // and returns the number of bytes written. Otherwise, it leaves the buffer
-  // untouched and returns the minimum required buffer size, in bytes.
-  virtual std::size_t Serialize(void* buffer, std::size_t buffer_size,
-                                SerializationContext* context) const = 0;
+  // Serializes *this and replaces the contents of *data with the result. The
+  // object should be serialized in a single pass, letting *data grow as
+  // needed. The caller may reserve capacity in *data beforehand, based on the
+  // size of an earlier version of the object; implementations should keep it
+  // (e.g., by calling data->clear() rather than assigning a new string).
+  virtual void Serialize(std::string* data,
+                         SerializationContext* context) const = 0;
 
   // Invokes the specified method on *this and passes it the specified
   // parameters. method_name must not be empty. The method must exist on the
@@ -16,6 +16,7 @@
 #ifndef PROTOCOL_SERVER_FORMAT_PROTOCOL_MESSAGE_H_
 #define PROTOCOL_SERVER_FORMAT_PROTOCOL_MESSAGE_H_
 
+#include <memory>
 #include <string>
 
 #include "base/integral_types.h"
@@ -24,15 +25,14 @@
 
 namespace floating_temple {
 
-template<class Message>
-void FormatProtocolMessage(const Message& message, std::string* output) {
+// Replaces the contents of *output with the length prefix of a message of the
+// given length, and reserves room for the message.
+inline void StartFormattedProtocolMessage(int message_length,
+                                          std::string* output) {
+  CHECK_GE(message_length, 0);
   CHECK(output != nullptr);
 
   output->clear();
-
-  const int message_length = message.ByteSize();
-  CHECK_GE(message_length, 0);
-
   output->reserve(
       static_cast<std::string::size_type>(kMaxVarintLength + message_length));
 
@@ -42,9 +42,45 @@ void FormatProtocolMessage(const Message& message, std::string* output) {
   CHECK_LE(varint_length, kMaxVarintLength);
 
   output->append(buffer, static_cast<std::string::size_type>(varint_length));
+}
+
+template<class Message>
+void FormatProtocolMessage(const Message& message, std::string* output) {
+  StartFormattedProtocolMessage(message.ByteSize(), output);
   CHECK(message.AppendToString(output));
 }
 
+// Like FormatProtocolMessage, but the message may be missing required fields.
+// The recipient must parse it with ParsePartialFromArray (or similar) and fill
+// in the missing fields before using it.
+template<class Message>
+void FormatPartialProtocolMessage(const Message& message,
+                                  std::string* output) {
+  StartFormattedProtocolMessage(message.ByteSize(), output);
+  CHECK(message.AppendPartialToString(output));
+}
+
+// Formats the message into a new immutable buffer. The buffer can be shared by
+// several connections, so that a message sent to many peers is only serialized
+// once.
+template<class Message>
+std::shared_ptr<const std::string> FormatSharedProtocolMessage(
+    const Message& message) {
+  std::string* const output = new std::string();
+  FormatProtocolMessage(message, output);
+  return std::shared_ptr<const std::string>(output);
+}
+
+// Like FormatSharedProtocolMessage, but the message may be missing required
+// fields. (See FormatPartialProtocolMessage.)
+template<class Message>
+std::shared_ptr<const std::string> FormatSharedPartialProtocolMessage(
+    const Message& message) {
+  std::string* const output = new std::string();
+  FormatPartialProtocolMessage(message, output);
+  return std::shared_ptr<const std::string>(output);
+}
+
 }  // namespace floating_temple
 
 #endif  // PROTOCOL_SERVER_FORMAT_PROTOCOL_MESSAGE_H_
@@ -0,0 +1,101 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "protocol_server/frame_decoder.h"
+
+#include <climits>
+#include <vector>
+
+#include "base/logging.h"
+#include "protocol_server/parse_protocol_message.h"
+#include "protocol_server/varint.h"
+
+using std::vector;
+
+namespace floating_temple {
+
+FrameDecoder::FrameDecoder()
+    : pending_header_length_(-1),
+      pending_message_length_(-1) {
+}
+
+int FrameDecoder::DecodeFrames(const char* buffer, int buffer_size,
+                               vector<Frame>* frames) {
+  CHECK_GE(buffer_size, 0);
+  CHECK(frames != nullptr);
+
+  frames->clear();
+
+  int offset = 0;
+
+  while (offset < buffer_size) {
+    const int remaining_size = buffer_size - offset;
+
+    if (pending_header_length_ < 0) {
+      // Most messages are shorter than 128 bytes, so their headers are a
+      // single byte.
+      const unsigned char first_byte = static_cast<unsigned char>(
+          buffer[offset]);
+      if ((first_byte & 0x80) == 0) {
+        pending_header_length_ = 1;
+        pending_message_length_ = static_cast<int>(first_byte);
+      }
+    }
+
+    if (pending_header_length_ < 0) {
+      int message_length = 0;
+      const int header_length = ParseMessageLength(buffer + offset,
+                                                   remaining_size,
+                                                   &message_length);
+      if (header_length == kInvalidVarint ||
+          (header_length > 0 && message_length > INT_MAX - header_length)) {
+        frames->clear();
+        return -1;
+      }
+      if (header_length < 0) {
+        break;
+      }
+
+      pending_header_length_ = header_length;
+      pending_message_length_ = message_length;
+    }
+
+    const int frame_size = pending_header_length_ + pending_message_length_;
+    if (frame_size > remaining_size) {
+      break;
+    }
+
+    Frame frame;
+    frame.offset = offset + pending_header_length_;
+    frame.length = pending_message_length_;
+    frames->push_back(frame);
+
+    offset += frame_size;
+    pending_header_length_ = -1;
+    pending_message_length_ = -1;
+  }
+
+  return offset;
+}
+
+int FrameDecoder::pending_frame_size() const {
+  if (pending_header_length_ < 0) {
+    return -1;
+  }
+
+  return pending_header_length_ + pending_message_length_;
+}
+
+}  // namespace floating_temple
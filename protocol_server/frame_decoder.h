@@ -0,0 +1,73 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROTOCOL_SERVER_FRAME_DECODER_H_
+#define PROTOCOL_SERVER_FRAME_DECODER_H_
+
+#include <vector>
+
+#include "base/macros.h"
+
+namespace floating_temple {
+
+// Splits a stream of received data into frames, each of which is a message
+// preceded by its length as a varint (see FormatProtocolMessage).
+//
+// The decoder remembers the length of the incomplete frame at the end of the
+// data, so that the frame's header isn't parsed again each time more of the
+// frame is received.
+//
+// This class is not thread-safe.
+class FrameDecoder {
+ public:
+  // The location of a message within the buffer passed to DecodeFrames.
+  struct Frame {
+    int offset;
+    int length;
+  };
+
+  FrameDecoder();
+
+  // Finds all of the complete frames at the beginning of the buffer, and
+  // stores the locations of their messages in *frames. Returns the number of
+  // bytes that the frames occupy.
+  //
+  // The caller must discard that many bytes from the beginning of the buffer
+  // before the next call. The next call must be passed the remaining data,
+  // followed by any data that has been received since.
+  //
+  // Returns -1 (and clears *frames) if a frame header is invalid, or if a
+  // frame would be larger than INT_MAX bytes. The data can't be split into
+  // frames after that, so the caller should close the connection.
+  int DecodeFrames(const char* buffer, int buffer_size,
+                   std::vector<Frame>* frames);
+
+  // Returns the total size (including the header) of the incomplete frame at
+  // the end of the data, or -1 if the frame's header hasn't been received
+  // yet.
+  int pending_frame_size() const;
+
+ private:
+  // The header length and message length of the incomplete frame, or -1 if
+  // the frame's header hasn't been received yet.
+  int pending_header_length_;
+  int pending_message_length_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrameDecoder);
+};
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_FRAME_DECODER_H_
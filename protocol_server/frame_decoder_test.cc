@@ -0,0 +1,184 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "protocol_server/frame_decoder.h"
+
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "protocol_server/varint.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::string;
+using std::vector;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace {
+
+void AppendFrame(const string& message, string* data) {
+  char buffer[kMaxVarintLength];
+  const int varint_length = FormatVarint(static_cast<uint64>(message.length()),
+                                         buffer, kMaxVarintLength);
+  data->append(buffer, static_cast<string::size_type>(varint_length));
+  *data += message;
+}
+
+string GetMessage(const string& data, const FrameDecoder::Frame& frame) {
+  return data.substr(static_cast<string::size_type>(frame.offset),
+                     static_cast<string::size_type>(frame.length));
+}
+
+TEST(FrameDecoderTest, NoData) {
+  FrameDecoder frame_decoder;
+  vector<FrameDecoder::Frame> frames;
+
+  EXPECT_EQ(0, frame_decoder.DecodeFrames("", 0, &frames));
+  EXPECT_TRUE(frames.empty());
+  EXPECT_EQ(-1, frame_decoder.pending_frame_size());
+}
+
+TEST(FrameDecoderTest, SeveralCompleteFrames) {
+  string data;
+  AppendFrame("first", &data);
+  AppendFrame("", &data);
+  AppendFrame(string(300, 'x'), &data);
+
+  FrameDecoder frame_decoder;
+  vector<FrameDecoder::Frame> frames;
+
+  EXPECT_EQ(static_cast<int>(data.length()),
+            frame_decoder.DecodeFrames(data.data(),
+                                       static_cast<int>(data.length()),
+                                       &frames));
+  ASSERT_EQ(3u, frames.size());
+  EXPECT_EQ("first", GetMessage(data, frames[0]));
+  EXPECT_EQ("", GetMessage(data, frames[1]));
+  EXPECT_EQ(string(300, 'x'), GetMessage(data, frames[2]));
+  EXPECT_EQ(-1, frame_decoder.pending_frame_size());
+}
+
+TEST(FrameDecoderTest, IncompleteFrame) {
+  string data;
+  AppendFrame("first", &data);
+  const int first_frame_size = static_cast<int>(data.length());
+  AppendFrame("second", &data);
+
+  FrameDecoder frame_decoder;
+  vector<FrameDecoder::Frame> frames;
+
+  // Leave off the last byte of the second message.
+  EXPECT_EQ(first_frame_size,
+            frame_decoder.DecodeFrames(data.data(),
+                                       static_cast<int>(data.length()) - 1,
+                                       &frames));
+  ASSERT_EQ(1u, frames.size());
+  EXPECT_EQ("first", GetMessage(data, frames[0]));
+  EXPECT_EQ(7, frame_decoder.pending_frame_size());
+
+  // Pass the rest of the data, starting with the incomplete frame.
+  data.erase(0, static_cast<string::size_type>(first_frame_size));
+
+  EXPECT_EQ(static_cast<int>(data.length()),
+            frame_decoder.DecodeFrames(data.data(),
+                                       static_cast<int>(data.length()),
+                                       &frames));
+  ASSERT_EQ(1u, frames.size());
+  EXPECT_EQ("second", GetMessage(data, frames[0]));
+  EXPECT_EQ(-1, frame_decoder.pending_frame_size());
+}
+
+TEST(FrameDecoderTest, IncompleteHeader) {
+  string data;
+  AppendFrame(string(300, 'x'), &data);
+
+  FrameDecoder frame_decoder;
+  vector<FrameDecoder::Frame> frames;
+
+  // The header is two bytes long.
+  EXPECT_EQ(0, frame_decoder.DecodeFrames(data.data(), 1, &frames));
+  EXPECT_TRUE(frames.empty());
+  EXPECT_EQ(-1, frame_decoder.pending_frame_size());
+
+  EXPECT_EQ(0, frame_decoder.DecodeFrames(data.data(), 2, &frames));
+  EXPECT_TRUE(frames.empty());
+  EXPECT_EQ(302, frame_decoder.pending_frame_size());
+
+  EXPECT_EQ(302, frame_decoder.DecodeFrames(data.data(), 302, &frames));
+  ASSERT_EQ(1u, frames.size());
+  EXPECT_EQ(string(300, 'x'), GetMessage(data, frames[0]));
+}
+
+TEST(FrameDecoderTest, HeaderIsNotParsedAgain) {
+  string data;
+  AppendFrame("message", &data);
+
+  FrameDecoder frame_decoder;
+  vector<FrameDecoder::Frame> frames;
+
+  EXPECT_EQ(0, frame_decoder.DecodeFrames(data.data(), 3, &frames));
+  EXPECT_EQ(8, frame_decoder.pending_frame_size());
+
+  // The decoder uses the length that it already parsed, so changing the
+  // header has no effect.
+  data[0] = '\x02';
+
+  EXPECT_EQ(8, frame_decoder.DecodeFrames(data.data(),
+                                          static_cast<int>(data.length()),
+                                          &frames));
+  ASSERT_EQ(1u, frames.size());
+  EXPECT_EQ("message", GetMessage(data, frames[0]));
+}
+
+TEST(FrameDecoderTest, InvalidHeader) {
+  FrameDecoder frame_decoder;
+  vector<FrameDecoder::Frame> frames;
+
+  // The header is longer than any valid varint.
+  const string overlong_header(kMaxVarintLength + 1, '\x80');
+  EXPECT_EQ(-1, frame_decoder.DecodeFrames(
+      overlong_header.data(), static_cast<int>(overlong_header.length()),
+      &frames));
+  EXPECT_TRUE(frames.empty());
+
+  // The message length doesn't fit in an int.
+  string data;
+  AppendFrame("message", &data);
+  char buffer[kMaxVarintLength];
+  const int varint_length = FormatVarint(static_cast<uint64>(1) << 31, buffer,
+                                         kMaxVarintLength);
+  data.append(buffer, varint_length);
+
+  EXPECT_EQ(-1, frame_decoder.DecodeFrames(data.data(),
+                                           static_cast<int>(data.length()),
+                                           &frames));
+  EXPECT_TRUE(frames.empty());
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
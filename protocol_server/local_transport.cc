@@ -0,0 +1,218 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "protocol_server/local_transport.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/string_printf.h"
+#include "protocol_server/shared_memory_channel.h"
+#include "util/socket_util.h"
+
+using std::memcpy;
+using std::memset;
+using std::string;
+using std::unique_ptr;
+
+DEFINE_bool(protocol_server_shared_memory, true,
+            "If true, connections between protocol servers on the same host "
+            "exchange data through shared memory. Otherwise, they use a Unix "
+            "domain socket.");
+DEFINE_int32(protocol_server_shared_memory_ring_bytes, 1024 * 1024,
+             "The capacity of each direction of a shared memory channel, in "
+             "bytes. Must be a power of two.");
+
+namespace floating_temple {
+namespace {
+
+// The handshake is a single byte, plus the shared memory file descriptor if
+// a channel is used.
+const char kSharedMemoryHandshake = 'M';
+const char kSocketHandshake = 'S';
+
+// Returns true if the process on the other end of the Unix domain socket
+// belongs to the same user as this process.
+bool PeerHasSameUser(int socket_fd) {
+  uid_t peer_uid = 0;
+  if (!GetUnixSocketPeerUid(socket_fd, &peer_uid)) {
+    return false;
+  }
+
+  if (peer_uid != geteuid()) {
+    LOG(WARNING) << "The process on the other end of the local connection "
+                 << "belongs to user " << peer_uid << ".";
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+string GetLocalSocketName(const string& address, int port) {
+  return StringPrintf("floating_temple/%u/%s/%d",
+                      static_cast<unsigned>(geteuid()), address.c_str(), port);
+}
+
+int ListenForLocalConnections(const string& address, int port) {
+  return ListenOnAbstractUnixSocket(GetLocalSocketName(address, port));
+}
+
+int ConnectToLocalPeer(const string& address, int port,
+                       SharedMemoryChannel** channel) {
+  CHECK(channel != nullptr);
+
+  *channel = nullptr;
+
+  const int socket_fd = ConnectToAbstractUnixSocket(GetLocalSocketName(address,
+                                                                       port));
+  if (socket_fd == -1) {
+    return -1;
+  }
+
+  // Don't send the handshake (or the shared memory) to a process that has
+  // taken the socket name from another user.
+  if (!PeerHasSameUser(socket_fd)) {
+    CHECK_ERR(close(socket_fd));
+    return -1;
+  }
+
+  unique_ptr<SharedMemoryChannel> new_channel;
+  if (FLAGS_protocol_server_shared_memory) {
+    new_channel.reset(SharedMemoryChannel::Create(
+        static_cast<uint32>(FLAGS_protocol_server_shared_memory_ring_bytes)));
+    LOG_IF(WARNING, new_channel.get() == nullptr)
+        << "Could not create a shared memory channel. Falling back to the "
+        << "Unix domain socket.";
+  }
+
+  char handshake = new_channel.get() != nullptr ? kSharedMemoryHandshake
+                                                : kSocketHandshake;
+  iovec iov;
+  iov.iov_base = &handshake;
+  iov.iov_len = 1;
+
+  msghdr message_header;
+  memset(&message_header, 0, sizeof message_header);
+  message_header.msg_iov = &iov;
+  message_header.msg_iovlen = 1;
+
+  union {
+    cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  if (new_channel.get() != nullptr) {
+    memset(&control, 0, sizeof control);
+    message_header.msg_control = control.buffer;
+    message_header.msg_controllen = sizeof control.buffer;
+
+    cmsghdr* const control_header = CMSG_FIRSTHDR(&message_header);
+    control_header->cmsg_level = SOL_SOCKET;
+    control_header->cmsg_type = SCM_RIGHTS;
+    control_header->cmsg_len = CMSG_LEN(sizeof(int));
+
+    const int memory_fd = new_channel->memory_fd();
+    memcpy(CMSG_DATA(control_header), &memory_fd, sizeof memory_fd);
+  }
+
+  // The socket was just connected, so there's room for the handshake.
+  if (sendmsg(socket_fd, &message_header, MSG_NOSIGNAL) != 1) {
+    PLOG(WARNING) << "sendmsg";
+    CHECK_ERR(close(socket_fd));
+    return -1;
+  }
+
+  *channel = new_channel.release();
+  return socket_fd;
+}
+
+LocalHandshakeResult AcceptLocalPeer(int socket_fd,
+                                     SharedMemoryChannel** channel) {
+  CHECK(channel != nullptr);
+
+  *channel = nullptr;
+
+  if (!PeerHasSameUser(socket_fd)) {
+    return LOCAL_HANDSHAKE_FAILED;
+  }
+
+  char handshake = '\0';
+  iovec iov;
+  iov.iov_base = &handshake;
+  iov.iov_len = 1;
+
+  union {
+    cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof control);
+
+  msghdr message_header;
+  memset(&message_header, 0, sizeof message_header);
+  message_header.msg_iov = &iov;
+  message_header.msg_iovlen = 1;
+  message_header.msg_control = control.buffer;
+  message_header.msg_controllen = sizeof control.buffer;
+
+  const ssize_t byte_count = recvmsg(socket_fd, &message_header,
+                                     MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  if (byte_count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return LOCAL_HANDSHAKE_PENDING;
+  }
+  if (byte_count != 1) {
+    PLOG_IF(WARNING, byte_count == -1) << "recvmsg";
+    return LOCAL_HANDSHAKE_FAILED;
+  }
+
+  int memory_fd = -1;
+  const cmsghdr* const control_header = CMSG_FIRSTHDR(&message_header);
+  if (control_header != nullptr && control_header->cmsg_level == SOL_SOCKET &&
+      control_header->cmsg_type == SCM_RIGHTS &&
+      control_header->cmsg_len == CMSG_LEN(sizeof(int))) {
+    memcpy(&memory_fd, CMSG_DATA(control_header), sizeof memory_fd);
+  }
+
+  if (handshake == kSocketHandshake && memory_fd == -1) {
+    return LOCAL_HANDSHAKE_ACCEPTED;
+  }
+
+  if (handshake == kSharedMemoryHandshake && memory_fd != -1) {
+    *channel = SharedMemoryChannel::Open(memory_fd);
+    CHECK_ERR(close(memory_fd));
+    return *channel != nullptr ? LOCAL_HANDSHAKE_ACCEPTED
+                               : LOCAL_HANDSHAKE_FAILED;
+  }
+
+  LOG(WARNING) << "Invalid local connection handshake.";
+  if (memory_fd != -1) {
+    CHECK_ERR(close(memory_fd));
+  }
+  return LOCAL_HANDSHAKE_FAILED;
+}
+
+}  // namespace floating_temple
@@ -0,0 +1,84 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROTOCOL_SERVER_LOCAL_TRANSPORT_H_
+#define PROTOCOL_SERVER_LOCAL_TRANSPORT_H_
+
+#include <string>
+
+#include <gflags/gflags.h>
+
+DECLARE_bool(protocol_server_shared_memory);
+
+namespace floating_temple {
+
+class SharedMemoryChannel;
+
+// Functions for connecting protocol servers on the same host through a Unix
+// domain socket instead of TCP. A protocol server that listens on a TCP port
+// also listens on a Unix domain socket in the Linux abstract namespace, whose
+// name is derived from the user ID, the address, and the port. No socket file
+// is created, so there's nothing to clean up if the process dies.
+//
+// Any process on the host can bind to an abstract name, so both ends of a
+// connection check that the other end belongs to the same user. In particular,
+// the shared memory is only passed to a process that belongs to the same user.
+// If another process already holds the name, the protocol server doesn't
+// accept local connections, and its peers fall back to TCP.
+//
+// When a connection is opened, the initiator sends a handshake on the Unix
+// domain socket. The handshake either passes a shared memory channel (see
+// SharedMemoryChannel) to the acceptor, in which case the data is exchanged
+// through the channel and the socket is only used to wake the remote end, or
+// says that the data will be sent on the socket itself.
+
+// Returns the abstract name of the Unix domain socket used by the protocol
+// server that listens on the given TCP address and port.
+std::string GetLocalSocketName(const std::string& address, int port);
+
+// Listens on the Unix domain socket for the given TCP address and port.
+// Returns -1 if the socket name is already in use.
+int ListenForLocalConnections(const std::string& address, int port);
+
+// Connects to the protocol server on this host that listens on the given TCP
+// address and port, and sends the handshake. If the
+// --protocol_server_shared_memory flag is set and the shared memory can be
+// created, *channel is set to the new channel; otherwise it's set to NULL. The
+// caller must take ownership of **channel. Returns -1 if the server doesn't
+// listen on a Unix domain socket, or if the socket belongs to another user.
+int ConnectToLocalPeer(const std::string& address, int port,
+                       SharedMemoryChannel** channel);
+
+enum LocalHandshakeResult {
+  LOCAL_HANDSHAKE_PENDING,
+  LOCAL_HANDSHAKE_ACCEPTED,
+  LOCAL_HANDSHAKE_FAILED
+};
+
+// Tries to receive the handshake on a non-blocking connection that was
+// accepted on the Unix domain socket. Never blocks.
+//
+// Returns LOCAL_HANDSHAKE_PENDING if the handshake hasn't arrived yet; the
+// caller should try again when the socket becomes readable. Returns
+// LOCAL_HANDSHAKE_ACCEPTED, and sets *channel as in ConnectToLocalPeer, if the
+// handshake is valid. Returns LOCAL_HANDSHAKE_FAILED if the handshake is
+// invalid, the initiator belongs to another user, or the initiator closed the
+// connection, in which case the caller should close the connection.
+LocalHandshakeResult AcceptLocalPeer(int socket_fd,
+                                     SharedMemoryChannel** channel);
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_LOCAL_TRANSPORT_H_
@@ -15,6 +15,8 @@
 
 #include "protocol_server/parse_protocol_message.h"
 
+#include <climits>
+
 #include "base/integral_types.h"
 #include "base/logging.h"
 #include "protocol_server/varint.h"
@@ -29,15 +31,14 @@ int ParseMessageLength(const char* input_buffer, int buffer_size,
   const int varint_length = ParseVarint(input_buffer, buffer_size, &varint);
 
   if (varint_length < 0) {
-    return -1;
+    return varint_length;
   }
 
-  const int message_length_temp = static_cast<int>(varint);
-  // TODO(dss): Fail gracefully if the remote peer sends a variable-length
-  // integer that's too large.
-  CHECK_GE(message_length_temp, 0) << "Arithmetic overflow";
+  if (varint > static_cast<uint64>(INT_MAX)) {
+    return kInvalidVarint;
+  }
 
-  *message_length = message_length_temp;
+  *message_length = static_cast<int>(varint);
   return varint_length;
 }
 
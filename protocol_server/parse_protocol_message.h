@@ -16,9 +16,8 @@
 #ifndef PROTOCOL_SERVER_PARSE_PROTOCOL_MESSAGE_H_
 #define PROTOCOL_SERVER_PARSE_PROTOCOL_MESSAGE_H_
 
-#include <string>
-
 #include "base/logging.h"
+#include "protocol_server/varint.h"
 
 namespace floating_temple {
 
@@ -26,6 +25,8 @@ namespace floating_temple {
 // were parsed. If the input is incomplete, they return -1 and leave the output
 // parameter unchanged.
 
+// Returns kInvalidVarint (see protocol_server/varint.h) if the length prefix
+// isn't a valid variable-length integer or the length doesn't fit in an int.
 int ParseMessageLength(const char* input_buffer, int buffer_size,
                        int* message_length);
 
@@ -38,19 +39,17 @@ int ParseProtocolMessage(const char* input_buffer, int buffer_size,
   int message_length = 0;
   const int varint_length = ParseMessageLength(input_buffer, buffer_size,
                                                &message_length);
+  // TODO(dss): Fail gracefully if the remote peer sends an invalid length.
+  CHECK_NE(varint_length, kInvalidVarint);
   CHECK_GE(message_length, 0);
 
   if (varint_length < 0 || varint_length + message_length > buffer_size) {
     return -1;
   }
 
-  std::string encoded_message;
-  encoded_message.assign(input_buffer + varint_length,
-                         static_cast<std::string::size_type>(message_length));
-
   // TODO(dss): Fail gracefully if the remote peer sends an improperly encoded
   // protocol message.
-  CHECK(message->ParseFromString(encoded_message));
+  CHECK(message->ParseFromArray(input_buffer + varint_length, message_length));
 
   return varint_length + message_length;
 }
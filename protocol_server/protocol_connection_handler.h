@@ -16,6 +16,9 @@
 #ifndef PROTOCOL_SERVER_PROTOCOL_CONNECTION_HANDLER_H_
 #define PROTOCOL_SERVER_PROTOCOL_CONNECTION_HANDLER_H_
 
+#include <memory>
+#include <string>
+
 namespace floating_temple {
 
 template<class Message>
@@ -23,8 +26,17 @@ class ProtocolConnectionHandler {
  public:
   virtual ~ProtocolConnectionHandler() {}
 
-  virtual bool GetNextOutputMessage(Message* message) = 0;
-  virtual void NotifyMessageReceived(const Message& message) = 0;
+  // Retrieves the next message to be sent on the connection, already formatted
+  // by FormatProtocolMessage. Returns false if there are no messages waiting to
+  // be sent. The buffer may be shared with other connections.
+  virtual bool GetNextOutputMessage(
+      std::shared_ptr<const std::string>* formatted_message) = 0;
+  // Called when a message is received. The message isn't checked for missing
+  // required fields, so that messages formatted by FormatPartialProtocolMessage
+  // can be received; the handler must check them. The handler may modify the
+  // message in place; it's freed (along with the arena it was allocated from)
+  // after this method returns.
+  virtual void NotifyMessageReceived(Message* message) = 0;
 };
 
 }  // namespace floating_temple
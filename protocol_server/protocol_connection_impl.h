@@ -18,18 +18,26 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <google/protobuf/arena.h>
 
 #include "base/logging.h"
 #include "base/macros.h"
-#include "protocol_server/format_protocol_message.h"
-#include "protocol_server/parse_protocol_message.h"
+#include "protocol_server/frame_decoder.h"
 #include "protocol_server/protocol_connection.h"
 #include "protocol_server/protocol_connection_handler.h"
 #include "protocol_server/protocol_server_interface_for_connection.h"
+#include "protocol_server/receive_buffer.h"
+#include "protocol_server/shared_memory_channel.h"
 
 namespace floating_temple {
 
@@ -37,8 +45,15 @@ namespace floating_temple {
 template<class Message>
 class ProtocolConnectionImpl : public ProtocolConnection {
  public:
+  // Limit on the number of messages that are taken from the connection handler
+  // to be sent in a single system call.
+  static const int kMaxOutputMessageCount = 64;
+
+  // If 'channel' is not NULL, data is exchanged through the shared memory
+  // channel, and the socket is only used to wake the remote end. This class
+  // takes ownership of *channel.
   ProtocolConnectionImpl(ProtocolServerInterfaceForConnection* protocol_server,
-                         int socket_fd);
+                         int socket_fd, SharedMemoryChannel* channel);
   ~ProtocolConnectionImpl() override;
 
   void Init(ProtocolConnectionHandler<Message>* protocol_connection_handler);
@@ -54,17 +69,57 @@ class ProtocolConnectionImpl : public ProtocolConnection {
   // Sends and receives data on the socket connection.
   void SendAndReceive();
 
+  // The following methods let a reactor perform the socket I/O itself (e.g.,
+  // asynchronously). At most one receive and one send may be in progress at a
+  // time. They can't be used if the connection has a shared memory channel.
+
+  // Returns the buffer that the next received data should be written to, and
+  // sets *size to its size.
+  char* GetReceiveBuffer(int* size);
+  // Called with the result of receiving data into the buffer: the number of
+  // bytes received, or -1 and the error number.
+  void CompleteReceive(ssize_t byte_count, int error_number);
+  // Fills in 'iov' (which must have room for kMaxOutputMessageCount entries)
+  // with the output data that hasn't been sent yet. Returns the number of
+  // entries, or 0 if there's nothing to send.
+  int GetSendBuffers(iovec* iov);
+  // Called with the result of sending the buffers returned by GetSendBuffers:
+  // the number of bytes sent, or -1 and the error number.
+  void CompleteSend(ssize_t byte_count, int error_number);
+
   void CloseSocket();
 
   void Close() override;
   void NotifyMessageReadyToSend() override;
 
  private:
-  void ParseMessages(std::string* input_string);
+  // Data is read from the socket in chunks of this size (or larger, if a
+  // larger message is being received).
+  static const int kReceiveChunkSize = 64 * 1024;
+  // Size of the first block of the arena that each received message is parsed
+  // into. The block is reused for every message, so most messages can be
+  // parsed without allocating any memory.
+  static const int kArenaBlockSize = 16 * 1024;
+  // Limit on the total number of bytes that are taken from the connection
+  // handler to be sent in a single system call.
+  static const std::string::size_type kMaxOutputByteCount = 256 * 1024;
+
+  // Sends and receives data through the shared memory channel.
+  void SendAndReceiveOnChannel();
+  // Reads the wake-up bytes sent by the remote end until the socket would
+  // block. Returns true if the remote end has closed the connection.
+  bool DrainWakeUpBytes();
+  void WakeRemoteEnd();
+
+  void ParseMessages();
   bool PrivateHasOutputData();
+  // Removes 'byte_count' bytes that were sent from the beginning of the output
+  // data.
+  void ConsumeOutputData(std::string::size_type byte_count);
 
   ProtocolServerInterfaceForConnection* const protocol_server_;
   const int socket_fd_;
+  const std::unique_ptr<SharedMemoryChannel> channel_;
 
   ProtocolConnectionHandler<Message>* protocol_connection_handler_;
 
@@ -72,21 +127,39 @@ class ProtocolConnectionImpl : public ProtocolConnection {
   bool send_blocked_;
   bool close_requested_;
 
-  std::string input_data_;
-  std::string output_data_;
+  ReceiveBuffer input_data_;
+  FrameDecoder frame_decoder_;
+  // The complete messages found in input_data_ by the most recent call to
+  // ParseMessages. Kept as a member so that its memory is reused.
+  std::vector<FrameDecoder::Frame> frames_;
+  // The first block of the arena for each received message. See
+  // kArenaBlockSize.
+  std::vector<char> arena_block_;
+  // The formatted messages that are being sent, in order. The first
+  // 'output_offset_' bytes of the first message have already been sent.
+  // 'output_byte_count_' is the number of bytes that haven't been sent yet.
+  std::deque<std::shared_ptr<const std::string>> output_data_;
+  std::string::size_type output_offset_;
+  std::string::size_type output_byte_count_;
 
   DISALLOW_COPY_AND_ASSIGN(ProtocolConnectionImpl);
 };
 
 template<class Message>
 ProtocolConnectionImpl<Message>::ProtocolConnectionImpl(
-    ProtocolServerInterfaceForConnection* protocol_server, int socket_fd)
+    ProtocolServerInterfaceForConnection* protocol_server, int socket_fd,
+    SharedMemoryChannel* channel)
     : protocol_server_(CHECK_NOTNULL(protocol_server)),
       socket_fd_(socket_fd),
+      channel_(channel),
       protocol_connection_handler_(nullptr),
       receive_blocked_(false),
       send_blocked_(false),
-      close_requested_(false) {
+      close_requested_(false),
+      input_data_(kReceiveChunkSize),
+      arena_block_(kArenaBlockSize),
+      output_offset_(0),
+      output_byte_count_(0) {
   CHECK_NE(socket_fd, -1);
 }
 
@@ -110,30 +183,63 @@ bool ProtocolConnectionImpl<Message>::IsBlocked() {
 
 template<class Message>
 void ProtocolConnectionImpl<Message>::SendAndReceive() {
-  // TODO(dss): If output_data_ grows too large, temporarily suspend reads on
-  // the socket until some of the output data can be sent. This will prevent
-  // available memory from being exhausted.
+  // output_data_ holds a bounded number of messages. Messages waiting to be
+  // sent are queued by the connection handler, which is responsible for
+  // limiting how much memory they use.
 
-  char input_buffer[1000];
-  const ssize_t recv_count = recv(socket_fd_, input_buffer, sizeof input_buffer,
-                                  0);
+  if (channel_.get() != nullptr) {
+    SendAndReceiveOnChannel();
+    return;
+  }
 
-  if (recv_count > 0) {
-    input_data_.append(input_buffer,
-                       static_cast<std::string::size_type>(recv_count));
-    ParseMessages(&input_data_);
+  int free_space = 0;
+  char* const input_buffer = GetReceiveBuffer(&free_space);
+  const ssize_t recv_count = recv(socket_fd_, input_buffer,
+                                  static_cast<size_t>(free_space), 0);
+  CompleteReceive(recv_count, errno);
+
+  // Send as many of the queued messages as possible in a single system call,
+  // without copying them into a contiguous buffer.
+  iovec iov[kMaxOutputMessageCount];
+  const int iov_count = GetSendBuffers(iov);
+
+  if (iov_count > 0) {
+    msghdr message_header;
+    std::memset(&message_header, 0, sizeof message_header);
+    message_header.msg_iov = iov;
+    message_header.msg_iovlen = static_cast<size_t>(iov_count);
+
+    const ssize_t send_count = sendmsg(socket_fd_, &message_header,
+                                       MSG_NOSIGNAL);
+    CompleteSend(send_count, errno);
+  }
+}
+
+template<class Message>
+char* ProtocolConnectionImpl<Message>::GetReceiveBuffer(int* size) {
+  CHECK(channel_.get() == nullptr);
+  return input_data_.GetFreeSpace(kReceiveChunkSize, CHECK_NOTNULL(size));
+}
+
+template<class Message>
+void ProtocolConnectionImpl<Message>::CompleteReceive(ssize_t byte_count,
+                                                      int error_number) {
+  if (byte_count > 0) {
+    input_data_.CommitWrite(static_cast<int>(byte_count));
+    ParseMessages();
 
     receive_blocked_ = false;
   } else {
-    if (recv_count == 0) {
+    if (byte_count == 0) {
       VLOG(1) << "recv() returned 0";
       close_requested_ = true;
     } else {
-      if (errno != EAGAIN && errno != EWOULDBLOCK) {
-        if (errno == ECONNRESET) {
+      if (error_number != EAGAIN && error_number != EWOULDBLOCK) {
+        if (error_number == ECONNRESET) {
           VLOG(1) << "recv() failed with ECONNRESET";
           close_requested_ = true;
         } else {
+          errno = error_number;
           PLOG(FATAL) << "recv";
         }
       }
@@ -141,30 +247,50 @@ void ProtocolConnectionImpl<Message>::SendAndReceive() {
 
     receive_blocked_ = true;
   }
+}
 
-  if (PrivateHasOutputData()) {
-    const ssize_t send_count = send(socket_fd_, output_data_.data(),
-                                    output_data_.length(), MSG_NOSIGNAL);
+template<class Message>
+int ProtocolConnectionImpl<Message>::GetSendBuffers(iovec* iov) {
+  CHECK(iov != nullptr);
 
-    if (send_count >= 0) {
-      output_data_.erase(0, static_cast<std::string::size_type>(send_count));
+  if (!PrivateHasOutputData()) {
+    return 0;
+  }
 
-      send_blocked_ = false;
-    } else {
-      if (errno != EAGAIN && errno != EWOULDBLOCK) {
-        if (errno == ECONNRESET) {
-          VLOG(1) << "send() failed with ECONNRESET";
-          close_requested_ = true;
-        } else if (errno == EPIPE) {
-          VLOG(1) << "send() failed with EPIPE";
-          close_requested_ = true;
-        } else {
-          PLOG(FATAL) << "send";
-        }
-      }
+  int iov_count = 0;
 
-      send_blocked_ = true;
+  for (const std::shared_ptr<const std::string>& output_data : output_data_) {
+    const std::string::size_type offset = iov_count == 0 ? output_offset_ : 0;
+    iov[iov_count].iov_base = const_cast<char*>(output_data->data() + offset);
+    iov[iov_count].iov_len = output_data->length() - offset;
+    ++iov_count;
+  }
+
+  return iov_count;
+}
+
+template<class Message>
+void ProtocolConnectionImpl<Message>::CompleteSend(ssize_t byte_count,
+                                                   int error_number) {
+  if (byte_count >= 0) {
+    ConsumeOutputData(static_cast<std::string::size_type>(byte_count));
+
+    send_blocked_ = false;
+  } else {
+    if (error_number != EAGAIN && error_number != EWOULDBLOCK) {
+      if (error_number == ECONNRESET) {
+        VLOG(1) << "sendmsg() failed with ECONNRESET";
+        close_requested_ = true;
+      } else if (error_number == EPIPE) {
+        VLOG(1) << "sendmsg() failed with EPIPE";
+        close_requested_ = true;
+      } else {
+        errno = error_number;
+        PLOG(FATAL) << "sendmsg";
+      }
     }
+
+    send_blocked_ = true;
   }
 }
 
@@ -180,28 +306,146 @@ void ProtocolConnectionImpl<Message>::Close() {
 
 template<class Message>
 void ProtocolConnectionImpl<Message>::NotifyMessageReadyToSend() {
-  protocol_server_->NotifyConnectionsChanged();
+  protocol_server_->NotifyConnectionChanged(this);
 }
 
 template<class Message>
-void ProtocolConnectionImpl<Message>::ParseMessages(std::string* input_string) {
-  CHECK(protocol_connection_handler_ != nullptr);
-  CHECK(input_string != nullptr);
+void ProtocolConnectionImpl<Message>::SendAndReceiveOnChannel() {
+  // The remote end writes the data to the channel before it closes the
+  // socket, so check the socket first to avoid losing the last of the data.
+  const bool remote_end_closed = DrainWakeUpBytes();
+  bool wake_remote_end = false;
+
+  int free_space = 0;
+  char* const input_buffer = input_data_.GetFreeSpace(kReceiveChunkSize,
+                                                      &free_space);
+  const int read_count = channel_->Read(input_buffer, free_space,
+                                        &wake_remote_end);
+
+  if (read_count > 0) {
+    input_data_.CommitWrite(read_count);
+    ParseMessages();
+
+    receive_blocked_ = false;
+  } else if (remote_end_closed) {
+    close_requested_ = true;
+    receive_blocked_ = true;
+  } else {
+    receive_blocked_ = channel_->PrepareToWaitForData();
+  }
+
+  iovec iov[kMaxOutputMessageCount];
+  const int iov_count = GetSendBuffers(iov);
+
+  if (iov_count > 0) {
+    const std::string::size_type write_count = channel_->Write(
+        iov, iov_count, &wake_remote_end);
+
+    if (write_count > 0) {
+      ConsumeOutputData(write_count);
+      send_blocked_ = false;
+    } else {
+      send_blocked_ = channel_->PrepareToWaitForSpace();
+    }
+  }
+
+  if (wake_remote_end) {
+    WakeRemoteEnd();
+  }
+}
+
+template<class Message>
+bool ProtocolConnectionImpl<Message>::DrainWakeUpBytes() {
+  // The reactor waits for the socket with an edge-triggered epoll set, so all
+  // of the pending bytes must be read.
+  char buffer[64];
 
   for (;;) {
-    Message message;
-    const int char_count = ParseProtocolMessage(
-        input_string->data(), static_cast<int>(input_string->length()),
-        &message);
+    const ssize_t byte_count = recv(socket_fd_, buffer, sizeof buffer, 0);
 
-    if (char_count < 0) {
-      return;
+    if (byte_count == 0) {
+      VLOG(1) << "recv() returned 0";
+      return true;
+    }
+
+    if (byte_count == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      if (errno == ECONNRESET) {
+        VLOG(1) << "recv() failed with ECONNRESET";
+        return true;
+      }
+      PLOG(FATAL) << "recv";
     }
+  }
+}
+
+template<class Message>
+void ProtocolConnectionImpl<Message>::WakeRemoteEnd() {
+  const char wake_up_byte = '\0';
+
+  if (send(socket_fd_, &wake_up_byte, 1, MSG_NOSIGNAL) == -1) {
+    // If the socket buffer is full, the remote end already has wake-up bytes
+    // to read.
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      if (errno == ECONNRESET || errno == EPIPE) {
+        VLOG(1) << "send() failed: " << std::strerror(errno);
+        close_requested_ = true;
+      } else {
+        PLOG(FATAL) << "send";
+      }
+    }
+  }
+}
+
+template<class Message>
+void ProtocolConnectionImpl<Message>::ParseMessages() {
+  CHECK(protocol_connection_handler_ != nullptr);
 
-    message.CheckInitialized();
+  // Data received after the connection was found to be corrupt is ignored.
+  if (close_requested_) {
+    return;
+  }
+
+  const char* const data = input_data_.data();
+  const int char_count = frame_decoder_.DecodeFrames(data, input_data_.size(),
+                                                     &frames_);
+  if (char_count < 0) {
+    LOG(WARNING) << "Received an invalid frame header; closing the connection";
+    close_requested_ = true;
+    return;
+  }
+
+  for (const FrameDecoder::Frame& frame : frames_) {
+    // The message's submessages and strings are allocated from the arena, and
+    // are all freed at once when the handler returns. The arena only saves the
+    // allocations made while parsing; the handler copies whatever it keeps.
+    google::protobuf::ArenaOptions arena_options;
+    arena_options.initial_block = arena_block_.data();
+    arena_options.initial_block_size = arena_block_.size();
+    google::protobuf::Arena arena(arena_options);
+
+    Message* const message = google::protobuf::Arena::CreateMessage<Message>(
+        &arena);
+    // The handler checks the required fields, because the message may have
+    // been formatted by FormatPartialProtocolMessage.
+    if (!message->ParsePartialFromArray(data + frame.offset, frame.length)) {
+      LOG(WARNING) << "Received an improperly encoded protocol message; "
+                   << "closing the connection";
+      close_requested_ = true;
+      return;
+    }
     protocol_connection_handler_->NotifyMessageReceived(message);
+  }
+
+  input_data_.Consume(char_count);
 
-    input_string->erase(0, static_cast<std::string::size_type>(char_count));
+  // If the beginning of a message has been received, make room for the rest
+  // of it so that it can be read without reallocating the buffer again.
+  const int pending_frame_size = frame_decoder_.pending_frame_size();
+  if (pending_frame_size >= 0) {
+    input_data_.Reserve(pending_frame_size);
   }
 }
 
@@ -209,17 +453,51 @@ template<class Message>
 bool ProtocolConnectionImpl<Message>::PrivateHasOutputData() {
   CHECK(protocol_connection_handler_ != nullptr);
 
-  if (output_data_.empty()) {
-    Message message;
+  while (output_data_.size() <
+             static_cast<std::deque<std::shared_ptr<const std::string>>::
+                 size_type>(kMaxOutputMessageCount) &&
+         output_byte_count_ < kMaxOutputByteCount) {
+    std::shared_ptr<const std::string> formatted_message;
 
-    if (protocol_connection_handler_->GetNextOutputMessage(&message)) {
-      FormatProtocolMessage(message, &output_data_);
+    if (!protocol_connection_handler_->GetNextOutputMessage(
+            &formatted_message)) {
+      break;
     }
+
+    CHECK(formatted_message.get() != nullptr);
+    CHECK(!formatted_message->empty());
+
+    output_byte_count_ += formatted_message->length();
+    output_data_.push_back(formatted_message);
   }
 
   return !output_data_.empty();
 }
 
+template<class Message>
+void ProtocolConnectionImpl<Message>::ConsumeOutputData(
+    std::string::size_type byte_count) {
+  CHECK_LE(byte_count, output_byte_count_);
+  output_byte_count_ -= byte_count;
+
+  while (byte_count > 0) {
+    CHECK(!output_data_.empty());
+
+    const std::string::size_type remaining_byte_count =
+        output_data_.front()->length() - output_offset_;
+
+    if (byte_count < remaining_byte_count) {
+      output_offset_ += byte_count;
+      return;
+    }
+
+    // The message has been sent completely. Release the buffer.
+    byte_count -= remaining_byte_count;
+    output_data_.pop_front();
+    output_offset_ = 0;
+  }
+}
+
 }  // namespace floating_temple
 
 #endif  // PROTOCOL_SERVER_PROTOCOL_CONNECTION_IMPL_H_
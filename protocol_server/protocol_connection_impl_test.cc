@@ -19,6 +19,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <memory>
 #include <string>
 
 #include <gflags/gflags.h>
@@ -28,6 +29,7 @@
 #include "base/notification.h"
 #include "base/string_printf.h"
 #include "base/thread_safe_counter.h"
+#include "protocol_server/format_protocol_message.h"
 #include "protocol_server/protocol_connection.h"
 #include "protocol_server/protocol_connection_handler.h"
 #include "protocol_server/protocol_server_interface_for_connection.h"
@@ -38,11 +40,13 @@
 
 using google::InitGoogleLogging;
 using google::ParseCommandLineFlags;
+using testing::AllOf;
 using testing::AnyNumber;
 using testing::DoAll;
 using testing::InSequence;
 using testing::InitGoogleMock;
 using testing::InvokeWithoutArgs;
+using testing::Pointee;
 using testing::Return;
 using testing::SetArgPointee;
 using testing::Test;
@@ -55,12 +59,16 @@ MATCHER_P2(TestMessageMatches, n, s, "") {
   return arg.n() == n && arg.s() == s;
 }
 
+MATCHER(IsAllocatedOnArena, "") {
+  return arg.GetArena() != nullptr;
+}
+
 class MockProtocolServerInterfaceForConnection
     : public ProtocolServerInterfaceForConnection {
  public:
   MockProtocolServerInterfaceForConnection() {}
 
-  MOCK_METHOD0(NotifyConnectionsChanged, void());
+  MOCK_METHOD1(NotifyConnectionChanged, void(ProtocolConnection* connection));
 
  private:
   DISALLOW_COPY_AND_ASSIGN(MockProtocolServerInterfaceForConnection);
@@ -71,8 +79,9 @@ class MockProtocolConnectionHandler
  public:
   MockProtocolConnectionHandler() {}
 
-  MOCK_METHOD1(GetNextOutputMessage, bool(TestMessage* message));
-  MOCK_METHOD1(NotifyMessageReceived, void(const TestMessage& message));
+  MOCK_METHOD1(GetNextOutputMessage,
+               bool(std::shared_ptr<const std::string>* formatted_message));
+  MOCK_METHOD1(NotifyMessageReceived, void(TestMessage* message));
 
  private:
   DISALLOW_COPY_AND_ASSIGN(MockProtocolConnectionHandler);
@@ -97,9 +106,9 @@ class ProtocolConnectionImplTest : public Test {
     CHECK(SetFdToNonBlocking(fds[1]));
 
     protocol_connection1_ = new ProtocolConnectionImpl<TestMessage>(
-        &protocol_server_, fds[0]);
+        &protocol_server_, fds[0], nullptr);
     protocol_connection2_ = new ProtocolConnectionImpl<TestMessage>(
-        &protocol_server_, fds[1]);
+        &protocol_server_, fds[1], nullptr);
 
     protocol_connection1_->Init(&handler1_);
     protocol_connection2_->Init(&handler2_);
@@ -158,7 +167,7 @@ class ProtocolConnectionImplTest : public Test {
 TEST_F(ProtocolConnectionImplTest, SendMessage) {
   Notification done;
 
-  EXPECT_CALL(protocol_server_, NotifyConnectionsChanged())
+  EXPECT_CALL(protocol_server_, NotifyConnectionChanged(_))
       .Times(AnyNumber());
 
   {
@@ -169,8 +178,9 @@ TEST_F(ProtocolConnectionImplTest, SendMessage) {
     message.set_s("abcdefg");
 
     EXPECT_CALL(handler1_, GetNextOutputMessage(_))
-        .WillOnce(DoAll(SetArgPointee<0>(message),
-                        Return(true)));
+        .WillOnce(DoAll(
+            SetArgPointee<0>(FormatSharedProtocolMessage(message)),
+            Return(true)));
 
     EXPECT_CALL(handler1_, GetNextOutputMessage(_))
         .WillRepeatedly(Return(false));
@@ -179,7 +189,9 @@ TEST_F(ProtocolConnectionImplTest, SendMessage) {
   EXPECT_CALL(handler2_, GetNextOutputMessage(_))
       .WillRepeatedly(Return(false));
   EXPECT_CALL(handler2_,
-              NotifyMessageReceived(TestMessageMatches(123456789, "abcdefg")))
+              NotifyMessageReceived(Pointee(AllOf(
+                  TestMessageMatches(123456789, "abcdefg"),
+                  IsAllocatedOnArena()))))
       .WillOnce(InvokeWithoutArgs(&done, &Notification::Notify));
 
   StartProtocolServer();
@@ -192,7 +204,7 @@ TEST_F(ProtocolConnectionImplTest, SendMessage) {
 TEST_F(ProtocolConnectionImplTest, SendTwoMessages) {
   Notification done;
 
-  EXPECT_CALL(protocol_server_, NotifyConnectionsChanged())
+  EXPECT_CALL(protocol_server_, NotifyConnectionChanged(_))
       .Times(AnyNumber());
 
   {
@@ -203,16 +215,18 @@ TEST_F(ProtocolConnectionImplTest, SendTwoMessages) {
     message1.set_s("partridge");
 
     EXPECT_CALL(handler1_, GetNextOutputMessage(_))
-        .WillOnce(DoAll(SetArgPointee<0>(message1),
-                        Return(true)));
+        .WillOnce(DoAll(
+            SetArgPointee<0>(FormatSharedProtocolMessage(message1)),
+            Return(true)));
 
     TestMessage message2;
     message2.set_n(2);
     message2.set_s("turtle dove");
 
     EXPECT_CALL(handler1_, GetNextOutputMessage(_))
-        .WillOnce(DoAll(SetArgPointee<0>(message2),
-                        Return(true)));
+        .WillOnce(DoAll(
+            SetArgPointee<0>(FormatSharedProtocolMessage(message2)),
+            Return(true)));
 
     EXPECT_CALL(handler1_, GetNextOutputMessage(_))
         .WillRepeatedly(Return(false));
@@ -225,10 +239,12 @@ TEST_F(ProtocolConnectionImplTest, SendTwoMessages) {
     InSequence s;
 
     EXPECT_CALL(handler2_,
-                NotifyMessageReceived(TestMessageMatches(1, "partridge")))
+                NotifyMessageReceived(Pointee(
+                    TestMessageMatches(1, "partridge"))))
         .Times(1);
     EXPECT_CALL(handler2_,
-                NotifyMessageReceived(TestMessageMatches(2, "turtle dove")))
+                NotifyMessageReceived(Pointee(
+                    TestMessageMatches(2, "turtle dove"))))
         .WillOnce(InvokeWithoutArgs(&done, &Notification::Notify));
   }
 
@@ -263,7 +279,7 @@ void CreateSendTestMessageThread(ProtocolConnection* protocol_connection,
 TEST_F(ProtocolConnectionImplTest, SendMessagesFromDifferentThreads) {
   static const int kThreadCount = 100;
 
-  EXPECT_CALL(protocol_server_, NotifyConnectionsChanged())
+  EXPECT_CALL(protocol_server_, NotifyConnectionChanged(_))
       .Times(AnyNumber());
 
   ThreadSafeCounter counter(kThreadCount);
@@ -277,8 +293,9 @@ TEST_F(ProtocolConnectionImplTest, SendMessagesFromDifferentThreads) {
       message.set_s(StringPrintf("%d", i));
 
       EXPECT_CALL(handler1_, GetNextOutputMessage(_))
-          .WillOnce(DoAll(SetArgPointee<0>(message),
-                          Return(true)));
+          .WillOnce(DoAll(
+              SetArgPointee<0>(FormatSharedProtocolMessage(message)),
+              Return(true)));
     }
 
     EXPECT_CALL(handler1_, GetNextOutputMessage(_))
@@ -0,0 +1,541 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROTOCOL_SERVER_PROTOCOL_EPOLL_REACTOR_H_
+#define PROTOCOL_SERVER_PROTOCOL_EPOLL_REACTOR_H_
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/mutex.h"
+#include "base/mutex_lock.h"
+#include "base/time_util.h"
+#include "protocol_server/local_transport.h"
+#include "protocol_server/protocol_connection.h"
+#include "protocol_server/protocol_connection_handler.h"
+#include "protocol_server/protocol_connection_impl.h"
+#include "protocol_server/protocol_reactor.h"
+#include "protocol_server/protocol_server_handler.h"
+#include "protocol_server/protocol_server_interface_for_connection.h"
+#include "protocol_server/protocol_server_interface_for_reactor.h"
+#include "util/event_fd.h"
+#include "util/socket_util.h"
+
+DECLARE_int32(protocol_connection_timeout_sec_for_debugging);
+
+namespace floating_temple {
+
+// A reactor that waits for readiness events on its connections (using an
+// edge-triggered epoll set) and sends and receives data on them with
+// non-blocking system calls.
+template<class Message>
+class ProtocolEpollReactor : public ProtocolReactor<Message>,
+                             private ProtocolServerInterfaceForConnection {
+ public:
+  // 'listen_fd' is the listen socket that this reactor accepts connections
+  // on, or -1 if the reactor doesn't accept connections. If
+  // 'keep_accepted_connections' is false, accepted connections are passed to
+  // the server so that it can assign them to a reactor.
+  //
+  // 'local_listen_fd' is a Unix domain socket that this reactor accepts
+  // connections from the same host on (see local_transport.h), or -1. These
+  // connections are always passed to the server.
+  //
+  // This class does not take ownership of the listen sockets.
+  ProtocolEpollReactor(ProtocolServerInterfaceForReactor* server,
+                       ProtocolServerHandler<Message>* handler, int listen_fd,
+                       bool keep_accepted_connections, int local_listen_fd);
+  ~ProtocolEpollReactor() override;
+
+  void Start() override;
+  void Stop() override;
+
+  ProtocolConnectionImpl<Message>* AddConnection(
+      ProtocolConnectionHandler<Message>* connection_handler, int socket_fd,
+      const std::string& remote_address, SharedMemoryChannel* channel) override;
+
+ private:
+  // A connection accepted on the Unix domain socket whose handshake hasn't
+  // arrived yet.
+  struct PendingLocalConnection {
+    int socket_fd;
+    int64 deadline_usec;
+  };
+
+  static const int kMaxEpollEvents = 64;
+  // The initiator sends the handshake as soon as it connects, so it should
+  // arrive almost immediately.
+  static const int kLocalHandshakeTimeoutMs = 1000;
+
+  void DoEventLoop();
+  void AcceptConnections();
+  void AcceptLocalConnections();
+  // Tries to receive the handshake on a pending local connection. If the
+  // handshake has arrived, passes the connection to the server (or closes it
+  // if the handshake is invalid).
+  void ReceiveLocalHandshake(PendingLocalConnection* pending_connection);
+  // Closes the pending local connections whose handshakes are overdue.
+  void ExpireLocalHandshakes();
+  void RemovePendingLocalConnection(PendingLocalConnection* pending_connection);
+  // Sends and receives data on the connection once. Returns true if the
+  // connection can make more progress without waiting for a readiness event.
+  bool HandleConnection(ProtocolConnectionImpl<Message>* connection);
+  void CloseConnection(ProtocolConnectionImpl<Message>* connection);
+
+  void AddFdToEpollSet(int fd, void* ptr, uint32 events);
+
+  void NotifyConnectionChanged(ProtocolConnection* connection) override;
+
+  static void* ReactorThreadMain(void* reactor_raw);
+
+  ProtocolServerInterfaceForReactor* const server_;
+  ProtocolServerHandler<Message>* const handler_;
+  const int listen_fd_;
+  const bool keep_accepted_connections_;
+  const int local_listen_fd_;
+
+  int epoll_fd_;
+  // Signaled to wake the reactor thread when another thread notifies it of a
+  // connection, or when the reactor is stopped.
+  int wake_event_fd_;
+  pthread_t reactor_thread_;
+
+  // The connections that belong to this reactor, and the connections that
+  // other threads have asked the reactor thread to handle.
+  std::unordered_set<ProtocolConnectionImpl<Message>*> connections_;
+  std::unordered_set<ProtocolConnectionImpl<Message>*> notified_connections_;
+  bool stop_requested_;
+  mutable Mutex mu_;
+
+  // The local connections that are waiting for their handshakes. The
+  // handshakes are received by the event loop, so that a slow initiator can't
+  // stall the other connections. Only accessed by the reactor thread (and by
+  // Stop, after the thread has exited).
+  std::unordered_map<PendingLocalConnection*,
+                     std::unique_ptr<PendingLocalConnection>>
+      pending_local_connections_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProtocolEpollReactor);
+};
+
+template<class Message>
+ProtocolEpollReactor<Message>::ProtocolEpollReactor(
+    ProtocolServerInterfaceForReactor* server,
+    ProtocolServerHandler<Message>* handler, int listen_fd,
+    bool keep_accepted_connections, int local_listen_fd)
+    : server_(CHECK_NOTNULL(server)),
+      handler_(CHECK_NOTNULL(handler)),
+      listen_fd_(listen_fd),
+      keep_accepted_connections_(keep_accepted_connections),
+      local_listen_fd_(local_listen_fd),
+      epoll_fd_(-1),
+      wake_event_fd_(-1),
+      stop_requested_(false) {
+}
+
+template<class Message>
+ProtocolEpollReactor<Message>::~ProtocolEpollReactor() {
+  MutexLock lock(&mu_);
+  CHECK_EQ(connections_.size(), 0u);
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::Start() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  CHECK_ERR(epoll_fd_) << " epoll_create1";
+
+  wake_event_fd_ = eventfd(0, EFD_CLOEXEC);
+  CHECK_ERR(wake_event_fd_) << " eventfd";
+  CHECK(SetFdToNonBlocking(wake_event_fd_));
+
+  // The wake event FD is identified by a pointer to this object, the listen
+  // socket by a NULL pointer, and the local listen socket by a pointer to
+  // local_listen_fd_. Every other pointer in the epoll set identifies a
+  // connection.
+  AddFdToEpollSet(wake_event_fd_, this, EPOLLIN);
+  if (listen_fd_ != -1) {
+    AddFdToEpollSet(listen_fd_, nullptr, EPOLLIN | EPOLLET);
+  }
+  if (local_listen_fd_ != -1) {
+    AddFdToEpollSet(local_listen_fd_, const_cast<int*>(&local_listen_fd_),
+                    EPOLLIN | EPOLLET);
+  }
+
+  CHECK_PTHREAD_ERR(pthread_create(
+      &reactor_thread_, nullptr,
+      &ProtocolEpollReactor<Message>::ReactorThreadMain, this));
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::Stop() {
+  {
+    MutexLock lock(&mu_);
+    stop_requested_ = true;
+  }
+
+  SignalEventFd(wake_event_fd_);
+
+  void* thread_return_value = nullptr;
+  CHECK_PTHREAD_ERR(pthread_join(reactor_thread_, &thread_return_value));
+
+  {
+    MutexLock lock(&mu_);
+
+    for (ProtocolConnectionImpl<Message>* const connection : connections_) {
+      connection->CloseSocket();
+    }
+
+    connections_.clear();
+    notified_connections_.clear();
+  }
+
+  for (const auto& pending_pair : pending_local_connections_) {
+    CHECK_ERR(close(pending_pair.first->socket_fd));
+  }
+  pending_local_connections_.clear();
+
+  CHECK_ERR(close(wake_event_fd_));
+  CHECK_ERR(close(epoll_fd_));
+}
+
+template<class Message>
+ProtocolConnectionImpl<Message>* ProtocolEpollReactor<Message>::AddConnection(
+    ProtocolConnectionHandler<Message>* connection_handler, int socket_fd,
+    const std::string& remote_address, SharedMemoryChannel* channel) {
+  // TODO(dss): Should we set socket_fd to non-blocking mode here? (It's already
+  // set to non-blocking mode elsewhere, but perhaps this is the proper place to
+  // do it.)
+
+  ProtocolConnectionImpl<Message>* const connection =
+      new ProtocolConnectionImpl<Message>(this, socket_fd, channel);
+
+  if (connection_handler == nullptr) {
+    connection_handler = handler_->NotifyConnectionReceived(connection,
+                                                            remote_address);
+  }
+
+  connection->Init(connection_handler);
+
+  // Handle the connection once before waiting for it to become ready, so that
+  // any initial output is sent.
+  {
+    MutexLock lock(&mu_);
+    CHECK(connections_.insert(connection).second);
+    notified_connections_.insert(connection);
+  }
+
+  AddFdToEpollSet(socket_fd, connection,
+                  EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+  SignalEventFd(wake_event_fd_);
+
+  return connection;
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::DoEventLoop() {
+  int timeout_ms = -1;
+  if (FLAGS_protocol_connection_timeout_sec_for_debugging >= 0) {
+    timeout_ms = FLAGS_protocol_connection_timeout_sec_for_debugging * 1000;
+  }
+
+  // Connections that can make progress without waiting for a readiness event.
+  // They're handled in turn, one send/receive pass at a time, so that a busy
+  // connection can't starve the others.
+  std::unordered_set<ProtocolConnectionImpl<Message>*> ready_connections;
+  epoll_event events[kMaxEpollEvents];
+
+  std::vector<PendingLocalConnection*> ready_local_connections;
+
+  for (;;) {
+    // Don't wait for new events if there's already work to do. If local
+    // connections are waiting for their handshakes, wake up in time to expire
+    // them.
+    int wait_timeout_ms = ready_connections.empty() ? timeout_ms : 0;
+    bool handshake_timeout = false;
+    if (!pending_local_connections_.empty() &&
+        (wait_timeout_ms == -1 || wait_timeout_ms > kLocalHandshakeTimeoutMs)) {
+      wait_timeout_ms = kLocalHandshakeTimeoutMs;
+      handshake_timeout = true;
+    }
+
+    VLOG(1) << "Entering epoll_wait()";
+    const int event_count = epoll_wait(epoll_fd_, events, kMaxEpollEvents,
+                                       wait_timeout_ms);
+    VLOG(1) << "Exiting epoll_wait()";
+    CHECK_ERR(event_count) << " epoll_wait";
+    CHECK(event_count > 0 || wait_timeout_ms == 0 || handshake_timeout)
+        << "epoll_wait() timed out.";
+
+    bool accept_ready = false;
+    bool local_accept_ready = false;
+
+    {
+      MutexLock lock(&mu_);
+
+      if (stop_requested_) {
+        return;
+      }
+
+      for (int i = 0; i < event_count; ++i) {
+        void* const ptr = events[i].data.ptr;
+
+        if (ptr == this) {
+          ClearEventFd(wake_event_fd_);
+        } else if (ptr == nullptr) {
+          accept_ready = true;
+        } else if (ptr == &local_listen_fd_) {
+          local_accept_ready = true;
+        } else if (pending_local_connections_.find(
+                       static_cast<PendingLocalConnection*>(ptr)) !=
+                   pending_local_connections_.end()) {
+          ready_local_connections.push_back(
+              static_cast<PendingLocalConnection*>(ptr));
+        } else {
+          ready_connections.insert(
+              static_cast<ProtocolConnectionImpl<Message>*>(ptr));
+        }
+      }
+
+      // Ignore notifications for connections that have already been closed.
+      for (ProtocolConnectionImpl<Message>* const connection :
+               notified_connections_) {
+        if (connections_.find(connection) != connections_.end()) {
+          ready_connections.insert(connection);
+        }
+      }
+
+      notified_connections_.clear();
+    }
+
+    if (accept_ready) {
+      AcceptConnections();
+    }
+    for (PendingLocalConnection* const pending_connection :
+             ready_local_connections) {
+      ReceiveLocalHandshake(pending_connection);
+    }
+    ready_local_connections.clear();
+    if (local_accept_ready) {
+      AcceptLocalConnections();
+    }
+    if (!pending_local_connections_.empty()) {
+      ExpireLocalHandshakes();
+    }
+
+    for (auto connection_it = ready_connections.begin();
+         connection_it != ready_connections.end(); ) {
+      if (HandleConnection(*connection_it)) {
+        ++connection_it;
+      } else {
+        connection_it = ready_connections.erase(connection_it);
+      }
+    }
+  }
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::AcceptConnections() {
+  // The listen socket is edge-triggered, so accept connections until there
+  // are none left.
+  for (;;) {
+    std::string remote_address;
+    const int connection_fd = AcceptConnection(listen_fd_, &remote_address);
+
+    if (connection_fd == -1) {
+      return;
+    }
+
+    if (keep_accepted_connections_) {
+      AddConnection(nullptr, connection_fd, remote_address, nullptr);
+    } else {
+      server_->NotifyConnectionAccepted(connection_fd, remote_address,
+                                        nullptr);
+    }
+  }
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::AcceptLocalConnections() {
+  for (;;) {
+    std::string remote_address;
+    const int connection_fd = AcceptConnection(local_listen_fd_,
+                                               &remote_address);
+
+    if (connection_fd == -1) {
+      return;
+    }
+
+    std::unique_ptr<PendingLocalConnection> pending_connection(
+        new PendingLocalConnection());
+    pending_connection->socket_fd = connection_fd;
+    pending_connection->deadline_usec = GetCurrentTimeUsec() +
+        static_cast<int64>(kLocalHandshakeTimeoutMs) * 1000;
+
+    PendingLocalConnection* const pending_connection_ptr =
+        pending_connection.get();
+    pending_local_connections_.emplace(pending_connection_ptr,
+                                       std::move(pending_connection));
+
+    // Watch the connection before trying to receive the handshake, so that a
+    // handshake that arrives in between isn't missed.
+    AddFdToEpollSet(connection_fd, pending_connection_ptr,
+                    EPOLLIN | EPOLLRDHUP | EPOLLET);
+    ReceiveLocalHandshake(pending_connection_ptr);
+  }
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::ReceiveLocalHandshake(
+    PendingLocalConnection* pending_connection) {
+  CHECK(pending_connection != nullptr);
+
+  const int socket_fd = pending_connection->socket_fd;
+
+  SharedMemoryChannel* channel = nullptr;
+  const LocalHandshakeResult result = AcceptLocalPeer(socket_fd, &channel);
+
+  if (result == LOCAL_HANDSHAKE_PENDING) {
+    return;
+  }
+
+  RemovePendingLocalConnection(pending_connection);
+
+  if (result == LOCAL_HANDSHAKE_ACCEPTED) {
+    // Unix domain sockets don't have a network address.
+    server_->NotifyConnectionAccepted(socket_fd, "localhost", channel);
+  } else {
+    CHECK_ERR(close(socket_fd));
+  }
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::ExpireLocalHandshakes() {
+  const int64 current_time_usec = GetCurrentTimeUsec();
+
+  std::vector<PendingLocalConnection*> expired_connections;
+  for (const auto& pending_pair : pending_local_connections_) {
+    if (pending_pair.first->deadline_usec <= current_time_usec) {
+      expired_connections.push_back(pending_pair.first);
+    }
+  }
+
+  for (PendingLocalConnection* const pending_connection :
+           expired_connections) {
+    LOG(WARNING) << "Timed out waiting for the local connection handshake.";
+
+    const int socket_fd = pending_connection->socket_fd;
+    RemovePendingLocalConnection(pending_connection);
+    CHECK_ERR(close(socket_fd));
+  }
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::RemovePendingLocalConnection(
+    PendingLocalConnection* pending_connection) {
+  CHECK(pending_connection != nullptr);
+
+  // The connection may be added to another epoll set (possibly this one) once
+  // it's passed to the server, so it has to be removed from this one first.
+  CHECK_ERR(epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, pending_connection->socket_fd,
+                      nullptr)) << " epoll_ctl";
+  CHECK_EQ(pending_local_connections_.erase(pending_connection), 1u);
+}
+
+template<class Message>
+bool ProtocolEpollReactor<Message>::HandleConnection(
+    ProtocolConnectionImpl<Message>* connection) {
+  CHECK(connection != nullptr);
+
+  connection->SendAndReceive();
+
+  if (connection->close_requested()) {
+    CloseConnection(connection);
+    return false;
+  }
+
+  return !connection->IsBlocked();
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::CloseConnection(
+    ProtocolConnectionImpl<Message>* connection) {
+  CHECK(connection != nullptr);
+
+  {
+    MutexLock lock(&mu_);
+    CHECK_EQ(connections_.erase(connection), 1u);
+  }
+
+  // Closing the socket also removes it from the epoll set.
+  connection->CloseSocket();
+  handler_->NotifyConnectionClosed(connection->protocol_connection_handler());
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::AddFdToEpollSet(int fd, void* ptr,
+                                                   uint32 events) {
+  CHECK_GE(fd, 0);
+
+  VLOG(1) << "Adding FD " << fd << " to epoll set " << epoll_fd_;
+
+  epoll_event event;
+  event.events = events;
+  event.data.ptr = ptr;
+
+  CHECK_ERR(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) << " epoll_ctl";
+}
+
+template<class Message>
+void ProtocolEpollReactor<Message>::NotifyConnectionChanged(
+    ProtocolConnection* connection) {
+  CHECK(connection != nullptr);
+
+  {
+    MutexLock lock(&mu_);
+    if (!notified_connections_.insert(
+            static_cast<ProtocolConnectionImpl<Message>*>(connection)).second) {
+      // The reactor thread hasn't picked up the previous notification yet.
+      return;
+    }
+  }
+
+  SignalEventFd(wake_event_fd_);
+}
+
+// static
+template<class Message>
+void* ProtocolEpollReactor<Message>::ReactorThreadMain(void* reactor_raw) {
+  CHECK(reactor_raw != nullptr);
+  static_cast<ProtocolEpollReactor<Message>*>(reactor_raw)->DoEventLoop();
+  return nullptr;
+}
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_PROTOCOL_EPOLL_REACTOR_H_
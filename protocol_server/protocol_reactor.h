@@ -0,0 +1,56 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROTOCOL_SERVER_PROTOCOL_REACTOR_H_
+#define PROTOCOL_SERVER_PROTOCOL_REACTOR_H_
+
+#include <string>
+
+namespace floating_temple {
+
+class SharedMemoryChannel;
+template<class Message> class ProtocolConnectionHandler;
+template<class Message> class ProtocolConnectionImpl;
+
+// An event loop that owns a subset of the connections of a ProtocolServer.
+// The reactor's thread sends and receives data on its connections itself, so
+// each connection is only ever handled by a single thread.
+//
+// Other threads may add connections to the reactor, or notify it that a
+// connection has a message ready to send.
+template<class Message>
+class ProtocolReactor {
+ public:
+  virtual ~ProtocolReactor() {}
+
+  virtual void Start() = 0;
+  // Stops the reactor thread and closes the sockets of the remaining
+  // connections.
+  virtual void Stop() = 0;
+
+  // Creates a connection for the given socket and adds it to this reactor. If
+  // 'connection_handler' is NULL, the ProtocolServerHandler is asked to provide
+  // one. This method does not take ownership of *connection_handler. If
+  // 'channel' is not NULL, the connection exchanges data through it, and takes
+  // ownership of it. The caller must take ownership of the returned
+  // connection.
+  virtual ProtocolConnectionImpl<Message>* AddConnection(
+      ProtocolConnectionHandler<Message>* connection_handler, int socket_fd,
+      const std::string& remote_address, SharedMemoryChannel* channel) = 0;
+};
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_PROTOCOL_REACTOR_H_
@@ -21,3 +21,18 @@ DEFINE_int32(protocol_connection_timeout_sec_for_debugging, -1,
              "If this flag is set, the process will crash if it needs to wait "
              "more than the specified number of seconds to send or receive "
              "data on a protocol connection. (For debugging only.)");
+DEFINE_bool(protocol_server_local_transport, true,
+            "If true, the protocol server also listens on a Unix domain "
+            "socket, and connections to protocol servers on the same host go "
+            "through it (with shared memory, unless "
+            "--protocol_server_shared_memory is false) instead of TCP.");
+DEFINE_bool(protocol_server_reuse_port, false,
+            "If true, each of the protocol server's reactor threads listens "
+            "for incoming connections on its own socket, using the "
+            "SO_REUSEPORT socket option, and keeps the connections that it "
+            "accepts.");
+DEFINE_bool(protocol_server_use_io_uring, false,
+            "If true, the protocol server submits the socket I/O for its "
+            "connections to io_uring in batches, instead of waiting for "
+            "readiness events with epoll. If the kernel doesn't support "
+            "io_uring, the server falls back to epoll.");
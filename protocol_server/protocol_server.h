@@ -16,15 +16,10 @@
 #ifndef PROTOCOL_SERVER_PROTOCOL_SERVER_H_
 #define PROTOCOL_SERVER_PROTOCOL_SERVER_H_
 
-#include <pthread.h>
-#include <sys/eventfd.h>
-#include <sys/select.h>
-#include <sys/time.h>
-#include <sys/types.h>
 #include <unistd.h>
 
+#include <memory>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -33,38 +28,63 @@
 #include "base/macros.h"
 #include "base/mutex.h"
 #include "base/mutex_lock.h"
+#include "protocol_server/local_transport.h"
 #include "protocol_server/protocol_connection.h"
 #include "protocol_server/protocol_connection_handler.h"
-#include "protocol_server/protocol_connection_impl.h"
+#include "protocol_server/protocol_epoll_reactor.h"
+#include "protocol_server/protocol_reactor.h"
 #include "protocol_server/protocol_server_handler.h"
-#include "protocol_server/protocol_server_interface_for_connection.h"
-#include "util/event_fd.h"
-#include "util/producer_consumer_queue.h"
-#include "util/socket_util.h"
+#include "protocol_server/protocol_server_interface_for_reactor.h"
+#include "protocol_server/protocol_uring_reactor.h"
+#include "protocol_server/shared_memory_channel.h"
 #include "util/state_variable.h"
 #include "util/tcp.h"
 
-DECLARE_int32(protocol_connection_timeout_sec_for_debugging);
+DECLARE_bool(protocol_server_local_transport);
+DECLARE_bool(protocol_server_reuse_port);
+DECLARE_bool(protocol_server_use_io_uring);
 
 namespace floating_temple {
 
+// Sends and receives messages on a set of socket connections.
+//
+// The connections are divided among several reactors, each of which has its
+// own thread and event loop (see ProtocolReactor). New connections are
+// assigned to the reactors in round-robin order. If the
+// --protocol_server_reuse_port flag is set, each reactor also has its own
+// listen socket on the same port, and keeps the connections that it accepts.
+// Otherwise, the first reactor accepts all incoming connections.
+//
+// The reactors wait for readiness events with epoll (see ProtocolEpollReactor),
+// unless the --protocol_server_use_io_uring flag is set and the kernel supports
+// io_uring, in which case they submit the socket I/O to io_uring in batches
+// (see ProtocolUringReactor).
+//
+// If the --protocol_server_local_transport flag is set (and io_uring isn't
+// used), the server also listens on a Unix domain socket, and connections to
+// servers on the same host go through it instead of TCP, usually with a shared
+// memory channel. (See local_transport.h.)
 template<class Message>
-class ProtocolServer : private ProtocolServerInterfaceForConnection {
+class ProtocolServer : private ProtocolServerInterfaceForReactor {
  public:
   ProtocolServer();
   ~ProtocolServer();
 
+  // 'reactor_count' is the number of threads used to send and receive data.
   void Start(ProtocolServerHandler<Message>* handler,
              const std::string& local_address,
              int listen_port,
-             int send_receive_thread_count);
+             int reactor_count);
   void Stop();
 
   // This method does not take ownership of *connection_handler. The caller must
   // take ownership of the returned ProtocolConnection instance.
+  //
+  // Returns NULL if the connection couldn't be established within 'timeout_ms'
+  // milliseconds. -1 means no timeout.
   ProtocolConnection* OpenConnection(
       ProtocolConnectionHandler<Message>* connection_handler,
-      const std::string& address, int port);
+      const std::string& address, int port, int timeout_ms);
 
  private:
   enum {
@@ -75,41 +95,20 @@ class ProtocolServer : private ProtocolServerInterfaceForConnection {
     STOPPED = 0x10
   };
 
-  bool AcceptSingleConnection();
-
-  ProtocolConnectionImpl<Message>* CreateConnection(
-      ProtocolConnectionHandler<Message>* connection_handler, int socket_fd,
-      const std::string& remote_address);
-
-  void DoSelectLoop();
-  void SendAndReceiveData();
-
-  bool GetNextReadyConnection(ProtocolConnectionImpl<Message>** connection);
-  void AddConnectionToReadyConnections(
-      ProtocolConnectionImpl<Message>* connection);
+  ProtocolReactor<Message>* GetNextReactor();
 
-  void NotifyConnectionsChanged() override;
+  void NotifyConnectionAccepted(int socket_fd,
+                                const std::string& remote_address,
+                                SharedMemoryChannel* channel) override;
 
-  static void* SelectThreadMain(void* protocol_server_raw);
-  static void* SendReceiveThreadMain(void* protocol_server_raw);
+  std::vector<int> listen_fds_;
+  // The Unix domain socket for connections from the same host, or -1.
+  int local_listen_fd_;
+  std::vector<std::unique_ptr<ProtocolReactor<Message>>> reactors_;
 
-  static void AddFdToSet(int fd, fd_set* fds, int* nfds);
-
-  ProtocolServerHandler<Message>* handler_;
-  int listen_fd_;
-  // Signaled when a connection is added to blocked_connections_, or when the
-  // state of a connection changes.
-  int connections_changed_event_fd_;
-  pthread_t select_thread_;
-  std::vector<pthread_t> send_receive_threads_;
-
-  // A NULL pointer in this queue means that the listen socket is ready. (I.e.,
-  // an incoming connection is ready to be accepted.)
-  ProducerConsumerQueue<ProtocolConnectionImpl<Message>*> ready_connections_;
-
-  // A NULL pointer in this set means that the listen socket is blocked.
-  std::unordered_set<ProtocolConnectionImpl<Message>*> blocked_connections_;
-  mutable Mutex blocked_connections_mu_;
+  typename std::vector<std::unique_ptr<ProtocolReactor<Message>>>::size_type
+      next_reactor_index_;
+  mutable Mutex next_reactor_index_mu_;
 
   StateVariable state_;
 
@@ -118,10 +117,8 @@ class ProtocolServer : private ProtocolServerInterfaceForConnection {
 
 template<class Message>
 ProtocolServer<Message>::ProtocolServer()
-    : handler_(nullptr),
-      listen_fd_(-1),
-      connections_changed_event_fd_(-1),
-      ready_connections_(-1),
+    : local_listen_fd_(-1),
+      next_reactor_index_(0),
       state_(NOT_STARTED) {
   state_.AddStateTransition(NOT_STARTED, STARTING);
   state_.AddStateTransition(STARTING, RUNNING);
@@ -132,344 +129,133 @@ ProtocolServer<Message>::ProtocolServer()
 template<class Message>
 ProtocolServer<Message>::~ProtocolServer() {
   state_.CheckState(NOT_STARTED | STOPPED);
-
-  MutexLock lock(&blocked_connections_mu_);
-  CHECK_EQ(blocked_connections_.size(), 0u);
 }
 
 template<class Message>
 void ProtocolServer<Message>::Start(ProtocolServerHandler<Message>* handler,
                                     const std::string& local_address,
                                     int listen_port,
-                                    int send_receive_thread_count) {
+                                    int reactor_count) {
   CHECK(handler != nullptr);
-  CHECK_GT(send_receive_thread_count, 0);
+  CHECK_GT(reactor_count, 0);
 
   state_.ChangeState(STARTING);
 
-  handler_ = handler;
-  listen_fd_ = ListenOnLocalAddress(local_address, listen_port);
-
-  connections_changed_event_fd_ = eventfd(0, EFD_CLOEXEC);
-  CHECK_ERR(connections_changed_event_fd_) << " eventfd";
-  CHECK(SetFdToNonBlocking(connections_changed_event_fd_));
-
-  CHECK_PTHREAD_ERR(pthread_create(
-      &select_thread_, nullptr,
-      &ProtocolServer<Message>::SelectThreadMain, this));
-
-  send_receive_threads_.resize(send_receive_thread_count);
-  for (int i = 0; i < send_receive_thread_count; ++i) {
-    CHECK_PTHREAD_ERR(pthread_create(
-        &send_receive_threads_[i], nullptr,
-        &ProtocolServer<Message>::SendReceiveThreadMain, this));
+  bool use_io_uring = false;
+  if (FLAGS_protocol_server_use_io_uring) {
+    use_io_uring = ProtocolUringReactor<Message>::IsSupported();
+    LOG_IF(WARNING, !use_io_uring)
+        << "io_uring isn't available. Falling back to epoll.";
   }
 
-  CHECK(ready_connections_.Push(nullptr, false));
-
-  state_.ChangeState(RUNNING);
-}
-
-template<class Message>
-void ProtocolServer<Message>::Stop() {
-  state_.ChangeState(STOPPING);
-  // Wake the send/receive thread.
-  ready_connections_.Drain();
-  // Wake the select thread.
-  SignalEventFd(connections_changed_event_fd_);
-
-  for (const pthread_t thread : send_receive_threads_) {
-    void* thread_return_value = nullptr;
-    CHECK_PTHREAD_ERR(pthread_join(thread, &thread_return_value));
+  if (FLAGS_protocol_server_local_transport && !use_io_uring) {
+    local_listen_fd_ = ListenForLocalConnections(local_address, listen_port);
+    LOG_IF(WARNING, local_listen_fd_ == -1)
+        << "Could not listen for local connections. Connections from this "
+        << "host will use TCP.";
   }
 
-  void* thread_return_value = nullptr;
-  CHECK_PTHREAD_ERR(pthread_join(select_thread_, &thread_return_value));
+  reactors_.reserve(reactor_count);
 
-  CHECK_ERR(close(connections_changed_event_fd_));
-  CHECK_ERR(close(listen_fd_));
+  for (int i = 0; i < reactor_count; ++i) {
+    int listen_fd = -1;
 
-  std::unordered_set<ProtocolConnectionImpl<Message>*> all_connections;
-
-  for (;;) {
-    ProtocolConnectionImpl<Message>* connection = nullptr;
-    if (!ready_connections_.Pop(&connection, false)) {
-      break;
+    if (FLAGS_protocol_server_reuse_port) {
+      listen_fd = ListenOnSharedLocalPort(local_address, listen_port);
+    } else if (i == 0) {
+      listen_fd = ListenOnLocalAddress(local_address, listen_port);
     }
 
-    if (connection != nullptr) {
-      CHECK(all_connections.insert(connection).second);
+    if (listen_fd != -1) {
+      listen_fds_.push_back(listen_fd);
     }
-  }
 
-  {
-    MutexLock lock(&blocked_connections_mu_);
-
-    for (ProtocolConnectionImpl<Message>* const connection :
-             blocked_connections_) {
-      if (connection != nullptr) {
-        CHECK(all_connections.insert(connection).second);
-      }
+    if (use_io_uring) {
+      reactors_.emplace_back(new ProtocolUringReactor<Message>(
+          this, handler, listen_fd, FLAGS_protocol_server_reuse_port));
+    } else {
+      reactors_.emplace_back(new ProtocolEpollReactor<Message>(
+          this, handler, listen_fd, FLAGS_protocol_server_reuse_port,
+          i == 0 ? local_listen_fd_ : -1));
     }
-
-    blocked_connections_.clear();
   }
 
-  for (ProtocolConnectionImpl<Message>* const connection : all_connections) {
-    connection->CloseSocket();
+  for (const std::unique_ptr<ProtocolReactor<Message>>& reactor : reactors_) {
+    reactor->Start();
   }
 
-  state_.ChangeState(STOPPED);
-}
-
-template<class Message>
-ProtocolConnection* ProtocolServer<Message>::OpenConnection(
-    ProtocolConnectionHandler<Message>* connection_handler,
-    const std::string& address, int port) {
-  const int socket_fd = ConnectToRemoteHost(address, port);
-  if (socket_fd == -1) {
-    return nullptr;
-  }
-  return CreateConnection(connection_handler, socket_fd, "");
+  state_.ChangeState(RUNNING);
 }
 
 template<class Message>
-bool ProtocolServer<Message>::AcceptSingleConnection() {
-  std::string remote_address;
-  const int connection_fd = AcceptConnection(listen_fd_, &remote_address);
+void ProtocolServer<Message>::Stop() {
+  state_.ChangeState(STOPPING);
 
-  if (connection_fd == -1) {
-    return false;
+  for (const std::unique_ptr<ProtocolReactor<Message>>& reactor : reactors_) {
+    reactor->Stop();
   }
 
-  CreateConnection(nullptr, connection_fd, remote_address);
-
-  return true;
-}
-
-template<class Message>
-ProtocolConnectionImpl<Message>* ProtocolServer<Message>::CreateConnection(
-    ProtocolConnectionHandler<Message>* connection_handler, int socket_fd,
-    const std::string& remote_address) {
-  // TODO(dss): Should we set socket_fd to non-blocking mode here? (It's already
-  // set to non-blocking mode elsewhere, but perhaps this is the proper place to
-  // do it.)
-
-  ProtocolConnectionImpl<Message>* const connection =
-      new ProtocolConnectionImpl<Message>(this, socket_fd);
-
-  if (connection_handler == nullptr) {
-    connection_handler = handler_->NotifyConnectionReceived(connection,
-                                                            remote_address);
+  for (const int listen_fd : listen_fds_) {
+    CHECK_ERR(close(listen_fd));
   }
 
-  connection->Init(connection_handler);
-  AddConnectionToReadyConnections(connection);
-
-  return connection;
-}
-
-template<class Message>
-void ProtocolServer<Message>::DoSelectLoop() {
-  state_.WaitForNotState(NOT_STARTED | STARTING);
-
-  while (state_.MatchesStateMask(RUNNING)) {
-    ClearEventFd(connections_changed_event_fd_);
-
-    std::unordered_set<ProtocolConnectionImpl<Message>*>
-        blocked_connections_temp;
-    {
-      MutexLock lock(&blocked_connections_mu_);
-      blocked_connections_temp.swap(blocked_connections_);
-    }
-
-    int nfds = 0;
-
-    fd_set read_fd_set, write_fd_set;
-    FD_ZERO(&read_fd_set);
-    FD_ZERO(&write_fd_set);
-
-    for (auto connection_it = blocked_connections_temp.begin();
-         connection_it != blocked_connections_temp.end(); ) {
-      ProtocolConnectionImpl<Message>* const connection = *connection_it;
-
-      bool erase_connection = false;
-
-      if (connection == nullptr) {
-        AddFdToSet(listen_fd_, &read_fd_set, &nfds);
-      } else {
-        if (connection->close_requested()) {
-          connection->CloseSocket();
-          handler_->NotifyConnectionClosed(
-              connection->protocol_connection_handler());
-
-          erase_connection = true;
-        } else {
-          if (connection->IsBlocked()) {
-            const int socket_fd = connection->socket_fd();
-
-            AddFdToSet(socket_fd, &read_fd_set, &nfds);
-            if (connection->HasOutputData()) {
-              AddFdToSet(socket_fd, &write_fd_set, &nfds);
-            }
-          } else {
-            AddConnectionToReadyConnections(connection);
-            erase_connection = true;
-          }
-        }
-      }
-
-      if (erase_connection) {
-        const auto erase_it = connection_it;
-        ++connection_it;
-        blocked_connections_temp.erase(erase_it);
-      } else {
-        ++connection_it;
-      }
-    }
-
-    AddFdToSet(connections_changed_event_fd_, &read_fd_set, &nfds);
-
-    timeval deadline;
-    deadline.tv_sec = 0;
-    deadline.tv_usec = 0;
+  if (local_listen_fd_ != -1) {
+    CHECK_ERR(close(local_listen_fd_));
+    local_listen_fd_ = -1;
+  }
 
-    timeval* deadline_ptr = nullptr;
+  reactors_.clear();
+  listen_fds_.clear();
 
-    if (FLAGS_protocol_connection_timeout_sec_for_debugging >= 0) {
-      deadline.tv_sec = static_cast<long>(
-          FLAGS_protocol_connection_timeout_sec_for_debugging);
-      deadline_ptr = &deadline;
-    }
-
-    // TODO(dss): Use epoll instead of select for better performance.
-    VLOG(1) << "Entering select()";
-    const int fd_count = select(nfds, &read_fd_set, &write_fd_set, nullptr,
-                                deadline_ptr);
-    VLOG(1) << "Exiting select()";
-    CHECK_ERR(fd_count) << " select";
-    CHECK_GT(fd_count, 0) << "select() timed out.";
-
-    for (ProtocolConnectionImpl<Message>* const connection :
-             blocked_connections_temp) {
-      bool ready = false;
-
-      if (connection == nullptr) {
-        if (FD_ISSET(listen_fd_, &read_fd_set)) {
-          ready = true;
-        }
-      } else {
-        const int socket_fd = connection->socket_fd();
-
-        if (FD_ISSET(socket_fd, &read_fd_set) ||
-            FD_ISSET(socket_fd, &write_fd_set)) {
-          ready = true;
-        }
-      }
-
-      if (ready) {
-        AddConnectionToReadyConnections(connection);
-      } else {
-        MutexLock lock(&blocked_connections_mu_);
-        CHECK(blocked_connections_.insert(connection).second);
-      }
-    }
-  }
+  state_.ChangeState(STOPPED);
 }
 
 template<class Message>
-void ProtocolServer<Message>::SendAndReceiveData() {
-  state_.WaitForNotState(NOT_STARTED | STARTING);
-
-  for (;;) {
-    ProtocolConnectionImpl<Message>* connection = nullptr;
-    if (!GetNextReadyConnection(&connection)) {
-      return;
-    }
-
-    bool blocked = false;
-
-    if (connection == nullptr) {
-      if (!AcceptSingleConnection()) {
-        blocked = true;
-      }
-    } else {
-      connection->SendAndReceive();
-
-      if (connection->close_requested() || connection->IsBlocked()) {
-        blocked = true;
-      }
+ProtocolConnection* ProtocolServer<Message>::OpenConnection(
+    ProtocolConnectionHandler<Message>* connection_handler,
+    const std::string& address, int port, int timeout_ms) {
+  // Connect to servers on the same host through their Unix domain sockets if
+  // possible. This server only supports the local transport if it listens on
+  // a Unix domain socket itself.
+  if (local_listen_fd_ != -1 && IsLocalAddress(address)) {
+    SharedMemoryChannel* channel = nullptr;
+    const int socket_fd = ConnectToLocalPeer(address, port, &channel);
+
+    if (socket_fd != -1) {
+      return GetNextReactor()->AddConnection(connection_handler, socket_fd, "",
+                                             channel);
     }
 
-    if (blocked) {
-      {
-        MutexLock lock(&blocked_connections_mu_);
-        CHECK(blocked_connections_.insert(connection).second);
-      }
-
-      SignalEventFd(connections_changed_event_fd_);
-    } else {
-      AddConnectionToReadyConnections(connection);
-    }
+    LOG(WARNING) << "Could not connect to the local server on port " << port
+                 << " through a Unix domain socket. Falling back to TCP.";
   }
-}
 
-template<class Message>
-bool ProtocolServer<Message>::GetNextReadyConnection(
-    ProtocolConnectionImpl<Message>** connection) {
-  while (state_.MatchesStateMask(RUNNING)) {
-    if (ready_connections_.Pop(connection, true)) {
-      return true;
-    }
+  const int socket_fd = ConnectToRemoteHost(address, port, timeout_ms);
+  if (socket_fd == -1) {
+    return nullptr;
   }
-
-  return false;
+  return GetNextReactor()->AddConnection(connection_handler, socket_fd, "",
+                                         nullptr);
 }
 
 template<class Message>
-void ProtocolServer<Message>::AddConnectionToReadyConnections(
-    ProtocolConnectionImpl<Message>* connection) {
-  CHECK(ready_connections_.Push(connection, false));
-}
+ProtocolReactor<Message>* ProtocolServer<Message>::GetNextReactor() {
+  CHECK(!reactors_.empty());
 
-template<class Message>
-void ProtocolServer<Message>::NotifyConnectionsChanged() {
-  SignalEventFd(connections_changed_event_fd_);
-}
+  MutexLock lock(&next_reactor_index_mu_);
 
-// static
-template<class Message>
-void* ProtocolServer<Message>::SelectThreadMain(void* protocol_server_raw) {
-  CHECK(protocol_server_raw != nullptr);
-  static_cast<ProtocolServer<Message>*>(protocol_server_raw)->DoSelectLoop();
-  return nullptr;
-}
+  ProtocolReactor<Message>* const reactor =
+      reactors_[next_reactor_index_].get();
+  next_reactor_index_ = (next_reactor_index_ + 1) % reactors_.size();
 
-// static
-template<class Message>
-void* ProtocolServer<Message>::SendReceiveThreadMain(
-    void* protocol_server_raw) {
-  CHECK(protocol_server_raw != nullptr);
-  static_cast<ProtocolServer<Message>*>(protocol_server_raw)->
-      SendAndReceiveData();
-  return nullptr;
+  return reactor;
 }
 
-// static
 template<class Message>
-void ProtocolServer<Message>::AddFdToSet(int fd, fd_set* fds, int* nfds) {
-  CHECK_GE(fd, 0);
-  CHECK(fds != nullptr);
-  CHECK(nfds != nullptr);
-  CHECK_GE(*nfds, 0);
-
-  VLOG(1) << "Adding FD " << fd << " to fd_set " << fds;
-
-  FD_SET(fd, fds);
-
-  if (fd + 1 > *nfds) {
-    *nfds = fd + 1;
-  }
+void ProtocolServer<Message>::NotifyConnectionAccepted(
+    int socket_fd, const std::string& remote_address,
+    SharedMemoryChannel* channel) {
+  GetNextReactor()->AddConnection(nullptr, socket_fd, remote_address, channel);
 }
 
 }  // namespace floating_temple
@@ -18,11 +18,16 @@
 
 namespace floating_temple {
 
+class ProtocolConnection;
+
 class ProtocolServerInterfaceForConnection {
  public:
   virtual ~ProtocolServerInterfaceForConnection() {}
 
-  virtual void NotifyConnectionsChanged() = 0;
+  // Called when the connection may be able to make progress without waiting
+  // for the socket; e.g., because a message is ready to be sent or the
+  // connection should be closed.
+  virtual void NotifyConnectionChanged(ProtocolConnection* connection) = 0;
 };
 
 }  // namespace floating_temple
@@ -0,0 +1,40 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROTOCOL_SERVER_PROTOCOL_SERVER_INTERFACE_FOR_REACTOR_H_
+#define PROTOCOL_SERVER_PROTOCOL_SERVER_INTERFACE_FOR_REACTOR_H_
+
+#include <string>
+
+namespace floating_temple {
+
+class SharedMemoryChannel;
+
+class ProtocolServerInterfaceForReactor {
+ public:
+  virtual ~ProtocolServerInterfaceForReactor() {}
+
+  // Called when a reactor accepts a connection that it doesn't keep for
+  // itself. The server assigns the connection to one of its reactors. If
+  // 'channel' is not NULL, the connection exchanges data through it, and the
+  // callee takes ownership of it.
+  virtual void NotifyConnectionAccepted(int socket_fd,
+                                        const std::string& remote_address,
+                                        SharedMemoryChannel* channel) = 0;
+};
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_PROTOCOL_SERVER_INTERFACE_FOR_REACTOR_H_
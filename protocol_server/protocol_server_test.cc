@@ -0,0 +1,287 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "protocol_server/protocol_server.h"
+
+#include <unistd.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/mutex.h"
+#include "base/mutex_lock.h"
+#include "base/notification.h"
+#include "base/thread_safe_counter.h"
+#include "protocol_server/format_protocol_message.h"
+#include "protocol_server/local_transport.h"
+#include "protocol_server/protocol_connection.h"
+#include "protocol_server/protocol_connection_handler.h"
+#include "protocol_server/protocol_server_handler.h"
+#include "protocol_server/testdata/test.pb.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+#include "util/tcp.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::deque;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using testing::InitGoogleTest;
+using testing::Test;
+
+namespace floating_temple {
+namespace {
+
+// Sends the messages that are queued by the test, and checks that the
+// messages received on the connection are numbered consecutively. If 'echo' is
+// true, each received message is sent back to the remote end.
+class TestConnectionHandler : public ProtocolConnectionHandler<TestMessage> {
+ public:
+  TestConnectionHandler(bool echo, int expected_message_count)
+      : echo_(echo),
+        received_message_counter_(expected_message_count),
+        connection_(nullptr),
+        next_message_number_(0) {
+  }
+
+  ThreadSafeCounter* received_message_counter()
+      { return &received_message_counter_; }
+
+  void set_connection(ProtocolConnection* connection) {
+    MutexLock lock(&mu_);
+    connection_ = connection;
+  }
+
+  void QueueMessage(const TestMessage& message) {
+    ProtocolConnection* connection = nullptr;
+    {
+      MutexLock lock(&mu_);
+      output_messages_.push_back(FormatSharedProtocolMessage(message));
+      connection = connection_;
+    }
+
+    CHECK(connection != nullptr);
+    connection->NotifyMessageReadyToSend();
+  }
+
+  bool GetNextOutputMessage(shared_ptr<const string>* formatted_message)
+      override {
+    CHECK(formatted_message != nullptr);
+
+    MutexLock lock(&mu_);
+
+    if (output_messages_.empty()) {
+      return false;
+    }
+
+    *formatted_message = output_messages_.front();
+    output_messages_.pop_front();
+
+    return true;
+  }
+
+  void NotifyMessageReceived(TestMessage* message) override {
+    CHECK(message != nullptr);
+    message->CheckInitialized();
+
+    {
+      MutexLock lock(&mu_);
+      CHECK_EQ(message->n(), next_message_number_);
+      ++next_message_number_;
+    }
+
+    if (echo_) {
+      QueueMessage(*message);
+    } else {
+      received_message_counter_.Decrement();
+    }
+  }
+
+ private:
+  const bool echo_;
+  ThreadSafeCounter received_message_counter_;
+
+  ProtocolConnection* connection_;
+  deque<shared_ptr<const string>> output_messages_;
+  int next_message_number_;
+  mutable Mutex mu_;
+
+  DISALLOW_COPY_AND_ASSIGN(TestConnectionHandler);
+};
+
+// Accepts connections and echoes the messages received on them. If 'accept' is
+// false, the server isn't expected to receive any connections.
+class TestServerHandler : public ProtocolServerHandler<TestMessage> {
+ public:
+  explicit TestServerHandler(bool accept)
+      : accept_(accept) {
+  }
+
+  Notification* connection_closed() { return &connection_closed_; }
+
+  ProtocolConnectionHandler<TestMessage>* NotifyConnectionReceived(
+      ProtocolConnection* connection, const string& remote_address) override {
+    CHECK(accept_) << "Unexpected connection from " << remote_address;
+
+    TestConnectionHandler* const connection_handler =
+        new TestConnectionHandler(true, 0);
+    connection_handler->set_connection(connection);
+
+    MutexLock lock(&mu_);
+    connections_.emplace_back(connection);
+    connection_handlers_.emplace_back(connection_handler);
+
+    return connection_handler;
+  }
+
+  void NotifyConnectionClosed(
+      ProtocolConnectionHandler<TestMessage>* connection_handler) override {
+    connection_closed_.Notify();
+  }
+
+ private:
+  const bool accept_;
+  Notification connection_closed_;
+
+  vector<unique_ptr<ProtocolConnection>> connections_;
+  vector<unique_ptr<TestConnectionHandler>> connection_handlers_;
+  mutable Mutex mu_;
+
+  DISALLOW_COPY_AND_ASSIGN(TestServerHandler);
+};
+
+class ProtocolServerTest : public Test {
+ protected:
+  ProtocolServerTest()
+      : server_handler_(true),
+        client_handler_(false) {
+  }
+
+  void TearDown() override {
+    FLAGS_protocol_server_use_io_uring = false;
+    FLAGS_protocol_server_local_transport = true;
+    FLAGS_protocol_server_shared_memory = true;
+  }
+
+  // Starts a server and a client on this host, sends messages from the client
+  // to the server and back, and then closes the connection.
+  void EchoMessages() {
+    static const int kReactorCount = 2;
+    static const int kMessageCount = 1000;
+
+    const string local_address = GetLocalAddress();
+    const int server_port = GetUnusedPortForTesting();
+
+    server_.Start(&server_handler_, local_address, server_port,
+                  kReactorCount);
+    client_.Start(&client_handler_, local_address, GetUnusedPortForTesting(),
+                  kReactorCount);
+
+    TestConnectionHandler connection_handler(false, kMessageCount);
+    const unique_ptr<ProtocolConnection> connection(client_.OpenConnection(
+        &connection_handler, local_address, server_port, -1));
+    ASSERT_TRUE(connection.get() != nullptr);
+    connection_handler.set_connection(connection.get());
+
+    // Some of the messages are larger than the receive buffer, and larger than
+    // the amount of data that a connection sends in a single system call.
+    for (int i = 0; i < kMessageCount; ++i) {
+      TestMessage message;
+      message.set_n(i);
+      message.set_s(string(i % 100 == 0 ? 300 * 1024 : i, 'x'));
+
+      connection_handler.QueueMessage(message);
+    }
+
+    EXPECT_TRUE(connection_handler.received_message_counter()->
+                WaitForZeroWithTimeout(10000));  // milliseconds
+
+    connection->Close();
+    connection->NotifyMessageReadyToSend();
+
+    EXPECT_TRUE(client_handler_.connection_closed()->WaitWithTimeout(5000));
+    EXPECT_TRUE(server_handler_.connection_closed()->WaitWithTimeout(5000));
+
+    client_.Stop();
+    server_.Stop();
+  }
+
+  TestServerHandler server_handler_;
+  TestServerHandler client_handler_;
+  ProtocolServer<TestMessage> server_;
+  ProtocolServer<TestMessage> client_;
+};
+
+TEST_F(ProtocolServerTest, EchoMessagesWithEpoll) {
+  FLAGS_protocol_server_use_io_uring = false;
+  FLAGS_protocol_server_local_transport = false;
+  EchoMessages();
+}
+
+// If the kernel doesn't support io_uring, the server falls back to epoll and
+// this test still passes.
+TEST_F(ProtocolServerTest, EchoMessagesWithIoUring) {
+  FLAGS_protocol_server_use_io_uring = true;
+  EchoMessages();
+}
+
+TEST_F(ProtocolServerTest, EchoMessagesThroughSharedMemory) {
+  FLAGS_protocol_server_local_transport = true;
+  FLAGS_protocol_server_shared_memory = true;
+  EchoMessages();
+}
+
+TEST_F(ProtocolServerTest, EchoMessagesThroughUnixSocket) {
+  FLAGS_protocol_server_local_transport = true;
+  FLAGS_protocol_server_shared_memory = false;
+  EchoMessages();
+}
+
+// The name of the server's Unix domain socket is already in use. The server
+// starts anyway, without the local transport.
+TEST_F(ProtocolServerTest, StartWhenLocalSocketNameIsTaken) {
+  FLAGS_protocol_server_local_transport = true;
+
+  const string local_address = GetLocalAddress();
+  const int server_port = GetUnusedPortForTesting();
+
+  const int other_listen_fd = ListenForLocalConnections(local_address,
+                                                        server_port);
+  ASSERT_NE(-1, other_listen_fd);
+  EXPECT_EQ(-1, ListenForLocalConnections(local_address, server_port));
+
+  server_.Start(&server_handler_, local_address, server_port, 1);
+  server_.Stop();
+
+  CHECK_ERR(close(other_listen_fd));
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
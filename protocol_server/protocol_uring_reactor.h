@@ -0,0 +1,683 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROTOCOL_SERVER_PROTOCOL_URING_REACTOR_H_
+#define PROTOCOL_SERVER_PROTOCOL_URING_REACTOR_H_
+
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/mutex.h"
+#include "base/mutex_lock.h"
+#include "protocol_server/protocol_connection.h"
+#include "protocol_server/protocol_connection_handler.h"
+#include "protocol_server/protocol_connection_impl.h"
+#include "protocol_server/protocol_reactor.h"
+#include "protocol_server/protocol_server_handler.h"
+#include "protocol_server/protocol_server_interface_for_connection.h"
+#include "protocol_server/protocol_server_interface_for_reactor.h"
+#include "util/event_fd.h"
+#include "util/io_uring.h"
+#include "util/socket_util.h"
+
+namespace floating_temple {
+
+// A reactor that performs the socket I/O for its connections asynchronously,
+// using io_uring. Each connection has at most one receive and one send in
+// progress at a time. The operations for all of the connections (as well as
+// accepting new connections) are submitted in a batch, and the reactor thread
+// waits for their completions, with a single system call per iteration of the
+// event loop.
+//
+// The sockets are put in blocking mode, so that the kernel waits for them to
+// become ready instead of failing the operations with EAGAIN.
+template<class Message>
+class ProtocolUringReactor : public ProtocolReactor<Message>,
+                             private ProtocolServerInterfaceForConnection {
+ public:
+  // The parameters have the same meaning as for ProtocolEpollReactor.
+  ProtocolUringReactor(ProtocolServerInterfaceForReactor* server,
+                       ProtocolServerHandler<Message>* handler, int listen_fd,
+                       bool keep_accepted_connections);
+  ~ProtocolUringReactor() override;
+
+  // Returns true if the kernel supports the io_uring operations that this
+  // class uses.
+  static bool IsSupported();
+
+  void Start() override;
+  void Stop() override;
+
+  // TODO(dss): Support shared memory channels. For now, 'channel' must be
+  // NULL.
+  ProtocolConnectionImpl<Message>* AddConnection(
+      ProtocolConnectionHandler<Message>* connection_handler, int socket_fd,
+      const std::string& remote_address, SharedMemoryChannel* channel) override;
+
+ private:
+  // The type of an operation is stored in the low bits of the user data of its
+  // submission queue entry. The remaining bits hold a pointer to the state of
+  // the connection that the operation belongs to (if any).
+  enum OperationType {
+    RECEIVE_OPERATION = 0,
+    SEND_OPERATION = 1,
+    ACCEPT_OPERATION = 2,
+    WAKE_OPERATION = 3,
+    CANCEL_OPERATION = 4
+  };
+
+  // The state of a connection that belongs to this reactor. Accessed only by
+  // the reactor thread.
+  struct ConnectionState {
+    ProtocolConnectionImpl<Message>* connection;
+    bool receive_pending;
+    bool send_pending;
+    // When the connection is being closed, the remaining output data (e.g., a
+    // GOODBYE message) is sent once, then the socket is shut down so that the
+    // pending receive completes.
+    bool final_send_submitted;
+    bool shut_down;
+    // The arguments of the pending send. They must remain valid until the send
+    // completes.
+    msghdr message_header;
+    iovec iov[ProtocolConnectionImpl<Message>::kMaxOutputMessageCount];
+  };
+
+  static const unsigned kRingEntryCount = 256;
+  static const uint64 kOperationTypeMask = 0x7;
+
+  static std::vector<int> GetRequiredOpcodes();
+
+  void DoEventLoop();
+  // Adopts new connections and updates the connections that other threads
+  // have notified the reactor of. Returns true if the reactor should stop.
+  bool ProcessNotifications();
+  void HandleCompletion(const io_uring_cqe& cqe);
+  void HandleAcceptCompletion(int result);
+  // Submits the operations that the connection needs next, or closes it.
+  void UpdateConnection(ConnectionState* state);
+  void CloseConnection(ConnectionState* state);
+  // Shuts down the remaining connections and waits for all of the pending
+  // operations to complete.
+  void ShutDown();
+
+  void SubmitAccept();
+  void SubmitWakeRead();
+  void SubmitReceive(ConnectionState* state);
+  // Returns false if there's nothing to send.
+  bool SubmitSend(ConnectionState* state);
+  void SubmitCancel(uint64 target_user_data);
+  io_uring_sqe* GetSubmissionEntry(ConnectionState* state,
+                                   OperationType operation_type);
+
+  void NotifyConnectionChanged(ProtocolConnection* connection) override;
+
+  static void* ReactorThreadMain(void* reactor_raw);
+
+  ProtocolServerInterfaceForReactor* const server_;
+  ProtocolServerHandler<Message>* const handler_;
+  const int listen_fd_;
+  const bool keep_accepted_connections_;
+
+  IoUring ring_;
+  // Signaled to wake the reactor thread when another thread notifies it of a
+  // connection, or when the reactor is stopped.
+  int wake_event_fd_;
+  pthread_t reactor_thread_;
+
+  // The following members are accessed only by the reactor thread.
+  std::unordered_map<ProtocolConnectionImpl<Message>*,
+                     std::unique_ptr<ConnectionState>> connection_states_;
+  int pending_operation_count_;
+  bool accept_pending_;
+  bool wake_pending_;
+  bool stopping_;
+  // The buffers for the pending accept and wake operations.
+  sockaddr_storage accept_address_;
+  socklen_t accept_address_length_;
+  uint64 wake_counter_;
+
+  // Connections that have been added to the reactor but not yet adopted by the
+  // reactor thread, and connections that the reactor thread should update.
+  std::vector<ProtocolConnectionImpl<Message>*> new_connections_;
+  std::unordered_set<ProtocolConnectionImpl<Message>*> notified_connections_;
+  bool stop_requested_;
+  // Notifications from the reactor thread itself don't need to wake it.
+  bool reactor_thread_running_;
+  pthread_t reactor_thread_id_;
+  mutable Mutex mu_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProtocolUringReactor);
+};
+
+template<class Message>
+ProtocolUringReactor<Message>::ProtocolUringReactor(
+    ProtocolServerInterfaceForReactor* server,
+    ProtocolServerHandler<Message>* handler, int listen_fd,
+    bool keep_accepted_connections)
+    : server_(CHECK_NOTNULL(server)),
+      handler_(CHECK_NOTNULL(handler)),
+      listen_fd_(listen_fd),
+      keep_accepted_connections_(keep_accepted_connections),
+      wake_event_fd_(-1),
+      pending_operation_count_(0),
+      accept_pending_(false),
+      wake_pending_(false),
+      stopping_(false),
+      accept_address_length_(0),
+      wake_counter_(0),
+      stop_requested_(false),
+      reactor_thread_running_(false) {
+}
+
+template<class Message>
+ProtocolUringReactor<Message>::~ProtocolUringReactor() {
+  MutexLock lock(&mu_);
+  CHECK_EQ(connection_states_.size(), 0u);
+  CHECK_EQ(new_connections_.size(), 0u);
+}
+
+// static
+template<class Message>
+bool ProtocolUringReactor<Message>::IsSupported() {
+  IoUring ring;
+  return ring.Init(1, GetRequiredOpcodes());
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::Start() {
+  CHECK(ring_.Init(kRingEntryCount, GetRequiredOpcodes()));
+
+  // The wake event FD is read asynchronously, so it's left in blocking mode.
+  wake_event_fd_ = eventfd(0, EFD_CLOEXEC);
+  CHECK_ERR(wake_event_fd_) << " eventfd";
+
+  if (listen_fd_ != -1) {
+    CHECK(SetFdToBlocking(listen_fd_));
+  }
+
+  CHECK_PTHREAD_ERR(pthread_create(
+      &reactor_thread_, nullptr,
+      &ProtocolUringReactor<Message>::ReactorThreadMain, this));
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::Stop() {
+  {
+    MutexLock lock(&mu_);
+    stop_requested_ = true;
+  }
+
+  SignalEventFd(wake_event_fd_);
+
+  void* thread_return_value = nullptr;
+  CHECK_PTHREAD_ERR(pthread_join(reactor_thread_, &thread_return_value));
+
+  {
+    MutexLock lock(&mu_);
+
+    for (const auto& state_pair : connection_states_) {
+      state_pair.first->CloseSocket();
+    }
+    for (ProtocolConnectionImpl<Message>* const connection :
+             new_connections_) {
+      connection->CloseSocket();
+    }
+
+    connection_states_.clear();
+    new_connections_.clear();
+    notified_connections_.clear();
+  }
+
+  CHECK_ERR(close(wake_event_fd_));
+}
+
+template<class Message>
+ProtocolConnectionImpl<Message>* ProtocolUringReactor<Message>::AddConnection(
+    ProtocolConnectionHandler<Message>* connection_handler, int socket_fd,
+    const std::string& remote_address, SharedMemoryChannel* channel) {
+  CHECK(channel == nullptr);
+  CHECK(SetFdToBlocking(socket_fd));
+
+  ProtocolConnectionImpl<Message>* const connection =
+      new ProtocolConnectionImpl<Message>(this, socket_fd, nullptr);
+
+  if (connection_handler == nullptr) {
+    connection_handler = handler_->NotifyConnectionReceived(connection,
+                                                            remote_address);
+  }
+
+  connection->Init(connection_handler);
+
+  bool wake_reactor = false;
+  {
+    MutexLock lock(&mu_);
+    new_connections_.push_back(connection);
+    wake_reactor = !reactor_thread_running_ ||
+        !pthread_equal(reactor_thread_id_, pthread_self());
+  }
+
+  if (wake_reactor) {
+    SignalEventFd(wake_event_fd_);
+  }
+
+  return connection;
+}
+
+// static
+template<class Message>
+std::vector<int> ProtocolUringReactor<Message>::GetRequiredOpcodes() {
+  return std::vector<int>({ IORING_OP_ACCEPT, IORING_OP_ASYNC_CANCEL,
+                            IORING_OP_READ, IORING_OP_RECV,
+                            IORING_OP_SENDMSG });
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::DoEventLoop() {
+  // TODO(dss): Support the --protocol_connection_timeout_sec_for_debugging
+  // flag (e.g., with an IORING_OP_TIMEOUT operation).
+
+  {
+    MutexLock lock(&mu_);
+    reactor_thread_running_ = true;
+    reactor_thread_id_ = pthread_self();
+  }
+
+  if (listen_fd_ != -1) {
+    SubmitAccept();
+  }
+
+  while (!ProcessNotifications()) {
+    VLOG(1) << "Waiting for io_uring completions";
+    ring_.Submit(1);
+
+    io_uring_cqe cqe;
+    while (ring_.GetCompletion(&cqe)) {
+      HandleCompletion(cqe);
+    }
+  }
+
+  ShutDown();
+
+  {
+    MutexLock lock(&mu_);
+    reactor_thread_running_ = false;
+  }
+}
+
+template<class Message>
+bool ProtocolUringReactor<Message>::ProcessNotifications() {
+  for (;;) {
+    std::vector<ProtocolConnectionImpl<Message>*> new_connections;
+    std::unordered_set<ProtocolConnectionImpl<Message>*> notified_connections;
+
+    {
+      MutexLock lock(&mu_);
+
+      if (stop_requested_) {
+        return true;
+      }
+
+      new_connections.swap(new_connections_);
+      notified_connections.swap(notified_connections_);
+    }
+
+    if (!wake_pending_) {
+      SubmitWakeRead();
+    }
+
+    if (new_connections.empty() && notified_connections.empty()) {
+      return false;
+    }
+
+    for (ProtocolConnectionImpl<Message>* const connection : new_connections) {
+      // Value-initialization sets the rest of the members to zero.
+      ConnectionState* const state = new ConnectionState();
+      state->connection = connection;
+
+      CHECK(connection_states_.emplace(
+          connection, std::unique_ptr<ConnectionState>(state)).second);
+
+      // Handle the connection once before waiting for it, so that any initial
+      // output is sent.
+      UpdateConnection(state);
+    }
+
+    // Ignore notifications for connections that have already been closed.
+    for (ProtocolConnectionImpl<Message>* const connection :
+             notified_connections) {
+      const auto state_it = connection_states_.find(connection);
+      if (state_it != connection_states_.end()) {
+        UpdateConnection(state_it->second.get());
+      }
+    }
+  }
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::HandleCompletion(const io_uring_cqe& cqe) {
+  CHECK_GT(pending_operation_count_, 0);
+  --pending_operation_count_;
+
+  const OperationType operation_type = static_cast<OperationType>(
+      cqe.user_data & kOperationTypeMask);
+  ConnectionState* const state = reinterpret_cast<ConnectionState*>(
+      cqe.user_data & ~kOperationTypeMask);
+
+  // io_uring reports errors as negative error numbers.
+  const ssize_t byte_count = cqe.res >= 0 ? cqe.res : -1;
+  const int error_number = cqe.res >= 0 ? 0 : -cqe.res;
+
+  switch (operation_type) {
+    case RECEIVE_OPERATION:
+      CHECK(state != nullptr);
+      state->receive_pending = false;
+      if (!stopping_ && !state->connection->close_requested()) {
+        state->connection->CompleteReceive(byte_count, error_number);
+      }
+      break;
+
+    case SEND_OPERATION:
+      CHECK(state != nullptr);
+      state->send_pending = false;
+      if (!stopping_) {
+        state->connection->CompleteSend(byte_count, error_number);
+      }
+      break;
+
+    case ACCEPT_OPERATION:
+      accept_pending_ = false;
+      if (!stopping_) {
+        HandleAcceptCompletion(cqe.res);
+      }
+      return;
+
+    case WAKE_OPERATION:
+      wake_pending_ = false;
+      LOG_IF(FATAL, cqe.res < 0 && cqe.res != -ECANCELED)
+          << "Reading the wake event FD failed: " << std::strerror(-cqe.res);
+      return;
+
+    case CANCEL_OPERATION:
+      return;
+
+    default:
+      LOG(FATAL) << "Unexpected operation type: "
+                 << static_cast<int>(operation_type);
+  }
+
+  if (!stopping_) {
+    UpdateConnection(state);
+  }
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::HandleAcceptCompletion(int result) {
+  if (result >= 0) {
+    CHECK_LE(accept_address_length_, sizeof accept_address_);
+
+    std::string remote_address;
+    GetAddressString(reinterpret_cast<const sockaddr*>(&accept_address_),
+                     &remote_address);
+
+    if (keep_accepted_connections_) {
+      AddConnection(nullptr, result, remote_address, nullptr);
+    } else {
+      server_->NotifyConnectionAccepted(result, remote_address, nullptr);
+    }
+  } else {
+    LOG(WARNING) << "io_uring accept failed: " << std::strerror(-result);
+  }
+
+  SubmitAccept();
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::UpdateConnection(ConnectionState* state) {
+  CHECK(state != nullptr);
+
+  if (state->connection->close_requested()) {
+    CloseConnection(state);
+    return;
+  }
+
+  if (!state->receive_pending) {
+    SubmitReceive(state);
+  }
+  if (!state->send_pending) {
+    SubmitSend(state);
+  }
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::CloseConnection(ConnectionState* state) {
+  CHECK(state != nullptr);
+
+  if (state->send_pending) {
+    return;
+  }
+
+  if (!state->final_send_submitted) {
+    state->final_send_submitted = true;
+    if (SubmitSend(state)) {
+      return;
+    }
+  }
+
+  if (!state->shut_down) {
+    // Wake the pending receive, if any.
+    state->shut_down = true;
+    if (shutdown(state->connection->socket_fd(), SHUT_RDWR) == -1) {
+      PLOG_IF(FATAL, errno != ENOTCONN) << "shutdown";
+    }
+  }
+
+  if (state->receive_pending) {
+    return;
+  }
+
+  ProtocolConnectionImpl<Message>* const connection = state->connection;
+  CHECK_EQ(connection_states_.erase(connection), 1u);
+
+  connection->CloseSocket();
+  handler_->NotifyConnectionClosed(connection->protocol_connection_handler());
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::ShutDown() {
+  stopping_ = true;
+
+  if (accept_pending_) {
+    SubmitCancel(static_cast<uint64>(ACCEPT_OPERATION));
+  }
+  if (wake_pending_) {
+    SubmitCancel(static_cast<uint64>(WAKE_OPERATION));
+  }
+
+  for (const auto& state_pair : connection_states_) {
+    ConnectionState* const state = state_pair.second.get();
+
+    if (!state->shut_down) {
+      state->shut_down = true;
+      if (shutdown(state->connection->socket_fd(), SHUT_RDWR) == -1) {
+        PLOG_IF(FATAL, errno != ENOTCONN) << "shutdown";
+      }
+    }
+  }
+
+  // The buffers of the pending operations must remain valid until the
+  // operations complete.
+  while (pending_operation_count_ > 0) {
+    ring_.Submit(1);
+
+    io_uring_cqe cqe;
+    while (ring_.GetCompletion(&cqe)) {
+      HandleCompletion(cqe);
+    }
+  }
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::SubmitAccept() {
+  CHECK(!accept_pending_);
+
+  accept_address_length_ = static_cast<socklen_t>(sizeof accept_address_);
+
+  io_uring_sqe* const sqe = GetSubmissionEntry(nullptr, ACCEPT_OPERATION);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->addr = reinterpret_cast<uint64>(&accept_address_);
+  sqe->addr2 = reinterpret_cast<uint64>(&accept_address_length_);
+  sqe->accept_flags = SOCK_CLOEXEC;
+
+  accept_pending_ = true;
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::SubmitWakeRead() {
+  CHECK(!wake_pending_);
+
+  io_uring_sqe* const sqe = GetSubmissionEntry(nullptr, WAKE_OPERATION);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = wake_event_fd_;
+  sqe->addr = reinterpret_cast<uint64>(&wake_counter_);
+  sqe->len = static_cast<uint32>(sizeof wake_counter_);
+  // An offset of -1 means the current file position.
+  sqe->off = static_cast<uint64>(-1);
+
+  wake_pending_ = true;
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::SubmitReceive(ConnectionState* state) {
+  CHECK(state != nullptr);
+  CHECK(!state->receive_pending);
+
+  int size = 0;
+  char* const buffer = state->connection->GetReceiveBuffer(&size);
+
+  io_uring_sqe* const sqe = GetSubmissionEntry(state, RECEIVE_OPERATION);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = state->connection->socket_fd();
+  sqe->addr = reinterpret_cast<uint64>(buffer);
+  sqe->len = static_cast<uint32>(size);
+
+  state->receive_pending = true;
+}
+
+template<class Message>
+bool ProtocolUringReactor<Message>::SubmitSend(ConnectionState* state) {
+  CHECK(state != nullptr);
+  CHECK(!state->send_pending);
+
+  const int iov_count = state->connection->GetSendBuffers(state->iov);
+  if (iov_count == 0) {
+    return false;
+  }
+
+  std::memset(&state->message_header, 0, sizeof state->message_header);
+  state->message_header.msg_iov = state->iov;
+  state->message_header.msg_iovlen = static_cast<size_t>(iov_count);
+
+  io_uring_sqe* const sqe = GetSubmissionEntry(state, SEND_OPERATION);
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = state->connection->socket_fd();
+  sqe->addr = reinterpret_cast<uint64>(&state->message_header);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+
+  state->send_pending = true;
+
+  return true;
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::SubmitCancel(uint64 target_user_data) {
+  io_uring_sqe* const sqe = GetSubmissionEntry(nullptr, CANCEL_OPERATION);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target_user_data;
+}
+
+template<class Message>
+io_uring_sqe* ProtocolUringReactor<Message>::GetSubmissionEntry(
+    ConnectionState* state, OperationType operation_type) {
+  io_uring_sqe* sqe = ring_.GetSubmissionEntry();
+
+  if (sqe == nullptr) {
+    // The submission queue is full. Submit the queued entries to make room.
+    ring_.Submit(0);
+    sqe = ring_.GetSubmissionEntry();
+    CHECK(sqe != nullptr);
+  }
+
+  sqe->user_data = reinterpret_cast<uint64>(state) |
+      static_cast<uint64>(operation_type);
+  ++pending_operation_count_;
+
+  return sqe;
+}
+
+template<class Message>
+void ProtocolUringReactor<Message>::NotifyConnectionChanged(
+    ProtocolConnection* connection) {
+  CHECK(connection != nullptr);
+
+  {
+    MutexLock lock(&mu_);
+    if (!notified_connections_.insert(
+            static_cast<ProtocolConnectionImpl<Message>*>(connection)).second) {
+      // The reactor thread hasn't picked up the previous notification yet.
+      return;
+    }
+
+    // The reactor thread checks for notifications before it waits for
+    // completions.
+    if (reactor_thread_running_ &&
+        pthread_equal(reactor_thread_id_, pthread_self())) {
+      return;
+    }
+  }
+
+  SignalEventFd(wake_event_fd_);
+}
+
+// static
+template<class Message>
+void* ProtocolUringReactor<Message>::ReactorThreadMain(void* reactor_raw) {
+  CHECK(reactor_raw != nullptr);
+  static_cast<ProtocolUringReactor<Message>*>(reactor_raw)->DoEventLoop();
+  return nullptr;
+}
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_PROTOCOL_URING_REACTOR_H_
@@ -0,0 +1,119 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "protocol_server/receive_buffer.h"
+
+#include <cstring>
+#include <vector>
+
+#include "base/logging.h"
+
+using std::memmove;
+using std::vector;
+
+namespace floating_temple {
+
+ReceiveBuffer::ReceiveBuffer(int initial_capacity)
+    : initial_capacity_(initial_capacity),
+      start_(0),
+      end_(0) {
+  CHECK_GT(initial_capacity, 0);
+}
+
+ReceiveBuffer::~ReceiveBuffer() {
+}
+
+char* ReceiveBuffer::GetFreeSpace(int min_size, int* size) {
+  CHECK_GT(min_size, 0);
+  CHECK(size != nullptr);
+
+  const int capacity = static_cast<int>(buffer_.size());
+
+  if (capacity - end_ < min_size) {
+    const int data_size = end_ - start_;
+
+    if (capacity - data_size >= min_size) {
+      // There's enough room if the unconsumed data is moved to the beginning
+      // of the buffer.
+      memmove(buffer_.data(), buffer_.data() + start_,
+              static_cast<vector<char>::size_type>(data_size));
+      start_ = 0;
+      end_ = data_size;
+    } else {
+      int new_capacity = capacity > initial_capacity_ ? capacity
+                                                      : initial_capacity_;
+      while (new_capacity - data_size < min_size) {
+        new_capacity *= 2;
+      }
+      Reallocate(new_capacity);
+    }
+  }
+
+  *size = static_cast<int>(buffer_.size()) - end_;
+  return buffer_.data() + end_;
+}
+
+void ReceiveBuffer::CommitWrite(int byte_count) {
+  CHECK_GE(byte_count, 0);
+  CHECK_LE(byte_count, static_cast<int>(buffer_.size()) - end_);
+
+  end_ += byte_count;
+}
+
+void ReceiveBuffer::Consume(int byte_count) {
+  CHECK_GE(byte_count, 0);
+  CHECK_LE(byte_count, end_ - start_);
+
+  start_ += byte_count;
+
+  if (start_ == end_) {
+    start_ = 0;
+    end_ = 0;
+
+    // Don't hold on to the memory used by an unusually large message.
+    if (static_cast<int>(buffer_.size()) > initial_capacity_) {
+      vector<char>(static_cast<vector<char>::size_type>(
+          initial_capacity_)).swap(buffer_);
+    }
+  }
+}
+
+void ReceiveBuffer::Reserve(int byte_count) {
+  CHECK_GE(byte_count, 0);
+
+  const int data_size = end_ - start_;
+  if (byte_count > data_size) {
+    int free_space = 0;
+    GetFreeSpace(byte_count - data_size, &free_space);
+  }
+}
+
+void ReceiveBuffer::Reallocate(int capacity) {
+  const int data_size = end_ - start_;
+  CHECK_GE(capacity, data_size);
+
+  vector<char> new_buffer(static_cast<vector<char>::size_type>(capacity));
+  if (data_size > 0) {
+    memmove(new_buffer.data(), buffer_.data() + start_,
+            static_cast<vector<char>::size_type>(data_size));
+  }
+
+  buffer_.swap(new_buffer);
+  start_ = 0;
+  end_ = data_size;
+}
+
+}  // namespace floating_temple
@@ -0,0 +1,74 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PROTOCOL_SERVER_RECEIVE_BUFFER_H_
+#define PROTOCOL_SERVER_RECEIVE_BUFFER_H_
+
+#include <vector>
+
+#include "base/macros.h"
+
+namespace floating_temple {
+
+// A buffer for data received on a socket. Data is read directly into the free
+// space at the end of the buffer, and consumed from the beginning of the
+// buffer without being copied. The unconsumed data is only moved when there
+// isn't enough free space after it, in which case it's moved to the beginning
+// of the buffer (or to a larger buffer).
+//
+// This class is not thread-safe.
+class ReceiveBuffer {
+ public:
+  // 'initial_capacity' is the size of the buffer when it's first needed. The
+  // buffer returns to this size whenever it's emptied after growing larger.
+  explicit ReceiveBuffer(int initial_capacity);
+  ~ReceiveBuffer();
+
+  // The data that has been received but not yet consumed.
+  const char* data() const { return buffer_.data() + start_; }
+  int size() const { return end_ - start_; }
+
+  // Returns a pointer to the free space at the end of the buffer, after making
+  // sure that there are at least 'min_size' bytes of it. Sets *size to the
+  // actual number of bytes of free space.
+  char* GetFreeSpace(int min_size, int* size);
+  // Adds 'byte_count' bytes that were written to the free space to the
+  // received data.
+  void CommitWrite(int byte_count);
+
+  // Removes 'byte_count' bytes from the beginning of the received data.
+  void Consume(int byte_count);
+
+  // Makes sure that the buffer can hold at least 'byte_count' bytes of data in
+  // total. This is a hint that a message of that size is being received, so
+  // that the buffer only needs to grow once.
+  void Reserve(int byte_count);
+
+ private:
+  void Reallocate(int capacity);
+
+  const int initial_capacity_;
+
+  std::vector<char> buffer_;
+  int start_;
+  int end_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReceiveBuffer);
+};
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_RECEIVE_BUFFER_H_
@@ -0,0 +1,107 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "protocol_server/receive_buffer.h"
+
+#include <cstring>
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::memcpy;
+using std::string;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace {
+
+void Write(const string& s, ReceiveBuffer* receive_buffer) {
+  int free_space = 0;
+  char* const buffer = receive_buffer->GetFreeSpace(
+      static_cast<int>(s.length()), &free_space);
+  ASSERT_GE(free_space, static_cast<int>(s.length()));
+
+  memcpy(buffer, s.data(), s.length());
+  receive_buffer->CommitWrite(static_cast<int>(s.length()));
+}
+
+string GetData(const ReceiveBuffer& receive_buffer) {
+  return string(receive_buffer.data(),
+                static_cast<string::size_type>(receive_buffer.size()));
+}
+
+TEST(ReceiveBufferTest, WriteAndConsume) {
+  ReceiveBuffer receive_buffer(16);
+
+  Write("abcdef", &receive_buffer);
+  Write("ghij", &receive_buffer);
+  EXPECT_EQ("abcdefghij", GetData(receive_buffer));
+
+  receive_buffer.Consume(4);
+  EXPECT_EQ("efghij", GetData(receive_buffer));
+
+  receive_buffer.Consume(6);
+  EXPECT_EQ(0, receive_buffer.size());
+}
+
+TEST(ReceiveBufferTest, CompactUnconsumedData) {
+  ReceiveBuffer receive_buffer(16);
+
+  Write("0123456789abcdef", &receive_buffer);
+  receive_buffer.Consume(12);
+
+  // There's no free space at the end, but there's room at the beginning once
+  // the four unconsumed bytes are moved there.
+  const char* const old_data = receive_buffer.data();
+  Write("ghijklmnopqr", &receive_buffer);
+  EXPECT_EQ("cdefghijklmnopqr", GetData(receive_buffer));
+  EXPECT_LT(receive_buffer.data(), old_data);
+}
+
+TEST(ReceiveBufferTest, GrowForLargeMessage) {
+  ReceiveBuffer receive_buffer(16);
+
+  Write("header", &receive_buffer);
+  receive_buffer.Reserve(100);
+
+  int free_space = 0;
+  receive_buffer.GetFreeSpace(1, &free_space);
+  EXPECT_GE(free_space, 94);
+
+  const string body(94, 'x');
+  Write(body, &receive_buffer);
+  EXPECT_EQ("header" + body, GetData(receive_buffer));
+
+  // Once the buffer is empty, it returns to its initial size.
+  receive_buffer.Consume(100);
+  receive_buffer.GetFreeSpace(1, &free_space);
+  EXPECT_EQ(16, free_space);
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
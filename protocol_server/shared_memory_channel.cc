@@ -0,0 +1,281 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "protocol_server/shared_memory_channel.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+
+using std::memcpy;
+using std::min;
+using std::size_t;
+
+namespace floating_temple {
+namespace {
+
+const uint32 kChannelMagic = 0x46544d43;  // "FTMC"
+const size_t kCacheLineSize = 64;
+
+}  // namespace
+
+// The header at the beginning of the shared memory file.
+struct SharedMemoryChannel::ChannelHeader {
+  uint32 magic;
+  uint32 ring_size;
+};
+
+// The positions are byte counts since the ring was created; they're reduced
+// modulo the ring size to get offsets into the ring's data. Each field is
+// written by only one of the ends, and is on its own cache line so that the
+// ends don't contend for it.
+struct SharedMemoryChannel::RingHeader {
+  alignas(kCacheLineSize) uint64 read_position;
+  alignas(kCacheLineSize) uint64 write_position;
+  alignas(kCacheLineSize) uint32 reader_waiting;
+  uint32 writer_waiting;
+};
+
+SharedMemoryChannel::~SharedMemoryChannel() {
+  CHECK_ERR(munmap(memory_, memory_size_));
+  if (memory_fd_ != -1) {
+    CHECK_ERR(close(memory_fd_));
+  }
+}
+
+// static
+SharedMemoryChannel* SharedMemoryChannel::Create(uint32 ring_size) {
+  CHECK_GT(ring_size, 0u);
+  CHECK_EQ(ring_size & (ring_size - 1), 0u) << "ring_size must be a power of "
+                                            << "two.";
+
+  const int memory_fd = memfd_create("floating_temple_channel", MFD_CLOEXEC);
+  if (memory_fd == -1) {
+    PLOG(WARNING) << "memfd_create";
+    return nullptr;
+  }
+
+  // The file is initially filled with zeros, so the rings start out empty.
+  const size_t memory_size = GetMemorySize(ring_size);
+  if (ftruncate(memory_fd, static_cast<off_t>(memory_size)) == -1) {
+    PLOG(WARNING) << "ftruncate";
+    CHECK_ERR(close(memory_fd));
+    return nullptr;
+  }
+
+  void* const memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, memory_fd, 0);
+  if (memory == MAP_FAILED) {
+    PLOG(WARNING) << "mmap";
+    CHECK_ERR(close(memory_fd));
+    return nullptr;
+  }
+
+  ChannelHeader* const channel_header = static_cast<ChannelHeader*>(memory);
+  channel_header->magic = kChannelMagic;
+  channel_header->ring_size = ring_size;
+
+  return new SharedMemoryChannel(memory_fd, memory, memory_size, true);
+}
+
+// static
+SharedMemoryChannel* SharedMemoryChannel::Open(int memory_fd) {
+  struct stat file_stat;
+  CHECK_ERR(fstat(memory_fd, &file_stat));
+
+  const size_t memory_size = static_cast<size_t>(file_stat.st_size);
+  if (memory_size < sizeof(ChannelHeader)) {
+    LOG(WARNING) << "The shared memory file is too small.";
+    return nullptr;
+  }
+
+  void* const memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, memory_fd, 0);
+  if (memory == MAP_FAILED) {
+    PLOG(WARNING) << "mmap";
+    return nullptr;
+  }
+
+  const ChannelHeader* const channel_header =
+      static_cast<const ChannelHeader*>(memory);
+  const uint32 ring_size = channel_header->ring_size;
+
+  if (channel_header->magic != kChannelMagic || ring_size == 0 ||
+      (ring_size & (ring_size - 1)) != 0 ||
+      memory_size != GetMemorySize(ring_size)) {
+    LOG(WARNING) << "The shared memory file isn't a valid channel.";
+    CHECK_ERR(munmap(memory, memory_size));
+    return nullptr;
+  }
+
+  return new SharedMemoryChannel(-1, memory, memory_size, false);
+}
+
+int SharedMemoryChannel::Read(char* buffer, int size, bool* notify_peer) {
+  CHECK(buffer != nullptr);
+  CHECK_GE(size, 0);
+  CHECK(notify_peer != nullptr);
+
+  // Only this end writes the read position.
+  const uint64 read_position = incoming_ring_->read_position;
+  const uint64 write_position = __atomic_load_n(
+      &incoming_ring_->write_position, __ATOMIC_ACQUIRE);
+
+  const uint64 byte_count = min(write_position - read_position,
+                                static_cast<uint64>(size));
+  if (byte_count == 0) {
+    return 0;
+  }
+
+  // The data may wrap around the end of the ring.
+  const uint64 offset = read_position & (ring_size_ - 1);
+  const uint64 first_byte_count = min(byte_count, ring_size_ - offset);
+  memcpy(buffer, incoming_data_ + offset, first_byte_count);
+  memcpy(buffer + first_byte_count, incoming_data_,
+         byte_count - first_byte_count);
+
+  __atomic_store_n(&incoming_ring_->read_position, read_position + byte_count,
+                   __ATOMIC_RELEASE);
+
+  // The fence orders the store to the read position before the load of the
+  // waiting flag. (See PrepareToWaitForSpace.)
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&incoming_ring_->writer_waiting, __ATOMIC_RELAXED) !=
+          0 &&
+      __atomic_exchange_n(&incoming_ring_->writer_waiting, 0,
+                          __ATOMIC_SEQ_CST) != 0) {
+    *notify_peer = true;
+  }
+
+  return static_cast<int>(byte_count);
+}
+
+size_t SharedMemoryChannel::Write(const iovec* iov, int iov_count,
+                                  bool* notify_peer) {
+  CHECK(iov != nullptr);
+  CHECK(notify_peer != nullptr);
+
+  // Only this end writes the write position.
+  const uint64 write_position = outgoing_ring_->write_position;
+  const uint64 read_position = __atomic_load_n(
+      &outgoing_ring_->read_position, __ATOMIC_ACQUIRE);
+
+  uint64 free_space = ring_size_ - (write_position - read_position);
+  uint64 position = write_position;
+
+  for (int i = 0; i < iov_count && free_space > 0; ++i) {
+    const char* const data = static_cast<const char*>(iov[i].iov_base);
+    const uint64 byte_count = min(static_cast<uint64>(iov[i].iov_len),
+                                  free_space);
+
+    const uint64 offset = position & (ring_size_ - 1);
+    const uint64 first_byte_count = min(byte_count, ring_size_ - offset);
+    memcpy(outgoing_data_ + offset, data, first_byte_count);
+    memcpy(outgoing_data_, data + first_byte_count,
+           byte_count - first_byte_count);
+
+    position += byte_count;
+    free_space -= byte_count;
+  }
+
+  if (position == write_position) {
+    return 0;
+  }
+
+  __atomic_store_n(&outgoing_ring_->write_position, position,
+                   __ATOMIC_RELEASE);
+
+  // See the comment in Read.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&outgoing_ring_->reader_waiting, __ATOMIC_RELAXED) !=
+          0 &&
+      __atomic_exchange_n(&outgoing_ring_->reader_waiting, 0,
+                          __ATOMIC_SEQ_CST) != 0) {
+    *notify_peer = true;
+  }
+
+  return static_cast<size_t>(position - write_position);
+}
+
+bool SharedMemoryChannel::PrepareToWaitForData() {
+  __atomic_store_n(&incoming_ring_->reader_waiting, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  // If the writer added data before it could see the flag, it won't notify
+  // this end, so check the ring again.
+  if (__atomic_load_n(&incoming_ring_->write_position, __ATOMIC_ACQUIRE) !=
+      incoming_ring_->read_position) {
+    __atomic_store_n(&incoming_ring_->reader_waiting, 0, __ATOMIC_SEQ_CST);
+    return false;
+  }
+
+  return true;
+}
+
+bool SharedMemoryChannel::PrepareToWaitForSpace() {
+  __atomic_store_n(&outgoing_ring_->writer_waiting, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  // See the comment in PrepareToWaitForData.
+  if (outgoing_ring_->write_position -
+          __atomic_load_n(&outgoing_ring_->read_position, __ATOMIC_ACQUIRE) <
+      ring_size_) {
+    __atomic_store_n(&outgoing_ring_->writer_waiting, 0, __ATOMIC_SEQ_CST);
+    return false;
+  }
+
+  return true;
+}
+
+SharedMemoryChannel::SharedMemoryChannel(int memory_fd, void* memory,
+                                         size_t memory_size, bool initiator)
+    : memory_fd_(memory_fd),
+      memory_(CHECK_NOTNULL(memory)),
+      memory_size_(memory_size) {
+  char* const base = static_cast<char*>(memory);
+  ring_size_ = static_cast<const ChannelHeader*>(memory)->ring_size;
+
+  // Layout: the channel header, the two ring headers, and then the data for
+  // each ring. The initiator writes to the first ring.
+  RingHeader* const ring_headers = reinterpret_cast<RingHeader*>(
+      base + kCacheLineSize);
+  char* const ring_data = base + kCacheLineSize + 2 * sizeof(RingHeader);
+
+  const int outgoing_index = initiator ? 0 : 1;
+  const int incoming_index = 1 - outgoing_index;
+
+  outgoing_ring_ = &ring_headers[outgoing_index];
+  outgoing_data_ = ring_data + outgoing_index * ring_size_;
+  incoming_ring_ = &ring_headers[incoming_index];
+  incoming_data_ = ring_data + incoming_index * ring_size_;
+}
+
+// static
+size_t SharedMemoryChannel::GetMemorySize(uint32 ring_size) {
+  return kCacheLineSize + 2 * sizeof(RingHeader) +
+      2 * static_cast<size_t>(ring_size);
+}
+
+}  // namespace floating_temple
@@ -0,0 +1,100 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PROTOCOL_SERVER_SHARED_MEMORY_CHANNEL_H_
+#define PROTOCOL_SERVER_SHARED_MEMORY_CHANNEL_H_
+
+#include <sys/uio.h>
+
+#include <cstddef>
+
+#include "base/integral_types.h"
+#include "base/macros.h"
+
+namespace floating_temple {
+
+// A pair of single-producer, single-consumer byte rings in a shared memory
+// file, used to exchange data between two processes on the same host without
+// copying it through the kernel. One end of the channel (the initiator)
+// creates the shared memory file and sends its file descriptor to the other
+// end (the acceptor), which maps it. Each end writes to one of the rings and
+// reads from the other.
+//
+// The rings don't wake the remote end by themselves. When a reader finds its
+// ring empty (or a writer finds its ring full), it marks itself as waiting;
+// the remote end is then told to notify it (e.g., by writing a byte to a
+// socket) the next time it writes to (or reads from) the ring.
+//
+// This class is not thread-safe, but the two ends may be used concurrently.
+class SharedMemoryChannel {
+ public:
+  ~SharedMemoryChannel();
+
+  // Creates a new channel in an anonymous shared memory file. 'ring_size' is
+  // the capacity of each ring in bytes, and must be a power of two. Returns
+  // NULL if the shared memory couldn't be created.
+  static SharedMemoryChannel* Create(uint32 ring_size);
+  // Maps a channel that was created by the remote end. This function does not
+  // take ownership of 'memory_fd'. Returns NULL if the shared memory file
+  // isn't a valid channel.
+  static SharedMemoryChannel* Open(int memory_fd);
+
+  // The file descriptor of the shared memory file, to be sent to the remote
+  // end. Only valid for channels returned by Create.
+  int memory_fd() const { return memory_fd_; }
+
+  // Copies up to 'size' bytes from the incoming ring to 'buffer', and returns
+  // the number of bytes copied. Sets *notify_peer to true if the remote end is
+  // waiting for space in the ring.
+  int Read(char* buffer, int size, bool* notify_peer);
+  // Copies as much of the data described by 'iov' into the outgoing ring as
+  // will fit, and returns the number of bytes copied. Sets *notify_peer to
+  // true if the remote end is waiting for data.
+  std::size_t Write(const iovec* iov, int iov_count, bool* notify_peer);
+
+  // Marks this end as waiting for data in the incoming ring. Returns false
+  // (and clears the mark) if data has already arrived; the caller should read
+  // it instead of waiting.
+  bool PrepareToWaitForData();
+  // Marks this end as waiting for space in the outgoing ring. Returns false
+  // (and clears the mark) if space is already available.
+  bool PrepareToWaitForSpace();
+
+ private:
+  struct ChannelHeader;
+  struct RingHeader;
+
+  SharedMemoryChannel(int memory_fd, void* memory, std::size_t memory_size,
+                      bool initiator);
+
+  static std::size_t GetMemorySize(uint32 ring_size);
+
+  const int memory_fd_;
+  void* const memory_;
+  const std::size_t memory_size_;
+
+  uint32 ring_size_;
+  RingHeader* incoming_ring_;
+  char* incoming_data_;
+  RingHeader* outgoing_ring_;
+  char* outgoing_data_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemoryChannel);
+};
+
+}  // namespace floating_temple
+
+#endif  // PROTOCOL_SERVER_SHARED_MEMORY_CHANNEL_H_
@@ -0,0 +1,141 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "protocol_server/shared_memory_channel.h"
+
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::string;
+using std::unique_ptr;
+using testing::InitGoogleTest;
+using testing::Test;
+
+namespace floating_temple {
+namespace {
+
+class SharedMemoryChannelTest : public Test {
+ protected:
+  void SetUp() override {
+    initiator_.reset(SharedMemoryChannel::Create(16));
+    ASSERT_TRUE(initiator_.get() != nullptr);
+    acceptor_.reset(SharedMemoryChannel::Open(initiator_->memory_fd()));
+    ASSERT_TRUE(acceptor_.get() != nullptr);
+  }
+
+  unique_ptr<SharedMemoryChannel> initiator_;
+  unique_ptr<SharedMemoryChannel> acceptor_;
+};
+
+size_t Write(const string& s, SharedMemoryChannel* channel,
+             bool* notify_peer) {
+  iovec iov;
+  iov.iov_base = const_cast<char*>(s.data());
+  iov.iov_len = s.length();
+  return channel->Write(&iov, 1, notify_peer);
+}
+
+string Read(int size, SharedMemoryChannel* channel, bool* notify_peer) {
+  char buffer[64];
+  CHECK_LE(size, static_cast<int>(sizeof buffer));
+  const int byte_count = channel->Read(buffer, size, notify_peer);
+  return string(buffer, static_cast<string::size_type>(byte_count));
+}
+
+TEST_F(SharedMemoryChannelTest, BothDirections) {
+  bool notify_peer = false;
+
+  EXPECT_EQ(5u, Write("hello", initiator_.get(), &notify_peer));
+  EXPECT_EQ(7u, Write("goodbye", acceptor_.get(), &notify_peer));
+  EXPECT_FALSE(notify_peer);
+
+  EXPECT_EQ("hello", Read(64, acceptor_.get(), &notify_peer));
+  EXPECT_EQ("goodbye", Read(64, initiator_.get(), &notify_peer));
+  EXPECT_EQ("", Read(64, initiator_.get(), &notify_peer));
+  EXPECT_FALSE(notify_peer);
+}
+
+TEST_F(SharedMemoryChannelTest, WrapAround) {
+  bool notify_peer = false;
+
+  // The ring holds 16 bytes, so the second write is truncated.
+  EXPECT_EQ(12u, Write("0123456789ab", initiator_.get(), &notify_peer));
+  EXPECT_EQ(4u, Write("cdefghij", initiator_.get(), &notify_peer));
+  EXPECT_EQ(0u, Write("x", initiator_.get(), &notify_peer));
+
+  EXPECT_EQ("0123456789", Read(10, acceptor_.get(), &notify_peer));
+
+  // This write wraps around the end of the ring.
+  iovec iov[2];
+  iov[0].iov_base = const_cast<char*>("ghij");
+  iov[0].iov_len = 4;
+  iov[1].iov_base = const_cast<char*>("klmnop");
+  iov[1].iov_len = 6;
+  EXPECT_EQ(10u, initiator_->Write(iov, 2, &notify_peer));
+
+  EXPECT_EQ("abcdefghijklmnop", Read(64, acceptor_.get(), &notify_peer));
+  EXPECT_FALSE(notify_peer);
+}
+
+TEST_F(SharedMemoryChannelTest, WaitForData) {
+  bool notify_peer = false;
+
+  EXPECT_TRUE(acceptor_->PrepareToWaitForData());
+
+  EXPECT_EQ(3u, Write("abc", initiator_.get(), &notify_peer));
+  EXPECT_TRUE(notify_peer);
+
+  // The waiting flag was cleared by the first write.
+  notify_peer = false;
+  EXPECT_EQ(3u, Write("def", initiator_.get(), &notify_peer));
+  EXPECT_FALSE(notify_peer);
+
+  // Data is already available, so there's no need to wait.
+  EXPECT_FALSE(acceptor_->PrepareToWaitForData());
+  EXPECT_EQ("abcdef", Read(64, acceptor_.get(), &notify_peer));
+  EXPECT_FALSE(notify_peer);
+}
+
+TEST_F(SharedMemoryChannelTest, WaitForSpace) {
+  bool notify_peer = false;
+
+  EXPECT_EQ(16u, Write("0123456789abcdef", initiator_.get(), &notify_peer));
+  EXPECT_TRUE(initiator_->PrepareToWaitForSpace());
+
+  EXPECT_EQ("0123", Read(4, acceptor_.get(), &notify_peer));
+  EXPECT_TRUE(notify_peer);
+
+  EXPECT_FALSE(initiator_->PrepareToWaitForSpace());
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
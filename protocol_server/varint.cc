@@ -15,14 +15,22 @@
 
 #include "protocol_server/varint.h"
 
+#include <cstring>
+
 #include "base/integral_types.h"
 #include "base/logging.h"
 
+using std::memcpy;
+
 namespace floating_temple {
 namespace {
 
+const uint64 kContinuationBits = 0x8080808080808080u;
+
+// Only the first kMaxVarintLength bytes of the buffer are searched.
 const char* FindVarintLastChar(const char* buffer, int buffer_size) {
-  const char* const end_ptr = buffer + buffer_size;
+  const char* const end_ptr = buffer + (buffer_size < kMaxVarintLength ?
+                                        buffer_size : kMaxVarintLength);
 
   for (const char* p = buffer; p != end_ptr; ++p) {
     const unsigned char byte = static_cast<unsigned char>(*p);
@@ -34,6 +42,40 @@ const char* FindVarintLastChar(const char* buffer, int buffer_size) {
   return nullptr;
 }
 
+// Parses a varint of up to eight bytes by loading the bytes into a single
+// word, instead of examining them one at a time. The buffer must contain at
+// least eight bytes. Returns -1 if the varint is longer than eight bytes.
+int ParseShortVarint(const char* buffer, uint64* n) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64 word = 0;
+  memcpy(&word, buffer, sizeof word);
+
+  // The last byte of the varint is the first one whose high bit is clear.
+  const uint64 last_byte_bits = ~word & kContinuationBits;
+  if (last_byte_bits == 0) {
+    return -1;
+  }
+
+  const int length = (__builtin_ctzll(last_byte_bits) >> 3) + 1;
+
+  // Discard the bytes after the varint and the continuation bits, and then
+  // pack the 7-bit groups together: first into 14-bit groups, then 28-bit
+  // groups, and finally a single 56-bit value.
+  if (length < 8) {
+    word &= (static_cast<uint64>(1) << (length * 8)) - 1;
+  }
+  word &= ~kContinuationBits;
+  word = ((word & 0x7f007f007f007f00u) >> 1) | (word & 0x007f007f007f007fu);
+  word = ((word & 0x3fff00003fff0000u) >> 2) | (word & 0x00003fff00003fffu);
+  word = ((word & 0x0fffffff00000000u) >> 4) | (word & 0x000000000fffffffu);
+
+  *n = word;
+  return length;
+#else
+  return -1;
+#endif
+}
+
 }  // namespace
 
 int ParseVarint(const char* buffer, int buffer_size, uint64* n) {
@@ -41,9 +83,17 @@ int ParseVarint(const char* buffer, int buffer_size, uint64* n) {
   CHECK_GE(buffer_size, 0);
   CHECK(n != nullptr);
 
+  // Message lengths are almost always short enough for the fast path.
+  if (buffer_size >= 8) {
+    const int length = ParseShortVarint(buffer, n);
+    if (length >= 0) {
+      return length;
+    }
+  }
+
   const char* const last_char_ptr = FindVarintLastChar(buffer, buffer_size);
   if (last_char_ptr == nullptr) {
-    return -1;
+    return buffer_size < kMaxVarintLength ? -1 : kInvalidVarint;
   }
 
   uint64 result = 0;
@@ -51,11 +101,10 @@ int ParseVarint(const char* buffer, int buffer_size, uint64* n) {
   for (const char* p = last_char_ptr; p >= buffer; --p) {
     const unsigned char byte = static_cast<unsigned char>(*p);
 
-    // TODO(dss): Fail gracefully if the remote peer sends a variable-length
-    // integer that is too large.
-    CHECK_LT(result, (static_cast<uint64>(1) << 57))
-        << "Arithmetic overflow while parsing variable-length integer "
-        << "(buffer_size == " << buffer_size << ")";
+    // The data may have come from a remote peer, so an overflow isn't fatal.
+    if (result >= (static_cast<uint64>(1) << 57)) {
+      return kInvalidVarint;
+    }
 
     result <<= 7;
     result |= static_cast<uint64>(byte & 0x7f);
@@ -72,31 +121,22 @@ int FormatVarint(uint64 n, char* buffer, int buffer_size) {
   const int length = GetVarintLength(n);
   CHECK_LE(length, buffer_size);
 
-  char* const last_char_ptr = buffer + (length - 1);
-
-  for (char* p = buffer; p <= last_char_ptr; ++p) {
-    unsigned char byte = 0u;
+  unsigned char* p = reinterpret_cast<unsigned char*>(buffer);
 
-    if (p != last_char_ptr) {
-      byte |= 0x80;
-    }
-
-    byte |= static_cast<unsigned char>(n & 0x7f);
+  while (n >= 0x80) {
+    *p++ = static_cast<unsigned char>(n | 0x80);
     n >>= 7;
-
-    *p = static_cast<char>(byte);
   }
+  *p = static_cast<unsigned char>(n);
 
   return length;
 }
 
 int GetVarintLength(uint64 n) {
-  int length = 1;
-  while ((n >>= 7) != 0) {
-    ++length;
-  }
-
-  return length;
+  // Each byte holds seven bits of the value. (n | 1) has the same number of
+  // significant bits as n, except that zero takes one byte.
+  const int significant_bit_count = 64 - __builtin_clzll(n | 1);
+  return (significant_bit_count + 6) / 7;
 }
 
 }  // namespace floating_temple
@@ -24,12 +24,17 @@ namespace floating_temple {
 // ceil((64 bits) / (7 bits per byte))
 const int kMaxVarintLength = 10;
 
+// Returned by ParseVarint if the data can't be a variable-length integer.
+const int kInvalidVarint = -2;
+
 // Parses a variable-length integer and stores it in *n. 'size' is the size of
 // the buffer in bytes.
 //
 // If parsing was successful, this function returns the number of characters
 // that were parsed. If the encoding of the variable-length integer is
-// incomplete, this function returns -1 and leaves *n unchanged.
+// incomplete, this function returns -1 and leaves *n unchanged. If the
+// encoding is longer than kMaxVarintLength bytes or its value doesn't fit in
+// 64 bits, this function returns kInvalidVarint and leaves *n unchanged.
 int ParseVarint(const char* buffer, int buffer_size, uint64* n);
 
 // Encodes 'n' as a variable-length integer and stores it in the given buffer.
@@ -0,0 +1,282 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the speed of the varint and framing code in this directory with
+// the byte-at-a-time implementation that it replaced.
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/time_util.h"
+#include "protocol_server/frame_decoder.h"
+#include "protocol_server/varint.h"
+
+using floating_temple::FormatVarint;
+using floating_temple::FrameDecoder;
+using floating_temple::GetCurrentTimeUsec;
+using floating_temple::ParseVarint;
+using floating_temple::kMaxVarintLength;
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::mt19937_64;
+using std::printf;
+using std::string;
+using std::uniform_int_distribution;
+using std::vector;
+
+DEFINE_int32(varint_count, 1000000, "Number of varints to parse per pass");
+DEFINE_int32(message_count, 10000,
+             "Number of framed messages in the data to be decoded");
+DEFINE_int32(repetition_count, 100,
+             "Number of times the framed data is decoded per pass. (The data "
+             "is small enough to stay in the cache.)");
+DEFINE_int32(max_message_length, 200, "Maximum length of a framed message");
+DEFINE_int32(chunk_size, 1460,
+             "Number of bytes of framed data that arrive at a time");
+DEFINE_int32(pass_count, 5, "Number of times to repeat each benchmark");
+
+namespace floating_temple {
+namespace {
+
+typedef int (*DecodeFramesFunction)(const char* buffer, int buffer_size,
+                                    vector<FrameDecoder::Frame>* frames,
+                                    FrameDecoder* frame_decoder);
+
+// The implementation of ParseVarint before the word-at-a-time fast path was
+// added.
+int ParseVarintBytewise(const char* buffer, int buffer_size, uint64* n) {
+  const char* const end_ptr = buffer + buffer_size;
+  const char* last_char_ptr = nullptr;
+
+  for (const char* p = buffer; p != end_ptr; ++p) {
+    if ((static_cast<unsigned char>(*p) & 0x80) == 0) {
+      last_char_ptr = p;
+      break;
+    }
+  }
+
+  if (last_char_ptr == nullptr) {
+    return -1;
+  }
+
+  uint64 result = 0;
+
+  for (const char* p = last_char_ptr; p >= buffer; --p) {
+    CHECK_LT(result, (static_cast<uint64>(1) << 57));
+    result <<= 7;
+    result |= static_cast<uint64>(static_cast<unsigned char>(*p) & 0x7f);
+  }
+
+  *n = result;
+  return last_char_ptr - buffer + 1;
+}
+
+// The framing loop that ProtocolConnectionImpl used before FrameDecoder. The
+// header of every message is parsed again each time data arrives, including
+// the header of the incomplete message at the end.
+int DecodeFramesBytewise(const char* buffer, int buffer_size,
+                         vector<FrameDecoder::Frame>* frames,
+                         FrameDecoder* frame_decoder) {
+  frames->clear();
+
+  int offset = 0;
+
+  for (;;) {
+    uint64 message_length = 0;
+    const int header_length = ParseVarintBytewise(buffer + offset,
+                                                  buffer_size - offset,
+                                                  &message_length);
+    if (header_length < 0 ||
+        header_length + static_cast<int>(message_length) >
+            buffer_size - offset) {
+      break;
+    }
+
+    FrameDecoder::Frame frame;
+    frame.offset = offset + header_length;
+    frame.length = static_cast<int>(message_length);
+    frames->push_back(frame);
+
+    offset += header_length + static_cast<int>(message_length);
+  }
+
+  // Parse the header of the incomplete message again to find out how much
+  // space to reserve for it.
+  uint64 message_length = 0;
+  ParseVarintBytewise(buffer + offset, buffer_size - offset, &message_length);
+
+  return offset;
+}
+
+int DecodeFramesWithFrameDecoder(const char* buffer, int buffer_size,
+                                 vector<FrameDecoder::Frame>* frames,
+                                 FrameDecoder* frame_decoder) {
+  const int char_count = frame_decoder->DecodeFrames(buffer, buffer_size,
+                                                     frames);
+  frame_decoder->pending_frame_size();
+  return char_count;
+}
+
+void AppendVarint(uint64 n, string* data) {
+  char buffer[kMaxVarintLength];
+  const int length = FormatVarint(n, buffer, kMaxVarintLength);
+  data->append(buffer, static_cast<string::size_type>(length));
+}
+
+// Generates varints of every length from one to ten bytes, in equal numbers.
+void MakeVarintData(string* data, vector<int>* offsets) {
+  mt19937_64 generator(1);
+  uniform_int_distribution<int> bit_count_distribution(1, 64);
+
+  for (int i = 0; i < FLAGS_varint_count; ++i) {
+    const int bit_count = bit_count_distribution(generator);
+    const uint64 n = generator() >> (64 - bit_count);
+
+    offsets->push_back(static_cast<int>(data->length()));
+    AppendVarint(n, data);
+  }
+
+  // Padding, so that every varint is followed by at least eight bytes.
+  data->append(8, '\0');
+}
+
+void MakeFrameData(string* data) {
+  mt19937_64 generator(1);
+  uniform_int_distribution<int> length_distribution(0,
+                                                    FLAGS_max_message_length);
+
+  for (int i = 0; i < FLAGS_message_count; ++i) {
+    const int message_length = length_distribution(generator);
+    AppendVarint(static_cast<uint64>(message_length), data);
+    data->append(static_cast<string::size_type>(message_length), 'x');
+  }
+}
+
+int64 TimeVarintParsing(bool bytewise, const string& data,
+                        const vector<int>& offsets, uint64* checksum) {
+  const char* const buffer = data.data();
+  const int buffer_size = static_cast<int>(data.length());
+
+  const int64 start_time = GetCurrentTimeUsec();
+
+  for (int offset : offsets) {
+    uint64 n = 0;
+    if (bytewise) {
+      CHECK_GT(ParseVarintBytewise(buffer + offset, buffer_size - offset, &n),
+               0);
+    } else {
+      CHECK_GT(ParseVarint(buffer + offset, buffer_size - offset, &n), 0);
+    }
+    *checksum += n;
+  }
+
+  return GetCurrentTimeUsec() - start_time;
+}
+
+// Feeds the data to the decode function FLAGS_chunk_size bytes at a time, as
+// if it were arriving on a socket.
+int64 TimeFrameDecoding(DecodeFramesFunction decode_frames,
+                        const string& data, uint64* checksum) {
+  const char* const buffer = data.data();
+  const int data_size = static_cast<int>(data.length());
+
+  vector<FrameDecoder::Frame> frames;
+
+  const int64 start_time = GetCurrentTimeUsec();
+
+  for (int i = 0; i < FLAGS_repetition_count; ++i) {
+    FrameDecoder frame_decoder;
+    int start = 0;
+    int end = 0;
+
+    while (end < data_size) {
+      end += FLAGS_chunk_size;
+      if (end > data_size) {
+        end = data_size;
+      }
+
+      start += (*decode_frames)(buffer + start, end - start, &frames,
+                                &frame_decoder);
+
+      for (const FrameDecoder::Frame& frame : frames) {
+        *checksum += static_cast<uint64>(frame.length);
+      }
+    }
+
+    CHECK_EQ(start, data_size);
+  }
+
+  return GetCurrentTimeUsec() - start_time;
+}
+
+void PrintResult(const char* benchmark_name, int item_count, int64 old_usec,
+                 int64 new_usec) {
+  printf("%-24s old: %8.2f ns/item   new: %8.2f ns/item   speedup: %.2fx\n",
+         benchmark_name,
+         static_cast<double>(old_usec) * 1000.0 / item_count,
+         static_cast<double>(new_usec) * 1000.0 / item_count,
+         new_usec > 0 ? static_cast<double>(old_usec) / new_usec : 0.0);
+}
+
+void RunBenchmarks() {
+  string varint_data;
+  vector<int> varint_offsets;
+  MakeVarintData(&varint_data, &varint_offsets);
+
+  string frame_data;
+  MakeFrameData(&frame_data);
+
+  uint64 old_checksum = 0;
+  uint64 new_checksum = 0;
+
+  for (int i = 0; i < FLAGS_pass_count; ++i) {
+    const int64 old_varint_usec = TimeVarintParsing(true, varint_data,
+                                                    varint_offsets,
+                                                    &old_checksum);
+    const int64 new_varint_usec = TimeVarintParsing(false, varint_data,
+                                                    varint_offsets,
+                                                    &new_checksum);
+    PrintResult("ParseVarint", FLAGS_varint_count, old_varint_usec,
+                new_varint_usec);
+
+    const int64 old_frame_usec = TimeFrameDecoding(&DecodeFramesBytewise,
+                                                   frame_data, &old_checksum);
+    const int64 new_frame_usec = TimeFrameDecoding(
+        &DecodeFramesWithFrameDecoder, frame_data, &new_checksum);
+    PrintResult("DecodeFrames", FLAGS_message_count * FLAGS_repetition_count,
+                old_frame_usec, new_frame_usec);
+  }
+
+  // The checksums also keep the compiler from optimizing the loops away.
+  CHECK_EQ(old_checksum, new_checksum);
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+
+  floating_temple::RunBenchmarks();
+
+  return 0;
+}
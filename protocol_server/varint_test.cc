@@ -252,6 +252,61 @@ TEST(VarintTest, ParseVarint) {
   EXPECT_THAT(MakeString(0xd2, 0x85, 0xd8, 0xcc), DoesntParse());
 }
 
+// ParseVarint takes a different path when there are at least eight bytes in
+// the buffer, as there are when a varint is followed by a message.
+TEST(VarintTest, ParseVarintFollowedByOtherData) {
+  const uint64 kValues[] = {
+    0u, 1u, 127u, 128u, 300u, 16383u, 16384u, 0x1fffffu, 0x200000u,
+    1234567890u, 0x7ffffffffu, 0x800000000u, 0x40000000000u,
+    0xffffffffffffffu, 0x100000000000000u, 0x7fffffffffffffffu,
+    18446744073709551615u
+  };
+
+  for (uint64 value : kValues) {
+    char buffer[kMaxVarintLength + 8];
+    const int length = FormatVarint(value, buffer, kMaxVarintLength);
+    for (int i = length; i < static_cast<int>(sizeof buffer); ++i) {
+      buffer[i] = static_cast<char>(0xff);
+    }
+
+    for (int buffer_size = length;
+         buffer_size <= static_cast<int>(sizeof buffer); ++buffer_size) {
+      uint64 parsed_value = 0u;
+      EXPECT_EQ(length, ParseVarint(buffer, buffer_size, &parsed_value))
+          << "value == " << value << ", buffer_size == " << buffer_size;
+      EXPECT_EQ(value, parsed_value);
+    }
+  }
+
+  // Incomplete varints
+  EXPECT_THAT(MakeString(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80),
+              DoesntParse());
+  EXPECT_THAT(MakeString(0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff),
+              DoesntParse());
+}
+
+TEST(VarintTest, ParseInvalidVarint) {
+  uint64 value = 0u;
+
+  // Too long
+  const string too_long = MakeString(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+                                     0x80, 0x80, 0x80) + MakeString(0x01);
+  EXPECT_EQ(kInvalidVarint, ParseVarint(too_long.data(),
+                                        static_cast<int>(too_long.length()),
+                                        &value));
+  EXPECT_EQ(kInvalidVarint, ParseVarint(too_long.data(), kMaxVarintLength,
+                                        &value));
+
+  // Too large to fit in 64 bits
+  const string too_large = MakeString(0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                      0xff, 0xff, 0x02);
+  EXPECT_EQ(kInvalidVarint, ParseVarint(too_large.data(),
+                                        static_cast<int>(too_large.length()),
+                                        &value));
+
+  EXPECT_EQ(0u, value);
+}
+
 TEST(VarintTest, FormatVarint) {
   EXPECT_THAT(static_cast<uint64>(0), FormatsAs(MakeString(0x00)));
   EXPECT_THAT(static_cast<uint64>(1), FormatsAs(MakeString(0x01)));
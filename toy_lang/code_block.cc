@@ -26,6 +26,7 @@
 #include "include/c++/deserialization_context.h"
 #include "include/c++/method_context.h"
 #include "include/c++/serialization_context.h"
+#include "toy_lang/code_registry.h"
 #include "toy_lang/expression.h"
 #include "toy_lang/proto/serialization.pb.h"
 #include "toy_lang/zoo/variable_object.h"
@@ -40,15 +41,15 @@ namespace floating_temple {
 namespace toy_lang {
 
 CodeBlock::CodeBlock(
-    const shared_ptr<const Expression>& expression,
+    const shared_ptr<const RegisteredCode>& code,
     const unordered_map<int, ObjectReference*>& external_symbols,
     const vector<int>& parameter_symbol_ids,
     const vector<int>& local_symbol_ids)
-    : expression_(expression),
+    : code_(code),
       external_symbols_(external_symbols),
       parameter_symbol_ids_(parameter_symbol_ids),
       local_symbol_ids_(local_symbol_ids) {
-  CHECK(expression.get() != nullptr);
+  CHECK(code.get() != nullptr);
 }
 
 CodeBlock::~CodeBlock() {
@@ -78,11 +79,11 @@ ObjectReference* CodeBlock::Evaluate(const vector<ObjectReference*>& parameters,
     CHECK(symbol_bindings.emplace(symbol_id, object_reference).second);
   }
 
-  return expression_->Evaluate(symbol_bindings, method_context);
+  return code_->expression->Evaluate(symbol_bindings, method_context);
 }
 
 CodeBlock* CodeBlock::Clone() const {
-  return new CodeBlock(expression_, external_symbols_, parameter_symbol_ids_,
+  return new CodeBlock(code_, external_symbols_, parameter_symbol_ids_,
                        local_symbol_ids_);
 }
 
@@ -91,7 +92,9 @@ void CodeBlock::PopulateCodeBlockProto(CodeBlockProto* code_block_proto,
   CHECK(code_block_proto != nullptr);
   CHECK(context != nullptr);
 
-  expression_->PopulateExpressionProto(code_block_proto->mutable_expression());
+  // The body was serialized once, when it was registered.
+  code_block_proto->set_code_hash(code_->code_hash);
+  code_block_proto->set_expression_data(code_->expression_data);
 
   for (const pair<int, ObjectReference*>& external_symbol : external_symbols_) {
     ExternalSymbolProto* const external_symbol_proto =
@@ -111,7 +114,7 @@ void CodeBlock::PopulateCodeBlockProto(CodeBlockProto* code_block_proto,
 }
 
 string CodeBlock::DebugString() const {
-  return StringPrintf("{%s}", expression_->DebugString().c_str());
+  return StringPrintf("{%s}", code_->expression->DebugString().c_str());
 }
 
 // static
@@ -119,8 +122,10 @@ CodeBlock* CodeBlock::ParseCodeBlockProto(
     const CodeBlockProto& code_block_proto, DeserializationContext* context) {
   CHECK(context != nullptr);
 
-  const shared_ptr<const Expression> expression(
-      Expression::ParseExpressionProto(code_block_proto.expression()));
+  // The body is only parsed if no other code block with the same body has been
+  // seen by this process.
+  const shared_ptr<const RegisteredCode> code = RegisterSerializedExpression(
+      code_block_proto.code_hash(), code_block_proto.expression_data());
 
   const int external_symbol_count = code_block_proto.external_symbol_size();
   unordered_map<int, ObjectReference*> external_symbols;
@@ -148,7 +153,7 @@ CodeBlock* CodeBlock::ParseCodeBlockProto(
     local_symbol_ids[i] = code_block_proto.local_symbol_id(i);
   }
 
-  return new CodeBlock(expression, external_symbols, parameter_symbol_ids,
+  return new CodeBlock(code, external_symbols, parameter_symbol_ids,
                        local_symbol_ids);
 }
 
@@ -33,12 +33,12 @@ class SerializationContext;
 namespace toy_lang {
 
 class CodeBlockProto;
-class Expression;
+struct RegisteredCode;
 
 // TODO(dss): Consider merging this class into the CodeBlockObject class.
 class CodeBlock {
  public:
-  CodeBlock(const std::shared_ptr<const Expression>& expression,
+  CodeBlock(const std::shared_ptr<const RegisteredCode>& code,
             const std::unordered_map<int, ObjectReference*>& external_symbols,
             const std::vector<int>& parameter_symbol_ids,
             const std::vector<int>& local_symbol_ids);
@@ -55,7 +55,8 @@ class CodeBlock {
                                         DeserializationContext* context);
 
  private:
-  const std::shared_ptr<const Expression> expression_;
+  // Shared with every other code block that has the same body.
+  const std::shared_ptr<const RegisteredCode> code_;
   const std::unordered_map<int, ObjectReference*> external_symbols_;
   const std::vector<int> parameter_symbol_ids_;
   const std::vector<int> local_symbol_ids_;
@@ -0,0 +1,180 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "toy_lang/code_registry.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/mutex_lock.h"
+#include "toy_lang/expression.h"
+#include "toy_lang/proto/serialization.pb.h"
+
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+
+namespace floating_temple {
+namespace toy_lang {
+namespace {
+
+// The registered code, indexed by content hash. Entries are never removed;
+// the amount of code is bounded by the size of the programs being run.
+struct CodeRegistry {
+  unordered_map<string, shared_ptr<const RegisteredCode>> code;
+  Mutex mu;
+};
+
+CodeRegistry* GetCodeRegistry() {
+  // The registry is intentionally leaked so that it can be used during
+  // process shutdown.
+  static CodeRegistry* const code_registry = new CodeRegistry();
+  return code_registry;
+}
+
+uint64 MixBits(uint64 n) {
+  n ^= n >> 33;
+  n *= 0xff51afd7ed558ccdULL;
+  n ^= n >> 33;
+  n *= 0xc4ceb9fe1a85ec53ULL;
+  n ^= n >> 33;
+  return n;
+}
+
+void AppendUint64(uint64 n, string* s) {
+  for (int i = 0; i < 8; ++i) {
+    *s += static_cast<char>(n & 0xff);
+    n >>= 8;
+  }
+}
+
+// Returns the registered code with the given hash, or NULL if there isn't
+// any.
+shared_ptr<const RegisteredCode> FindCode(const string& code_hash) {
+  CodeRegistry* const code_registry = GetCodeRegistry();
+
+  MutexLock lock(&code_registry->mu);
+  const auto it = code_registry->code.find(code_hash);
+  if (it == code_registry->code.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+// Adds the code to the registry, unless code with the same hash is already
+// there. Returns the registered code.
+shared_ptr<const RegisteredCode> AddCode(
+    const shared_ptr<const RegisteredCode>& code) {
+  CodeRegistry* const code_registry = GetCodeRegistry();
+
+  MutexLock lock(&code_registry->mu);
+  return code_registry->code.emplace(code->code_hash, code).first->second;
+}
+
+// Parses the expression proto and registers the result. 'expression_data' is
+// the serialized form of 'expression_proto', and 'code_hash' is its hash.
+shared_ptr<const RegisteredCode> ParseAndAddCode(
+    const string& code_hash, const string& expression_data,
+    const ExpressionProto& expression_proto) {
+  // The registry lock isn't held here, since parsing the expression registers
+  // any code blocks nested inside it.
+  const shared_ptr<RegisteredCode> code(new RegisteredCode());
+  code->code_hash = code_hash;
+  code->expression_data = expression_data;
+  code->expression.reset(Expression::ParseExpressionProto(expression_proto));
+
+  return AddCode(code);
+}
+
+}  // namespace
+
+string GetCodeHash(const string& expression_data) {
+  // Two independent 64-bit hashes: FNV-1a, and a multiply-and-shift hash.
+  uint64 h1 = 0xcbf29ce484222325ULL;
+  uint64 h2 = 0x9e3779b97f4a7c15ULL;
+
+  for (const char c : expression_data) {
+    const uint64 byte = static_cast<unsigned char>(c);
+    h1 = (h1 ^ byte) * 0x100000001b3ULL;
+    h2 = (h2 + byte) * 0xc6a4a7935bd1e995ULL;
+    h2 ^= h2 >> 47;
+  }
+
+  h1 = MixBits(h1 ^ static_cast<uint64>(expression_data.length()));
+  h2 = MixBits(h2 ^ h1);
+
+  string code_hash;
+  code_hash.reserve(16);
+  AppendUint64(h1, &code_hash);
+  AppendUint64(h2, &code_hash);
+
+  return code_hash;
+}
+
+shared_ptr<const RegisteredCode> RegisterExpression(
+    const shared_ptr<const Expression>& expression) {
+  CHECK(expression.get() != nullptr);
+
+  ExpressionProto expression_proto;
+  expression->PopulateExpressionProto(&expression_proto);
+
+  const shared_ptr<RegisteredCode> code(new RegisteredCode());
+  CHECK(expression_proto.SerializeToString(&code->expression_data));
+  code->code_hash = GetCodeHash(code->expression_data);
+  code->expression = expression;
+
+  return AddCode(code);
+}
+
+shared_ptr<const RegisteredCode> RegisterSerializedExpression(
+    const string& code_hash, const string& expression_data) {
+  // Otherwise, a peer could substitute different code for a block that's
+  // already registered.
+  CHECK_EQ(GetCodeHash(expression_data), code_hash)
+      << "The code hash doesn't match the expression data.";
+
+  const shared_ptr<const RegisteredCode> code = FindCode(code_hash);
+  if (code.get() != nullptr) {
+    return code;
+  }
+
+  ExpressionProto expression_proto;
+  CHECK(expression_proto.ParseFromString(expression_data));
+
+  return ParseAndAddCode(code_hash, expression_data, expression_proto);
+}
+
+shared_ptr<const RegisteredCode> RegisterExpressionProto(
+    const ExpressionProto& expression_proto) {
+  // Hashing the serialized expression is cheaper than parsing it, and the
+  // same expression is usually already registered.
+  string expression_data;
+  CHECK(expression_proto.SerializeToString(&expression_data));
+  const string code_hash = GetCodeHash(expression_data);
+
+  const shared_ptr<const RegisteredCode> code = FindCode(code_hash);
+  if (code.get() != nullptr) {
+    return code;
+  }
+
+  return ParseAndAddCode(code_hash, expression_data, expression_proto);
+}
+
+}  // namespace toy_lang
+}  // namespace floating_temple
@@ -0,0 +1,63 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TOY_LANG_CODE_REGISTRY_H_
+#define TOY_LANG_CODE_REGISTRY_H_
+
+#include <memory>
+#include <string>
+
+namespace floating_temple {
+namespace toy_lang {
+
+class Expression;
+class ExpressionProto;
+
+// The body of a code block, stored once per process and shared by every code
+// block with the same content. 'expression_data' is the serialized
+// ExpressionProto, and 'code_hash' is its content hash (see GetCodeHash).
+struct RegisteredCode {
+  std::string code_hash;
+  std::string expression_data;
+  std::shared_ptr<const Expression> expression;
+};
+
+// Returns the 16-byte content hash of a serialized ExpressionProto. The hash
+// isn't cryptographic; it only needs to tell apart the code blocks written by
+// cooperating peers.
+std::string GetCodeHash(const std::string& expression_data);
+
+// Registers the given expression and returns the registered code. If an
+// expression with the same content was already registered, returns that one
+// instead.
+std::shared_ptr<const RegisteredCode> RegisterExpression(
+    const std::shared_ptr<const Expression>& expression);
+
+// Returns the registered code with the given hash. If there isn't any, parses
+// 'expression_data' and registers the result. 'code_hash' must be the hash of
+// 'expression_data'; this is checked, since the hash may have been received
+// from a remote peer.
+std::shared_ptr<const RegisteredCode> RegisterSerializedExpression(
+    const std::string& code_hash, const std::string& expression_data);
+
+// Returns the registered code for the given expression proto. If there isn't
+// any, parses the proto and registers the result.
+std::shared_ptr<const RegisteredCode> RegisterExpressionProto(
+    const ExpressionProto& expression_proto);
+
+}  // namespace toy_lang
+}  // namespace floating_temple
+
+#endif  // TOY_LANG_CODE_REGISTRY_H_
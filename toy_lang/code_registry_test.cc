@@ -0,0 +1,93 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "toy_lang/code_registry.h"
+
+#include <memory>
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+#include "toy_lang/expression.h"
+#include "toy_lang/proto/serialization.pb.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::shared_ptr;
+using std::string;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace toy_lang {
+namespace {
+
+TEST(CodeRegistryTest, IdenticalExpressionsAreRegisteredOnce) {
+  const shared_ptr<const Expression> expression1(new IntExpression(17));
+  const shared_ptr<const Expression> expression2(new IntExpression(17));
+  const shared_ptr<const Expression> expression3(new StringExpression("17"));
+
+  const shared_ptr<const RegisteredCode> code1 = RegisterExpression(
+      expression1);
+  const shared_ptr<const RegisteredCode> code2 = RegisterExpression(
+      expression2);
+  const shared_ptr<const RegisteredCode> code3 = RegisterExpression(
+      expression3);
+
+  EXPECT_EQ(16u, code1->code_hash.length());
+  EXPECT_EQ(GetCodeHash(code1->expression_data), code1->code_hash);
+
+  EXPECT_EQ(code1.get(), code2.get());
+  EXPECT_EQ(expression1.get(), code2->expression.get());
+
+  EXPECT_NE(code1->code_hash, code3->code_hash);
+  EXPECT_EQ(expression3.get(), code3->expression.get());
+}
+
+TEST(CodeRegistryTest, RegisterSerializedExpression) {
+  ExpressionProto expression_proto;
+  expression_proto.mutable_string_expression()->set_string_value(
+      "RegisterSerializedExpression");
+
+  string expression_data;
+  CHECK(expression_proto.SerializeToString(&expression_data));
+  const string code_hash = GetCodeHash(expression_data);
+
+  // The first time, the expression is parsed.
+  const shared_ptr<const RegisteredCode> code1 = RegisterSerializedExpression(
+      code_hash, expression_data);
+  EXPECT_EQ(code_hash, code1->code_hash);
+  EXPECT_EQ(expression_data, code1->expression_data);
+  EXPECT_EQ("\"RegisterSerializedExpression\"",
+            code1->expression->DebugString());
+
+  // After that, the registered expression is reused.
+  EXPECT_EQ(code1.get(),
+            RegisterSerializedExpression(code_hash, expression_data).get());
+  EXPECT_EQ(code1.get(), RegisterExpression(code1->expression).get());
+  EXPECT_EQ(code1.get(), RegisterExpressionProto(expression_proto).get());
+}
+
+}  // namespace
+}  // namespace toy_lang
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -28,6 +28,7 @@
 #include "include/c++/method_context.h"
 #include "include/c++/value.h"
 #include "toy_lang/code_block.h"
+#include "toy_lang/code_registry.h"
 #include "toy_lang/get_serialized_expression_type.h"
 #include "toy_lang/proto/serialization.pb.h"
 #include "toy_lang/wrap.h"
@@ -190,13 +191,13 @@ SymbolExpression* SymbolExpression::ParseSymbolExpressionProto(
   return new SymbolExpression(symbol_expression_proto.symbol_id());
 }
 
-BlockExpression::BlockExpression(const shared_ptr<const Expression>& expression,
+BlockExpression::BlockExpression(const shared_ptr<const RegisteredCode>& code,
                                  const vector<int>& parameter_symbol_ids,
                                  const vector<int>& local_symbol_ids)
-    : expression_(expression),
+    : code_(code),
       parameter_symbol_ids_(parameter_symbol_ids),
       local_symbol_ids_(local_symbol_ids) {
-  CHECK(expression.get() != nullptr);
+  CHECK(code.get() != nullptr);
 }
 
 ObjectReference* BlockExpression::Evaluate(
@@ -204,7 +205,7 @@ ObjectReference* BlockExpression::Evaluate(
     MethodContext* method_context) const {
   CHECK(method_context != nullptr);
 
-  CodeBlock* const code_block = new CodeBlock(expression_, symbol_bindings,
+  CodeBlock* const code_block = new CodeBlock(code_, symbol_bindings,
                                               parameter_symbol_ids_,
                                               local_symbol_ids_);
   LocalObject* const code_block_object = new CodeBlockObject(
@@ -219,7 +220,7 @@ void BlockExpression::PopulateExpressionProto(
   BlockExpressionProto* const block_expression_proto =
       expression_proto->mutable_block_expression();
 
-  expression_->PopulateExpressionProto(
+  code_->expression->PopulateExpressionProto(
       block_expression_proto->mutable_expression());
 
   for (int symbol_id : parameter_symbol_ids_) {
@@ -232,14 +233,14 @@ void BlockExpression::PopulateExpressionProto(
 }
 
 string BlockExpression::DebugString() const {
-  return StringPrintf("{%s}", expression_->DebugString().c_str());
+  return StringPrintf("{%s}", code_->expression->DebugString().c_str());
 }
 
 // static
 BlockExpression* BlockExpression::ParseBlockExpressionProto(
     const BlockExpressionProto& block_expression_proto) {
-  const shared_ptr<const Expression> expression(
-      Expression::ParseExpressionProto(block_expression_proto.expression()));
+  const shared_ptr<const RegisteredCode> code = RegisterExpressionProto(
+      block_expression_proto.expression());
 
   const int parameter_symbol_count =
       block_expression_proto.parameter_symbol_id_size();
@@ -254,8 +255,7 @@ BlockExpression* BlockExpression::ParseBlockExpressionProto(
     local_symbol_ids[i] = block_expression_proto.local_symbol_id(i);
   }
 
-  return new BlockExpression(expression, parameter_symbol_ids,
-                             local_symbol_ids);
+  return new BlockExpression(code, parameter_symbol_ids, local_symbol_ids);
 }
 
 FunctionCallExpression::FunctionCallExpression(
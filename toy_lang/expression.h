@@ -36,6 +36,7 @@ class ExpressionProto;
 class FunctionCallExpressionProto;
 class IntExpressionProto;
 class ListExpressionProto;
+struct RegisteredCode;
 class StringExpressionProto;
 class SymbolExpressionProto;
 
@@ -117,7 +118,7 @@ class SymbolExpression : public Expression {
 
 class BlockExpression : public Expression {
  public:
-  BlockExpression(const std::shared_ptr<const Expression>& expression,
+  BlockExpression(const std::shared_ptr<const RegisteredCode>& code,
                   const std::vector<int>& parameter_symbol_ids,
                   const std::vector<int>& local_symbol_ids);
 
@@ -132,7 +133,7 @@ class BlockExpression : public Expression {
       const BlockExpressionProto& block_expression_proto);
 
  private:
-  const std::shared_ptr<const Expression> expression_;
+  const std::shared_ptr<const RegisteredCode> code_;
   const std::vector<int> parameter_symbol_ids_;
   const std::vector<int> local_symbol_ids_;
 
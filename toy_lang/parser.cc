@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "base/logging.h"
+#include "toy_lang/code_registry.h"
 #include "toy_lang/expression.h"
 #include "toy_lang/lexer.h"
 #include "toy_lang/symbol_table.h"
@@ -248,8 +249,8 @@ Expression* Parser::LeaveScope(const shared_ptr<const Expression>& expression) {
   vector<int> local_symbol_ids;
   symbol_table_->LeaveScope(&parameter_symbol_ids, &local_symbol_ids);
 
-  return new BlockExpression(expression, parameter_symbol_ids,
-                             local_symbol_ids);
+  return new BlockExpression(RegisterExpression(expression),
+                             parameter_symbol_ids, local_symbol_ids);
 }
 
 }  // namespace toy_lang
@@ -31,6 +31,7 @@
 #include "toy_lang/proto/serialization.pb.h"
 #include "toy_lang/wrap.h"
 #include "util/dump_context.h"
+#include "util/persistent_vector.h"
 
 using std::string;
 using std::vector;
@@ -50,6 +51,10 @@ ListObject::ListObject(const vector<ObjectReference*>& items)
     : items_(items) {
 }
 
+ListObject::ListObject(const PersistentVector<ObjectReference*>& items)
+    : items_(items) {
+}
+
 LocalObject* ListObject::Clone() const {
   MutexLock lock(&items_mu_);
   return new ListObject(items_);
@@ -75,36 +80,40 @@ void ListObject::InvokeMethod(MethodContext* method_context,
     MutexLock lock(&items_mu_);
     CHECK(!items_.empty());
     const int64 length = static_cast<int64>(items_.size());
-    return_value->set_object_reference(0, items_[TrueMod(index, length)]);
+    return_value->set_object_reference(0,
+                                       items_.Get(TrueMod(index, length)));
   } else if (method_name == "append") {
     CHECK_EQ(parameters.size(), 1u);
 
     {
       MutexLock lock(&items_mu_);
-      items_.push_back(parameters[0].object_reference());
+      items_.PushBack(parameters[0].object_reference());
     }
 
     return_value->set_empty(0);
   } else if (method_name == "get_string") {
     CHECK_EQ(parameters.size(), 0u);
 
-    string s = "[";
+    PersistentVector<ObjectReference*> items_temp;
     {
       MutexLock lock(&items_mu_);
+      items_temp = items_;
+    }
 
-      for (vector<ObjectReference*>::const_iterator it = items_.begin();
-           it != items_.end(); ++it) {
-        if (it != items_.begin()) {
-          s += ' ';
-        }
-
-        string item_str;
-        if (!UnwrapString(method_context, *it, &item_str)) {
-          return;
-        }
+    string s = "[";
+    for (PersistentVector<ObjectReference*>::const_iterator it =
+             items_temp.begin();
+         it != items_temp.end(); ++it) {
+      if (it != items_temp.begin()) {
+        s += ' ';
+      }
 
-        s += item_str;
+      string item_str;
+      if (!UnwrapString(method_context, *it, &item_str)) {
+        return;
       }
+
+      s += item_str;
     }
     s += ']';
 
@@ -117,7 +126,7 @@ void ListObject::InvokeMethod(MethodContext* method_context,
 void ListObject::Dump(DumpContext* dc) const {
   CHECK(dc != nullptr);
 
-  vector<ObjectReference*> items_temp;
+  PersistentVector<ObjectReference*> items_temp;
   {
     MutexLock lock(&items_mu_);
     items_temp = items_;
@@ -143,11 +152,11 @@ ListObject* ListObject::ParseListProto(const ListProto& list_proto,
                                        DeserializationContext* context) {
   CHECK(context != nullptr);
 
-  vector<ObjectReference*> items(list_proto.object_index_size());
+  PersistentVector<ObjectReference*> items;
 
   for (int i = 0; i < list_proto.object_index_size(); ++i) {
     const int64 object_index = list_proto.object_index(i);
-    items[i] = context->GetObjectReferenceByIndex(object_index);
+    items.PushBack(context->GetObjectReferenceByIndex(object_index));
   }
 
   return new ListObject(items);
@@ -157,9 +166,13 @@ void ListObject::PopulateObjectProto(ObjectProto* object_proto,
                                      SerializationContext* context) const {
   ListProto* const list_proto = object_proto->mutable_list_object();
 
-  MutexLock lock(&items_mu_);
+  PersistentVector<ObjectReference*> items_temp;
+  {
+    MutexLock lock(&items_mu_);
+    items_temp = items_;
+  }
 
-  for (ObjectReference* const object_reference : items_) {
+  for (ObjectReference* const object_reference : items_temp) {
     const int object_index = context->GetIndexForObjectReference(
         object_reference);
     list_proto->add_object_index(object_index);
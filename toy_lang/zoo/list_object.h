@@ -21,6 +21,7 @@
 #include "base/macros.h"
 #include "base/mutex.h"
 #include "toy_lang/zoo/local_object_impl.h"
+#include "util/persistent_vector.h"
 
 namespace floating_temple {
 
@@ -51,7 +52,11 @@ class ListObject : public LocalObjectImpl {
                            SerializationContext* context) const override;
 
  private:
-  std::vector<ObjectReference*> items_;
+  explicit ListObject(const PersistentVector<ObjectReference*>& items);
+
+  // The vector shares its structure with the vectors of any clones of this
+  // object, so Clone() takes constant time.
+  PersistentVector<ObjectReference*> items_;
   mutable Mutex items_mu_;
 
   DISALLOW_COPY_AND_ASSIGN(ListObject);
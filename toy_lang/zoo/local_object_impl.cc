@@ -16,6 +16,7 @@
 #include "toy_lang/zoo/local_object_impl.h"
 
 #include <cstddef>
+#include <string>
 
 #include "base/logging.h"
 #include "toy_lang/get_serialized_object_type.h"
@@ -51,23 +52,24 @@
 #include "toy_lang/zoo/while_function.h"
 
 using std::size_t;
+using std::string;
 
 namespace floating_temple {
 namespace toy_lang {
 
-size_t LocalObjectImpl::Serialize(void* buffer, size_t buffer_size,
-                                  SerializationContext* context) const {
+void LocalObjectImpl::Serialize(string* data,
+                                SerializationContext* context) const {
+  CHECK(data != nullptr);
+
   ObjectProto object_proto;
   // TODO(dss): Use the 'this' keyword when calling a pure virtual method on
   // this object.
   PopulateObjectProto(&object_proto, context);
 
-  const size_t byte_size = static_cast<size_t>(object_proto.ByteSize());
-  if (byte_size <= buffer_size) {
-    object_proto.SerializeWithCachedSizesToArray(static_cast<uint8*>(buffer));
-  }
-
-  return byte_size;
+  // SerializeToString computes the size of the proto once, resizes *data to
+  // fit (keeping any capacity that the caller reserved), and then writes the
+  // proto directly into it.
+  CHECK(object_proto.SerializeToString(data));
 }
 
 // static
@@ -17,6 +17,7 @@
 #define TOY_LANG_ZOO_LOCAL_OBJECT_IMPL_H_
 
 #include <cstddef>
+#include <string>
 
 #include "include/c++/local_object.h"
 
@@ -31,8 +32,8 @@ class ObjectProto;
 
 class LocalObjectImpl : public LocalObject {
  public:
-  std::size_t Serialize(void* buffer, std::size_t buffer_size,
-                        SerializationContext* context) const override;
+  void Serialize(std::string* data,
+                 SerializationContext* context) const override;
 
   static LocalObjectImpl* Deserialize(const void* buffer,
                                       std::size_t buffer_size,
@@ -16,7 +16,6 @@
 #include "toy_lang/zoo/map_object.h"
 
 #include <string>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -28,10 +27,10 @@
 #include "include/c++/serialization_context.h"
 #include "toy_lang/proto/serialization.pb.h"
 #include "util/dump_context.h"
+#include "util/persistent_map.h"
 
 using std::pair;
 using std::string;
-using std::unordered_map;
 using std::vector;
 
 namespace floating_temple {
@@ -58,24 +57,24 @@ void MapObject::InvokeMethod(MethodContext* method_context,
     CHECK_EQ(parameters.size(), 1u);
 
     const string& key = parameters[0].string_value();
-    return_value->set_bool_value(0, map_.find(key) != map_.end());
+    return_value->set_bool_value(0, map_.Find(key) != nullptr);
   } else if (method_name == "get") {
     CHECK_EQ(parameters.size(), 1u);
 
     const string& key = parameters[0].string_value();
 
-    const unordered_map<string, ObjectReference*>::const_iterator it =
-        map_.find(key);
-    CHECK(it != map_.end()) << "Key not found: \"" << CEscape(key) << "\"";
+    ObjectReference* const* const object_reference = map_.Find(key);
+    CHECK(object_reference != nullptr) << "Key not found: \""
+                                       << CEscape(key) << "\"";
 
-    return_value->set_object_reference(0, it->second);
+    return_value->set_object_reference(0, *object_reference);
   } else if (method_name == "set") {
     CHECK_EQ(parameters.size(), 2u);
 
     const string& key = parameters[0].string_value();
     ObjectReference* const object_reference = parameters[1].object_reference();
 
-    map_[key] = object_reference;
+    map_.Set(key, object_reference);
 
     return_value->set_empty(0);
   } else {
@@ -108,7 +107,7 @@ MapObject* MapObject::ParseMapProto(const MapProto& map_proto,
   CHECK(context != nullptr);
 
   MapObject* const new_object = new MapObject();
-  unordered_map<string, ObjectReference*>* const the_map = &new_object->map_;
+  PersistentMap<string, ObjectReference*>* const the_map = &new_object->map_;
 
   for (int i = 0; i < map_proto.entry_size(); ++i) {
     const MapEntryProto& entry_proto = map_proto.entry(i);
@@ -118,7 +117,7 @@ MapObject* MapObject::ParseMapProto(const MapProto& map_proto,
     ObjectReference* const object_reference =
         context->GetObjectReferenceByIndex(object_index);
 
-    CHECK(the_map->emplace(key, object_reference).second);
+    CHECK(the_map->Set(key, object_reference));
   }
 
   return new_object;
@@ -17,10 +17,10 @@
 #define TOY_LANG_ZOO_MAP_OBJECT_H_
 
 #include <string>
-#include <unordered_map>
 
 #include "base/macros.h"
 #include "toy_lang/zoo/local_object_impl.h"
+#include "util/persistent_map.h"
 
 namespace floating_temple {
 
@@ -51,8 +51,11 @@ class MapObject : public LocalObjectImpl {
                            SerializationContext* context) const override;
 
  private:
+  // The map shares its structure with the maps of any clones of this object,
+  // so Clone() takes constant time.
+  //
   // TODO(dss): Should this map be protected by a mutex?
-  std::unordered_map<std::string, ObjectReference*> map_;
+  PersistentMap<std::string, ObjectReference*> map_;
 
   DISALLOW_COPY_AND_ASSIGN(MapObject);
 };
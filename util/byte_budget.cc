@@ -0,0 +1,139 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "util/byte_budget.h"
+
+#include <ctime>
+
+#include "base/cond_var.h"
+#include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/mutex_lock.h"
+#include "base/time_util.h"
+
+namespace floating_temple {
+
+ByteBudget::ByteBudget(int64 max_byte_count)
+    : parent_(nullptr),
+      root_(this),
+      max_byte_count_(max_byte_count),
+      byte_count_(0),
+      exhausted_since_usec_(-1) {
+  CHECK_GE(max_byte_count, -1);
+}
+
+ByteBudget::ByteBudget(ByteBudget* parent, int64 max_byte_count)
+    : parent_(CHECK_NOTNULL(parent)),
+      root_(parent->root_),
+      max_byte_count_(max_byte_count),
+      byte_count_(0),
+      exhausted_since_usec_(-1) {
+  CHECK_GE(max_byte_count, -1);
+}
+
+ByteBudget::~ByteBudget() {
+  ReleaseAll();
+}
+
+int64 ByteBudget::byte_count() const {
+  MutexLock lock(&root_->mu_);
+  return byte_count_;
+}
+
+bool ByteBudget::exhausted() const {
+  MutexLock lock(&root_->mu_);
+  return Exhausted_Locked();
+}
+
+int64 ByteBudget::exhausted_since_usec() const {
+  MutexLock lock(&root_->mu_);
+  return exhausted_since_usec_;
+}
+
+void ByteBudget::Charge(int64 byte_count) {
+  CHECK_GE(byte_count, 0);
+
+  MutexLock lock(&root_->mu_);
+  Charge_Locked(byte_count);
+}
+
+void ByteBudget::Release(int64 byte_count) {
+  CHECK_GE(byte_count, 0);
+
+  MutexLock lock(&root_->mu_);
+  CHECK_LE(byte_count, byte_count_);
+
+  Charge_Locked(-byte_count);
+  root_->available_cond_.Broadcast();
+}
+
+void ByteBudget::ReleaseAll() {
+  MutexLock lock(&root_->mu_);
+
+  if (byte_count_ > 0) {
+    Charge_Locked(-byte_count_);
+    root_->available_cond_.Broadcast();
+  }
+}
+
+bool ByteBudget::WaitUntilAvailable(int timeout_ms) const {
+  CHECK_GE(timeout_ms, 0);
+
+  const int64 deadline_usec = GetCurrentTimeUsec() +
+      static_cast<int64>(timeout_ms) * 1000;
+  timespec deadline;
+  deadline.tv_sec = static_cast<time_t>(deadline_usec / 1000000);
+  deadline.tv_nsec = static_cast<long>(deadline_usec % 1000000 * 1000);
+
+  MutexLock lock(&root_->mu_);
+
+  while (Exhausted_Locked() && GetCurrentTimeUsec() <= deadline_usec) {
+    root_->available_cond_.TimedWait(&root_->mu_, &deadline);
+  }
+
+  return !Exhausted_Locked();
+}
+
+bool ByteBudget::Exhausted_Locked() const {
+  for (const ByteBudget* budget = this; budget != nullptr;
+       budget = budget->parent_) {
+    if (budget->max_byte_count_ >= 0 &&
+        budget->byte_count_ >= budget->max_byte_count_) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ByteBudget::Charge_Locked(int64 byte_count) {
+  for (ByteBudget* budget = this; budget != nullptr; budget = budget->parent_) {
+    budget->byte_count_ += byte_count;
+    CHECK_GE(budget->byte_count_, 0);
+
+    if (budget->max_byte_count_ >= 0 &&
+        budget->byte_count_ >= budget->max_byte_count_) {
+      if (budget->exhausted_since_usec_ == -1) {
+        budget->exhausted_since_usec_ = GetCurrentTimeUsec();
+      }
+    } else {
+      budget->exhausted_since_usec_ = -1;
+    }
+  }
+}
+
+}  // namespace floating_temple
@@ -0,0 +1,85 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTIL_BYTE_BUDGET_H_
+#define UTIL_BYTE_BUDGET_H_
+
+#include "base/cond_var.h"
+#include "base/integral_types.h"
+#include "base/macros.h"
+#include "base/mutex.h"
+
+namespace floating_temple {
+
+// Keeps track of the number of bytes of memory used by a buffer (or a set of
+// buffers), and lets producers wait until the number falls below a limit.
+//
+// Budgets can be nested: bytes charged to a budget are also charged to its
+// parent, so a parent budget can limit the total memory used by all of its
+// children. A budget is exhausted if its own limit or the limit of any of its
+// ancestors has been reached.
+//
+// The limit is soft: Charge() always succeeds, even if the budget is already
+// exhausted. It's up to the caller to call WaitUntilAvailable() first.
+//
+// A budget and all of its descendants share a single mutex, so this class is
+// thread-safe. A parent budget must outlive its children.
+class ByteBudget {
+ public:
+  // A 'max_byte_count' of -1 means that the budget is unlimited.
+  explicit ByteBudget(int64 max_byte_count);
+  ByteBudget(ByteBudget* parent, int64 max_byte_count);
+  // Releases any bytes that are still charged to this budget from its
+  // ancestors.
+  ~ByteBudget();
+
+  int64 byte_count() const;
+  bool exhausted() const;
+
+  // Returns the time (in microseconds since the epoch) at which this budget's
+  // own limit was reached, or -1 if the budget isn't over its own limit.
+  // Ancestor limits are not considered.
+  int64 exhausted_since_usec() const;
+
+  void Charge(int64 byte_count);
+  void Release(int64 byte_count);
+  void ReleaseAll();
+
+  // Waits until the budget is no longer exhausted, or until the timeout
+  // expires. Returns true if the budget is available.
+  bool WaitUntilAvailable(int timeout_ms) const;
+
+ private:
+  bool Exhausted_Locked() const;
+  void Charge_Locked(int64 byte_count);
+
+  ByteBudget* const parent_;
+  ByteBudget* const root_;
+  const int64 max_byte_count_;
+
+  int64 byte_count_;
+  int64 exhausted_since_usec_;
+
+  // Only used by the root budget.
+  mutable CondVar available_cond_;
+  mutable Mutex mu_;
+
+  DISALLOW_COPY_AND_ASSIGN(ByteBudget);
+};
+
+}  // namespace floating_temple
+
+#endif  // UTIL_BYTE_BUDGET_H_
@@ -0,0 +1,100 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "util/byte_budget.h"
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace {
+
+TEST(ByteBudgetTest, ChargeAndRelease) {
+  ByteBudget byte_budget(100);
+
+  EXPECT_FALSE(byte_budget.exhausted());
+  EXPECT_EQ(-1, byte_budget.exhausted_since_usec());
+
+  byte_budget.Charge(60);
+  EXPECT_EQ(60, byte_budget.byte_count());
+  EXPECT_FALSE(byte_budget.exhausted());
+
+  // The limit is soft. A charge that goes over the limit still succeeds.
+  byte_budget.Charge(60);
+  EXPECT_EQ(120, byte_budget.byte_count());
+  EXPECT_TRUE(byte_budget.exhausted());
+  EXPECT_NE(-1, byte_budget.exhausted_since_usec());
+  EXPECT_FALSE(byte_budget.WaitUntilAvailable(10));
+
+  byte_budget.Release(60);
+  EXPECT_FALSE(byte_budget.exhausted());
+  EXPECT_EQ(-1, byte_budget.exhausted_since_usec());
+  EXPECT_TRUE(byte_budget.WaitUntilAvailable(0));
+}
+
+TEST(ByteBudgetTest, ChildrenShareParentBudget) {
+  ByteBudget parent(100);
+  ByteBudget child1(&parent, 80);
+  ByteBudget child2(&parent, 80);
+
+  child1.Charge(50);
+  child2.Charge(50);
+
+  // Neither child is over its own limit, but together they've used up the
+  // parent's budget.
+  EXPECT_EQ(100, parent.byte_count());
+  EXPECT_TRUE(child1.exhausted());
+  EXPECT_TRUE(child2.exhausted());
+  EXPECT_EQ(-1, child1.exhausted_since_usec());
+
+  child2.ReleaseAll();
+  EXPECT_EQ(50, parent.byte_count());
+  EXPECT_FALSE(child1.exhausted());
+
+  {
+    ByteBudget child3(&parent, -1);
+    child3.Charge(70);
+    EXPECT_TRUE(child1.exhausted());
+  }
+
+  // Destroying a child releases its bytes from the parent.
+  EXPECT_EQ(50, parent.byte_count());
+  EXPECT_FALSE(child1.exhausted());
+}
+
+TEST(ByteBudgetTest, UnlimitedBudget) {
+  ByteBudget byte_budget(-1);
+
+  byte_budget.Charge(1000000000);
+  EXPECT_FALSE(byte_budget.exhausted());
+  EXPECT_TRUE(byte_budget.WaitUntilAvailable(0));
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
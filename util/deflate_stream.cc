@@ -0,0 +1,75 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/deflate_stream.h"
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "base/logging.h"
+
+using std::size_t;
+using std::string;
+
+namespace floating_temple {
+namespace {
+
+const size_t kOutputChunkSize = 4096;
+
+}  // namespace
+
+DeflateStream::DeflateStream() {
+  memset(&stream_, 0, sizeof stream_);
+  stream_.zalloc = Z_NULL;
+  stream_.zfree = Z_NULL;
+  stream_.opaque = Z_NULL;
+
+  CHECK_EQ(deflateInit(&stream_, Z_DEFAULT_COMPRESSION), Z_OK);
+}
+
+DeflateStream::~DeflateStream() {
+  deflateEnd(&stream_);
+}
+
+void DeflateStream::Compress(const char* data, size_t size, string* output) {
+  CHECK(data != nullptr || size == 0);
+  CHECK(output != nullptr);
+
+  stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream_.avail_in = static_cast<uInt>(size);
+
+  // With Z_SYNC_FLUSH, deflate() is finished when it leaves some of the output
+  // buffer unused.
+  do {
+    const string::size_type old_length = output->length();
+    output->resize(old_length + kOutputChunkSize);
+
+    stream_.next_out = reinterpret_cast<Bytef*>(&(*output)[old_length]);
+    stream_.avail_out = static_cast<uInt>(kOutputChunkSize);
+
+    const int result = deflate(&stream_, Z_SYNC_FLUSH);
+    CHECK(result == Z_OK || result == Z_BUF_ERROR) << "deflate returned "
+                                                   << result;
+
+    output->resize(old_length + kOutputChunkSize - stream_.avail_out);
+  } while (stream_.avail_out == 0);
+
+  CHECK_EQ(stream_.avail_in, 0u);
+}
+
+}  // namespace floating_temple
@@ -0,0 +1,53 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTIL_DEFLATE_STREAM_H_
+#define UTIL_DEFLATE_STREAM_H_
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <string>
+
+#include "base/macros.h"
+
+namespace floating_temple {
+
+// Compresses a sequence of buffers with zlib, using a single compression
+// context for the whole sequence. Later buffers can refer back to data in
+// earlier buffers, so a stream of similar messages compresses much better than
+// each message would on its own. The buffers must be decompressed in the same
+// order by a single InflateStream.
+//
+// This class is not thread-safe.
+class DeflateStream {
+ public:
+  DeflateStream();
+  ~DeflateStream();
+
+  // Compresses the given data and appends it to *output. The output is flushed,
+  // so that the receiver can decompress all of the data passed to this method
+  // so far without waiting for more.
+  void Compress(const char* data, std::size_t size, std::string* output);
+
+ private:
+  z_stream stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeflateStream);
+};
+
+}  // namespace floating_temple
+
+#endif  // UTIL_DEFLATE_STREAM_H_
@@ -0,0 +1,97 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/deflate_stream.h"
+
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include "base/logging.h"
+#include "base/string_printf.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+#include "util/inflate_stream.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::string;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace {
+
+TEST(DeflateStreamTest, RoundTrip) {
+  DeflateStream deflate_stream;
+  InflateStream inflate_stream;
+
+  string total_compressed;
+
+  // Each buffer must be decompressible as soon as it's received, without
+  // waiting for the next one.
+  for (int i = 0; i < 50; ++i) {
+    const string input = StringPrintf(
+        "{\"method_name\": \"get_value\", \"object_id\": %d}", i);
+
+    string compressed;
+    deflate_stream.Compress(input.data(), input.length(), &compressed);
+    total_compressed += compressed;
+
+    string decompressed;
+    ASSERT_TRUE(inflate_stream.Decompress(compressed.data(),
+                                          compressed.length(), &decompressed));
+    EXPECT_EQ(input, decompressed);
+  }
+
+  // Later buffers refer back to the earlier ones, so the repeated text is only
+  // sent once.
+  EXPECT_LT(total_compressed.length(), 50u * 20u);
+}
+
+TEST(DeflateStreamTest, LargeBuffer) {
+  string input;
+  for (int i = 0; i < 100000; ++i) {
+    input += StringPrintf("%d,", i);
+  }
+
+  DeflateStream deflate_stream;
+  string compressed;
+  deflate_stream.Compress(input.data(), input.length(), &compressed);
+  EXPECT_LT(compressed.length(), input.length());
+
+  InflateStream inflate_stream;
+  string decompressed;
+  ASSERT_TRUE(inflate_stream.Decompress(compressed.data(), compressed.length(),
+                                        &decompressed));
+  EXPECT_EQ(input, decompressed);
+}
+
+TEST(DeflateStreamTest, CorruptInput) {
+  const string input = "This is not a zlib stream.";
+
+  InflateStream inflate_stream;
+  string decompressed;
+  EXPECT_FALSE(inflate_stream.Decompress(input.data(), input.length(),
+                                         &decompressed));
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -19,10 +19,11 @@
 namespace floating_temple {
 
 // Convenience functions for using event FDs. Event FDs are useful in Linux
-// because the select() function can only wait on file descriptors. To wait on
-// some other event (e.g., a shutdown notification), create an event FD and pass
-// it to select(). Another thread can then signal the event FD to wake the
-// select thread. For more information, see the man page for eventfd(2).
+// because the select() and epoll_wait() functions can only wait on file
+// descriptors. To wait on some other event (e.g., a shutdown notification),
+// create an event FD and add it to the set of file descriptors. Another thread
+// can then signal the event FD to wake the waiting thread. For more
+// information, see the man page for eventfd(2).
 
 // Signals the event FD by writing an increment of 1 to it. Crashes if an error
 // occurs.
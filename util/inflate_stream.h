@@ -0,0 +1,50 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTIL_INFLATE_STREAM_H_
+#define UTIL_INFLATE_STREAM_H_
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <string>
+
+#include "base/macros.h"
+
+namespace floating_temple {
+
+// Decompresses a sequence of buffers that were compressed by a DeflateStream.
+// The buffers must be passed to Decompress() in the order in which they were
+// compressed.
+//
+// This class is not thread-safe.
+class InflateStream {
+ public:
+  InflateStream();
+  ~InflateStream();
+
+  // Decompresses the given data and appends it to *output. Returns false if
+  // the data is corrupt, in which case the stream can't be used any further.
+  bool Decompress(const char* data, std::size_t size, std::string* output);
+
+ private:
+  z_stream stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(InflateStream);
+};
+
+}  // namespace floating_temple
+
+#endif  // UTIL_INFLATE_STREAM_H_
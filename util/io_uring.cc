@@ -0,0 +1,244 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "util/io_uring.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+
+using std::max;
+using std::memset;
+using std::size_t;
+using std::vector;
+
+namespace floating_temple {
+namespace {
+
+template<typename T>
+T* GetRingField(void* ring, uint32 offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+void* MapRing(int ring_fd, size_t size, off_t offset) {
+  void* const ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+  if (ptr == MAP_FAILED) {
+    PLOG(WARNING) << "mmap";
+    return nullptr;
+  }
+  return ptr;
+}
+
+}  // namespace
+
+IoUring::IoUring()
+    : ring_fd_(-1),
+      sq_ring_(nullptr),
+      sq_ring_size_(0),
+      cq_ring_(nullptr),
+      cq_ring_size_(0),
+      sqes_(nullptr),
+      sqes_size_(0),
+      sq_head_(nullptr),
+      sq_tail_(nullptr),
+      sq_ring_mask_(0),
+      sq_entry_count_(0),
+      sq_array_(nullptr),
+      cq_head_(nullptr),
+      cq_tail_(nullptr),
+      cq_ring_mask_(0),
+      cqes_(nullptr),
+      local_sq_tail_(0) {
+}
+
+IoUring::~IoUring() {
+  if (sqes_ != nullptr) {
+    CHECK_ERR(munmap(sqes_, sqes_size_));
+  }
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    CHECK_ERR(munmap(cq_ring_, cq_ring_size_));
+  }
+  if (sq_ring_ != nullptr) {
+    CHECK_ERR(munmap(sq_ring_, sq_ring_size_));
+  }
+  if (ring_fd_ != -1) {
+    CHECK_ERR(close(ring_fd_));
+  }
+}
+
+bool IoUring::Init(unsigned entry_count, const vector<int>& required_opcodes) {
+  CHECK_EQ(ring_fd_, -1);
+  CHECK_GT(entry_count, 0u);
+
+  io_uring_params params;
+  memset(&params, 0, sizeof params);
+
+  const long ring_fd = syscall(__NR_io_uring_setup, entry_count, &params);
+  if (ring_fd == -1) {
+    PLOG(WARNING) << "io_uring_setup";
+    return false;
+  }
+  ring_fd_ = static_cast<int>(ring_fd);
+
+  if (!IsSupported(ring_fd_, required_opcodes)) {
+    return false;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes +
+      params.cq_entries * sizeof(io_uring_cqe);
+
+  // If the kernel supports it, the submission and completion queue rings are
+  // mapped with a single call.
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    sq_ring_size_ = max(sq_ring_size_, cq_ring_size_);
+    cq_ring_size_ = sq_ring_size_;
+  }
+
+  sq_ring_ = MapRing(ring_fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == nullptr) {
+    return false;
+  }
+
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = MapRing(ring_fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == nullptr) {
+      return false;
+    }
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(MapRing(ring_fd_, sqes_size_,
+                                             IORING_OFF_SQES));
+  if (sqes_ == nullptr) {
+    return false;
+  }
+
+  sq_head_ = GetRingField<unsigned>(sq_ring_, params.sq_off.head);
+  sq_tail_ = GetRingField<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_ring_mask_ = *GetRingField<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_entry_count_ = params.sq_entries;
+  sq_array_ = GetRingField<unsigned>(sq_ring_, params.sq_off.array);
+
+  cq_head_ = GetRingField<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = GetRingField<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_ring_mask_ = *GetRingField<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = GetRingField<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+
+  local_sq_tail_ = *sq_tail_;
+
+  return true;
+}
+
+io_uring_sqe* IoUring::GetSubmissionEntry() {
+  CHECK(sqes_ != nullptr);
+
+  const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (local_sq_tail_ - head >= sq_entry_count_) {
+    return nullptr;
+  }
+
+  const unsigned index = local_sq_tail_ & sq_ring_mask_;
+  sq_array_[index] = index;
+  ++local_sq_tail_;
+
+  io_uring_sqe* const sqe = &sqes_[index];
+  memset(sqe, 0, sizeof *sqe);
+
+  return sqe;
+}
+
+void IoUring::Submit(unsigned wait_count) {
+  CHECK(sqes_ != nullptr);
+
+  // Publish the new entries to the kernel. Entries that were published earlier
+  // but not consumed (because the kernel was out of resources) are submitted
+  // again.
+  __atomic_store_n(sq_tail_, local_sq_tail_, __ATOMIC_RELEASE);
+  const unsigned submit_count =
+      local_sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+  const unsigned flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+  VLOG(2) << "Entering io_uring_enter()";
+  const long result = syscall(__NR_io_uring_enter, ring_fd_, submit_count,
+                              wait_count, flags, nullptr, 0);
+  VLOG(2) << "Exiting io_uring_enter()";
+
+  if (result == -1) {
+    // EAGAIN and EBUSY mean that the kernel can't accept more entries until
+    // some of the completions have been reaped.
+    PLOG_IF(FATAL, errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        << "io_uring_enter";
+  }
+}
+
+bool IoUring::GetCompletion(io_uring_cqe* cqe) {
+  CHECK(cqe != nullptr);
+  CHECK(cqes_ != nullptr);
+
+  const unsigned head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  *cqe = cqes_[head & cq_ring_mask_];
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+// static
+bool IoUring::IsSupported(int ring_fd, const vector<int>& opcodes) {
+  static const unsigned kMaxOpCount = 256;
+
+  const size_t probe_size = sizeof(io_uring_probe) +
+      kMaxOpCount * sizeof(io_uring_probe_op);
+  vector<char> probe_buffer(probe_size, '\0');
+  io_uring_probe* const probe = reinterpret_cast<io_uring_probe*>(
+      probe_buffer.data());
+
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe,
+              kMaxOpCount) == -1) {
+    PLOG(WARNING) << "io_uring_register(IORING_REGISTER_PROBE)";
+    return false;
+  }
+
+  for (const int opcode : opcodes) {
+    if (opcode > probe->last_op ||
+        (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0) {
+      LOG(WARNING) << "io_uring doesn't support opcode " << opcode;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace floating_temple
@@ -0,0 +1,92 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTIL_IO_URING_H_
+#define UTIL_IO_URING_H_
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/macros.h"
+
+namespace floating_temple {
+
+// A minimal wrapper for a Linux io_uring instance, using the raw system calls.
+// (See the man page for io_uring(7).) The caller fills in submission queue
+// entries, submits them all with a single system call, and then reaps the
+// completions.
+//
+// This class is not thread-safe.
+class IoUring {
+ public:
+  IoUring();
+  ~IoUring();
+
+  // Creates the submission and completion queues. Returns false if io_uring
+  // isn't available (e.g., the kernel doesn't support it, or it's disabled by
+  // a seccomp policy), or if it doesn't support all of the given operations.
+  bool Init(unsigned entry_count, const std::vector<int>& required_opcodes);
+
+  // Returns a zeroed submission queue entry to be filled in by the caller, or
+  // NULL if the submission queue is full. The entry is submitted by the next
+  // call to Submit.
+  io_uring_sqe* GetSubmissionEntry();
+
+  // Submits the entries that were returned by GetSubmissionEntry, and waits
+  // until at least 'wait_count' completions are available. Returns early
+  // (without an error) if the wait is interrupted by a signal.
+  void Submit(unsigned wait_count);
+
+  // Copies the next completion to *cqe and removes it from the completion
+  // queue. Returns false if there are no completions available.
+  bool GetCompletion(io_uring_cqe* cqe);
+
+ private:
+  static bool IsSupported(int ring_fd, const std::vector<int>& opcodes);
+
+  int ring_fd_;
+
+  void* sq_ring_;
+  std::size_t sq_ring_size_;
+  void* cq_ring_;
+  std::size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  std::size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_ring_mask_;
+  unsigned sq_entry_count_;
+  unsigned* sq_array_;
+
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_ring_mask_;
+  io_uring_cqe* cqes_;
+
+  // The tail of the submission queue, including the entries that haven't been
+  // submitted yet.
+  unsigned local_sq_tail_;
+
+  DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+}  // namespace floating_temple
+
+#endif  // UTIL_IO_URING_H_
@@ -0,0 +1,358 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTIL_PERSISTENT_MAP_H_
+#define UTIL_PERSISTENT_MAP_H_
+
+#include <climits>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/logging.h"
+
+namespace floating_temple {
+
+// An unordered map that shares its structure with its copies. Copying a
+// PersistentMap takes constant time, regardless of the number of entries.
+// Modifying one copy does not affect any other copy.
+//
+// The map is implemented as a hash array mapped trie: each node uses five bits
+// of the key's hash to select one of up to 32 slots, and a bitmap to record
+// which slots are occupied. Nodes are never modified once they've been
+// created, so Set() copies at most one node per level of the trie.
+//
+// Like the standard containers, this class is not thread-safe. However, since
+// nodes are immutable, separate copies of the same map may be used
+// concurrently from different threads.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class PersistentMap {
+ public:
+  typedef std::pair<Key, Value> value_type;
+
+  class const_iterator;
+
+  PersistentMap();
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns a pointer to the value associated with the given key, or NULL if
+  // the key is not present in the map. The pointer remains valid as long as
+  // this map (or any copy of it) is neither modified nor destroyed.
+  const Value* Find(const Key& key) const;
+
+  // Associates the given value with the given key, replacing the existing
+  // value if there is one. Returns true if the key was not already present.
+  bool Set(const Key& key, const Value& value);
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+ private:
+  static const int kBits = 5;
+  static const int kHashBits = static_cast<int>(sizeof(std::size_t) *
+                                                CHAR_BIT);
+  static const std::size_t kMask = (static_cast<std::size_t>(1) << kBits) - 1;
+
+  struct Node;
+
+  struct Entry {
+    std::size_t hash;
+    value_type key_value;
+  };
+
+  // Exactly one of 'child' and 'entry' is non-NULL.
+  struct Slot {
+    std::shared_ptr<const Node> child;
+    std::shared_ptr<const Entry> entry;
+  };
+
+  // Once all of the hash bits have been consumed, entries whose hashes collide
+  // are stored in a "collision node": 'bitmap' is unused, and 'slots' is an
+  // unordered list of entries.
+  struct Node {
+    uint32 bitmap;
+    std::vector<Slot> slots;
+  };
+
+  static std::shared_ptr<const Node> Assoc(const Node* node, int shift,
+                                           const std::shared_ptr<const Entry>&
+                                               entry,
+                                           bool* added);
+  static std::shared_ptr<const Node> MakeNode(
+      int shift, const std::shared_ptr<const Entry>& entry);
+
+  static uint32 GetBit(std::size_t hash, int shift);
+  static int GetSlotIndex(uint32 bitmap, uint32 bit);
+
+  std::size_t size_;
+  std::shared_ptr<const Node> root_;
+};
+
+template<typename Key, typename Value, typename Hash>
+class PersistentMap<Key, Value, Hash>::const_iterator {
+ public:
+  const_iterator() {}
+
+  const value_type& operator*() const;
+  const value_type* operator->() const { return &**this; }
+
+  const_iterator& operator++();
+
+  bool operator==(const const_iterator& other) const {
+    return stack_ == other.stack_;
+  }
+  bool operator!=(const const_iterator& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  explicit const_iterator(const Node* root);
+
+  // Descends from the slot at the top of the stack to the leftmost entry
+  // beneath it.
+  void DescendToEntry();
+
+  // The path from the root to the current entry. Each element is a node and
+  // the index of a slot within that node. The stack is empty at the end.
+  std::vector<std::pair<const Node*, std::size_t>> stack_;
+
+  friend class PersistentMap;
+};
+
+template<typename Key, typename Value, typename Hash>
+PersistentMap<Key, Value, Hash>::PersistentMap()
+    : size_(0) {
+}
+
+template<typename Key, typename Value, typename Hash>
+const Value* PersistentMap<Key, Value, Hash>::Find(const Key& key) const {
+  const std::size_t hash = Hash()(key);
+  const Node* node = root_.get();
+  int shift = 0;
+
+  while (node != nullptr) {
+    if (shift >= kHashBits) {
+      for (const Slot& slot : node->slots) {
+        if (slot.entry->key_value.first == key) {
+          return &slot.entry->key_value.second;
+        }
+      }
+      return nullptr;
+    }
+
+    const uint32 bit = GetBit(hash, shift);
+    if ((node->bitmap & bit) == 0) {
+      return nullptr;
+    }
+
+    const Slot& slot = node->slots[GetSlotIndex(node->bitmap, bit)];
+    if (slot.child.get() != nullptr) {
+      node = slot.child.get();
+      shift += kBits;
+    } else {
+      const Entry& entry = *slot.entry;
+      if (entry.hash == hash && entry.key_value.first == key) {
+        return &entry.key_value.second;
+      }
+      return nullptr;
+    }
+  }
+
+  return nullptr;
+}
+
+template<typename Key, typename Value, typename Hash>
+bool PersistentMap<Key, Value, Hash>::Set(const Key& key, const Value& value) {
+  const std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+  entry->hash = Hash()(key);
+  entry->key_value.first = key;
+  entry->key_value.second = value;
+
+  bool added = false;
+  root_ = Assoc(root_.get(), 0, entry, &added);
+
+  if (added) {
+    ++size_;
+  }
+
+  return added;
+}
+
+template<typename Key, typename Value, typename Hash>
+typename PersistentMap<Key, Value, Hash>::const_iterator
+PersistentMap<Key, Value, Hash>::begin() const {
+  return const_iterator(root_.get());
+}
+
+template<typename Key, typename Value, typename Hash>
+typename PersistentMap<Key, Value, Hash>::const_iterator
+PersistentMap<Key, Value, Hash>::end() const {
+  return const_iterator();
+}
+
+// static
+template<typename Key, typename Value, typename Hash>
+std::shared_ptr<const typename PersistentMap<Key, Value, Hash>::Node>
+PersistentMap<Key, Value, Hash>::Assoc(
+    const Node* node, int shift, const std::shared_ptr<const Entry>& entry,
+    bool* added) {
+  CHECK(entry.get() != nullptr);
+  CHECK(added != nullptr);
+
+  if (node == nullptr) {
+    *added = true;
+    return MakeNode(shift, entry);
+  }
+
+  const std::shared_ptr<Node> new_node = std::make_shared<Node>(*node);
+
+  if (shift >= kHashBits) {
+    for (Slot& slot : new_node->slots) {
+      if (slot.entry->key_value.first == entry->key_value.first) {
+        slot.entry = entry;
+        return new_node;
+      }
+    }
+
+    Slot slot;
+    slot.entry = entry;
+    new_node->slots.push_back(slot);
+    *added = true;
+
+    return new_node;
+  }
+
+  const uint32 bit = GetBit(entry->hash, shift);
+  const int slot_index = GetSlotIndex(node->bitmap, bit);
+
+  if ((node->bitmap & bit) == 0) {
+    Slot slot;
+    slot.entry = entry;
+    new_node->slots.insert(new_node->slots.begin() + slot_index, slot);
+    new_node->bitmap |= bit;
+    *added = true;
+
+    return new_node;
+  }
+
+  Slot* const slot = &new_node->slots[slot_index];
+
+  if (slot->child.get() != nullptr) {
+    slot->child = Assoc(slot->child.get(), shift + kBits, entry, added);
+  } else if (slot->entry->hash == entry->hash &&
+             slot->entry->key_value.first == entry->key_value.first) {
+    slot->entry = entry;
+  } else {
+    // Two different keys map to this slot. Push both of them down into a new
+    // child node.
+    bool existing_added = false;
+    const std::shared_ptr<const Node> child = MakeNode(shift + kBits,
+                                                       slot->entry);
+    slot->child = Assoc(child.get(), shift + kBits, entry, &existing_added);
+    slot->entry.reset();
+    CHECK(existing_added);
+    *added = true;
+  }
+
+  return new_node;
+}
+
+// static
+template<typename Key, typename Value, typename Hash>
+std::shared_ptr<const typename PersistentMap<Key, Value, Hash>::Node>
+PersistentMap<Key, Value, Hash>::MakeNode(
+    int shift, const std::shared_ptr<const Entry>& entry) {
+  const std::shared_ptr<Node> new_node = std::make_shared<Node>();
+  new_node->bitmap = shift >= kHashBits ? 0 : GetBit(entry->hash, shift);
+
+  Slot slot;
+  slot.entry = entry;
+  new_node->slots.push_back(slot);
+
+  return new_node;
+}
+
+// static
+template<typename Key, typename Value, typename Hash>
+uint32 PersistentMap<Key, Value, Hash>::GetBit(std::size_t hash, int shift) {
+  return static_cast<uint32>(1) << ((hash >> shift) & kMask);
+}
+
+// static
+template<typename Key, typename Value, typename Hash>
+int PersistentMap<Key, Value, Hash>::GetSlotIndex(uint32 bitmap, uint32 bit) {
+  return __builtin_popcount(bitmap & (bit - 1));
+}
+
+template<typename Key, typename Value, typename Hash>
+PersistentMap<Key, Value, Hash>::const_iterator::const_iterator(
+    const Node* root) {
+  if (root != nullptr) {
+    stack_.emplace_back(root, 0);
+    DescendToEntry();
+  }
+}
+
+template<typename Key, typename Value, typename Hash>
+const typename PersistentMap<Key, Value, Hash>::value_type&
+PersistentMap<Key, Value, Hash>::const_iterator::operator*() const {
+  CHECK(!stack_.empty());
+  const std::pair<const Node*, std::size_t>& top = stack_.back();
+  return top.first->slots[top.second].entry->key_value;
+}
+
+template<typename Key, typename Value, typename Hash>
+typename PersistentMap<Key, Value, Hash>::const_iterator&
+PersistentMap<Key, Value, Hash>::const_iterator::operator++() {
+  CHECK(!stack_.empty());
+
+  for (;;) {
+    std::pair<const Node*, std::size_t>* const top = &stack_.back();
+    ++top->second;
+
+    if (top->second < top->first->slots.size()) {
+      DescendToEntry();
+      return *this;
+    }
+
+    stack_.pop_back();
+    if (stack_.empty()) {
+      return *this;
+    }
+  }
+}
+
+template<typename Key, typename Value, typename Hash>
+void PersistentMap<Key, Value, Hash>::const_iterator::DescendToEntry() {
+  for (;;) {
+    const std::pair<const Node*, std::size_t>& top = stack_.back();
+    const Node* const child = top.first->slots[top.second].child.get();
+
+    if (child == nullptr) {
+      return;
+    }
+
+    stack_.emplace_back(child, 0);
+  }
+}
+
+}  // namespace floating_temple
+
+#endif  // UTIL_PERSISTENT_MAP_H_
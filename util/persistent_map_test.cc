@@ -0,0 +1,165 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/persistent_map.h"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "base/logging.h"
+#include "base/string_printf.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::map;
+using std::pair;
+using std::size_t;
+using std::string;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace {
+
+// A deliberately poor hash function, to exercise the handling of hash
+// collisions.
+struct CollidingHash {
+  size_t operator()(const string& s) const {
+    return s.length();
+  }
+};
+
+TEST(PersistentMapTest, EmptyMap) {
+  const PersistentMap<string, int> m;
+
+  EXPECT_TRUE(m.empty());
+  EXPECT_EQ(0u, m.size());
+  EXPECT_TRUE(m.Find("a") == nullptr);
+  EXPECT_TRUE(m.begin() == m.end());
+}
+
+TEST(PersistentMapTest, SetAndFind) {
+  PersistentMap<string, int> m;
+
+  for (int i = 0; i < 5000; ++i) {
+    EXPECT_TRUE(m.Set(StringPrintf("key%d", i), i));
+  }
+  EXPECT_EQ(5000u, m.size());
+
+  for (int i = 0; i < 5000; ++i) {
+    const int* const value = m.Find(StringPrintf("key%d", i));
+    ASSERT_TRUE(value != nullptr);
+    EXPECT_EQ(i, *value);
+  }
+
+  EXPECT_TRUE(m.Find("key5000") == nullptr);
+  EXPECT_TRUE(m.Find("") == nullptr);
+}
+
+TEST(PersistentMapTest, ReplaceValue) {
+  PersistentMap<string, int> m;
+
+  EXPECT_TRUE(m.Set("abc", 1));
+  EXPECT_FALSE(m.Set("abc", 2));
+
+  EXPECT_EQ(1u, m.size());
+  EXPECT_EQ(2, *m.Find("abc"));
+}
+
+TEST(PersistentMapTest, Iterate) {
+  PersistentMap<string, int> m;
+  map<string, int> expected;
+
+  for (int i = 0; i < 2000; ++i) {
+    const string key = StringPrintf("%d", i * 7);
+    m.Set(key, i);
+    expected[key] = i;
+  }
+
+  map<string, int> actual;
+  for (const pair<string, int>& entry : m) {
+    EXPECT_TRUE(actual.emplace(entry.first, entry.second).second);
+  }
+
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(PersistentMapTest, CopiesAreIndependent) {
+  PersistentMap<string, int> a;
+  for (int i = 0; i < 500; ++i) {
+    a.Set(StringPrintf("%d", i), i);
+  }
+
+  PersistentMap<string, int> b = a;
+  b.Set("0", -1);
+  b.Set("new", 1000);
+
+  EXPECT_EQ(500u, a.size());
+  EXPECT_EQ(0, *a.Find("0"));
+  EXPECT_TRUE(a.Find("new") == nullptr);
+
+  EXPECT_EQ(501u, b.size());
+  EXPECT_EQ(-1, *b.Find("0"));
+  EXPECT_EQ(1000, *b.Find("new"));
+
+  for (int i = 1; i < 500; ++i) {
+    const string key = StringPrintf("%d", i);
+    EXPECT_EQ(i, *a.Find(key));
+    EXPECT_EQ(i, *b.Find(key));
+  }
+}
+
+TEST(PersistentMapTest, HashCollisions) {
+  PersistentMap<string, int, CollidingHash> m;
+
+  EXPECT_TRUE(m.Set("a", 1));
+  EXPECT_TRUE(m.Set("b", 2));
+  EXPECT_TRUE(m.Set("c", 3));
+  EXPECT_TRUE(m.Set("dd", 4));
+  EXPECT_FALSE(m.Set("b", 5));
+
+  PersistentMap<string, int, CollidingHash> copy = m;
+  EXPECT_TRUE(copy.Set("e", 6));
+
+  EXPECT_EQ(4u, m.size());
+  EXPECT_EQ(1, *m.Find("a"));
+  EXPECT_EQ(5, *m.Find("b"));
+  EXPECT_EQ(3, *m.Find("c"));
+  EXPECT_EQ(4, *m.Find("dd"));
+  EXPECT_TRUE(m.Find("e") == nullptr);
+  EXPECT_TRUE(m.Find("ee") == nullptr);
+
+  EXPECT_EQ(5u, copy.size());
+  EXPECT_EQ(6, *copy.Find("e"));
+
+  int entry_count = 0;
+  for (const pair<string, int>& entry : copy) {
+    EXPECT_TRUE(copy.Find(entry.first) != nullptr);
+    ++entry_count;
+  }
+  EXPECT_EQ(5, entry_count);
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,270 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTIL_PERSISTENT_VECTOR_H_
+#define UTIL_PERSISTENT_VECTOR_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace floating_temple {
+
+// A vector that shares its structure with its copies. Copying a
+// PersistentVector takes constant time, regardless of the number of items.
+// Modifying one copy does not affect any other copy.
+//
+// The items are stored in the leaves of a trie with a branching factor of 32,
+// plus a separate "tail" leaf that holds the last 1 to 32 items. Nodes are
+// never modified once they are reachable from more than one vector, so
+// PushBack() copies at most one node per level of the trie.
+//
+// Like the standard containers, this class is not thread-safe. However, since
+// nodes are immutable once shared, separate copies of the same vector may be
+// used concurrently from different threads.
+template<typename T>
+class PersistentVector {
+ public:
+  class const_iterator;
+
+  PersistentVector();
+  explicit PersistentVector(const std::vector<T>& items);
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns the item at the given index. 'index' must be less than size().
+  const T& Get(std::size_t index) const;
+
+  // Appends an item to the end of the vector.
+  void PushBack(const T& item);
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+ private:
+  static const int kBits = 5;
+  static const std::size_t kBranchingFactor = static_cast<std::size_t>(1)
+      << kBits;
+  static const std::size_t kMask = kBranchingFactor - 1;
+
+  // Interior nodes use 'children'; leaf nodes use 'items'.
+  struct Node {
+    std::vector<std::shared_ptr<Node>> children;
+    std::vector<T> items;
+  };
+
+  // Returns the number of items stored in the trie (i.e., not in the tail).
+  std::size_t TailOffset() const;
+  // Returns the items of the leaf that contains the item at the given index.
+  const std::vector<T>& GetLeafItems(std::size_t index) const;
+
+  std::shared_ptr<Node> PushTail(int level, const Node& parent,
+                                 const std::shared_ptr<Node>& tail) const;
+  static std::shared_ptr<Node> NewPath(int level,
+                                       const std::shared_ptr<Node>& node);
+
+  std::size_t size_;
+  int shift_;
+  std::shared_ptr<Node> root_;
+  std::shared_ptr<Node> tail_;
+};
+
+template<typename T>
+class PersistentVector<T>::const_iterator {
+ public:
+  const_iterator() : vector_(nullptr), index_(0), leaf_items_(nullptr) {}
+
+  const T& operator*() const { return (*leaf_items_)[index_ & kMask]; }
+  const T* operator->() const { return &**this; }
+
+  const_iterator& operator++();
+
+  bool operator==(const const_iterator& other) const {
+    return vector_ == other.vector_ && index_ == other.index_;
+  }
+  bool operator!=(const const_iterator& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  const_iterator(const PersistentVector* v, std::size_t index);
+
+  const PersistentVector* vector_;
+  std::size_t index_;
+  // Cached pointer to the items of the current leaf, so that iterating over
+  // the whole vector only descends the trie once per leaf.
+  const std::vector<T>* leaf_items_;
+
+  friend class PersistentVector;
+};
+
+template<typename T>
+PersistentVector<T>::PersistentVector()
+    : size_(0),
+      shift_(kBits) {
+}
+
+template<typename T>
+PersistentVector<T>::PersistentVector(const std::vector<T>& items)
+    : size_(0),
+      shift_(kBits) {
+  for (const T& item : items) {
+    PushBack(item);
+  }
+}
+
+template<typename T>
+const T& PersistentVector<T>::Get(std::size_t index) const {
+  CHECK_LT(index, size_);
+  return GetLeafItems(index)[index & kMask];
+}
+
+template<typename T>
+void PersistentVector<T>::PushBack(const T& item) {
+  if (size_ - TailOffset() < kBranchingFactor) {
+    if (tail_.get() == nullptr) {
+      tail_ = std::make_shared<Node>();
+    } else if (tail_.use_count() > 1) {
+      // The tail is shared with another vector. Copy it before modifying it.
+      tail_ = std::make_shared<Node>(*tail_);
+    }
+
+    tail_->items.push_back(item);
+    ++size_;
+    return;
+  }
+
+  // The tail is full. Move it into the trie and start a new tail.
+  if (root_.get() == nullptr) {
+    root_ = std::make_shared<Node>();
+  }
+
+  if ((size_ >> kBits) > (static_cast<std::size_t>(1) << shift_)) {
+    // The trie is full. Add a level on top.
+    const std::shared_ptr<Node> new_root = std::make_shared<Node>();
+    new_root->children.push_back(root_);
+    new_root->children.push_back(NewPath(shift_, tail_));
+    root_ = new_root;
+    shift_ += kBits;
+  } else {
+    root_ = PushTail(shift_, *root_, tail_);
+  }
+
+  tail_ = std::make_shared<Node>();
+  tail_->items.push_back(item);
+  ++size_;
+}
+
+template<typename T>
+typename PersistentVector<T>::const_iterator PersistentVector<T>::begin()
+    const {
+  return const_iterator(this, 0);
+}
+
+template<typename T>
+typename PersistentVector<T>::const_iterator PersistentVector<T>::end() const {
+  return const_iterator(this, size_);
+}
+
+template<typename T>
+std::size_t PersistentVector<T>::TailOffset() const {
+  if (size_ < kBranchingFactor) {
+    return 0;
+  }
+
+  return ((size_ - 1) >> kBits) << kBits;
+}
+
+template<typename T>
+const std::vector<T>& PersistentVector<T>::GetLeafItems(std::size_t index)
+    const {
+  if (index >= TailOffset()) {
+    return tail_->items;
+  }
+
+  const Node* node = root_.get();
+  for (int level = shift_; level > 0; level -= kBits) {
+    node = node->children[(index >> level) & kMask].get();
+  }
+
+  return node->items;
+}
+
+template<typename T>
+std::shared_ptr<typename PersistentVector<T>::Node>
+PersistentVector<T>::PushTail(int level, const Node& parent,
+                              const std::shared_ptr<Node>& tail) const {
+  const std::shared_ptr<Node> new_node = std::make_shared<Node>(parent);
+  const std::size_t child_index = ((size_ - 1) >> level) & kMask;
+
+  std::shared_ptr<Node> child;
+  if (level == kBits) {
+    child = tail;
+  } else if (child_index < parent.children.size()) {
+    child = PushTail(level - kBits, *parent.children[child_index], tail);
+  } else {
+    child = NewPath(level - kBits, tail);
+  }
+
+  if (child_index < new_node->children.size()) {
+    new_node->children[child_index] = child;
+  } else {
+    CHECK_EQ(child_index, new_node->children.size());
+    new_node->children.push_back(child);
+  }
+
+  return new_node;
+}
+
+// static
+template<typename T>
+std::shared_ptr<typename PersistentVector<T>::Node>
+PersistentVector<T>::NewPath(int level, const std::shared_ptr<Node>& node) {
+  if (level == 0) {
+    return node;
+  }
+
+  const std::shared_ptr<Node> new_node = std::make_shared<Node>();
+  new_node->children.push_back(NewPath(level - kBits, node));
+
+  return new_node;
+}
+
+template<typename T>
+PersistentVector<T>::const_iterator::const_iterator(const PersistentVector* v,
+                                                    std::size_t index)
+    : vector_(CHECK_NOTNULL(v)),
+      index_(index),
+      leaf_items_(index < v->size_ ? &v->GetLeafItems(index) : nullptr) {
+}
+
+template<typename T>
+typename PersistentVector<T>::const_iterator&
+PersistentVector<T>::const_iterator::operator++() {
+  ++index_;
+
+  if ((index_ & kMask) == 0 && index_ < vector_->size_) {
+    leaf_items_ = &vector_->GetLeafItems(index_);
+  }
+
+  return *this;
+}
+
+}  // namespace floating_temple
+
+#endif  // UTIL_PERSISTENT_VECTOR_H_
@@ -0,0 +1,146 @@
+// Floating Temple
+// Copyright 2015 Derek S. Snyder
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/persistent_vector.h"
+
+#include <cstddef>
+#include <vector>
+
+#include "base/logging.h"
+#include "third_party/gmock-1.7.0/gtest/include/gtest/gtest.h"
+
+using google::InitGoogleLogging;
+using google::ParseCommandLineFlags;
+using std::size_t;
+using std::vector;
+using testing::InitGoogleTest;
+
+namespace floating_temple {
+namespace {
+
+TEST(PersistentVectorTest, EmptyVector) {
+  const PersistentVector<int> v;
+
+  EXPECT_TRUE(v.empty());
+  EXPECT_EQ(0u, v.size());
+  EXPECT_TRUE(v.begin() == v.end());
+}
+
+TEST(PersistentVectorTest, PushBackAndGet) {
+  // Use enough items to require three levels in the trie.
+  const int kItemCount = 40000;
+
+  PersistentVector<int> v;
+  for (int i = 0; i < kItemCount; ++i) {
+    v.PushBack(i * 3);
+  }
+
+  EXPECT_FALSE(v.empty());
+  ASSERT_EQ(static_cast<size_t>(kItemCount), v.size());
+
+  for (int i = 0; i < kItemCount; ++i) {
+    EXPECT_EQ(i * 3, v.Get(i));
+  }
+}
+
+TEST(PersistentVectorTest, Iterate) {
+  const int kItemCount = 1100;
+
+  PersistentVector<int> v;
+  for (int i = 0; i < kItemCount; ++i) {
+    v.PushBack(i);
+  }
+
+  int expected = 0;
+  for (const int item : v) {
+    EXPECT_EQ(expected, item);
+    ++expected;
+  }
+  EXPECT_EQ(kItemCount, expected);
+}
+
+TEST(PersistentVectorTest, ConstructFromStdVector) {
+  vector<int> items;
+  for (int i = 0; i < 100; ++i) {
+    items.push_back(100 - i);
+  }
+
+  const PersistentVector<int> v(items);
+
+  ASSERT_EQ(items.size(), v.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    EXPECT_EQ(items[i], v.Get(i));
+  }
+}
+
+TEST(PersistentVectorTest, CopiesAreIndependent) {
+  PersistentVector<int> a;
+  for (int i = 0; i < 1000; ++i) {
+    a.PushBack(i);
+  }
+
+  PersistentVector<int> b = a;
+  PersistentVector<int> c = a;
+
+  b.PushBack(-1);
+  c.PushBack(-2);
+  c.PushBack(-3);
+
+  EXPECT_EQ(1000u, a.size());
+  EXPECT_EQ(1001u, b.size());
+  EXPECT_EQ(1002u, c.size());
+
+  EXPECT_EQ(-1, b.Get(1000));
+  EXPECT_EQ(-2, c.Get(1000));
+  EXPECT_EQ(-3, c.Get(1001));
+
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(i, a.Get(i));
+    EXPECT_EQ(i, b.Get(i));
+    EXPECT_EQ(i, c.Get(i));
+  }
+}
+
+TEST(PersistentVectorTest, CopyAtEveryLength) {
+  // Take a snapshot after every append, including appends that move the tail
+  // into the trie and appends that add a level to the trie, and verify that
+  // none of the snapshots are disturbed by later appends.
+  const int kItemCount = 1200;
+
+  vector<PersistentVector<int>> snapshots;
+  PersistentVector<int> v;
+  for (int i = 0; i < kItemCount; ++i) {
+    snapshots.push_back(v);
+    v.PushBack(i);
+  }
+
+  for (int length = 0; length < kItemCount; ++length) {
+    const PersistentVector<int>& snapshot = snapshots[length];
+    ASSERT_EQ(static_cast<size_t>(length), snapshot.size());
+    for (int i = 0; i < length; ++i) {
+      EXPECT_EQ(i, snapshot.Get(i));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace floating_temple
+
+int main(int argc, char** argv) {
+  ParseCommandLineFlags(&argc, &argv, true);
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
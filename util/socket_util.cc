@@ -30,6 +30,8 @@
 
 #include "base/logging.h"
 
+using std::memcpy;
+using std::memset;
 using std::size_t;
 using std::string;
 using std::strncpy;
@@ -52,6 +54,47 @@ void PopulateUnixAddrStruct(const string& socket_file_name, sockaddr_un* addr) {
   addr->sun_path[path_max - 1] = '\0';
 }
 
+// Abstract socket names aren't null-terminated, so the length of the address
+// must be passed to bind() and connect() exactly.
+socklen_t PopulateAbstractUnixAddrStruct(const string& socket_name,
+                                         sockaddr_un* addr) {
+  CHECK(addr != nullptr);
+
+  const size_t socket_name_length = socket_name.length();
+  CHECK_GT(socket_name_length, 0u);
+  CHECK_LT(socket_name_length, sizeof addr->sun_path);
+
+  memset(addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+  // The leading null byte puts the name in the abstract namespace.
+  memcpy(addr->sun_path + 1, socket_name.data(), socket_name_length);
+
+  return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 +
+                                socket_name_length);
+}
+
+int ConnectToUnixAddress(const sockaddr_un& addr, socklen_t addr_length,
+                         const string& description) {
+  // Create the connection socket.
+  const int connection_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  CHECK_ERR(connection_fd) << " socket";
+
+  // Connect to the Unix-domain socket. Don't set the connection socket to
+  // non-blocking mode yet, because that may cause connect() to fail with
+  // EINPROGRESS.
+  if (connect(connection_fd, reinterpret_cast<const sockaddr*>(&addr),
+              addr_length) == -1) {
+    PLOG(WARNING) << "Could not connect to " << description;
+    CHECK_ERR(close(connection_fd));
+    return -1;
+  }
+
+  // Set the connection socket to non-blocking mode.
+  CHECK(SetFdToNonBlocking(connection_fd));
+
+  return connection_fd;
+}
+
 }  // namespace
 
 int ListenOnUnixSocket(const string& socket_file_name) {
@@ -77,23 +120,67 @@ int ListenOnUnixSocket(const string& socket_file_name) {
 }
 
 int ConnectToUnixSocket(const string& socket_file_name) {
-  // Create the connection socket.
-  const int connection_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
-  CHECK_ERR(connection_fd) << " socket";
-
-  // Connect to the Unix-domain socket. Don't set the connection socket to
-  // non-blocking mode yet, because that may cause connect() to fail with
-  // EINPROGRESS.
   sockaddr_un addr;
   PopulateUnixAddrStruct(socket_file_name, &addr);
 
-  CHECK_ERR(connect(connection_fd, reinterpret_cast<const sockaddr*>(&addr),
-                    static_cast<socklen_t>(sizeof addr)));
+  return ConnectToUnixAddress(addr, static_cast<socklen_t>(sizeof addr),
+                              socket_file_name);
+}
 
-  // Set the connection socket to non-blocking mode.
-  CHECK(SetFdToNonBlocking(connection_fd));
+int ListenOnAbstractUnixSocket(const string& socket_name) {
+  // Create the listen socket.
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  CHECK_ERR(listen_fd) << " socket";
 
-  return connection_fd;
+  // Set the listen socket to non-blocking mode.
+  CHECK(SetFdToNonBlocking(listen_fd));
+
+  // Bind the listen socket to the specified name. Another process may already
+  // be using the name.
+  sockaddr_un addr;
+  const socklen_t addr_length = PopulateAbstractUnixAddrStruct(socket_name,
+                                                               &addr);
+
+  if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr),
+           addr_length) == -1) {
+    PLOG(WARNING) << "Could not bind to the abstract Unix socket "
+                  << socket_name;
+    CHECK_ERR(close(listen_fd));
+    return -1;
+  }
+
+  // Put the socket in listen mode.
+  // TODO(dss): Should the backlog value be set to something smaller?
+  CHECK_ERR(listen(listen_fd, 128));
+
+  return listen_fd;
+}
+
+int ConnectToAbstractUnixSocket(const string& socket_name) {
+  sockaddr_un addr;
+  const socklen_t addr_length = PopulateAbstractUnixAddrStruct(socket_name,
+                                                               &addr);
+
+  return ConnectToUnixAddress(addr, addr_length,
+                              "the abstract Unix socket " + socket_name);
+}
+
+bool GetUnixSocketPeerUid(int socket_fd, uid_t* uid) {
+  CHECK(uid != nullptr);
+
+  ucred credentials;
+  socklen_t credentials_length = sizeof credentials;
+
+  if (getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &credentials,
+                 &credentials_length) == -1) {
+    PLOG(WARNING) << "getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, ...)";
+    return false;
+  }
+
+  CHECK_EQ(credentials_length, sizeof credentials);
+  *uid = credentials.uid;
+
+  return true;
 }
 
 int AcceptConnection(int listen_fd, string* remote_address) {
@@ -165,4 +252,20 @@ bool SetFdToNonBlocking(int fd) {
   return true;
 }
 
+bool SetFdToBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+
+  if (flags == -1) {
+    PLOG(WARNING) << "fcntl(fd, F_GETFL)";
+    return false;
+  }
+
+  if (fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+    PLOG(WARNING) << "fcntl(fd, F_SETFL, flags & ~O_NONBLOCK)";
+    return false;
+  }
+
+  return true;
+}
+
 }  // namespace floating_temple
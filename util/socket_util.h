@@ -17,18 +17,34 @@
 #define UTIL_SOCKET_UTIL_H_
 
 #include <sys/socket.h>
+#include <sys/types.h>
 
 #include <string>
 
 namespace floating_temple {
 
 int ListenOnUnixSocket(const std::string& socket_file_name);
+// Returns -1 if the connection could not be made.
 int ConnectToUnixSocket(const std::string& socket_file_name);
 
+// Like ListenOnUnixSocket and ConnectToUnixSocket, but for sockets in the Linux
+// abstract namespace, which have no socket files. Any process on the host can
+// bind to an abstract name, so ListenOnAbstractUnixSocket returns -1 if the
+// name is already in use, and the caller should check who is on the other end
+// of a connection with GetUnixSocketPeerUid.
+int ListenOnAbstractUnixSocket(const std::string& socket_name);
+// Returns -1 if the connection could not be made.
+int ConnectToAbstractUnixSocket(const std::string& socket_name);
+// Gets the user ID of the process on the other end of a connected Unix domain
+// socket. (For the initiator of a connection, that's the process that called
+// listen().) Returns false if the user ID can't be determined.
+bool GetUnixSocketPeerUid(int socket_fd, uid_t* uid);
+
 int AcceptConnection(int listen_fd, std::string* remote_address);
 void GetAddressString(const sockaddr* address, std::string* address_string);
 
 bool SetFdToNonBlocking(int fd);
+bool SetFdToBlocking(int fd);
 
 }  // namespace floating_temple
 
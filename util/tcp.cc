@@ -19,11 +19,13 @@
 #include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstring>
 #include <string>
 
@@ -64,7 +66,7 @@ addrinfo* GetAddressInfo(const string& address, int port) {
   return result;
 }
 
-int BindToAddress(const addrinfo* ai) {
+int BindToAddress(const addrinfo* ai, bool reuse_port) {
   const int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
                         ai->ai_protocol);
   if (fd == -1) {
@@ -77,6 +79,12 @@ int BindToAddress(const addrinfo* ai) {
     return -1;
   }
 
+  if (reuse_port) {
+    const int option_value = 1;
+    CHECK_ERR(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &option_value,
+                         sizeof option_value));
+  }
+
   if (bind(fd, ai->ai_addr, static_cast<socklen_t>(ai->ai_addrlen)) == -1) {
     PLOG(WARNING) << "bind";
     CHECK_ERR(close(fd));
@@ -86,22 +94,52 @@ int BindToAddress(const addrinfo* ai) {
   return fd;
 }
 
-int ConnectToAddress(const addrinfo* ai) {
-  const int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+int ConnectToAddress(const addrinfo* ai, int timeout_ms) {
+  // The socket is created in non-blocking mode so that the connection attempt
+  // can be abandoned when the timeout expires.
+  const int fd = socket(ai->ai_family,
+                        ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
                         ai->ai_protocol);
   if (fd == -1) {
     PLOG(WARNING) << "socket";
     return -1;
   }
 
-  if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+  if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+    return fd;
+  }
+
+  if (errno != EINPROGRESS) {
     PLOG(WARNING) << "connect";
     CHECK_ERR(close(fd));
     return -1;
   }
 
-  // Set the connected socket to non-blocking mode.
-  if (!SetFdToNonBlocking(fd)) {
+  pollfd poll_fd;
+  poll_fd.fd = fd;
+  poll_fd.events = POLLOUT;
+  poll_fd.revents = 0;
+
+  int ready_count = 0;
+  do {
+    ready_count = poll(&poll_fd, 1, timeout_ms);
+  } while (ready_count == -1 && errno == EINTR);
+  CHECK_ERR(ready_count);
+
+  if (ready_count == 0) {
+    LOG(WARNING) << "connect: Timed out after " << timeout_ms << " ms";
+    CHECK_ERR(close(fd));
+    return -1;
+  }
+
+  int error_code = 0;
+  socklen_t error_code_size = sizeof error_code;
+  CHECK_ERR(getsockopt(fd, SOL_SOCKET, SO_ERROR, &error_code,
+                       &error_code_size));
+
+  if (error_code != 0) {
+    errno = error_code;
+    PLOG(WARNING) << "connect";
     CHECK_ERR(close(fd));
     return -1;
   }
@@ -109,11 +147,11 @@ int ConnectToAddress(const addrinfo* ai) {
   return fd;
 }
 
-int BindToSomeAddress(const addrinfo* ai_list) {
+int BindToSomeAddress(const addrinfo* ai_list, bool reuse_port) {
   CHECK(ai_list != nullptr);
 
   for (const addrinfo* ai = ai_list; ai != nullptr; ai = ai->ai_next) {
-    const int socket_fd = BindToAddress(ai);
+    const int socket_fd = BindToAddress(ai, reuse_port);
 
     if (socket_fd != -1) {
       return socket_fd;
@@ -123,11 +161,11 @@ int BindToSomeAddress(const addrinfo* ai_list) {
   return -1;
 }
 
-int ConnectToSomeAddress(const addrinfo* ai_list) {
+int ConnectToSomeAddress(const addrinfo* ai_list, int timeout_ms) {
   CHECK(ai_list != nullptr);
 
   for (const addrinfo* ai = ai_list; ai != nullptr; ai = ai->ai_next) {
-    const int socket_fd = ConnectToAddress(ai);
+    const int socket_fd = ConnectToAddress(ai, timeout_ms);
 
     if (socket_fd != -1) {
       return socket_fd;
@@ -137,6 +175,21 @@ int ConnectToSomeAddress(const addrinfo* ai_list) {
   return -1;
 }
 
+int ListenOnLocalAddressHelper(const string& local_address, int port,
+                               bool reuse_port) {
+  addrinfo* const address_info = GetAddressInfo(local_address, port);
+  const int socket_fd = BindToSomeAddress(address_info, reuse_port);
+  freeaddrinfo(address_info);
+
+  CHECK_NE(socket_fd, -1) << "Could not bind to any local address on port "
+                          << port;
+
+  // TODO(dss): Should the backlog value be set to something smaller?
+  CHECK_ERR(listen(socket_fd, 128));
+
+  return socket_fd;
+}
+
 }  // namespace
 
 string GetLocalAddress() {
@@ -169,23 +222,40 @@ string GetLocalAddress() {
   return address_string;
 }
 
-int ListenOnLocalAddress(const string& local_address, int port) {
-  addrinfo* const address_info = GetAddressInfo(local_address, port);
-  const int socket_fd = BindToSomeAddress(address_info);
-  freeaddrinfo(address_info);
+bool IsLocalAddress(const string& address) {
+  ifaddrs* ifa_list = nullptr;
+  CHECK_ERR(getifaddrs(&ifa_list));
 
-  CHECK_NE(socket_fd, -1) << "Could not bind to any local address on port "
-                          << port;
+  bool is_local = false;
 
-  // TODO(dss): Should the backlog value be set to something smaller?
-  CHECK_ERR(listen(socket_fd, 128));
+  for (const ifaddrs* ifa = ifa_list; ifa != nullptr && !is_local;
+       ifa = ifa->ifa_next) {
+    const sockaddr* const ifa_address = ifa->ifa_addr;
 
-  return socket_fd;
+    if (ifa_address != nullptr && (ifa_address->sa_family == AF_INET ||
+                                   ifa_address->sa_family == AF_INET6)) {
+      string address_string;
+      GetAddressString(ifa_address, &address_string);
+      is_local = address_string == address;
+    }
+  }
+
+  freeifaddrs(ifa_list);
+
+  return is_local;
+}
+
+int ListenOnLocalAddress(const string& local_address, int port) {
+  return ListenOnLocalAddressHelper(local_address, port, false);
+}
+
+int ListenOnSharedLocalPort(const string& local_address, int port) {
+  return ListenOnLocalAddressHelper(local_address, port, true);
 }
 
-int ConnectToRemoteHost(const string& address, int port) {
+int ConnectToRemoteHost(const string& address, int port, int timeout_ms) {
   addrinfo* const address_info = GetAddressInfo(address, port);
-  const int socket_fd = ConnectToSomeAddress(address_info);
+  const int socket_fd = ConnectToSomeAddress(address_info, timeout_ms);
   freeaddrinfo(address_info);
 
   LOG_IF(WARNING, socket_fd == -1)
@@ -213,7 +283,7 @@ int GetUnusedPortForTesting() {
     }
 
     addrinfo* const address_info = GetAddressInfo(local_address, port);
-    const int socket_fd = BindToSomeAddress(address_info);
+    const int socket_fd = BindToSomeAddress(address_info, false);
     freeaddrinfo(address_info);
 
     if (socket_fd != -1) {
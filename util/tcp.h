@@ -21,8 +21,18 @@
 namespace floating_temple {
 
 std::string GetLocalAddress();
+// Returns true if the numeric address belongs to one of this host's network
+// interfaces (including the loopback interface).
+bool IsLocalAddress(const std::string& address);
 int ListenOnLocalAddress(const std::string& local_address, int port);
-int ConnectToRemoteHost(const std::string& address, int port);
+// Like ListenOnLocalAddress, but sets the SO_REUSEPORT option on the socket so
+// that several sockets can listen on the same port. The kernel distributes
+// incoming connections among them.
+int ListenOnSharedLocalPort(const std::string& local_address, int port);
+// Returns a connected socket in non-blocking mode, or -1 if the connection
+// couldn't be established. Each of the host's addresses is given 'timeout_ms'
+// milliseconds to accept the connection; -1 means no timeout.
+int ConnectToRemoteHost(const std::string& address, int port, int timeout_ms);
 
 int GetUnusedPortForTesting();
 